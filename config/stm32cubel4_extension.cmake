@@ -1,7 +1,65 @@
-set(INCLUDE__STM32CUBEL4_EXTENSION TRUE)
-set(PROJECT_UBINOS_LIBRARIES ${PROJECT_UBINOS_LIBRARIES} STM32CubeL4_extension)
-
-set_cache_default(STM32CUBEL4__DTTY_STM32_UART_ENABLE FALSE BOOL "")
-
-set_cache_default(STM32CUBEL4__DTTY_STM32_USBD_ENABLE FALSE BOOL "")
-
+set(INCLUDE__STM32CUBEL4_EXTENSION TRUE)
+set(PROJECT_UBINOS_LIBRARIES ${PROJECT_UBINOS_LIBRARIES} STM32CubeL4_extension)
+
+set_cache_default(STM32CUBEL4__DTTY_STM32_UART_ENABLE FALSE BOOL "")
+
+set_cache_default(STM32CUBEL4__DTTY_STM32_USBD_ENABLE FALSE BOOL "")
+
+set_cache_default(STM32CUBEL4__DTTY_LINE_ENABLE FALSE BOOL "")
+set_cache_default(STM32CUBEL4__DTTY_LINE_SIZE 128 STRING "Maximum length of a line edited by the dtty line discipline")
+
+set_cache_default(STM32CUBEL4__DTTY_READ_ENABLE FALSE BOOL "")
+
+set_cache_default(STM32CUBEL4__DTTY_POLL_ENABLE FALSE BOOL "")
+
+set_cache_default(STM32CUBEL4__DTTY_EARLY_ENABLE FALSE BOOL "")
+set_cache_default(STM32CUBEL4__DTTY_EARLY_BUFFER_SIZE 1024 STRING "Size of the dtty buffer used before the kernel is active")
+
+set_cache_default(STM32CUBEL4__DTTY_CRASHLOG_ENABLE FALSE BOOL "")
+set_cache_default(STM32CUBEL4__DTTY_CRASHLOG_SIZE 2048 STRING "Size of the dtty output kept across a reset")
+
+set_cache_default(STM32CUBEL4__DTTY_BLACKBOX_ENABLE FALSE BOOL "")
+set_cache_default(STM32CUBEL4__DTTY_BLACKBOX_BUFFER_SIZE 1024 STRING "Size of the dtty output captured before it is moved to the black box log")
+
+set_cache_default(STM32CUBEL4__DTTY_PRIO_ENABLE FALSE BOOL "")
+set_cache_default(STM32CUBEL4__DTTY_PRIO_BUFFER_SIZE 1024 STRING "Size of the dtty high priority output lane")
+
+set_cache_default(STM32CUBEL4__DTTY_WRITEV_ENABLE FALSE BOOL "")
+
+set_cache_default(STM32CUBEL4__DTTY_USBD_LINK_ENABLE FALSE BOOL "")
+set_cache_default(STM32CUBEL4__DTTY_USBD_LINK_KEEP_SIZE 2048 STRING "Size of the newest dtty output kept while no host has the USB port open")
+
+set_cache_default(STM32CUBEL4__DTTY_USBD_PORT_ENABLE FALSE BOOL "")
+set_cache_default(STM32CUBEL4__DTTY_USBD_PORT_COUNT 2 STRING "Number of the CDC ACM functions of the USB dtty device, the console included (2 or 3)")
+set_cache_default(STM32CUBEL4__DTTY_USBD_PORT_BUFFER_SIZE 4096 STRING "Size of the write buffer and of the read buffer of each additional USB dtty port")
+
+
+set_cache_default(STM32CUBEL4__NVMEM_ASYNC_ENABLE FALSE BOOL "")
+
+set_cache_default(STM32CUBEL4__NVMEM_RWW_ENABLE FALSE BOOL "")
+
+set_cache_default(STM32CUBEL4__NVMEM_KV_ENABLE FALSE BOOL "")
+
+set_cache_default(STM32CUBEL4__NVMEM_LOG_ENABLE FALSE BOOL "")
+
+set_cache_default(STM32CUBEL4__NVMEM_JOURNAL_ENABLE FALSE BOOL "")
+
+set_cache_default(STM32CUBEL4__NVMEM_CRC_ENABLE FALSE BOOL "")
+
+set_cache_default(STM32CUBEL4__NVMEM_DMA_ENABLE FALSE BOOL "")
+set_cache_default(STM32CUBEL4__NVMEM_DMA_INSTANCE 2 STRING "DMA controller used by nvmem_read (1 or 2)")
+set_cache_default(STM32CUBEL4__NVMEM_DMA_CHANNEL 1 STRING "DMA channel used by nvmem_read (1 to 7)")
+set_cache_default(STM32CUBEL4__NVMEM_DMA_READ_THRESHOLD 256 STRING "Minimum size of the nvmem_read done by DMA")
+
+set_cache_default(STM32CUBEL4__NVMEM_MAP_ENABLE FALSE BOOL "")
+
+set_cache_default(STM32CUBEL4__NVMEM_CACHE_ENABLE FALSE BOOL "")
+set_cache_default(STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT 2 STRING "Number of pages of the nvmem write-back cache")
+set_cache_default(STM32CUBEL4__NVMEM_CACHE_TIMEOUTMS 1000 STRING "Time a page can stay dirty in the nvmem write-back cache")
+
+set_cache_default(STM32CUBEL4__NVMEM_FWUP_ENABLE FALSE BOOL "")
+set_cache_default(STM32CUBEL4__NVMEM_FWUP_CHUNK_SIZE 2048 STRING "Size of the chunks written by the firmware update engine (multiple of 8)")
+
+set_cache_default(STM32CUBEL4__NVMEM_STREAM_ENABLE FALSE BOOL "")
+
+set_cache_default(STM32CUBEL4__NVMEM_OB_ENABLE FALSE BOOL "")
@@ -0,0 +1,488 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef STM32CUBEL4_EXTENSION_DTTY_H_
+#define STM32CUBEL4_EXTENSION_DTTY_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @file dtty.h
+ *
+ * @brief STM32L4 specific extensions of the dtty API (UART and USB CDC)
+ */
+
+#include <ubinos.h>
+
+#if (UBINOS__BSP__USE_DTTY == 1)
+
+#if (STM32CUBEL4__DTTY_LINE_ENABLE == 1)
+
+/*!
+ * Line discipline (canonical mode)
+ *
+ * In canonical mode, the received characters are edited in the receive interrupt: they are echoed
+ * (if the echo is enabled), backspace (0x08 or 0x7F) removes the last character of the line,
+ * and '\r' or '\n' completes the line ("\r\n" counts as one line end). A line holds up to
+ * STM32CUBEL4__DTTY_LINE_SIZE characters, the characters beyond are dropped.
+ * The readers are woken only when a line is completed, and dtty_getc, dtty_kbhit and
+ * dtty_getline only see the completed lines (each ending with '\n').
+ * On the UART, the line end '\r' is detected by the character match (CMF) of the USART.
+ */
+
+/*!
+ * Enable or disable the canonical mode. The line being edited is discarded.
+ *
+ * @param enable    1 to enable, 0 to disable
+ *
+ * @return 0 on success, -1 on failure
+ */
+int dtty_setcanon(int enable);
+
+/*!
+ * Returns 1 if the canonical mode is enabled, 0 otherwise.
+ */
+int dtty_getcanon(void);
+
+/*!
+ * Read a line. It blocks until a line is completed.
+ * In canonical mode, it is woken once per line. Otherwise, the characters are read one by one
+ * (as dtty_getc) until '\r' or '\n'.
+ *
+ * @param buf   Buffer to receive the line, without the line end and terminated with '\0'
+ * @param max   Size of the buffer (the characters that do not fit are dropped)
+ *
+ * @return Length of the line on success, negative value on failure
+ */
+int dtty_getline(char *buf, int max);
+
+#endif /* (STM32CUBEL4__DTTY_LINE_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_READ_ENABLE == 1)
+
+/*!
+ * Read with termios-like VMIN/VTIME semantics (no echo, not available in canonical mode).
+ *
+ * vmin > 0, vtimems > 0:   returns when vmin characters are received, or when the line stays
+ *                          idle for vtimems after at least one character.
+ * vmin > 0, vtimems == 0:  returns when vmin characters are received.
+ * vmin == 0, vtimems > 0:  returns when at least one character is received, or after vtimems.
+ * vmin == 0, vtimems == 0: returns the characters already received, without blocking.
+ *
+ * The reader is not woken for every character. On the UART, the idle time is measured by the
+ * receiver timeout of the USART (RTOF), so the USART shall support it (not the LPUART) and
+ * dtty_stm32_uart_irq_callback shall be called from its interrupt handler. On USB, a short
+ * packet (smaller than the maximum packet size) also ends the read, as the end of a message.
+ *
+ * @param buf       Buffer to receive the characters
+ * @param max       Size of the buffer
+ * @param vmin      Minimum number of characters (limited to max)
+ * @param vtimems   Idle time in milliseconds
+ *
+ * @return Number of characters read on success, negative value on failure
+ */
+int dtty_read(char *buf, int max, int vmin, uint32_t vtimems);
+
+#if (STM32CUBEL4__DTTY_STM32_UART_ENABLE == 1)
+
+/*!
+ * Handle the receiver timeout (RTOF) of the dtty USART.
+ * It shall be called from the interrupt handler of the USART, before HAL_UART_IRQHandler, and
+ * dtty_stm32_uart_err_callback from HAL_UART_ErrorCallback (which ends the read on HAL_UART_ERROR_RTO).
+ */
+void dtty_stm32_uart_irq_callback(void);
+
+#endif /* (STM32CUBEL4__DTTY_STM32_UART_ENABLE == 1) */
+
+#endif /* (STM32CUBEL4__DTTY_READ_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_POLL_ENABLE == 1)
+
+/*!
+ * Poll set
+ *
+ * A poll set lets one task wait for several events: the dtty becoming readable or writable,
+ * a dtty error, data sent or received on the USB ports, the completion of asynchronous nvmem
+ * requests (with dtty_poll_nvmem_callback) and user events signaled by other tasks or interrupts
+ * (dtty_poll_signal).
+ * RX and TX are levels, checked when the task wakes up. The other events are latched until
+ * they are returned by dtty_poll_wait.
+ */
+
+#define DTTY_POLL_MAX           4           /*!< Maximum number of open poll sets */
+#define DTTY_POLL_WAIT_FOREVER  (0xFFFFFFFF)
+
+#define DTTY_POLL_RX            0x00000001  /*!< Readable (a line is completed in canonical mode) */
+#define DTTY_POLL_TX            0x00000002  /*!< Writable (the write buffer is not full) */
+#define DTTY_POLL_ERR           0x00000004  /*!< Error (the port was reset) */
+#define DTTY_POLL_PORT_TX(n)    (0x00000010UL << (n)) /*!< Data of USB port n (1 or 2) was sent: its write buffer has room */
+#define DTTY_POLL_PORT_RX(n)    (0x00001000UL << (n)) /*!< Data was received on USB port n (1 or 2) */
+#define DTTY_POLL_NVMEM         0x00000100  /*!< An asynchronous nvmem request is completed */
+#define DTTY_POLL_USER(n)       (0x00010000UL << (n)) /*!< User event n (0 to 7) */
+
+/*!
+ * Poll set. It is owned by the caller and shall remain valid until it is closed.
+ */
+typedef struct _dtty_poll_t
+{
+    uint32_t mask;                      /*!< Events waited for */
+
+    /* The fields below are managed by the driver */
+    sem_pt sem;
+    volatile uint32_t pending;
+} dtty_poll_t;
+
+typedef dtty_poll_t * dtty_poll_pt;
+
+/*!
+ * Open a poll set.
+ *
+ * @param poll  Poll set
+ * @param mask  Events waited for (DTTY_POLL_*)
+ *
+ * @return 0 on success, -1 on failure (no free slot)
+ */
+int dtty_poll_open(dtty_poll_pt poll, uint32_t mask);
+
+/*!
+ * Close a poll set.
+ *
+ * @param poll  Poll set
+ *
+ * @return 0 on success, -1 on failure
+ */
+int dtty_poll_close(dtty_poll_pt poll);
+
+/*!
+ * Wait for one of the events of a poll set.
+ *
+ * @param poll      Poll set
+ * @param timeoutms Timeout in milliseconds (0 to check without blocking, DTTY_POLL_WAIT_FOREVER to wait forever)
+ *
+ * @return Events that occurred (0 on timeout), negative value on failure
+ */
+int dtty_poll_wait(dtty_poll_pt poll, uint32_t timeoutms);
+
+/*!
+ * Signal events to a poll set. It can be called in interrupt context.
+ *
+ * @param poll      Poll set
+ * @param events    Events (DTTY_POLL_USER(n) or DTTY_POLL_NVMEM)
+ */
+void dtty_poll_signal(dtty_poll_pt poll, uint32_t events);
+
+#if (UBINOS__UBIDRV__INCLUDE_NVMEM == 1) && (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+
+struct _nvmem_async_t;
+
+/*!
+ * Completion callback of asynchronous nvmem requests, to be used with the poll set as callback_arg.
+ * It signals DTTY_POLL_NVMEM.
+ */
+void dtty_poll_nvmem_callback(struct _nvmem_async_t * req, ubi_err_t result, void * arg);
+
+#endif /* (UBINOS__UBIDRV__INCLUDE_NVMEM == 1) && (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+#endif /* (STM32CUBEL4__DTTY_POLL_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+
+/*!
+ * Early console
+ *
+ * Before the kernel is active (dtty_init cannot run yet), dtty_putc and dtty_putn write to a static
+ * buffer of STM32CUBEL4__DTTY_EARLY_BUFFER_SIZE bytes instead of failing. dtty_init replays it into
+ * the write buffer. When the buffer is full, the newer characters are dropped.
+ */
+
+/*!
+ * Send the early output at once by polling the UART, instead of keeping it in the early buffer.
+ * The UART is initialized on the first character, so the system clock shall be configured by then.
+ * It slows the boot down by the transmission time.
+ *
+ * @param enable    1 to enable, 0 to disable
+ *
+ * @return 0 on success, -1 on failure (after dtty_init, or on USB)
+ */
+int dtty_early_setpolled(int enable);
+
+/*!
+ * Returns the number of writes truncated because the early buffer was full.
+ */
+uint32_t dtty_early_get_overflow_count(void);
+
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_CRASHLOG_ENABLE == 1)
+
+/*!
+ * Crash log
+ *
+ * The last STM32CUBEL4__DTTY_CRASHLOG_SIZE bytes written to the dtty are also kept in a ring in
+ * the .noinit section (with a magic number, a header check and a sum of the ring), which is not cleared by a reset.
+ * After a reset (bsp_abortsystem, fault, watchdog), dtty_init writes this tail again before
+ * anything else, so the output that was still queued when the system stopped is not lost.
+ * The linker script shall place .noinit in RAM without initializing it (NOLOAD).
+ */
+
+/*!
+ * Returns the number of bytes of the previous run written by dtty_init (0 after a power on).
+ */
+uint32_t dtty_crashlog_get_replayed(void);
+
+/*!
+ * Empty the crash log, for instance before an intended reset.
+ */
+void dtty_crashlog_discard(void);
+
+#endif /* (STM32CUBEL4__DTTY_CRASHLOG_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_BLACKBOX_ENABLE == 1)
+
+/*!
+ * Black box
+ *
+ * The dtty output (before the autocr conversion) is recorded into a circular log on nvmem
+ * (nvmem_log.h), which survives a power loss. The writers only copy it into a capture buffer of
+ * STM32CUBEL4__DTTY_BLACKBOX_BUFFER_SIZE bytes; dtty_blackbox_flush moves it to the log, so it shall
+ * be called periodically by a task (for instance a low priority background task). When the capture
+ * buffer is full, the newer characters are dropped. A filter can select the lines to record.
+ */
+
+struct _nvmem_log_t;
+
+/*!
+ * Line filter. It is called by dtty_blackbox_flush for every line (ending with '\n', or cut at
+ * 128 characters), and returns 1 to record the line, 0 to drop it.
+ */
+typedef int (*dtty_blackbox_filter_ft)(const char *line, int len);
+
+/*!
+ * Start recording the output into a log, or stop (log NULL).
+ *
+ * @param log   Mounted log, or NULL
+ *
+ * @return 0 on success, -1 on failure
+ */
+int dtty_blackbox_attach(struct _nvmem_log_t *log);
+
+/*!
+ * Set the line filter (NULL to record all the output).
+ */
+void dtty_blackbox_setfilter(dtty_blackbox_filter_ft filter);
+
+/*!
+ * Move the captured output to the log.
+ *
+ * @param sync  1 to also program the last partial record (nvmem_log_sync), so that nothing is lost on a reset
+ *
+ * @return 0 on success, -1 on failure
+ */
+int dtty_blackbox_flush(int sync);
+
+/*!
+ * Write the records of a log to the dtty, from the oldest, for instance at startup before attaching it.
+ * The output written meanwhile is not recorded. The dump waits for free space in the write buffer,
+ * and stops with a failure if the output is not drained for a second.
+ *
+ * @param log   Mounted log
+ *
+ * @return Number of bytes written on success, negative value on failure
+ */
+int dtty_blackbox_dump(struct _nvmem_log_t *log);
+
+/*!
+ * Returns the number of writes truncated because the capture buffer was full.
+ */
+uint32_t dtty_blackbox_get_overflow_count(void);
+
+#endif /* (STM32CUBEL4__DTTY_BLACKBOX_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_PRIO_ENABLE == 1)
+
+/*!
+ * Priority output lanes
+ *
+ * The output written with dtty_putn_prio(DTTY_PRIO_HIGH, ...) goes to a separate buffer of
+ * STM32CUBEL4__DTTY_PRIO_BUFFER_SIZE bytes (high priority lane), which the transmitter drains before
+ * the normal output at the next message boundary of the normal output: after a line end, or after
+ * DTTY_PRIO_RUN_MAX characters without one. An alarm or a shell response thus waits for at most
+ * one line of the queued bulk output, instead of the whole write buffer.
+ */
+
+#define DTTY_PRIO_NORMAL    0       /*!< Normal lane (as dtty_putn) */
+#define DTTY_PRIO_HIGH      1       /*!< High priority lane */
+
+#define DTTY_PRIO_RUN_MAX   256     /*!< Longest normal output sent before the high priority lane can take over */
+
+/*!
+ * Write a message to a lane. On the high priority lane, the message is queued as a whole or not at all,
+ * without waiting for the writers of the normal lane (dtty_flush included).
+ *
+ * @param prio  Lane (DTTY_PRIO_NORMAL or DTTY_PRIO_HIGH)
+ * @param str   Message
+ * @param len   Length of the message
+ *
+ * @return Number of characters written on success, negative value on failure (-1 if the lane is full)
+ */
+int dtty_putn_prio(int prio, const char *str, int len);
+
+#endif /* (STM32CUBEL4__DTTY_PRIO_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_WRITEV_ENABLE == 1)
+
+/*!
+ * Vectored output
+ *
+ * dtty_writev writes several segments (for instance a header, a timestamp, a payload and a line end)
+ * as one output: the segments are queued under one acquisition of the write lock and the transmitter
+ * is started once, so the output of other tasks is never interleaved with them, and the caller does
+ * not have to assemble them in a temporary buffer.
+ */
+
+/*!
+ * Segment of a vectored output (as struct iovec of POSIX, which is not provided by the toolchain)
+ */
+typedef struct _dtty_iovec_t
+{
+    const void * iov_base;      /*!< Start address of the segment */
+    size_t iov_len;             /*!< Length of the segment */
+} dtty_iovec_t;
+
+/*!
+ * Write the segments of a vector as one output.
+ * When the write buffer becomes full, the rest of the output is dropped (as dtty_putn).
+ *
+ * @param iov       Segments
+ * @param iovcnt    Number of segments
+ *
+ * @return Number of characters of the segments accepted (the '\r' of the autocr conversion is not counted)
+ *         on success, negative value on failure
+ */
+int dtty_writev(const dtty_iovec_t *iov, int iovcnt);
+
+#endif /* (STM32CUBEL4__DTTY_WRITEV_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1) && (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1)
+
+/*!
+ * USB CDC host connection
+ *
+ * The USB dtty driver considers that a host has the port open while DTR is set (SET_CONTROL_LINE_STATE)
+ * and the bus is not suspended; a bus reset clears DTR. In between, nothing is sent, and the output
+ * is handled according to the link policy. The application calls the following functions from its
+ * CDC interface and PCD callbacks (interrupt context):
+ *
+ * - void dtty_stm32_usbd_linestate_callback(uint16_t state): CDC_SET_CONTROL_LINE_STATE,
+ *   with the wValue of the request
+ * - void dtty_stm32_usbd_suspend_callback(void): HAL_PCD_SuspendCallback
+ * - void dtty_stm32_usbd_resume_callback(void): HAL_PCD_ResumeCallback
+ * - void dtty_stm32_usbd_reset_callback(void): HAL_PCD_ResetCallback
+ */
+
+#define DTTY_USBD_LINK_DISCARD  0   /*!< The output is dropped */
+#define DTTY_USBD_LINK_KEEP     1   /*!< The newest output is kept, and sent when a host opens the port (default) */
+#define DTTY_USBD_LINK_BLOCK    2   /*!< The writers wait until a host opens the port */
+
+/*!
+ * Set the policy applied to the output while no host has the port open.
+ * The output recorded by the crash log and the black box does not depend on it.
+ *
+ * @param policy    DTTY_USBD_LINK_DISCARD, DTTY_USBD_LINK_KEEP or DTTY_USBD_LINK_BLOCK
+ * @param keep      Number of the newest characters kept in all the lanes (DTTY_USBD_LINK_KEEP),
+ *                  STM32CUBEL4__DTTY_USBD_LINK_KEEP_SIZE by default
+ *
+ * @return 0 on success, negative value on failure
+ */
+int dtty_usbd_setlinkpolicy(int policy, uint32_t keep);
+
+/*!
+ * Returns 1 if a host has the port open, 0 otherwise.
+ */
+int dtty_usbd_isconnected(void);
+
+/*!
+ * Returns the number of characters dropped while no host had the port open.
+ */
+uint32_t dtty_usbd_get_link_drop_count(void);
+
+#endif /* (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1) && (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1) && (STM32CUBEL4__DTTY_USBD_PORT_ENABLE == 1)
+
+/*!
+ * USB composite device ports
+ *
+ * The USB dtty device has STM32CUBEL4__DTTY_USBD_PORT_COUNT CDC ACM functions (ports): port 0 is the
+ * console (dtty), the others are raw byte channels (for instance binary telemetry or firmware update),
+ * each with its own endpoints and write and read buffers of STM32CUBEL4__DTTY_USBD_PORT_BUFFER_SIZE
+ * bytes. The writer task (dtty_write_process) serves all the ports. A port carries the data as it is
+ * (no autocr conversion, echo or line discipline), and its output is not recorded by the crash log or
+ * the black box.
+ *
+ * The composite device (descriptors and classes) belongs to the application, which implements:
+ *
+ * - void dtty_stm32_usbd_port_register(void): registers the CDC functions and their interfaces
+ *   (called after USBD_Init)
+ * - uint8_t dtty_stm32_usbd_port_transmit(int port, uint8_t *buf, uint32_t len): starts a transfer on
+ *   the IN endpoint of a port, returns USBD_OK or USBD_BUSY
+ * - uint8_t dtty_stm32_usbd_port_receive(int port): prepares the OUT endpoint of a port for the next packet
+ *
+ * and calls from the interface callbacks of each function (interrupt context):
+ *
+ * - void dtty_stm32_usbd_port_rx_callback(int port, uint8_t *buf, uint32_t *len)
+ * - void dtty_stm32_usbd_port_tx_callback(int port)
+ */
+
+#define DTTY_USBD_PORT_CONSOLE  0       /*!< Port of the console */
+#define DTTY_USBD_PORT_MAX      3       /*!< Maximum number of ports */
+
+/*!
+ * Write data to a port (other than the console). When the write buffer becomes full, the rest is dropped.
+ *
+ * @param port  Port (1 to STM32CUBEL4__DTTY_USBD_PORT_COUNT - 1)
+ * @param buf   Data
+ * @param len   Length of the data
+ *
+ * @return Number of bytes written on success, negative value on failure
+ */
+int dtty_usbd_port_write(int port, const void *buf, int len);
+
+/*!
+ * Read the data received on a port (other than the console).
+ *
+ * @param port      Port (1 to STM32CUBEL4__DTTY_USBD_PORT_COUNT - 1)
+ * @param buf       Buffer
+ * @param max       Size of the buffer
+ * @param timeoutms Maximum time to wait for data (0 not to wait)
+ *
+ * @return Number of bytes read (0 if nothing was received in time), negative value on failure
+ */
+int dtty_usbd_port_read(int port, void *buf, int max, uint32_t timeoutms);
+
+/*!
+ * Returns the number of writes to a port truncated because its write buffer was full.
+ */
+uint32_t dtty_usbd_port_get_overflow_count(int port);
+
+/*!
+ * Returns the number of packets received on a port that did not fit in its read buffer.
+ * The OUT endpoint is only prepared while the read buffer has room for a packet, so the host
+ * is held off (NAK) by a slow reader and the count stays 0 unless the packets exceed the maximum size.
+ */
+uint32_t dtty_usbd_port_get_rx_overflow_count(int port);
+
+#endif /* (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1) && (STM32CUBEL4__DTTY_USBD_PORT_ENABLE == 1) */
+
+#endif /* (UBINOS__BSP__USE_DTTY == 1) */
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* STM32CUBEL4_EXTENSION_DTTY_H_ */
@@ -0,0 +1,662 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef STM32CUBEL4_EXTENSION_NVMEM_H_
+#define STM32CUBEL4_EXTENSION_NVMEM_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @file nvmem.h
+ *
+ * @brief STM32L4 specific extensions of the ubidrv nvmem API
+ */
+
+#include <ubinos.h>
+
+#if (UBINOS__UBIDRV__INCLUDE_NVMEM == 1)
+
+#include <ubinos/ubidrv/nvmem.h>
+
+/*!
+ * Check if an area is erased (reads back as all 0xFF).
+ * nvmem_erase uses the same check to skip the pages that are already erased.
+ *
+ * @param addr  Start address of the area
+ * @param size  Size of the area
+ *
+ * @return 1 if the area is erased, 0 otherwise (or if the area is not entirely in the FLASH)
+ */
+int nvmem_is_erased(const uint8_t *addr, size_t size);
+
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+
+#define NVMEM_WAIT_FOREVER (0xFFFFFFFF)
+
+struct _nvmem_async_t;
+
+/*!
+ * Asynchronous operation completion callback.
+ * It is called in interrupt context.
+ *
+ * @param req       Completed request
+ * @param result    Result of the request
+ * @param arg       Argument given with the request
+ */
+typedef void (*nvmem_async_callback_ft)(struct _nvmem_async_t * req, ubi_err_t result, void * arg);
+
+/*!
+ * Asynchronous nvmem operation request.
+ * The request is owned by the caller and shall remain valid until it is completed.
+ */
+typedef struct _nvmem_async_t
+{
+    nvmem_async_callback_ft callback;   /*!< Called on completion (NULL if not used) */
+    void * callback_arg;                /*!< Argument passed to the callback */
+    sem_pt sem;                         /*!< Given on completion (NULL if not used) */
+
+    /* The fields below are managed by the driver */
+    struct _nvmem_async_t * next;
+    uint8_t op;
+    volatile uint8_t done;
+    volatile ubi_err_t result;
+    uint32_t addr;
+    uint32_t size;
+    const uint8_t * buf;
+} nvmem_async_t;
+
+typedef nvmem_async_t * nvmem_async_pt;
+
+/*!
+ * Queue an erase of the area. The call returns immediately.
+ *
+ * @param req   Request to be queued
+ * @param addr  Start address of the area
+ * @param size  Size of the area
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_erase_async(nvmem_async_pt req, uint8_t *addr, size_t size);
+
+/*!
+ * Queue an update of the area. The call returns immediately.
+ * The buf shall remain valid until the request is completed.
+ *
+ * @param req   Request to be queued
+ * @param addr  Start address of the area
+ * @param buf   Data to be written
+ * @param size  Size of the data
+ *
+ * @return Error code (UBI_ERR_NOT_SUPPORTED once the journal is initialized: use nvmem_update)
+ */
+ubi_err_t nvmem_update_async(nvmem_async_pt req, uint8_t *addr, const uint8_t *buf, size_t size);
+
+/*!
+ * Wait for completion of a queued request.
+ *
+ * @param req       Request to wait for
+ * @param timeoutms Timeout in milliseconds (NVMEM_WAIT_FOREVER to wait forever)
+ *
+ * @return Result of the request, or UBI_ERR_TIMEOUT
+ */
+ubi_err_t nvmem_async_wait(nvmem_async_pt req, uint32_t timeoutms);
+
+/*!
+ * Returns 1 if there are queued or running asynchronous requests, 0 otherwise.
+ */
+int nvmem_async_is_busy(void);
+
+/*!
+ * FLASH interrupt handler.
+ * The FLASH_IRQHandler of the application shall call this instead of HAL_FLASH_IRQHandler.
+ */
+void nvmem_stm32_flash_irq_handler(void);
+
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_RWW_ENABLE == 1)
+
+/*!
+ * Read-while-write mode.
+ *
+ * Pages of the bank the code is fetched from are erased and programmed by functions placed in the
+ * ".RamFunc" section (the linker script shall copy it to RAM), with interrupts masked.
+ * Asynchronous requests are accepted only for the other bank, so the application keeps running
+ * while they are in progress.
+ */
+
+/*!
+ * Read-while-write benchmark result (in CPU cycles)
+ */
+typedef struct _nvmem_rww_benchmark_t
+{
+    uint32_t sync_cycles;           /*!< Time the caller is blocked by nvmem_update in the code bank */
+    uint32_t async_blocked_cycles;  /*!< Time the caller is blocked by nvmem_update_async in the other bank */
+    uint32_t async_cycles;          /*!< Time until the nvmem_update_async in the other bank is completed */
+    uint32_t async_work_count;      /*!< Loop iterations run by the caller while waiting for it */
+} nvmem_rww_benchmark_t;
+
+/*!
+ * Returns 1 if the area is not in the bank the code is fetched from, 0 otherwise.
+ */
+int nvmem_rww_is_concurrent(const uint8_t *addr, size_t size);
+
+/*!
+ * Measure the stall time of an update in the code bank against an update in the other bank.
+ * The first 16 bytes of both pages are modified.
+ *
+ * @param code_bank_page    Scratch page in the bank the code is fetched from
+ * @param other_bank_page   Scratch page in the other bank
+ * @param result            Result
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_rww_benchmark(uint8_t *code_bank_page, uint8_t *other_bank_page, nvmem_rww_benchmark_t *result);
+
+#endif /* (STM32CUBEL4__NVMEM_RWW_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+
+/*!
+ * Journaled update mode.
+ *
+ * Once nvmem_journal_init is called, nvmem_update writes the new image of every page it has to
+ * erase to a scratch page, records it in the journal page with a sequence number and CRCs, and
+ * only then erases and programs the target page. An update interrupted by a reset is completed
+ * by nvmem_journal_init on the next boot.
+ * nvmem_update_async is not journaled, so it is refused while the journal is in use.
+ * The journal area itself cannot be updated or erased through the nvmem calls.
+ *
+ * The journal area is one journal page followed by the scratch pages.
+ * nvmem_journal_maintain erases the used scratch pages and the full journal page ahead of the next
+ * updates (call it from a low priority task); otherwise an update erases them itself. With them
+ * erased ahead, a page update costs one extra page program and four doubleword programs.
+ */
+
+#define NVMEM_JOURNAL_SCRATCH_MAX 8
+
+/*!
+ * Initialize the journal and complete the interrupted update, if any.
+ *
+ * @param addr                  Start address of the journal area (page aligned)
+ * @param scratch_page_count    Number of scratch pages (1 to NVMEM_JOURNAL_SCRATCH_MAX)
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_journal_init(uint8_t *addr, uint32_t scratch_page_count);
+
+/*!
+ * Erase the used scratch pages, and the journal page once it is full.
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_journal_maintain(void);
+
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+
+/*!
+ * Integrity checking with the CRC unit and the FLASH ECC.
+ *
+ * The CRC is the CRC-32 of IEEE 802.3 (as zlib crc32), computed by the CRC unit.
+ * Writes are verified by comparing the CRC of the source, accumulated while it is programmed,
+ * with the CRC of the FLASH.
+ *
+ * A double ECC error (ECCD) raises a NMI. The NMI_Handler of the application shall call
+ * nvmem_stm32_flash_nmi_handler, so that the error is recorded and reported by the nvmem API
+ * (UBI_ERR_INVALID_DATA) instead of faulting.
+ */
+
+#define NVMEM_ECC_NONE      0   /*!< No ECC error */
+#define NVMEM_ECC_CORRECTED 1   /*!< Single error, corrected (ECCC) */
+#define NVMEM_ECC_DETECTED  2   /*!< Double error, detected (ECCD) */
+
+/*!
+ * nvmem error status
+ */
+typedef struct _nvmem_error_t
+{
+    uint32_t ecc_corrected_count;   /*!< Number of corrected ECC errors */
+    uint32_t ecc_detected_count;    /*!< Number of uncorrectable ECC errors */
+    uint8_t * last_addr;            /*!< Address of the last ECC error */
+    uint8_t last_type;              /*!< Type of the last ECC error (NVMEM_ECC_*) */
+} nvmem_error_t;
+
+/*!
+ * Compute the CRC of an area.
+ *
+ * @param addr  Start address of the area (4 byte aligned)
+ * @param size  Size of the area
+ * @param crc_p Pointer to receive the CRC
+ *
+ * @return Error code (UBI_ERR_INVALID_DATA if an uncorrectable ECC error was detected in the area)
+ */
+ubi_err_t nvmem_crc32(const uint8_t *addr, size_t size, uint32_t *crc_p);
+
+/*!
+ * Check an area against its expected CRC, at bus speed (to be used for boot-time scans).
+ *
+ * @param addr          Start address of the area (4 byte aligned)
+ * @param size          Size of the area
+ * @param expected_crc  Expected CRC
+ *
+ * @return Error code (UBI_ERR_INVALID_DATA if the CRC does not match or an uncorrectable ECC error was detected)
+ */
+ubi_err_t nvmem_check(const uint8_t *addr, size_t size, uint32_t expected_crc);
+
+/*!
+ * Get the nvmem error status.
+ *
+ * @param error_p   Pointer to receive the status
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_get_error(nvmem_error_t *error_p);
+
+/*!
+ * Clear the nvmem error status.
+ */
+void nvmem_clear_error(void);
+
+/*!
+ * FLASH ECC NMI handler.
+ *
+ * @return 1 if the NMI was raised by a FLASH double ECC error (and is handled), 0 otherwise.
+ */
+int nvmem_stm32_flash_nmi_handler(void);
+
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_DMA_ENABLE == 1)
+
+/*!
+ * DMA read mode.
+ *
+ * nvmem_read copies the reads of STM32CUBEL4__NVMEM_DMA_READ_THRESHOLD bytes or more with a DMA
+ * memory-to-memory transfer (channel STM32CUBEL4__NVMEM_DMA_CHANNEL of DMA STM32CUBEL4__NVMEM_DMA_INSTANCE)
+ * and sleeps on a semaphore until it is over. Smaller reads, reads whose source and destination
+ * are not equally word aligned and reads issued while the channel is busy are copied by the CPU.
+ *
+ * The interrupt handler of the channel (e.g. DMA2_Channel1_IRQHandler) of the application shall
+ * call nvmem_stm32_dma_irq_handler.
+ */
+
+/*!
+ * DMA read completion callback.
+ * It is called in interrupt context.
+ *
+ * @param result    Result of the read
+ * @param arg       Argument given with the read
+ */
+typedef void (*nvmem_read_callback_ft)(ubi_err_t result, void * arg);
+
+/*!
+ * Start a read of the area with the DMA. The call returns immediately.
+ * If the read cannot be done by the DMA, it is done by the CPU and the callback is called before returning.
+ * The buf shall remain valid until the read is completed.
+ *
+ * @param addr      Start address of the area
+ * @param buf       Buffer to read into
+ * @param size      Size of the area
+ * @param callback  Called on completion (NULL if not used)
+ * @param arg       Argument passed to the callback
+ *
+ * @return Error code (UBI_ERR_BUSY if a DMA read is in progress)
+ */
+ubi_err_t nvmem_read_async(const uint8_t *addr, uint8_t *buf, size_t size, nvmem_read_callback_ft callback, void *arg);
+
+/*!
+ * Returns 1 if a DMA read is in progress, 0 otherwise.
+ */
+int nvmem_read_async_is_busy(void);
+
+/*!
+ * DMA channel interrupt handler.
+ */
+void nvmem_stm32_dma_irq_handler(void);
+
+#endif /* (STM32CUBEL4__NVMEM_DMA_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_MAP_ENABLE == 1)
+
+/*!
+ * Memory-mapped read.
+ *
+ * nvmem_map returns a direct pointer into the FLASH, so that the data can be parsed in place.
+ * While an area is mapped, nvmem_erase and nvmem_update (and their asynchronous variants) on a page
+ * that overlaps it are rejected with UBI_ERR_INVALID_STATE.
+ */
+
+#define NVMEM_MAP_MAX 8
+
+/*!
+ * Map an area of the FLASH.
+ * An address in the boot alias of the FLASH (from 0x00000000) is translated to its address in the
+ * FLASH area, which follows the bank swap setting the same way as the erase and program operations.
+ *
+ * @param addr  Start address of the area
+ * @param size  Size of the area
+ * @param ptr_p Pointer to receive the read-only pointer to the area
+ *
+ * @return Error code (UBI_ERR_NO_MEM if NVMEM_MAP_MAX areas are already mapped)
+ */
+ubi_err_t nvmem_map(const uint8_t *addr, size_t size, const uint8_t **ptr_p);
+
+/*!
+ * Unmap an area mapped by nvmem_map.
+ *
+ * @param ptr   Pointer returned by nvmem_map
+ *
+ * @return Error code (UBI_ERR_NOT_FOUND if ptr is not mapped)
+ */
+ubi_err_t nvmem_unmap(const uint8_t *ptr);
+
+/*!
+ * Returns 1 if a mapped area overlaps the pages of the area, 0 otherwise.
+ */
+int nvmem_is_mapped(const uint8_t *addr, size_t size);
+
+#endif /* (STM32CUBEL4__NVMEM_MAP_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+
+/*!
+ * Write-back cache.
+ *
+ * An nvmem_update that would have to erase a page copies the page into one of
+ * STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT RAM pages and merges the data there instead, so a run of
+ * updates of the same page costs one erase. Updates of doublewords that are still erased are
+ * programmed directly, as they do not need an erase.
+ *
+ * A dirty page is written back by nvmem_sync, by nvmem_cache_maintain once it has been dirty for
+ * STM32CUBEL4__NVMEM_CACHE_TIMEOUTMS, when its slot is needed for another page, and before an
+ * asynchronous update or a nvmem_map of the page. nvmem_erase drops the cached pages it erases.
+ *
+ * nvmem_read returns the cached data. nvmem_is_erased, nvmem_crc32 and nvmem_check see the
+ * FLASH contents (call nvmem_sync first).
+ */
+
+/*!
+ * Write back all dirty pages.
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_sync(void);
+
+/*!
+ * Write back the pages that have been dirty for STM32CUBEL4__NVMEM_CACHE_TIMEOUTMS or more.
+ * It is intended to be called periodically from a low priority task.
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_cache_maintain(void);
+
+/*!
+ * Returns the number of dirty pages.
+ */
+uint32_t nvmem_cache_get_dirty_count(void);
+
+/*!
+ * Low-power entry hook.
+ * The application shall call this before entering a low-power mode in which the RAM may be lost.
+ */
+void nvmem_stm32_lowpower_enter_hook(void);
+
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_FWUP_ENABLE == 1)
+
+/*!
+ * Dual bank boot.
+ *
+ * The bank the device boots from (the active bank) is mapped at the start of the FLASH, and the
+ * other bank (the inactive bank) right after it. A new image is written to the inactive bank
+ * while the code keeps running from the active bank, and nvmem_bank_swap makes it the active
+ * bank on the next boot (see nvmem_fwup.h).
+ */
+
+/*!
+ * Get the area of the inactive bank.
+ *
+ * @param addr_p    Pointer to receive the start address of the bank
+ * @param size_p    Pointer to receive the size of the bank
+ *
+ * @return Error code (UBI_ERR_NOT_SUPPORTED if the FLASH has a single bank)
+ */
+ubi_err_t nvmem_bank_get_inactive(uint8_t **addr_p, size_t *size_p);
+
+/*!
+ * Returns the active bank (1 or 2).
+ */
+int nvmem_bank_get_active(void);
+
+/*!
+ * Set the BFB2 option bit so that the device boots from the inactive bank, and reload the
+ * option bytes (which resets the device). Pending writes are synchronized first.
+ *
+ * @return Error code (it does not return on success, UBI_ERR_NOT_SUPPORTED if the FLASH has a single bank)
+ */
+ubi_err_t nvmem_bank_swap(void);
+
+#endif /* (STM32CUBEL4__NVMEM_FWUP_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_STREAM_ENABLE == 1)
+
+/*!
+ * Streaming writer.
+ *
+ * The appended data is accumulated into a buffer of NVMEM_STREAM_BUF_SIZE bytes (a row of the
+ * FLASH) and programmed a buffer at a time, as whole doublewords into erased FLASH. Each page is
+ * erased once, when the write cursor enters it (pages that are already erased are not), so a
+ * stream of small unaligned appends costs no page read-modify-write.
+ *
+ * A page the stream enters is erased as a whole. If the stream does not start at a page boundary,
+ * the part of its first page from the start of the stream shall be erased.
+ */
+
+#define NVMEM_STREAM_BUF_SIZE 256
+
+/*!
+ * Streaming writer
+ */
+typedef struct _nvmem_stream_t
+{
+    /* The fields below are managed by the driver */
+    uint32_t addr;          /*!< Address at which the buffer is to be programmed */
+    uint32_t end;           /*!< End address of the area */
+    uint32_t erased_end;    /*!< End address of the erased area ahead of addr */
+    uint32_t buf_len;
+    uint8_t open;
+    uint64_t buf[NVMEM_STREAM_BUF_SIZE / sizeof(uint64_t)];
+} nvmem_stream_t;
+
+typedef nvmem_stream_t * nvmem_stream_pt;
+
+/*!
+ * Open a stream writing an area.
+ *
+ * @param stream    Stream
+ * @param addr      Start address of the area (8 byte aligned)
+ * @param size      Size of the area
+ *
+ * @return Error code (UBI_ERR_INVALID_STATE if the start of the first page is not erased)
+ */
+ubi_err_t nvmem_stream_open(nvmem_stream_pt stream, uint8_t *addr, size_t size);
+
+/*!
+ * Append data to the stream.
+ *
+ * @param stream    Open stream
+ * @param buf       Data
+ * @param size      Size of the data
+ *
+ * @return Error code (UBI_ERR_BUF_FULL if the data goes beyond the end of the area,
+ *         UBI_ERR_BUSY before any data is taken, UBI_ERR_INTERNAL if programming fails:
+ *         the data taken up to then is kept and programmed again by the next append or the close,
+ *         so the stream is to be closed rather than the data appended again)
+ */
+ubi_err_t nvmem_stream_append(nvmem_stream_pt stream, const uint8_t *buf, size_t size);
+
+/*!
+ * Program the data left in the buffer and close the stream.
+ * The last doubleword is padded with 0xFF (it cannot be programmed again without an erase).
+ *
+ * @param stream    Open stream
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_stream_close(nvmem_stream_pt stream);
+
+#endif /* (STM32CUBEL4__NVMEM_STREAM_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_OB_ENABLE == 1)
+
+/*!
+ * Option bytes.
+ *
+ * The nvmem_ob_set_* functions queue option byte changes, and nvmem_ob_commit programs all of them
+ * and loads them with a single option byte launch, which resets the device.
+ *
+ * nvmem_erase, nvmem_update, their asynchronous variants and nvmem_stream_open reject the areas
+ * protected by the write protection (WRP) and the proprietary code readout protection (PCROP)
+ * with UBI_ERR_INVALID_PARAM, before any FLASH operation.
+ *
+ * The banks are the physical banks: bank 1 is mapped after bank 2 while the bank swap is set.
+ */
+
+#define NVMEM_OB_PENDING_MAX        8   /*!< Maximum number of queued changes */
+
+#define NVMEM_OB_WRP_BANK1_A        0   /*!< Write protection area A of bank 1 */
+#define NVMEM_OB_WRP_BANK1_B        1   /*!< Write protection area B of bank 1 */
+#define NVMEM_OB_WRP_BANK2_A        2   /*!< Write protection area A of bank 2 */
+#define NVMEM_OB_WRP_BANK2_B        3   /*!< Write protection area B of bank 2 */
+#define NVMEM_OB_WRP_AREA_COUNT     4
+
+#define NVMEM_OB_RDP_LEVEL_0        0   /*!< No readout protection */
+#define NVMEM_OB_RDP_LEVEL_1        1   /*!< Readout protection */
+#define NVMEM_OB_RDP_LEVEL_2        2   /*!< Chip protection (irreversible) */
+
+/*!
+ * Protected area (size is 0 if the protection is disabled)
+ */
+typedef struct _nvmem_ob_area_t
+{
+    uint8_t * addr;
+    size_t size;
+} nvmem_ob_area_t;
+
+/*!
+ * Option byte settings
+ */
+typedef struct _nvmem_ob_info_t
+{
+    nvmem_ob_area_t wrp[NVMEM_OB_WRP_AREA_COUNT];   /*!< Write protection areas (NVMEM_OB_WRP_*) */
+    nvmem_ob_area_t pcrop[2];                       /*!< PCROP areas of bank 1 and bank 2 */
+    uint8_t pcrop_rdp_erase;                        /*!< 1 if the PCROP areas are erased on a RDP regression */
+    uint8_t rdp_level;                              /*!< NVMEM_OB_RDP_LEVEL_* */
+    uint8_t bfb2;                                   /*!< 1 if the device boots from bank 2 when it holds a valid image */
+    uint8_t dualbank;                               /*!< 1 if the FLASH is organized in two banks */
+} nvmem_ob_info_t;
+
+/*!
+ * Queue a change of a write protection area.
+ * The area is extended to whole pages.
+ *
+ * @param area  Write protection area (NVMEM_OB_WRP_*)
+ * @param addr  Start address of the area, in the bank of the write protection area
+ * @param size  Size of the area (0 to disable the write protection area)
+ *
+ * @return Error code (UBI_ERR_NO_MEM if NVMEM_OB_PENDING_MAX changes are already queued)
+ */
+ubi_err_t nvmem_ob_set_wrp(uint32_t area, const uint8_t *addr, size_t size);
+
+/*!
+ * Queue a change of the PCROP area of a bank.
+ * The area is extended to whole doublewords. Reducing an area may require a RDP regression.
+ *
+ * @param bank          Bank (1 or 2)
+ * @param addr          Start address of the area, in the bank
+ * @param size          Size of the area (0 to disable the PCROP area)
+ * @param rdp_erase     1 to erase the PCROP areas on a RDP regression from level 1 to level 0
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_ob_set_pcrop(uint32_t bank, const uint8_t *addr, size_t size, int rdp_erase);
+
+/*!
+ * Queue a change of the readout protection level.
+ * A regression from level 1 to level 0 mass erases the FLASH. Level 2 cannot be left.
+ *
+ * @param level Level (NVMEM_OB_RDP_LEVEL_*)
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_ob_set_rdp(uint32_t level);
+
+/*!
+ * Queue a change of the BFB2 (boot from bank 2) option.
+ *
+ * @param enable    1 to boot from bank 2 when it holds a valid image, 0 to boot from bank 1
+ *
+ * @return Error code (UBI_ERR_NOT_SUPPORTED if the part has no BFB2 option)
+ */
+ubi_err_t nvmem_ob_set_bfb2(int enable);
+
+/*!
+ * Queue a change of the dual bank option, on the devices that have one.
+ * A change of the bank organization mass erases the FLASH.
+ *
+ * @param enable    1 for two banks, 0 for a single bank
+ *
+ * @return Error code (UBI_ERR_NOT_SUPPORTED if the device has no dual bank option)
+ */
+ubi_err_t nvmem_ob_set_dualbank(int enable);
+
+/*!
+ * Drop the queued changes.
+ */
+void nvmem_ob_discard(void);
+
+/*!
+ * Returns the number of queued changes.
+ */
+uint32_t nvmem_ob_get_pending_count(void);
+
+/*!
+ * Program the queued changes and load them (which resets the device).
+ * Pending writes are synchronized first. If the programming fails, the changes programmed so far
+ * are loaded on the next reset.
+ *
+ * @return Error code (it does not return on success, unless no change is queued)
+ */
+ubi_err_t nvmem_ob_commit(void);
+
+/*!
+ * Get the option byte settings in effect.
+ *
+ * @param info_p    Pointer to receive the settings
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_ob_get_info(nvmem_ob_info_t *info_p);
+
+/*!
+ * Returns 1 if a WRP or PCROP area overlaps the area, 0 otherwise.
+ */
+int nvmem_is_protected(const uint8_t *addr, size_t size);
+
+#endif /* (STM32CUBEL4__NVMEM_OB_ENABLE == 1) */
+
+#endif /* (UBINOS__UBIDRV__INCLUDE_NVMEM == 1) */
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* STM32CUBEL4_EXTENSION_NVMEM_H_ */
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef STM32CUBEL4_EXTENSION_NVMEM_FWUP_H_
+#define STM32CUBEL4_EXTENSION_NVMEM_FWUP_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @file nvmem_fwup.h
+ *
+ * @brief A/B firmware update on the inactive FLASH bank
+ *
+ * The new image is written to the inactive bank in chunks of STM32CUBEL4__NVMEM_FWUP_CHUNK_SIZE
+ * bytes as it is received, while the application keeps running from the active bank (the bank
+ * being programmed is not the one the code is fetched from, so the code execution is not stalled).
+ * Once the whole image is written, its CRC and vector table are checked, and nvmem_fwup_activate
+ * swaps the banks and resets the device. The previous image stays in the other bank.
+ *
+ * The CRC is the CRC-32 of IEEE 802.3 (as zlib crc32).
+ */
+
+#include <ubinos.h>
+
+#if (UBINOS__UBIDRV__INCLUDE_NVMEM == 1)
+#if (STM32CUBEL4__NVMEM_FWUP_ENABLE == 1)
+
+#include <ubinos/ubidrv/nvmem.h>
+
+/*!
+ * Header sent before the image by nvmem_fwup_receive (little endian words)
+ */
+#define NVMEM_FWUP_HDR_MAGIC    0x50555746UL /* "FWUP" */
+#define NVMEM_FWUP_HDR_SIZE     12 /* magic, image size, image CRC */
+
+#define NVMEM_FWUP_STATE_IDLE       0
+#define NVMEM_FWUP_STATE_WRITING    1
+#define NVMEM_FWUP_STATE_VERIFIED   2
+
+/*!
+ * Firmware update
+ */
+typedef struct _nvmem_fwup_t
+{
+    /* The fields below are managed by the update engine */
+    uint8_t * base;
+    uint32_t bank_size;
+    uint32_t image_size;
+    uint32_t offset;
+    uint32_t chunk_len;
+    uint8_t state;
+    uint64_t chunk[STM32CUBEL4__NVMEM_FWUP_CHUNK_SIZE / sizeof(uint64_t)];
+} nvmem_fwup_t;
+
+typedef nvmem_fwup_t * nvmem_fwup_pt;
+
+/*!
+ * Start writing a new image to the inactive bank.
+ *
+ * @param fwup          Firmware update
+ * @param image_size    Size of the image
+ *
+ * @return Error code (UBI_ERR_NO_MEM if the image does not fit in the bank)
+ */
+ubi_err_t nvmem_fwup_begin(nvmem_fwup_pt fwup, uint32_t image_size);
+
+/*!
+ * Write the next part of the image. The data is written to the FLASH a chunk at a time.
+ *
+ * @param fwup  Firmware update
+ * @param data  Data
+ * @param size  Size of the data
+ *
+ * @return Error code (UBI_ERR_BUF_FULL if the data goes beyond the image size)
+ */
+ubi_err_t nvmem_fwup_write(nvmem_fwup_pt fwup, const uint8_t * data, size_t size);
+
+/*!
+ * Write the last chunk and check the image written to the inactive bank.
+ *
+ * @param fwup          Firmware update
+ * @param expected_crc  Expected CRC of the image
+ *
+ * @return Error code (UBI_ERR_INVALID_DATA if the CRC does not match or the vector table is not valid)
+ */
+ubi_err_t nvmem_fwup_finish(nvmem_fwup_pt fwup, uint32_t expected_crc);
+
+/*!
+ * Abort the update. The part of the image already written is left in the inactive bank.
+ *
+ * @param fwup  Firmware update
+ */
+void nvmem_fwup_abort(nvmem_fwup_pt fwup);
+
+/*!
+ * Boot the checked image (nvmem_bank_swap).
+ *
+ * @param fwup  Firmware update, finished successfully
+ *
+ * @return Error code (it does not return on success)
+ */
+ubi_err_t nvmem_fwup_activate(nvmem_fwup_pt fwup);
+
+/*!
+ * Receive an image from the dtty (UART or USB CDC) and write it to the inactive bank.
+ * The image shall be preceded by a header of NVMEM_FWUP_HDR_SIZE bytes (NVMEM_FWUP_HDR_MAGIC,
+ * image size and image CRC, as little endian words). The echo of the dtty is disabled meanwhile.
+ *
+ * @param fwup      Firmware update
+ * @param timeoutms Maximum time without receiving data, in milliseconds
+ *
+ * @return Error code (UBI_ERR_TIMEOUT if the data stopped, UBI_ERR_INVALID_DATA if the header or the image is not valid)
+ */
+ubi_err_t nvmem_fwup_receive(nvmem_fwup_pt fwup, uint32_t timeoutms);
+
+#endif /* (STM32CUBEL4__NVMEM_FWUP_ENABLE == 1) */
+#endif /* (UBINOS__UBIDRV__INCLUDE_NVMEM == 1) */
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* STM32CUBEL4_EXTENSION_NVMEM_FWUP_H_ */
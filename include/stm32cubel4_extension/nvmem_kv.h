@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef STM32CUBEL4_EXTENSION_NVMEM_KV_H_
+#define STM32CUBEL4_EXTENSION_NVMEM_KV_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @file nvmem_kv.h
+ *
+ * @brief Log-structured key-value store on nvmem
+ *
+ * Records are appended to a ring of pages. Only the doublewords of a new record are programmed,
+ * so a set does not erase a page. When free pages run short, the live records of the oldest page
+ * are copied to the head of the log and the oldest page is erased, so every page of the ring is
+ * erased in turn (wear leveling). An in-RAM hash index maps keys to their latest record.
+ */
+
+#include <ubinos.h>
+
+#if (UBINOS__UBIDRV__INCLUDE_NVMEM == 1)
+#if (STM32CUBEL4__NVMEM_KV_ENABLE == 1)
+
+#include <ubinos/ubidrv/nvmem.h>
+
+#define NVMEM_KV_KEY_LEN_MAX 64
+
+/*!
+ * Hash index slot
+ */
+typedef struct _nvmem_kv_slot_t
+{
+    uint32_t hash;
+    uint32_t addr;
+} nvmem_kv_slot_t;
+
+/*!
+ * Key-value store
+ */
+typedef struct _nvmem_kv_t
+{
+    /* Configuration, set by the caller before nvmem_kv_mount */
+    uint8_t * base;             /*!< Start address of the area (page aligned) */
+    uint32_t page_size;         /*!< Size of a flash page */
+    uint32_t page_count;        /*!< Number of pages of the area (at least 3) */
+    uint32_t index_size;        /*!< Number of hash index slots (power of 2) */
+
+    /* The fields below are managed by the store */
+    mutex_pt lock;
+    nvmem_kv_slot_t * index;
+    uint32_t index_used;
+    uint32_t * erase_counts;
+    uint32_t tail_page;
+    uint32_t head_page;
+    uint32_t head_offset;
+    uint32_t head_seq;
+    uint32_t used_pages;
+    uint8_t mounted;
+} nvmem_kv_t;
+
+typedef nvmem_kv_t * nvmem_kv_pt;
+
+/*!
+ * Mount the store. Pages that do not hold a valid log are erased.
+ *
+ * @param kv    Store, with its configuration fields set
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_kv_mount(nvmem_kv_pt kv);
+
+/*!
+ * Unmount the store and release its memory.
+ *
+ * @param kv    Store
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_kv_unmount(nvmem_kv_pt kv);
+
+/*!
+ * Erase all records of the store.
+ *
+ * @param kv    Mounted store
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_kv_format(nvmem_kv_pt kv);
+
+/*!
+ * Set the value of a key.
+ *
+ * @param kv    Mounted store
+ * @param key   Key (null terminated string, up to NVMEM_KV_KEY_LEN_MAX bytes)
+ * @param value Value
+ * @param size  Size of the value
+ *
+ * @return Error code (UBI_ERR_NO_MEM if the store is full)
+ */
+ubi_err_t nvmem_kv_set(nvmem_kv_pt kv, const char * key, const void * value, size_t size);
+
+/*!
+ * Get the value of a key.
+ *
+ * @param kv        Mounted store
+ * @param key       Key
+ * @param buf       Buffer to read the value into
+ * @param bufsize   Size of the buffer
+ * @param size_p    Pointer to receive the size of the value (NULL if not used)
+ *
+ * @return Error code (UBI_ERR_NOT_FOUND if the key does not exist, UBI_ERR_BUF_FULL if the buffer is too small)
+ */
+ubi_err_t nvmem_kv_get(nvmem_kv_pt kv, const char * key, void * buf, size_t bufsize, size_t * size_p);
+
+/*!
+ * Delete a key.
+ *
+ * @param kv    Mounted store
+ * @param key   Key
+ *
+ * @return Error code (UBI_ERR_NOT_FOUND if the key does not exist)
+ */
+ubi_err_t nvmem_kv_delete(nvmem_kv_pt kv, const char * key);
+
+/*!
+ * Compact the oldest pages until at least min_free_pages pages are free.
+ * It is intended to be called from a low priority background task,
+ * so that the sets seldom have to compact by themselves.
+ *
+ * @param kv                Mounted store
+ * @param min_free_pages    Number of free pages to reach
+ *
+ * @return Error code (UBI_ERR_NO_MEM if a pass frees no space, as every record of the oldest page is live)
+ */
+ubi_err_t nvmem_kv_compact(nvmem_kv_pt kv, uint32_t min_free_pages);
+
+/*!
+ * Returns the number of free pages of the store.
+ */
+uint32_t nvmem_kv_get_free_pages(nvmem_kv_pt kv);
+
+/*!
+ * Returns the erase count of a page, as recorded in the page headers
+ * (pages found erased at mount take the count of the head page).
+ */
+uint32_t nvmem_kv_get_erase_count(nvmem_kv_pt kv, uint32_t page);
+
+#endif /* (STM32CUBEL4__NVMEM_KV_ENABLE == 1) */
+#endif /* (UBINOS__UBIDRV__INCLUDE_NVMEM == 1) */
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* STM32CUBEL4_EXTENSION_NVMEM_KV_H_ */
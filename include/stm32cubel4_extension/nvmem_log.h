@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef STM32CUBEL4_EXTENSION_NVMEM_LOG_H_
+#define STM32CUBEL4_EXTENSION_NVMEM_LOG_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @file nvmem_log.h
+ *
+ * @brief Circular log on nvmem
+ *
+ * The appended data is accumulated into a buffer of NVMEM_LOG_BUF_SIZE bytes and programmed as
+ * one record (a header and whole doublewords) into the erased part of the head page, so an append
+ * does not erase a page. When the head page is full, the log moves to the next page of the ring,
+ * which is erased first if it holds the oldest records. Every page of the ring is thus erased in
+ * turn (wear leveling), and the log keeps the latest (page_count - 1) to page_count pages of data.
+ * The page headers hold a sequence number, so the mount reads one header per page and walks the
+ * records of the head page only.
+ */
+
+#include <ubinos.h>
+
+#if (UBINOS__UBIDRV__INCLUDE_NVMEM == 1)
+#if (STM32CUBEL4__NVMEM_LOG_ENABLE == 1)
+
+#include <ubinos/ubidrv/nvmem.h>
+
+#define NVMEM_LOG_BUF_SIZE      256
+#define NVMEM_LOG_REC_DATA_MAX  (NVMEM_LOG_BUF_SIZE - 8)    /*!< Maximum size of the data of a record */
+
+/*!
+ * Circular log
+ */
+typedef struct _nvmem_log_t
+{
+    /* Configuration, set by the caller before nvmem_log_mount */
+    uint8_t * base;             /*!< Start address of the area (page aligned) */
+    uint32_t page_size;         /*!< Size of a flash page */
+    uint32_t page_count;        /*!< Number of pages of the area (at least 2) */
+
+    /* The fields below are managed by the log */
+    mutex_pt lock;
+    uint32_t tail_page;
+    uint32_t head_page;
+    uint32_t head_offset;
+    uint32_t head_seq;
+    uint32_t used_pages;
+    uint32_t buf_len;
+    uint8_t mounted;
+    uint64_t buf[NVMEM_LOG_BUF_SIZE / sizeof(uint64_t)];
+} nvmem_log_t;
+
+typedef nvmem_log_t * nvmem_log_pt;
+
+/*!
+ * Read cursor of a log. It is owned by the caller.
+ */
+typedef struct _nvmem_log_reader_t
+{
+    /* The fields below are managed by the log */
+    uint32_t page;
+    uint32_t seq;
+    uint32_t offset;
+} nvmem_log_reader_t;
+
+typedef nvmem_log_reader_t * nvmem_log_reader_pt;
+
+/*!
+ * Mount the log. Pages that do not hold a valid page header are erased when the log enters them.
+ *
+ * @param log   Log, with its configuration fields set
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_log_mount(nvmem_log_pt log);
+
+/*!
+ * Unmount the log. The data left in the buffer is programmed first.
+ *
+ * @param log   Log
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_log_unmount(nvmem_log_pt log);
+
+/*!
+ * Erase all records of the log.
+ *
+ * @param log   Mounted log
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_log_format(nvmem_log_pt log);
+
+/*!
+ * Append data to the log. A record is programmed each time the buffer is full.
+ *
+ * @param log   Mounted log
+ * @param buf   Data
+ * @param size  Size of the data
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_log_append(nvmem_log_pt log, const uint8_t * buf, size_t size);
+
+/*!
+ * Program the data left in the buffer as a record (shorter than the buffer).
+ * Until then, it is not seen by nvmem_log_read and it is lost on a reset.
+ *
+ * @param log   Mounted log
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_log_sync(nvmem_log_pt log);
+
+/*!
+ * Place a cursor on the oldest record of the log.
+ *
+ * @param log       Mounted log
+ * @param reader    Cursor
+ *
+ * @return Error code
+ */
+ubi_err_t nvmem_log_rewind(nvmem_log_pt log, nvmem_log_reader_pt reader);
+
+/*!
+ * Read the data of the record at a cursor and move the cursor to the next record.
+ * If the page of the cursor has been reused by the log meanwhile, the cursor moves to the oldest record.
+ *
+ * @param log       Mounted log
+ * @param reader    Cursor
+ * @param buf       Buffer to read the data into (NVMEM_LOG_REC_DATA_MAX bytes is always enough)
+ * @param bufsize   Size of the buffer
+ * @param size_p    Pointer to receive the size of the data
+ *
+ * @return Error code (UBI_ERR_NOT_FOUND after the last record, UBI_ERR_BUF_FULL if the buffer is too small,
+ *         UBI_ERR_INVALID_DATA if the oldest page cannot be read)
+ */
+ubi_err_t nvmem_log_read(nvmem_log_pt log, nvmem_log_reader_pt reader, uint8_t * buf, size_t bufsize, size_t * size_p);
+
+#endif /* (STM32CUBEL4__NVMEM_LOG_ENABLE == 1) */
+#endif /* (UBINOS__UBIDRV__INCLUDE_NVMEM == 1) */
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* STM32CUBEL4_EXTENSION_NVMEM_LOG_H_ */
@@ -1,13 +1,71 @@
-////////
-
-
-#cmakedefine01 INCLUDE__STM32CUBEL4_EXTENSION
-
-#if (INCLUDE__STM32CUBEL4_EXTENSION == 1)
-
-#cmakedefine01 STM32CUBEL4__DTTY_STM32_UART_ENABLE
-
-#cmakedefine01 STM32CUBEL4__DTTY_STM32_USBD_ENABLE
-
-#endif /* (INCLUDE__STM32CUBEL4_EXTENSION == 1) */
-
+////////
+
+
+#cmakedefine01 INCLUDE__STM32CUBEL4_EXTENSION
+
+#if (INCLUDE__STM32CUBEL4_EXTENSION == 1)
+
+#cmakedefine01 STM32CUBEL4__DTTY_STM32_UART_ENABLE
+
+#cmakedefine01 STM32CUBEL4__DTTY_STM32_USBD_ENABLE
+
+#cmakedefine01 STM32CUBEL4__DTTY_LINE_ENABLE
+#define STM32CUBEL4__DTTY_LINE_SIZE @STM32CUBEL4__DTTY_LINE_SIZE@
+
+#cmakedefine01 STM32CUBEL4__DTTY_READ_ENABLE
+
+#cmakedefine01 STM32CUBEL4__DTTY_POLL_ENABLE
+
+#cmakedefine01 STM32CUBEL4__DTTY_EARLY_ENABLE
+#define STM32CUBEL4__DTTY_EARLY_BUFFER_SIZE @STM32CUBEL4__DTTY_EARLY_BUFFER_SIZE@
+
+#cmakedefine01 STM32CUBEL4__DTTY_CRASHLOG_ENABLE
+#define STM32CUBEL4__DTTY_CRASHLOG_SIZE @STM32CUBEL4__DTTY_CRASHLOG_SIZE@
+
+#cmakedefine01 STM32CUBEL4__DTTY_BLACKBOX_ENABLE
+#define STM32CUBEL4__DTTY_BLACKBOX_BUFFER_SIZE @STM32CUBEL4__DTTY_BLACKBOX_BUFFER_SIZE@
+
+#cmakedefine01 STM32CUBEL4__DTTY_PRIO_ENABLE
+#define STM32CUBEL4__DTTY_PRIO_BUFFER_SIZE @STM32CUBEL4__DTTY_PRIO_BUFFER_SIZE@
+
+#cmakedefine01 STM32CUBEL4__DTTY_WRITEV_ENABLE
+
+#cmakedefine01 STM32CUBEL4__DTTY_USBD_LINK_ENABLE
+#define STM32CUBEL4__DTTY_USBD_LINK_KEEP_SIZE @STM32CUBEL4__DTTY_USBD_LINK_KEEP_SIZE@
+
+#cmakedefine01 STM32CUBEL4__DTTY_USBD_PORT_ENABLE
+#define STM32CUBEL4__DTTY_USBD_PORT_COUNT @STM32CUBEL4__DTTY_USBD_PORT_COUNT@
+#define STM32CUBEL4__DTTY_USBD_PORT_BUFFER_SIZE @STM32CUBEL4__DTTY_USBD_PORT_BUFFER_SIZE@
+
+#cmakedefine01 STM32CUBEL4__NVMEM_ASYNC_ENABLE
+
+#cmakedefine01 STM32CUBEL4__NVMEM_RWW_ENABLE
+
+#cmakedefine01 STM32CUBEL4__NVMEM_KV_ENABLE
+
+#cmakedefine01 STM32CUBEL4__NVMEM_LOG_ENABLE
+
+#cmakedefine01 STM32CUBEL4__NVMEM_JOURNAL_ENABLE
+
+#cmakedefine01 STM32CUBEL4__NVMEM_CRC_ENABLE
+
+#cmakedefine01 STM32CUBEL4__NVMEM_DMA_ENABLE
+#define STM32CUBEL4__NVMEM_DMA_INSTANCE @STM32CUBEL4__NVMEM_DMA_INSTANCE@
+#define STM32CUBEL4__NVMEM_DMA_CHANNEL @STM32CUBEL4__NVMEM_DMA_CHANNEL@
+#define STM32CUBEL4__NVMEM_DMA_READ_THRESHOLD @STM32CUBEL4__NVMEM_DMA_READ_THRESHOLD@
+
+#cmakedefine01 STM32CUBEL4__NVMEM_MAP_ENABLE
+
+#cmakedefine01 STM32CUBEL4__NVMEM_CACHE_ENABLE
+#define STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT @STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT@
+#define STM32CUBEL4__NVMEM_CACHE_TIMEOUTMS @STM32CUBEL4__NVMEM_CACHE_TIMEOUTMS@
+
+#cmakedefine01 STM32CUBEL4__NVMEM_FWUP_ENABLE
+#define STM32CUBEL4__NVMEM_FWUP_CHUNK_SIZE @STM32CUBEL4__NVMEM_FWUP_CHUNK_SIZE@
+
+#cmakedefine01 STM32CUBEL4__NVMEM_STREAM_ENABLE
+
+#cmakedefine01 STM32CUBEL4__NVMEM_OB_ENABLE
+
+#endif /* (INCLUDE__STM32CUBEL4_EXTENSION == 1) */
+
@@ -0,0 +1,3816 @@
+/**
+  ******************************************************************************
+  * @file    flash_l4.c
+  * @author  MCD Application Team
+  * @brief   Management of the L4 internal flash memory.
+  ******************************************************************************
+  * @attention
+  *
+  * <h2><center>&copy; Copyright (c) 2017 STMicroelectronics International N.V.
+  * All rights reserved.</center></h2>
+  *
+  * This software component is licensed by ST under Ultimate Liberty license
+  * SLA0044, the "License"; You may not use this file except in compliance with
+  * the License. You may obtain a copy of the License at:
+  *                             www.st.com/SLA0044
+  *
+  ******************************************************************************
+  */
+
+#include <ubinos/ubidrv/nvmem.h>
+#include <stm32cubel4_extension/nvmem.h>
+
+#if (UBINOS__UBIDRV__INCLUDE_NVMEM == 1)
+#if (INCLUDE__STM32CUBEL4_EXTENSION == 1)
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#include "stm32l4xx_hal.h"
+
+#undef LOGM_CATEGORY
+#define LOGM_CATEGORY LOGM_CATEGORY__NVMEM
+
+#define ROUND_DOWN(a,b) (((a) / (b)) * (b))
+#define ROUND_UP(a,b)   ((((a) + (b) - 1) / (b)) * (b))
+#define MIN(a,b)        (((a) < (b)) ? (a) : (b))
+
+/* FLASH geometry, from the device headers
+ * NVMEM_DUAL_BANK      1 if the FLASH is organized in two banks (it follows the dual bank option
+ *                      byte on the parts that have one)
+ * NVMEM_PAGE_SIZE      Page size
+ * NVMEM_PAGE_SIZE_MAX  Largest page size of the part, for the page buffers
+ * NVMEM_BANK_SIZE      Bank size (the FLASH size with a single bank)
+ * NVMEM_PCROP_GRANULE  Granularity of the PCROP areas
+ */
+#if defined(FLASH_OPTR_DBANK)
+/* STM32L4R/L4S/L4P/L4Q: two banks of 4 KB pages with DBANK set, one bank of 8 KB pages otherwise */
+#define NVMEM_DUAL_BANK         (READ_BIT(FLASH->OPTR, FLASH_OPTR_DBANK) != 0U)
+#define NVMEM_PAGE_SIZE         (NVMEM_DUAL_BANK ? FLASH_PAGE_SIZE : FLASH_PAGE_SIZE_128_BITS)
+#define NVMEM_PAGE_SIZE_MAX     FLASH_PAGE_SIZE_128_BITS
+#define NVMEM_PCROP_GRANULE     (NVMEM_DUAL_BANK ? 8U : 16U)
+#elif defined(FLASH_OPTR_DUALBANK)
+/* STM32L47x/L48x/L49x/L4Ax: two banks, except the 256 KB and 512 KB parts with DUALBANK cleared */
+#define NVMEM_DUAL_BANK         ((FLASH_SIZE > 0x80000U) || (READ_BIT(FLASH->OPTR, FLASH_OPTR_DUALBANK) != 0U))
+#define NVMEM_PAGE_SIZE         FLASH_PAGE_SIZE
+#define NVMEM_PAGE_SIZE_MAX     FLASH_PAGE_SIZE
+#elif defined(FLASH_BANK_2)
+#define NVMEM_DUAL_BANK         1
+#define NVMEM_PAGE_SIZE         FLASH_PAGE_SIZE
+#define NVMEM_PAGE_SIZE_MAX     FLASH_PAGE_SIZE
+#else
+/* STM32L41x to STM32L46x: one bank. FLASH_BANK_2 is never selected, it is defined for the bank math only */
+#define NVMEM_DUAL_BANK         0
+#define NVMEM_PAGE_SIZE         FLASH_PAGE_SIZE
+#define NVMEM_PAGE_SIZE_MAX     FLASH_PAGE_SIZE
+#define FLASH_BANK_2            ((uint32_t)0x02)
+#endif
+#define NVMEM_BANK_SIZE         (NVMEM_DUAL_BANK ? (FLASH_SIZE >> 1U) : FLASH_SIZE)
+#if !defined(NVMEM_PCROP_GRANULE)
+#define NVMEM_PCROP_GRANULE     8U
+#endif
+
+#if (STM32CUBEL4__NVMEM_RWW_ENABLE == 1) && !defined(FLASH_CR_BKER)
+#error "The read-while-write mode needs a dual bank FLASH"
+#endif
+
+static  uint32_t FLASH_Init(void);
+static int FLASH_write_at(uint32_t address, uint64_t *pData, uint32_t len_bytes);
+static int FLASH_unlock_erase(uint32_t address, uint32_t len_bytes);
+
+static uint32_t FLASH_Erase_Bank_Pages(uint32_t address, uint32_t len_bytes);
+static int FLASH_Erase_Size(uint32_t address, uint32_t len_bytes);
+//static int FLASH_Write(uint32_t address, uint32_t *pData, uint32_t len_bytes);
+static int FLASH_Update(uint32_t dst_addr, const void *data, uint32_t size);
+static int FLASH_is_blank(uint32_t address, uint32_t len_bytes);
+static int FLASH_is_in_range(uint32_t address, uint32_t len_bytes);
+static uint32_t FLASH_get_bank(uint32_t addr);
+static uint32_t FLASH_get_page(uint32_t addr);
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) || (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+static uint32_t FLASH_crc32(const uint8_t *data, uint32_t len_bytes);
+#endif
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+static void FLASH_crc_lock(void);
+static void FLASH_crc_unlock(void);
+static void FLASH_crc_hw_reset(void);
+static void FLASH_crc_hw_feed(const uint8_t *data, uint32_t len_bytes);
+static uint32_t FLASH_crc_hw_result(void);
+static uint32_t FLASH_crc_hw_compute(const uint8_t *data, uint32_t len_bytes);
+static ubi_err_t FLASH_ecc_check(uint32_t detected_count, uint32_t address, uint32_t len_bytes);
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_RWW_ENABLE == 1)
+/* Functions placed in RAM, so that they can run while the bank the code is fetched from is busy */
+#define FLASH_RAMFUNC __attribute__((section(".RamFunc"), noinline, long_call))
+
+static uint32_t FLASH_rww_code_bank(void);
+static FLASH_RAMFUNC int FLASH_ram_erase_program(uint32_t bank, uint32_t page, int erase, uint32_t address, const uint64_t *pData, uint32_t len_bytes);
+#endif /* (STM32CUBEL4__NVMEM_RWW_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+static volatile uint32_t _g_nvmem_ecc_detected_count = 0;
+/* The CRC unit keeps its state between the reset, the feeds and the read of the result */
+static mutex_pt _g_nvmem_crc_lock = NULL;
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) || (STM32CUBEL4__NVMEM_STREAM_ENABLE == 1)
+static int FLASH_page_erase(uint32_t page_addr);
+static int FLASH_page_program(uint32_t address, uint64_t *pData, uint32_t len_bytes);
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) || (STM32CUBEL4__NVMEM_STREAM_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+static uint32_t _g_nvmem_journal_meta = 0;
+
+static int FLASH_journal_update_page(uint32_t fl_addr, uint64_t *page_cache);
+static int FLASH_journal_overlaps(uint32_t address, uint32_t len_bytes);
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_DMA_ENABLE == 1)
+static ubi_err_t FLASH_dma_read(const uint8_t *addr, uint8_t *buf, uint32_t len_bytes);
+#endif /* (STM32CUBEL4__NVMEM_DMA_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_MAP_ENABLE == 1)
+static int FLASH_map_overlaps(uint32_t address, uint32_t len_bytes);
+#endif /* (STM32CUBEL4__NVMEM_MAP_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+static int FLASH_cache_update(uint32_t address, const uint8_t *data, uint32_t len_bytes);
+static void FLASH_cache_read(uint32_t address, uint8_t *buf, uint32_t len_bytes);
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+static int FLASH_cache_overlaps(uint32_t address, uint32_t len_bytes);
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+static int FLASH_cache_flush_range(uint32_t address, uint32_t len_bytes, int drop);
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_STREAM_ENABLE == 1)
+static int FLASH_stream_program(nvmem_stream_pt stream, uint32_t len_bytes);
+#endif /* (STM32CUBEL4__NVMEM_STREAM_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_FWUP_ENABLE == 1) || (STM32CUBEL4__NVMEM_OB_ENABLE == 1)
+static int FLASH_ob_program_launch(FLASH_OBProgramInitTypeDef *OBInit, uint32_t count);
+#endif /* (STM32CUBEL4__NVMEM_FWUP_ENABLE == 1) || (STM32CUBEL4__NVMEM_OB_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_OB_ENABLE == 1)
+static void FLASH_ob_get_areas(nvmem_ob_area_t *wrp, nvmem_ob_area_t *pcrop);
+static int FLASH_ob_is_protected(uint32_t address, uint32_t len_bytes);
+#endif /* (STM32CUBEL4__NVMEM_OB_ENABLE == 1) */
+
+ubi_err_t nvmem_erase(uint8_t *addr, size_t size)
+{
+    ubi_err_t ubi_err;
+    int r;
+
+    do
+    {
+        if (!FLASH_is_in_range((uint32_t) addr, size))
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+        if (nvmem_async_is_busy())
+        {
+            ubi_err = UBI_ERR_BUSY;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+        if (FLASH_journal_overlaps((uint32_t) addr, size))
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_OB_ENABLE == 1)
+        if (FLASH_ob_is_protected((uint32_t) addr, size))
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_OB_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_MAP_ENABLE == 1)
+        if (FLASH_map_overlaps((uint32_t) addr, size))
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_MAP_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+        FLASH_cache_flush_range((uint32_t) addr, size, 1);
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+
+        ubi_err = UBI_ERR_INTERNAL;
+
+        r = FLASH_Erase_Size((uint32_t) addr, size);
+        if (r == 0)
+        {
+            ubi_err = UBI_ERR_OK;
+        }
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_update(uint8_t *addr, const uint8_t *buf, size_t size)
+{
+    ubi_err_t ubi_err;
+    int r;
+
+    do
+    {
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+        if (nvmem_async_is_busy())
+        {
+            ubi_err = UBI_ERR_BUSY;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+        if (FLASH_journal_overlaps((uint32_t) addr, size))
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_OB_ENABLE == 1)
+        if (FLASH_ob_is_protected((uint32_t) addr, size))
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_OB_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_MAP_ENABLE == 1)
+        if (FLASH_map_overlaps((uint32_t) addr, size))
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_MAP_ENABLE == 1) */
+
+        ubi_err = UBI_ERR_INTERNAL;
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+        r = FLASH_cache_update((uint32_t) addr, buf, size);
+#else
+        r = FLASH_Update((uint32_t) addr, buf, size);
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+        if (r == 0)
+        {
+            ubi_err = UBI_ERR_OK;
+        }
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_read(const uint8_t *addr, uint8_t *buf, size_t size)
+{
+    ubi_err_t ubi_err;
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+    uint32_t detected_count = _g_nvmem_ecc_detected_count;
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+
+    do
+    {
+#if (STM32CUBEL4__NVMEM_DMA_ENABLE == 1)
+        if (size >= STM32CUBEL4__NVMEM_DMA_READ_THRESHOLD)
+        {
+            ubi_err = FLASH_dma_read(addr, buf, size);
+            if (ubi_err != UBI_ERR_OK)
+            {
+                break;
+            }
+        }
+        else
+#endif /* (STM32CUBEL4__NVMEM_DMA_ENABLE == 1) */
+        {
+            memcpy((void *)buf, (void *)addr, size);
+            ubi_err = UBI_ERR_OK;
+        }
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+        FLASH_cache_read((uint32_t) addr, buf, size);
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+        ubi_err = FLASH_ecc_check(detected_count, (uint32_t) addr, size);
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+    } while (0);
+
+    return ubi_err;
+}
+
+int nvmem_is_erased(const uint8_t *addr, size_t size)
+{
+    uint32_t start = (uint32_t) addr;
+    uint32_t end = start + size;
+    uint32_t aligned_start = ROUND_UP(start, 4);
+    uint32_t aligned_end = ROUND_DOWN(end, 4);
+    uint32_t i;
+
+    /* An empty area stays erased, wherever it is */
+    if (size != 0 && !FLASH_is_in_range(start, size))
+    {
+        return 0;
+    }
+
+    if (aligned_start >= aligned_end)
+    {
+        aligned_start = end;
+        aligned_end = end;
+    }
+
+    for (i = start; i < aligned_start; i++)
+    {
+        if (*(uint8_t *) i != 0xFF)
+        {
+            return 0;
+        }
+    }
+
+    if (FLASH_is_blank(aligned_start, aligned_end - aligned_start) != 0)
+    {
+        return 0;
+    }
+
+    for (i = aligned_end; i < end; i++)
+    {
+        if (*(uint8_t *) i != 0xFF)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+  * @brief  Erase FLASH memory page(s) at address.
+  * @note   The range to erase shall not cross the bank boundary.
+  * @param  In: address     Start address to erase from.
+  * @param  In: len_bytes   Length to be erased.
+  * @retval  0:  Success.
+            -1:  Failure.
+  */
+int FLASH_unlock_erase(uint32_t address, uint32_t len_bytes)
+{
+  int rc = -1;
+  uint32_t PageError = 0;
+  FLASH_EraseInitTypeDef EraseInit;
+
+  /* L4 ROM memory map, with 1 or 2 banks split into NVMEM_PAGE_SIZE pages.
+   * WARN: ABW. If the passed address and size are not page-aligned,
+   * the start of the first page and the end of the last page are erased anyway.
+   * After erase, the flash is left in unlocked state.
+   */
+  EraseInit.TypeErase = FLASH_TYPEERASE_PAGES;
+
+  if (!FLASH_is_in_range(address, len_bytes))
+  {
+#ifndef CODE_UNDER_FIREWALL
+    printf("Error: Cannot erase outside of the FLASH.\n");
+#endif
+    return rc;
+  }
+
+  EraseInit.Banks = FLASH_get_bank(address);
+  if (EraseInit.Banks != FLASH_get_bank(address + len_bytes - 1))
+  {
+#ifndef CODE_UNDER_FIREWALL
+    printf("Error: Cannot erase across FLASH banks.\n");
+#endif
+    return rc;
+  }
+  else
+  {
+    EraseInit.Page = FLASH_get_page(address);
+    EraseInit.NbPages = FLASH_get_page(address + len_bytes - 1) - EraseInit.Page + 1;
+
+    HAL_FLASH_Unlock();
+
+    if (HAL_FLASHEx_Erase(&EraseInit, &PageError) == HAL_OK)
+    {
+      rc = 0;
+    }
+    else
+    {
+#ifndef CODE_UNDER_FIREWALL
+      printf("Error erasing at 0x%08lx\n", (unsigned long) address);
+#endif
+    }
+  }
+  return rc;
+}
+
+/**
+  * @brief  Write to FLASH memory.
+  * @param  In: address     Destination address.
+  * @param  In: pData       Data to be programmed: Must be 8 byte aligned.
+  * @param  In: len_bytes   Number of bytes to be programmed.
+  * @note   Erased (all 0xFF) doublewords are left as they are.
+  * @retval  0: Success.
+            -1: Failure.
+  */
+static int FLASH_write_at(uint32_t address, uint64_t *pData, uint32_t len_bytes)
+{
+  uint32_t i;
+  int ret = -1;
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+  uint32_t src_crc;
+
+  /* Taken before the interrupts are masked: the CRC unit is used until the memory check is done */
+  FLASH_crc_lock();
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+#ifndef CODE_UNDER_FIREWALL
+    /* irq already mask under firewall */
+  __disable_irq();
+#endif
+
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+  /* The CRC of the source is accumulated while the doublewords are programmed */
+  FLASH_crc_hw_reset();
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+
+  for (i = 0; i < len_bytes; i += 8)
+  {
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+    FLASH_crc_hw_feed((uint8_t *) (pData + (i/8)), 8);
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+    if (*(pData + (i/8)) == 0xFFFFFFFFFFFFFFFFULL)
+    {
+      continue;
+    }
+    if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD,
+        address + i,
+        *(pData + (i/8) )) != HAL_OK)
+    {
+      break;
+    }
+  }
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+  /* Memory check: one CRC pass over the FLASH at bus speed */
+  src_crc = FLASH_crc_hw_result();
+  if ((i >= len_bytes) && (FLASH_crc_hw_compute((uint8_t *) address, len_bytes) == src_crc))
+  {
+    ret = 0;
+  }
+  else
+  {
+#ifndef CODE_UNDER_FIREWALL
+    printf("Write failed @0x%08lx\n", (unsigned long) address);
+#endif
+  }
+#else
+  /* Memory check */
+  for (i = 0; i < len_bytes; i += 4)
+  {
+    uint32_t *dst = (uint32_t *)(address + i);
+    uint32_t *src = ((uint32_t *) pData) + (i/4);
+
+    if ( *dst != *src )
+    {
+#ifndef CODE_UNDER_FIREWALL
+      printf("Write failed @0x%08lx, read value=0x%08lx, expected=0x%08lx\n", (unsigned long) dst, (unsigned long) *dst, (unsigned long) *src);
+#endif
+      break;
+    }
+    ret = 0;
+  }
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+#ifndef CODE_UNDER_FIREWALL
+  /* irq should never be enable under firewall */
+  __enable_irq();
+#endif
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+  FLASH_crc_unlock();
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+  return ret;
+}
+
+/**
+  * @brief  Get the bank of a given address.
+  * @note   The banks are physical: with the bank swap, bank 2 is mapped at FLASH_BASE.
+  * @param  In: addr      Address in the FLASH Memory.
+  * @retval Bank identifier.
+  *           FLASH_BANK_1
+  *           FLASH_BANK_2
+  */
+static uint32_t FLASH_get_bank(uint32_t addr)
+{
+  uint32_t upper;
+
+  if (!NVMEM_DUAL_BANK)
+  {
+    return FLASH_BANK_1;
+  }
+
+  upper = (addr >= (FLASH_BASE + NVMEM_BANK_SIZE)) ? 1U : 0U;
+#if defined(SYSCFG_MEMRMP_FB_MODE)
+  if (READ_BIT(SYSCFG->MEMRMP, SYSCFG_MEMRMP_FB_MODE) != 0U)
+  {
+    /* Bank swap */
+    upper ^= 1U;
+  }
+#endif /* defined(SYSCFG_MEMRMP_FB_MODE) */
+
+  return (upper != 0U) ? FLASH_BANK_2 : FLASH_BANK_1;
+}
+
+/**
+  * @brief  Get the page of a given address within its FLASH bank.
+  * @param  In: addr    Address in the FLASH memory.
+  * @retval Page number.
+  */
+static uint32_t FLASH_get_page(uint32_t addr)
+{
+  return ((addr - FLASH_BASE) % NVMEM_BANK_SIZE) / NVMEM_PAGE_SIZE;
+}
+
+/**
+  * @brief  Update a chunk of the FLASH memory.
+  * @note   The FLASH chunk must no cross a FLASH bank boundary.
+  * @note   The source and destination buffers have no specific alignment constraints.
+  * @param  In: dst_addr    Destination address in the FLASH memory.
+  * @param  In: data        Source address.
+  * @param  In: size        Number of bytes to update.
+  * @retval  0:  Success.
+  *        !=0:  Failure.
+  */
+int FLASH_Update(uint32_t dst_addr, const void *data, uint32_t size)
+{
+  int ret = 0;
+  int remaining = size;
+  uint8_t * src_addr = (uint8_t *) data;
+  uint64_t *page_cache = (uint64_t*) malloc(NVMEM_PAGE_SIZE);
+
+  if(page_cache == NULL)
+  {
+    printf("Could not allocate %lu bytes for Flash update.\n", (unsigned long) NVMEM_PAGE_SIZE);
+    return HAL_ERROR;
+  }
+
+  __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+
+  do {
+    uint32_t fl_addr = ROUND_DOWN(dst_addr, NVMEM_PAGE_SIZE);
+    int fl_offset = dst_addr - fl_addr;
+    int len = MIN((int) NVMEM_PAGE_SIZE - fl_offset, remaining);
+    uint32_t dw_offset;
+    uint32_t dw_len;
+
+    /* If the doublewords to update are still erased, they are programmed without erasing the page */
+    dw_offset = ROUND_DOWN(fl_offset, 8);
+    dw_len = ROUND_UP(fl_offset + len, 8) - dw_offset;
+    if (FLASH_is_blank(fl_addr + dw_offset, dw_len) == 0)
+    {
+      memset((uint8_t *)page_cache + dw_offset, 0xFF, dw_len);
+      memcpy((uint8_t *)page_cache + fl_offset, src_addr, len);
+
+      HAL_FLASH_Unlock();
+#if (STM32CUBEL4__NVMEM_RWW_ENABLE == 1)
+      if (FLASH_get_bank(fl_addr) == FLASH_rww_code_bank())
+      {
+        ret = FLASH_ram_erase_program(FLASH_get_bank(fl_addr), FLASH_get_page(fl_addr), 0, fl_addr + dw_offset, page_cache + (dw_offset / 8), dw_len);
+        if ((ret == 0) && (memcmp((void *) (fl_addr + dw_offset), (uint8_t *) page_cache + dw_offset, dw_len) != 0))
+        {
+          ret = -1;
+        }
+      }
+      else
+#endif /* (STM32CUBEL4__NVMEM_RWW_ENABLE == 1) */
+      {
+        ret = FLASH_write_at(fl_addr + dw_offset, page_cache + (dw_offset / 8), dw_len);
+      }
+      if (ret != 0)
+      {
+#ifndef CODE_UNDER_FIREWALL
+        printf("Error writing %lu bytes at 0x%08lx\n", (unsigned long) dw_len, (unsigned long) (fl_addr + dw_offset));
+#endif
+      }
+      else
+      {
+        dst_addr += len;
+        src_addr += len;
+        remaining -= len;
+      }
+      continue;
+    }
+
+    /* Load from the flash into the cache */
+    memcpy(page_cache, (void *) fl_addr, NVMEM_PAGE_SIZE);
+    /* Update the cache from the source */
+    memcpy((uint8_t *)page_cache + fl_offset, src_addr, len);
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+    if (_g_nvmem_journal_meta != 0U)
+    {
+      ret = FLASH_journal_update_page(fl_addr, page_cache);
+      if (ret != 0)
+      {
+#ifndef CODE_UNDER_FIREWALL
+        printf("Error updating %lu bytes at 0x%08lx\n", (unsigned long) NVMEM_PAGE_SIZE, (unsigned long) fl_addr);
+#endif
+      }
+      else
+      {
+        dst_addr += len;
+        src_addr += len;
+        remaining -= len;
+      }
+      continue;
+    }
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) */
+#if (STM32CUBEL4__NVMEM_RWW_ENABLE == 1)
+    if (FLASH_get_bank(fl_addr) == FLASH_rww_code_bank())
+    {
+      /* The page is in the bank the code is fetched from: erase and program it from RAM */
+      HAL_FLASH_Unlock();
+      ret = FLASH_ram_erase_program(FLASH_get_bank(fl_addr), FLASH_get_page(fl_addr), 1, fl_addr, page_cache, NVMEM_PAGE_SIZE);
+      if ((ret != 0) || (memcmp((void *) fl_addr, page_cache, NVMEM_PAGE_SIZE) != 0))
+      {
+#ifndef CODE_UNDER_FIREWALL
+        printf("Error updating %lu bytes at 0x%08lx\n", (unsigned long) NVMEM_PAGE_SIZE, (unsigned long) fl_addr);
+#endif
+        ret = -1;
+      }
+      else
+      {
+        dst_addr += len;
+        src_addr += len;
+        remaining -= len;
+      }
+      continue;
+    }
+#endif /* (STM32CUBEL4__NVMEM_RWW_ENABLE == 1) */
+    /* Erase the page, and write the cache */
+    ret = FLASH_unlock_erase(fl_addr, NVMEM_PAGE_SIZE);
+    if (ret != 0)
+    {
+#ifndef CODE_UNDER_FIREWALL
+      printf("Error erasing at 0x%08lx\n", (unsigned long) fl_addr);
+#endif
+    }
+    else
+    {
+      /* NOTE: we may Consider disabling interrupts if needed during Flash writing */
+      ret = FLASH_write_at(fl_addr, page_cache, NVMEM_PAGE_SIZE);
+
+      if(ret != 0)
+      {
+#ifndef CODE_UNDER_FIREWALL
+        printf("Error writing %lu bytes at 0x%08lx\n", (unsigned long) NVMEM_PAGE_SIZE, (unsigned long) fl_addr);
+#endif
+      }
+      else
+      {
+        dst_addr += len;
+        src_addr += len;
+        remaining -= len;
+      }
+    }
+  } while ((ret == 0) && (remaining > 0));
+  HAL_FLASH_Lock();
+
+  free(page_cache);
+
+  return ret;
+}
+
+/**
+  * @brief  Check if a FLASH area is erased.
+  * @param  In: address     Start address, 4 byte aligned.
+  * @param  In: len_bytes   Length of the area, multiple of 4.
+  * @retval  0: The area is erased.
+  *         -1: The area is not erased.
+  */
+static int FLASH_is_blank(uint32_t address, uint32_t len_bytes)
+{
+  const uint32_t *word = (const uint32_t *) address;
+  uint32_t words = len_bytes / 4U;
+  uint32_t i;
+
+  /* Unrolled by 8 words, with a single test per 32 bytes */
+  for (i = 0; i + 8U <= words; i += 8U)
+  {
+    if ((word[i] & word[i + 1U] & word[i + 2U] & word[i + 3U] &
+         word[i + 4U] & word[i + 5U] & word[i + 6U] & word[i + 7U]) != 0xFFFFFFFFU)
+    {
+      return -1;
+    }
+  }
+  for (; i < words; i++)
+  {
+    if (word[i] != 0xFFFFFFFFU)
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+  * @brief  Check that an area is inside the FLASH memory.
+  * @param  In: address     Start address.
+  * @param  In: len_bytes   Length of the area.
+  * @retval  1: The area is not empty and inside the FLASH.
+  *          0: Otherwise.
+  */
+static int FLASH_is_in_range(uint32_t address, uint32_t len_bytes)
+{
+  /* The start address is checked first, so that the remaining length does not wrap */
+  return (address >= FLASH_BASE) && (address < (FLASH_BASE + FLASH_SIZE)) && (len_bytes != 0U)
+         && (len_bytes <= (FLASH_BASE + FLASH_SIZE - address));
+}
+
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+
+/**
+  * @brief  Take the lock of the CRC unit (not in interrupt context or before the kernel runs).
+  */
+static void FLASH_crc_lock(void)
+{
+  mutex_pt lock;
+  int r;
+  (void) r;
+
+  if (!_bsp_kernel_active || bsp_isintr())
+  {
+    return;
+  }
+
+  if (_g_nvmem_crc_lock == NULL)
+  {
+    r = mutex_create(&lock);
+    assert(r == 0);
+
+    ubik_entercrit();
+    if (_g_nvmem_crc_lock == NULL)
+    {
+      _g_nvmem_crc_lock = lock;
+      lock = NULL;
+    }
+    ubik_exitcrit();
+
+    if (lock != NULL)
+    {
+      mutex_delete(&lock);
+    }
+  }
+
+  mutex_lock(_g_nvmem_crc_lock);
+}
+
+static void FLASH_crc_unlock(void)
+{
+  if (!_bsp_kernel_active || bsp_isintr() || _g_nvmem_crc_lock == NULL)
+  {
+    return;
+  }
+
+  mutex_unlock(_g_nvmem_crc_lock);
+}
+
+/**
+  * @brief  Reset the CRC unit for a CRC-32 (IEEE 802.3) computation.
+  * @note   The CRC unit is configured for reflected input and output, so that the 32-bit writes
+  *         of little-endian data give the same result as the byte-wise software algorithm.
+  */
+static void FLASH_crc_hw_reset(void)
+{
+  __HAL_RCC_CRC_CLK_ENABLE();
+
+  CRC->INIT = 0xFFFFFFFFU;
+  CRC->POL = 0x04C11DB7U;
+  CRC->CR = CRC_CR_REV_IN | CRC_CR_REV_OUT | CRC_CR_RESET;
+}
+
+/**
+  * @brief  Feed the CRC unit.
+  * @param  In: data        Data, 4 byte aligned.
+  * @param  In: len_bytes   Length of the data.
+  */
+static void FLASH_crc_hw_feed(const uint8_t *data, uint32_t len_bytes)
+{
+  const uint32_t *word = (const uint32_t *) data;
+  uint32_t words = len_bytes / 4U;
+  uint32_t i;
+
+  /* Unrolled, so that the loop runs at the FLASH read speed */
+  for (i = 0; i + 4U <= words; i += 4U)
+  {
+    CRC->DR = word[i];
+    CRC->DR = word[i + 1U];
+    CRC->DR = word[i + 2U];
+    CRC->DR = word[i + 3U];
+  }
+  for (; i < words; i++)
+  {
+    CRC->DR = word[i];
+  }
+  for (i = words * 4U; i < len_bytes; i++)
+  {
+    *(__IO uint8_t *) &CRC->DR = data[i];
+  }
+}
+
+static uint32_t FLASH_crc_hw_result(void)
+{
+  return ~(CRC->DR);
+}
+
+/**
+  * @brief  Compute the CRC-32 of a buffer with the CRC unit. Called with the CRC unit locked.
+  * @param  In: data        Buffer, 4 byte aligned.
+  * @param  In: len_bytes   Length of the buffer.
+  * @retval CRC.
+  */
+static uint32_t FLASH_crc_hw_compute(const uint8_t *data, uint32_t len_bytes)
+{
+  FLASH_crc_hw_reset();
+  FLASH_crc_hw_feed(data, len_bytes);
+  return FLASH_crc_hw_result();
+}
+
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) || (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+
+/**
+  * @brief  Compute the CRC-32 (IEEE 802.3) of a buffer.
+  * @param  In: data        Buffer (4 byte aligned if the CRC unit is used).
+  * @param  In: len_bytes   Length of the buffer.
+  * @retval CRC.
+  */
+static uint32_t FLASH_crc32(const uint8_t *data, uint32_t len_bytes)
+{
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+  uint32_t crc;
+
+  FLASH_crc_lock();
+  crc = FLASH_crc_hw_compute(data, len_bytes);
+  FLASH_crc_unlock();
+
+  return crc;
+#else
+  static const uint32_t nibble_table[16] =
+  {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  uint32_t crc = 0xFFFFFFFFU;
+  uint32_t i;
+
+  for (i = 0; i < len_bytes; i++)
+  {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ nibble_table[crc & 0x0FU];
+    crc = (crc >> 4) ^ nibble_table[crc & 0x0FU];
+  }
+  return ~crc;
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+}
+
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) || (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+
+static volatile uint32_t _g_nvmem_ecc_corrected_count = 0;
+static volatile uint32_t _g_nvmem_ecc_last_addr = 0;
+static volatile uint8_t _g_nvmem_ecc_last_type = NVMEM_ECC_NONE;
+
+/**
+  * @brief  Get the address of the last ECC error from the ECCR register.
+  * @retval Address in the FLASH memory.
+  */
+static uint32_t FLASH_ecc_addr(uint32_t eccr)
+{
+  uint32_t offset = eccr & FLASH_ECCR_ADDR_ECC;
+#if defined(FLASH_ECCR_BK_ECC)
+  uint32_t bank = ((eccr & FLASH_ECCR_BK_ECC) == 0U) ? FLASH_BANK_1 : FLASH_BANK_2;
+
+  /* BK_ECC is the physical bank, which is mapped at the second half unless it is the one at FLASH_BASE */
+  if (NVMEM_DUAL_BANK && (bank != FLASH_get_bank(FLASH_BASE)))
+  {
+    offset += NVMEM_BANK_SIZE;
+  }
+#endif /* defined(FLASH_ECCR_BK_ECC) */
+  return FLASH_BASE + offset;
+}
+
+/**
+  * @brief  Record and clear the pending ECC error flags.
+  */
+static void FLASH_ecc_poll(void)
+{
+  uint32_t eccr = FLASH->ECCR;
+
+  if ((eccr & FLASH_ECCR_ECCD) != 0U)
+  {
+    _g_nvmem_ecc_detected_count++;
+    _g_nvmem_ecc_last_addr = FLASH_ecc_addr(eccr);
+    _g_nvmem_ecc_last_type = NVMEM_ECC_DETECTED;
+  }
+  else if ((eccr & FLASH_ECCR_ECCC) != 0U)
+  {
+    _g_nvmem_ecc_corrected_count++;
+    _g_nvmem_ecc_last_addr = FLASH_ecc_addr(eccr);
+    _g_nvmem_ecc_last_type = NVMEM_ECC_CORRECTED;
+  }
+  else
+  {
+    return;
+  }
+
+  /* The flags are cleared by writing 1, ECCIE is kept */
+  FLASH->ECCR = (eccr & (FLASH_ECCR_ECCIE | FLASH_ECCR_ECCC | FLASH_ECCR_ECCD));
+}
+
+/**
+  * @brief  Check the ECC errors raised while the area was read.
+  * @retval UBI_ERR_OK, or UBI_ERR_INVALID_DATA if an uncorrectable error was detected in the area.
+  */
+static ubi_err_t FLASH_ecc_check(uint32_t detected_count, uint32_t address, uint32_t len_bytes)
+{
+  FLASH_ecc_poll();
+
+  if (_g_nvmem_ecc_detected_count != detected_count &&
+      _g_nvmem_ecc_last_addr >= ROUND_DOWN(address, 8) && _g_nvmem_ecc_last_addr < address + len_bytes)
+  {
+    return UBI_ERR_INVALID_DATA;
+  }
+  return UBI_ERR_OK;
+}
+
+int nvmem_stm32_flash_nmi_handler(void)
+{
+    if ((FLASH->ECCR & FLASH_ECCR_ECCD) == 0U)
+    {
+        return 0;
+    }
+
+    FLASH_ecc_poll();
+
+    return 1;
+}
+
+ubi_err_t nvmem_crc32(const uint8_t *addr, size_t size, uint32_t *crc_p)
+{
+    ubi_err_t ubi_err;
+    uint32_t detected_count = _g_nvmem_ecc_detected_count;
+
+    do
+    {
+        if (crc_p == NULL || ((uint32_t) addr % 4) != 0)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        *crc_p = FLASH_crc32(addr, size);
+        ubi_err = FLASH_ecc_check(detected_count, (uint32_t) addr, size);
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_check(const uint8_t *addr, size_t size, uint32_t expected_crc)
+{
+    ubi_err_t ubi_err;
+    uint32_t crc;
+
+    ubi_err = nvmem_crc32(addr, size, &crc);
+    if (ubi_err == UBI_ERR_OK && crc != expected_crc)
+    {
+        ubi_err = UBI_ERR_INVALID_DATA;
+    }
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_get_error(nvmem_error_t *error_p)
+{
+    if (error_p == NULL)
+    {
+        return UBI_ERR_INVALID_PARAM;
+    }
+
+    FLASH_ecc_poll();
+
+    error_p->ecc_corrected_count = _g_nvmem_ecc_corrected_count;
+    error_p->ecc_detected_count = _g_nvmem_ecc_detected_count;
+    error_p->last_addr = (uint8_t *) _g_nvmem_ecc_last_addr;
+    error_p->last_type = _g_nvmem_ecc_last_type;
+
+    return UBI_ERR_OK;
+}
+
+void nvmem_clear_error(void)
+{
+    FLASH_ecc_poll();
+
+    _g_nvmem_ecc_corrected_count = 0;
+    _g_nvmem_ecc_detected_count = 0;
+    _g_nvmem_ecc_last_addr = 0;
+    _g_nvmem_ecc_last_type = NVMEM_ECC_NONE;
+}
+
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) || (STM32CUBEL4__NVMEM_STREAM_ENABLE == 1)
+/**
+  * @brief  Erase a page, from RAM if it is in the bank the code is fetched from.
+  * @note   After erase, the flash is left in unlocked state.
+  * @param  In: page_addr   Address of the page.
+  * @retval  0: Success.
+  *         -1: Failure.
+  */
+static int FLASH_page_erase(uint32_t page_addr)
+{
+#if (STM32CUBEL4__NVMEM_RWW_ENABLE == 1)
+  if (FLASH_get_bank(page_addr) == FLASH_rww_code_bank())
+  {
+    HAL_FLASH_Unlock();
+    return FLASH_ram_erase_program(FLASH_get_bank(page_addr), FLASH_get_page(page_addr), 1, 0U, NULL, 0U);
+  }
+#endif /* (STM32CUBEL4__NVMEM_RWW_ENABLE == 1) */
+  return FLASH_unlock_erase(page_addr, NVMEM_PAGE_SIZE);
+}
+
+/**
+  * @brief  Program erased FLASH memory, from RAM if it is in the bank the code is fetched from.
+  * @note   After programming, the flash is left in unlocked state.
+  * @param  In: address     Destination address.
+  * @param  In: pData       Data to be programmed: Must be 8 byte aligned.
+  * @param  In: len_bytes   Number of bytes to be programmed.
+  * @retval  0: Success.
+  *         -1: Failure.
+  */
+static int FLASH_page_program(uint32_t address, uint64_t *pData, uint32_t len_bytes)
+{
+  HAL_FLASH_Unlock();
+#if (STM32CUBEL4__NVMEM_RWW_ENABLE == 1)
+  if (FLASH_get_bank(address) == FLASH_rww_code_bank())
+  {
+    if (FLASH_ram_erase_program(FLASH_get_bank(address), FLASH_get_page(address), 0, address, pData, len_bytes) != 0)
+    {
+      return -1;
+    }
+    return (memcmp((void *) address, pData, len_bytes) == 0) ? 0 : -1;
+  }
+#endif /* (STM32CUBEL4__NVMEM_RWW_ENABLE == 1) */
+  return FLASH_write_at(address, pData, len_bytes);
+}
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) || (STM32CUBEL4__NVMEM_STREAM_ENABLE == 1) */
+
+/* Public functions ---------------------------------------------------------*/
+/**
+  * @brief  Unlocks Flash for write access
+  * @param  None
+  * @retval HAL Status.
+  */
+uint32_t FLASH_Init(void)
+{
+  uint32_t ret = HAL_ERROR;
+
+  /* Unlock the Program memory */
+  if (HAL_FLASH_Unlock() == HAL_OK)
+  {
+
+    /* Clear all FLASH flags */
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_PGSERR | FLASH_FLAG_WRPERR | FLASH_FLAG_OPTVERR);
+
+    /* Unlock the Program memory */
+    if (HAL_FLASH_Lock() == HAL_OK)
+    {
+      ret = HAL_OK;
+    }
+    else
+    {
+         printf("FLASH_If_Init : failed to lock\n");
+    }
+  }
+  else
+  {
+    printf("FLASH_If_Init : failed to unlock\n");
+  }
+  return ret;
+}
+
+/**
+  * @brief  Erase the pages of an area within a FLASH bank. The FLASH shall be unlocked.
+  * @note   The pages that are already erased are skipped.
+  * @param  In: uStart      Start address.
+  * @param  In: uLength     Number of bytes (the area shall not cross the bank boundary).
+  * @retval HAL status.
+  */
+static uint32_t FLASH_Erase_Bank_Pages(uint32_t uStart, uint32_t uLength)
+{
+  uint32_t page_error = 0U;
+  FLASH_EraseInitTypeDef x_erase_init;
+  uint32_t e_ret_status = HAL_OK;
+  uint32_t first_page = 0U, nb_of_pages = 0U, bank_number = 0U;
+  uint32_t page = 0U, page_addr = 0U;
+
+  /* Get the 1st page to erase */
+  first_page = FLASH_get_page(uStart);
+  /* Get the number of pages to erase from 1st page */
+  nb_of_pages = FLASH_get_page(uStart + uLength - 1U) - first_page + 1U;
+  /* Get the bank */
+  bank_number = FLASH_get_bank(uStart);
+
+  /* Pages that are already erased are skipped, the others are erased by runs of consecutive pages */
+  page = first_page;
+  page_addr = ROUND_DOWN(uStart, NVMEM_PAGE_SIZE);
+  while ((e_ret_status == HAL_OK) && (page < first_page + nb_of_pages))
+  {
+    if (FLASH_is_blank(page_addr, NVMEM_PAGE_SIZE) == 0)
+    {
+      page++;
+      page_addr += NVMEM_PAGE_SIZE;
+      continue;
+    }
+
+    /* Fill EraseInit structure*/
+    x_erase_init.TypeErase   = FLASH_TYPEERASE_PAGES;
+    x_erase_init.Banks       = bank_number;
+    x_erase_init.Page        = page;
+    x_erase_init.NbPages     = 0U;
+    while ((page < first_page + nb_of_pages) && (FLASH_is_blank(page_addr, NVMEM_PAGE_SIZE) != 0))
+    {
+      x_erase_init.NbPages++;
+      page++;
+      page_addr += NVMEM_PAGE_SIZE;
+    }
+
+#if (STM32CUBEL4__NVMEM_RWW_ENABLE == 1)
+    if (bank_number == FLASH_rww_code_bank())
+    {
+      /* The pages are in the bank the code is fetched from: erase them from RAM, one page per call
+      to bound the time interrupts are masked */
+      for (page_error = x_erase_init.Page; page_error < x_erase_init.Page + x_erase_init.NbPages; page_error++)
+      {
+        if (FLASH_ram_erase_program(bank_number, page_error, 1, 0U, NULL, 0U) != 0)
+        {
+#ifndef CODE_UNDER_FIREWALL
+          printf("ERROR flash erase\n");
+#endif
+          e_ret_status = HAL_ERROR;
+          break;
+        }
+      }
+    }
+    else
+#endif /* (STM32CUBEL4__NVMEM_RWW_ENABLE == 1) */
+    if (HAL_FLASHEx_Erase(&x_erase_init, &page_error) != HAL_OK)
+    {
+      /* Error occurred while page erase */
+      HAL_FLASH_GetError();
+#ifndef CODE_UNDER_FIREWALL
+      printf("ERROR flash erase\n");
+#endif
+      e_ret_status = HAL_ERROR;
+    }
+  }
+
+  return e_ret_status;
+}
+
+/**
+  * @brief  This function erases bytes in user flash area
+  * @note   The pages are numbered per bank, so an area crossing the bank boundary is erased bank by bank.
+  * @param  Start: Start of user flash area
+  * @param  uLength: number of bytes.
+  * @retval HAL status.
+  */
+int FLASH_Erase_Size(uint32_t uStart, uint32_t uLength)
+{
+  uint32_t e_ret_status = HAL_ERROR;
+  uint32_t bank_end = 0U, chunk = 0U;
+
+  if (!FLASH_is_in_range(uStart, uLength))
+  {
+#ifndef CODE_UNDER_FIREWALL
+    printf("Error: Cannot erase outside of the FLASH.\n");
+#endif
+    return e_ret_status;
+  }
+
+  /* Initialize Flash */
+  e_ret_status = FLASH_Init();
+
+  if (e_ret_status == HAL_OK)
+  {
+    /* Unlock the Flash to enable the flash control register access *************/
+    if (HAL_FLASH_Unlock() == HAL_OK)
+    {
+      while ((e_ret_status == HAL_OK) && (uLength > 0U))
+      {
+        bank_end = FLASH_BASE + ROUND_DOWN(uStart - FLASH_BASE, NVMEM_BANK_SIZE) + NVMEM_BANK_SIZE;
+        chunk = (uLength > (bank_end - uStart)) ? (bank_end - uStart) : uLength;
+
+        e_ret_status = FLASH_Erase_Bank_Pages(uStart, chunk);
+
+        uStart += chunk;
+        uLength -= chunk;
+      }
+
+      /* Lock the Flash to disable the flash control register access (recommended
+      to protect the FLASH memory against possible unwanted operation) *********/
+      HAL_FLASH_Lock();
+    }
+    else
+    {
+      printf("ERROR cannot unlock\n");
+    }
+  }
+  else
+  {
+    printf("cannot init\n");
+  }
+  return e_ret_status;
+}
+
+#if (STM32CUBEL4__NVMEM_RWW_ENABLE == 1)
+
+/**
+  * @brief  Get the bank the code of this driver is fetched from.
+  * @retval Bank identifier.
+  */
+static uint32_t FLASH_rww_code_bank(void)
+{
+  return FLASH_get_bank((uint32_t) &FLASH_rww_code_bank);
+}
+
+/**
+  * @brief  Wait for the end of the ongoing FLASH operation, without fetching code from FLASH.
+  * @retval  0: Success.
+  *         -1: Failure.
+  */
+static inline __attribute__((always_inline)) int FLASH_ram_wait(void)
+{
+  uint32_t error;
+
+  while ((FLASH->SR & FLASH_SR_BSY) != 0U)
+  {
+  }
+
+  error = FLASH->SR & FLASH_FLAG_SR_ERRORS;
+  FLASH->SR = error | FLASH_SR_EOP;
+
+  return (error == 0U) ? 0 : -1;
+}
+
+/**
+  * @brief  Erase a page and/or program it, running from RAM with interrupts masked.
+  * @note   The FLASH shall be unlocked. Erased (all 0xFF) doublewords are not programmed.
+  * @param  In: bank        Bank of the page.
+  * @param  In: page        Page number in the bank.
+  * @param  In: erase       Erase the page before programming it.
+  * @param  In: address     Address of the page (ignored if pData is NULL).
+  * @param  In: pData       Data to be programmed, or NULL to erase only.
+  * @param  In: len_bytes   Number of bytes to be programmed.
+  * @retval  0: Success.
+  *         -1: Failure.
+  */
+static FLASH_RAMFUNC int FLASH_ram_erase_program(uint32_t bank, uint32_t page, int erase, uint32_t address, const uint64_t *pData, uint32_t len_bytes)
+{
+  int ret = 0;
+  uint32_t i;
+  uint32_t caches;
+  uint32_t primask;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+
+  /* The caches shall not be used while the FLASH is erased */
+  caches = FLASH->ACR & (FLASH_ACR_ICEN | FLASH_ACR_DCEN);
+  CLEAR_BIT(FLASH->ACR, FLASH_ACR_ICEN | FLASH_ACR_DCEN);
+
+  if (erase)
+  {
+    if (bank == FLASH_BANK_1)
+    {
+      CLEAR_BIT(FLASH->CR, FLASH_CR_BKER);
+    }
+    else
+    {
+      SET_BIT(FLASH->CR, FLASH_CR_BKER);
+    }
+    MODIFY_REG(FLASH->CR, FLASH_CR_PNB, (page << FLASH_CR_PNB_Pos));
+    SET_BIT(FLASH->CR, FLASH_CR_PER);
+    SET_BIT(FLASH->CR, FLASH_CR_STRT);
+    ret = FLASH_ram_wait();
+    CLEAR_BIT(FLASH->CR, (FLASH_CR_PER | FLASH_CR_PNB));
+  }
+
+  if (pData != NULL)
+  {
+    for (i = 0U; (ret == 0) && (i < len_bytes); i += 8U)
+    {
+      if (pData[i / 8U] == 0xFFFFFFFFFFFFFFFFULL)
+      {
+        continue;
+      }
+
+      SET_BIT(FLASH->CR, FLASH_CR_PG);
+      *(__IO uint32_t *)(address + i) = (uint32_t) pData[i / 8U];
+      __ISB();
+      *(__IO uint32_t *)(address + i + 4U) = (uint32_t) (pData[i / 8U] >> 32);
+      ret = FLASH_ram_wait();
+      CLEAR_BIT(FLASH->CR, FLASH_CR_PG);
+    }
+  }
+
+  /* Reset the caches, then restore them */
+  SET_BIT(FLASH->ACR, FLASH_ACR_ICRST | FLASH_ACR_DCRST);
+  CLEAR_BIT(FLASH->ACR, FLASH_ACR_ICRST | FLASH_ACR_DCRST);
+  SET_BIT(FLASH->ACR, caches);
+
+  __set_PRIMASK(primask);
+
+  return ret;
+}
+
+int nvmem_rww_is_concurrent(const uint8_t *addr, size_t size)
+{
+    uint32_t code_bank = FLASH_rww_code_bank();
+
+    if (size == 0 || !NVMEM_DUAL_BANK)
+    {
+        return 0;
+    }
+
+    if (FLASH_get_bank((uint32_t) addr) == code_bank || FLASH_get_bank((uint32_t) addr + size - 1) == code_bank)
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+ubi_err_t nvmem_rww_benchmark(uint8_t *code_bank_page, uint8_t *other_bank_page, nvmem_rww_benchmark_t *result)
+{
+    ubi_err_t ubi_err;
+    uint32_t start;
+    uint8_t data[16];
+    uint32_t i;
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+    nvmem_async_t req;
+    volatile uint32_t work;
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+    do
+    {
+        if (result == NULL || nvmem_rww_is_concurrent(code_bank_page, NVMEM_PAGE_SIZE) ||
+                !nvmem_rww_is_concurrent(other_bank_page, NVMEM_PAGE_SIZE))
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        memset(result, 0, sizeof(nvmem_rww_benchmark_t));
+
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+        for (i = 0; i < sizeof(data); i++)
+        {
+            data[i] = (uint8_t) (code_bank_page[i] + 1);
+        }
+
+        /* Update of a page in the code bank: the caller is blocked until it is over */
+        start = DWT->CYCCNT;
+        ubi_err = nvmem_update(code_bank_page, data, sizeof(data));
+        result->sync_cycles = DWT->CYCCNT - start;
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+        /* Update of a page in the other bank: the caller keeps running while it is in progress */
+        memset(&req, 0, sizeof(nvmem_async_t));
+        work = 0;
+
+        start = DWT->CYCCNT;
+        ubi_err = nvmem_update_async(&req, other_bank_page, data, sizeof(data));
+        result->async_blocked_cycles = DWT->CYCCNT - start;
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+        while (!req.done)
+        {
+            work++;
+        }
+        result->async_cycles = DWT->CYCCNT - start;
+        result->async_work_count = work;
+
+        ubi_err = req.result;
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+    } while (0);
+
+    return ubi_err;
+}
+
+#endif /* (STM32CUBEL4__NVMEM_RWW_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+
+#define NVMEM_JOURNAL_REC_MAGIC     0x524A564EUL /* "NVJR" */
+#define NVMEM_JOURNAL_REC_SIZE      32
+#define NVMEM_JOURNAL_REC_DATA_SIZE 24
+
+/* Journal record. The commit doubleword is programmed to 0 once the target page is written. */
+typedef struct _nvmem_journal_rec_t
+{
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t target;
+  uint32_t scratch;
+  uint32_t image_crc;
+  uint32_t rec_crc;
+  uint64_t commit;
+} nvmem_journal_rec_t;
+
+static uint32_t _g_nvmem_journal_scratch_count = 0;
+static uint32_t _g_nvmem_journal_offset = 0;
+static uint32_t _g_nvmem_journal_seq = 0;
+static uint32_t _g_nvmem_journal_next_scratch = 0;
+static uint8_t _g_nvmem_journal_scratch_erased[NVMEM_JOURNAL_SCRATCH_MAX];
+
+static uint32_t FLASH_journal_scratch_addr(uint32_t index)
+{
+  return _g_nvmem_journal_meta + ((index + 1U) * NVMEM_PAGE_SIZE);
+}
+
+/**
+  * @brief  Get an erased scratch page, erasing one if none is left.
+  * @retval Index of the scratch page, or -1 on failure.
+  */
+static int FLASH_journal_get_scratch(void)
+{
+  uint32_t i;
+  uint32_t index;
+
+  for (i = 0; i < _g_nvmem_journal_scratch_count; i++)
+  {
+    index = (_g_nvmem_journal_next_scratch + i) % _g_nvmem_journal_scratch_count;
+    if (_g_nvmem_journal_scratch_erased[index])
+    {
+      return (int) index;
+    }
+  }
+
+  /* Slow path: nvmem_journal_maintain has not been called since the last updates */
+  index = _g_nvmem_journal_next_scratch;
+  if (FLASH_page_erase(FLASH_journal_scratch_addr(index)) != 0)
+  {
+    return -1;
+  }
+  _g_nvmem_journal_scratch_erased[index] = 1;
+
+  return (int) index;
+}
+
+/**
+  * @brief  Write a page image to its target page and mark its journal record committed.
+  * @param  In: rec_addr    Address of the journal record.
+  * @param  In: target      Target page address.
+  * @param  In: image       Page image.
+  * @retval  0: Success.
+  *         -1: Failure.
+  */
+static int FLASH_journal_apply(uint32_t rec_addr, uint32_t target, uint64_t *image)
+{
+  uint64_t committed = 0;
+
+  if (FLASH_page_erase(target) != 0)
+  {
+    return -1;
+  }
+  if (FLASH_page_program(target, image, NVMEM_PAGE_SIZE) != 0)
+  {
+    return -1;
+  }
+  return FLASH_page_program(rec_addr + NVMEM_JOURNAL_REC_DATA_SIZE, &committed, sizeof(uint64_t));
+}
+
+/**
+  * @brief  Update a page through the journal.
+  * @note   The new image is written to a scratch page and recorded in the journal before the
+  *         target page is erased, so an interrupted update is completed by nvmem_journal_init.
+  * @param  In: fl_addr     Target page address.
+  * @param  In: page_cache  New page image.
+  * @retval  0: Success.
+  *         -1: Failure.
+  */
+static int FLASH_journal_update_page(uint32_t fl_addr, uint64_t *page_cache)
+{
+  nvmem_journal_rec_t rec;
+  uint32_t rec_addr;
+  int scratch;
+
+  scratch = FLASH_journal_get_scratch();
+  if (scratch < 0)
+  {
+    return -1;
+  }
+
+  /* New image to the scratch page */
+  if (FLASH_page_program(FLASH_journal_scratch_addr(scratch), page_cache, NVMEM_PAGE_SIZE) != 0)
+  {
+    return -1;
+  }
+  _g_nvmem_journal_scratch_erased[scratch] = 0;
+  _g_nvmem_journal_next_scratch = (scratch + 1) % _g_nvmem_journal_scratch_count;
+
+  /* Slow path: every record of a full journal page is committed, so it can be erased */
+  if (_g_nvmem_journal_offset + NVMEM_JOURNAL_REC_SIZE > NVMEM_PAGE_SIZE)
+  {
+    if (FLASH_page_erase(_g_nvmem_journal_meta) != 0)
+    {
+      return -1;
+    }
+    _g_nvmem_journal_offset = 0;
+  }
+
+  /* Journal record: from now on, the update is completed on boot if it is interrupted */
+  memset(&rec, 0xFF, sizeof(nvmem_journal_rec_t));
+  rec.magic = NVMEM_JOURNAL_REC_MAGIC;
+  rec.seq = ++_g_nvmem_journal_seq;
+  rec.target = fl_addr;
+  rec.scratch = FLASH_journal_scratch_addr(scratch);
+  rec.image_crc = FLASH_crc32((uint8_t *) page_cache, NVMEM_PAGE_SIZE);
+  rec.rec_crc = FLASH_crc32((uint8_t *) &rec, offsetof(nvmem_journal_rec_t, rec_crc));
+
+  rec_addr = _g_nvmem_journal_meta + _g_nvmem_journal_offset;
+  _g_nvmem_journal_offset += NVMEM_JOURNAL_REC_SIZE;
+  if (FLASH_page_program(rec_addr, (uint64_t *) &rec, NVMEM_JOURNAL_REC_DATA_SIZE) != 0)
+  {
+    return -1;
+  }
+
+  return FLASH_journal_apply(rec_addr, fl_addr, page_cache);
+}
+
+/**
+  * @brief  Check if an area overlaps the journal.
+  * @retval 1: It overlaps. 0: It does not.
+  */
+static int FLASH_journal_overlaps(uint32_t address, uint32_t len_bytes)
+{
+  uint32_t journal_end = _g_nvmem_journal_meta + ((_g_nvmem_journal_scratch_count + 1U) * NVMEM_PAGE_SIZE);
+
+  if (_g_nvmem_journal_meta == 0U)
+  {
+    return 0;
+  }
+  return ((address < journal_end) && (address + len_bytes > _g_nvmem_journal_meta)) ? 1 : 0;
+}
+
+ubi_err_t nvmem_journal_init(uint8_t *addr, uint32_t scratch_page_count)
+{
+    ubi_err_t ubi_err;
+    nvmem_journal_rec_t rec;
+    uint64_t *image = NULL;
+    uint32_t meta = (uint32_t) addr;
+    uint32_t offset;
+    uint32_t i;
+
+    do
+    {
+        if ((meta % NVMEM_PAGE_SIZE) != 0 || scratch_page_count == 0 || scratch_page_count > NVMEM_JOURNAL_SCRATCH_MAX)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        image = (uint64_t *) malloc(NVMEM_PAGE_SIZE);
+        if (image == NULL)
+        {
+            ubi_err = UBI_ERR_NO_MEM;
+            break;
+        }
+
+        _g_nvmem_journal_meta = meta;
+        _g_nvmem_journal_scratch_count = scratch_page_count;
+        _g_nvmem_journal_offset = NVMEM_PAGE_SIZE;
+        _g_nvmem_journal_seq = 0;
+        _g_nvmem_journal_next_scratch = 0;
+
+        ubi_err = UBI_ERR_OK;
+        __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+
+        /* Single scan of the journal page: interrupted updates are completed */
+        for (offset = 0; offset + NVMEM_JOURNAL_REC_SIZE <= NVMEM_PAGE_SIZE; offset += NVMEM_JOURNAL_REC_SIZE)
+        {
+            memcpy(&rec, (void *) (meta + offset), sizeof(nvmem_journal_rec_t));
+            if (FLASH_is_blank(meta + offset, NVMEM_JOURNAL_REC_SIZE) == 0)
+            {
+                _g_nvmem_journal_offset = offset;
+                break;
+            }
+            if (rec.magic != NVMEM_JOURNAL_REC_MAGIC ||
+                rec.rec_crc != FLASH_crc32((uint8_t *) &rec, offsetof(nvmem_journal_rec_t, rec_crc)))
+            {
+                /* Interrupted record write: its target page was not touched */
+                continue;
+            }
+            if ((int32_t) (rec.seq - _g_nvmem_journal_seq) > 0)
+            {
+                _g_nvmem_journal_seq = rec.seq;
+            }
+            if (rec.commit != 0xFFFFFFFFFFFFFFFFULL)
+            {
+                continue;
+            }
+
+            memcpy(image, (void *) rec.scratch, NVMEM_PAGE_SIZE);
+            if (FLASH_crc32((uint8_t *) image, NVMEM_PAGE_SIZE) != rec.image_crc)
+            {
+#ifndef CODE_UNDER_FIREWALL
+                printf("nvmem journal: corrupted image for 0x%08lx\n", (unsigned long) rec.target);
+#endif
+                ubi_err = UBI_ERR_INVALID_DATA;
+                continue;
+            }
+#ifndef CODE_UNDER_FIREWALL
+            printf("nvmem journal: completing update of 0x%08lx\n", (unsigned long) rec.target);
+#endif
+            if (FLASH_journal_apply(meta + offset, rec.target, image) != 0)
+            {
+                ubi_err = UBI_ERR_ERROR;
+                break;
+            }
+        }
+
+        for (i = 0; i < scratch_page_count; i++)
+        {
+            _g_nvmem_journal_scratch_erased[i] = (FLASH_is_blank(FLASH_journal_scratch_addr(i), NVMEM_PAGE_SIZE) == 0) ? 1 : 0;
+        }
+
+        HAL_FLASH_Lock();
+    } while (0);
+
+    free(image);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_journal_maintain(void)
+{
+    ubi_err_t ubi_err = UBI_ERR_OK;
+    uint32_t i;
+
+    if (_g_nvmem_journal_meta == 0U)
+    {
+        return UBI_ERR_INVALID_STATE;
+    }
+
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+    if (nvmem_async_is_busy())
+    {
+        return UBI_ERR_BUSY;
+    }
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+    for (i = 0; i < _g_nvmem_journal_scratch_count; i++)
+    {
+        if (_g_nvmem_journal_scratch_erased[i])
+        {
+            continue;
+        }
+        if (FLASH_page_erase(FLASH_journal_scratch_addr(i)) != 0)
+        {
+            ubi_err = UBI_ERR_ERROR;
+            break;
+        }
+        _g_nvmem_journal_scratch_erased[i] = 1;
+    }
+
+    /* A full journal page holds only committed records: it is erased ahead of the next update */
+    if (ubi_err == UBI_ERR_OK && _g_nvmem_journal_offset + NVMEM_JOURNAL_REC_SIZE > NVMEM_PAGE_SIZE)
+    {
+        if (FLASH_page_erase(_g_nvmem_journal_meta) != 0)
+        {
+            ubi_err = UBI_ERR_ERROR;
+        }
+        else
+        {
+            _g_nvmem_journal_offset = 0;
+        }
+    }
+
+    HAL_FLASH_Lock();
+
+    return ubi_err;
+}
+
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+
+#define NVMEM_ASYNC_OP_ERASE        0
+#define NVMEM_ASYNC_OP_UPDATE       1
+
+#define NVMEM_ASYNC_STATE_IDLE      0
+#define NVMEM_ASYNC_STATE_ERASE     1
+#define NVMEM_ASYNC_STATE_PROGRAM   2
+
+static nvmem_async_pt _g_nvmem_async_head = NULL;
+static nvmem_async_pt _g_nvmem_async_tail = NULL;
+
+static volatile uint8_t _g_nvmem_async_state = NVMEM_ASYNC_STATE_IDLE;
+static uint8_t _g_nvmem_async_irq_init = 0;
+
+static uint32_t _g_nvmem_async_page_addr;
+static uint32_t _g_nvmem_async_page_offset;
+static uint32_t _g_nvmem_async_done_len;
+static uint32_t _g_nvmem_async_chunk_len;
+static uint64_t _g_nvmem_async_page_cache[NVMEM_PAGE_SIZE_MAX / sizeof(uint64_t)];
+
+static ubi_err_t _nvmem_async_submit(nvmem_async_pt req);
+static void _nvmem_async_begin(nvmem_async_pt req);
+static void _nvmem_async_begin_page(nvmem_async_pt req);
+static void _nvmem_async_program_next(nvmem_async_pt req);
+static void _nvmem_async_complete(ubi_err_t result);
+
+static ubi_err_t _nvmem_async_submit(nvmem_async_pt req)
+{
+    int need_start = 0;
+
+    if (!_g_nvmem_async_irq_init)
+    {
+        HAL_NVIC_SetPriority(FLASH_IRQn, NVIC_PRIO_MIDDLE, 0);
+        HAL_NVIC_EnableIRQ(FLASH_IRQn);
+        _g_nvmem_async_irq_init = 1;
+    }
+
+    req->next = NULL;
+    req->done = 0;
+    req->result = UBI_ERR_BUSY;
+
+    ubik_entercrit();
+
+    if (_g_nvmem_async_tail == NULL)
+    {
+        _g_nvmem_async_head = req;
+        need_start = 1;
+    }
+    else
+    {
+        _g_nvmem_async_tail->next = req;
+    }
+    _g_nvmem_async_tail = req;
+
+    if (need_start)
+    {
+        _nvmem_async_begin(req);
+    }
+
+    ubik_exitcrit();
+
+    return UBI_ERR_OK;
+}
+
+/* Starts the request at the head of the queue. Called with interrupts masked or in FLASH interrupt context. */
+static void _nvmem_async_begin(nvmem_async_pt req)
+{
+    FLASH_EraseInitTypeDef x_erase_init;
+    uint32_t first_addr;
+    uint32_t last_addr;
+
+    HAL_FLASH_Unlock();
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+
+    if (req->op == NVMEM_ASYNC_OP_ERASE)
+    {
+        /* Erased pages at the start and at the end of the area are skipped */
+        first_addr = ROUND_DOWN(req->addr, NVMEM_PAGE_SIZE);
+        last_addr = ROUND_DOWN(req->addr + req->size - 1U, NVMEM_PAGE_SIZE);
+        while (first_addr <= last_addr && FLASH_is_blank(first_addr, NVMEM_PAGE_SIZE) == 0)
+        {
+            first_addr += NVMEM_PAGE_SIZE;
+        }
+        while (last_addr > first_addr && FLASH_is_blank(last_addr, NVMEM_PAGE_SIZE) == 0)
+        {
+            last_addr -= NVMEM_PAGE_SIZE;
+        }
+        if (first_addr > last_addr)
+        {
+            _nvmem_async_complete(UBI_ERR_OK);
+            return;
+        }
+
+        x_erase_init.TypeErase   = FLASH_TYPEERASE_PAGES;
+        x_erase_init.Banks       = FLASH_get_bank(first_addr);
+        x_erase_init.Page        = FLASH_get_page(first_addr);
+        x_erase_init.NbPages     = FLASH_get_page(last_addr) - x_erase_init.Page + 1U;
+
+        _g_nvmem_async_state = NVMEM_ASYNC_STATE_ERASE;
+        if (HAL_FLASHEx_Erase_IT(&x_erase_init) != HAL_OK)
+        {
+            _nvmem_async_complete(UBI_ERR_ERROR);
+        }
+    }
+    else
+    {
+        _g_nvmem_async_done_len = 0;
+        _nvmem_async_begin_page(req);
+    }
+}
+
+/* Loads the page of the current update position into the cache, merges the new data and erases the page. */
+static void _nvmem_async_begin_page(nvmem_async_pt req)
+{
+    FLASH_EraseInitTypeDef x_erase_init;
+    uint32_t dst_addr = req->addr + _g_nvmem_async_done_len;
+    uint32_t fl_offset;
+
+    _g_nvmem_async_page_addr = ROUND_DOWN(dst_addr, NVMEM_PAGE_SIZE);
+    fl_offset = dst_addr - _g_nvmem_async_page_addr;
+    _g_nvmem_async_chunk_len = MIN(NVMEM_PAGE_SIZE - fl_offset, req->size - _g_nvmem_async_done_len);
+
+    memcpy(_g_nvmem_async_page_cache, (void *) _g_nvmem_async_page_addr, NVMEM_PAGE_SIZE);
+    memcpy((uint8_t *) _g_nvmem_async_page_cache + fl_offset, req->buf + _g_nvmem_async_done_len, _g_nvmem_async_chunk_len);
+
+    x_erase_init.TypeErase   = FLASH_TYPEERASE_PAGES;
+    x_erase_init.Banks       = FLASH_get_bank(_g_nvmem_async_page_addr);
+    x_erase_init.Page        = FLASH_get_page(_g_nvmem_async_page_addr);
+    x_erase_init.NbPages     = 1U;
+
+    _g_nvmem_async_state = NVMEM_ASYNC_STATE_ERASE;
+    if (HAL_FLASHEx_Erase_IT(&x_erase_init) != HAL_OK)
+    {
+        _nvmem_async_complete(UBI_ERR_ERROR);
+    }
+}
+
+/* Programs the next doubleword of the page cache. Erased (all 0xFF) doublewords are skipped. */
+static void _nvmem_async_program_next(nvmem_async_pt req)
+{
+    uint32_t index;
+
+    for (;;)
+    {
+        if (_g_nvmem_async_page_offset >= NVMEM_PAGE_SIZE)
+        {
+            _g_nvmem_async_done_len += _g_nvmem_async_chunk_len;
+            if (_g_nvmem_async_done_len >= req->size)
+            {
+                _nvmem_async_complete(UBI_ERR_OK);
+            }
+            else
+            {
+                _nvmem_async_begin_page(req);
+            }
+            break;
+        }
+
+        index = _g_nvmem_async_page_offset / sizeof(uint64_t);
+        if (_g_nvmem_async_page_cache[index] == 0xFFFFFFFFFFFFFFFFULL)
+        {
+            _g_nvmem_async_page_offset += sizeof(uint64_t);
+            continue;
+        }
+
+        _g_nvmem_async_state = NVMEM_ASYNC_STATE_PROGRAM;
+        if (HAL_FLASH_Program_IT(FLASH_TYPEPROGRAM_DOUBLEWORD,
+                _g_nvmem_async_page_addr + _g_nvmem_async_page_offset,
+                _g_nvmem_async_page_cache[index]) != HAL_OK)
+        {
+            _nvmem_async_complete(UBI_ERR_ERROR);
+        }
+        break;
+    }
+}
+
+/* Completes the request at the head of the queue and starts the next one. */
+static void _nvmem_async_complete(ubi_err_t result)
+{
+    nvmem_async_pt req;
+    nvmem_async_pt next;
+
+    HAL_FLASH_Lock();
+    _g_nvmem_async_state = NVMEM_ASYNC_STATE_IDLE;
+
+    req = _g_nvmem_async_head;
+    next = req->next;
+    _g_nvmem_async_head = next;
+    if (next == NULL)
+    {
+        _g_nvmem_async_tail = NULL;
+    }
+
+    req->result = result;
+    req->done = 1;
+
+    if (req->callback != NULL)
+    {
+        req->callback(req, result, req->callback_arg);
+    }
+    if (req->sem != NULL)
+    {
+        sem_give(req->sem);
+    }
+
+    if (next != NULL)
+    {
+        _nvmem_async_begin(next);
+    }
+}
+
+void nvmem_stm32_flash_irq_handler(void)
+{
+    nvmem_async_pt req;
+
+    HAL_FLASH_IRQHandler();
+
+    /* The HAL keeps the FLASH process locked until the procedure is over, so the next step is issued here */
+    if (pFlash.ProcedureOnGoing != FLASH_PROC_NONE)
+    {
+        return;
+    }
+
+    req = _g_nvmem_async_head;
+    if (req == NULL || _g_nvmem_async_state == NVMEM_ASYNC_STATE_IDLE)
+    {
+        return;
+    }
+
+    if (HAL_FLASH_GetError() != HAL_FLASH_ERROR_NONE)
+    {
+        _nvmem_async_complete(UBI_ERR_ERROR);
+        return;
+    }
+
+    switch (_g_nvmem_async_state)
+    {
+    case NVMEM_ASYNC_STATE_ERASE:
+        if (req->op == NVMEM_ASYNC_OP_ERASE)
+        {
+            _nvmem_async_complete(UBI_ERR_OK);
+        }
+        else
+        {
+            _g_nvmem_async_page_offset = 0;
+            _nvmem_async_program_next(req);
+        }
+        break;
+
+    case NVMEM_ASYNC_STATE_PROGRAM:
+        if (*(uint64_t *) (_g_nvmem_async_page_addr + _g_nvmem_async_page_offset) !=
+                _g_nvmem_async_page_cache[_g_nvmem_async_page_offset / sizeof(uint64_t)])
+        {
+            _nvmem_async_complete(UBI_ERR_ERROR);
+            break;
+        }
+        _g_nvmem_async_page_offset += sizeof(uint64_t);
+        _nvmem_async_program_next(req);
+        break;
+
+    default:
+        break;
+    }
+}
+
+ubi_err_t nvmem_erase_async(nvmem_async_pt req, uint8_t *addr, size_t size)
+{
+    ubi_err_t ubi_err;
+
+    do
+    {
+        if (req == NULL || size == 0)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        if (!FLASH_is_in_range((uint32_t) addr, size))
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        if (FLASH_get_bank((uint32_t) addr) != FLASH_get_bank((uint32_t) addr + size - 1))
+        {
+#ifndef CODE_UNDER_FIREWALL
+            printf("Error: Cannot erase across FLASH banks.\n");
+#endif
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+        if (FLASH_journal_overlaps((uint32_t) addr, size))
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_RWW_ENABLE == 1)
+        if (!nvmem_rww_is_concurrent(addr, size))
+        {
+            /* The CPU would stall on every code fetch until the operation is over */
+            ubi_err = UBI_ERR_NOT_SUPPORTED;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_RWW_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_OB_ENABLE == 1)
+        if (FLASH_ob_is_protected((uint32_t) addr, size))
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_OB_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_MAP_ENABLE == 1)
+        if (FLASH_map_overlaps((uint32_t) addr, size))
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_MAP_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+        FLASH_cache_flush_range((uint32_t) addr, size, 1);
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+
+        req->op = NVMEM_ASYNC_OP_ERASE;
+        req->addr = (uint32_t) addr;
+        req->size = size;
+        req->buf = NULL;
+
+        ubi_err = _nvmem_async_submit(req);
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_update_async(nvmem_async_pt req, uint8_t *addr, const uint8_t *buf, size_t size)
+{
+    ubi_err_t ubi_err;
+
+    do
+    {
+        if (req == NULL || buf == NULL || size == 0)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        if (!FLASH_is_in_range((uint32_t) addr, size))
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+        if (_g_nvmem_journal_meta != 0U)
+        {
+            /* The queued update would erase its pages without a journal record */
+            ubi_err = UBI_ERR_NOT_SUPPORTED;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_RWW_ENABLE == 1)
+        if (!nvmem_rww_is_concurrent(addr, size))
+        {
+            /* The CPU would stall on every code fetch until the operation is over */
+            ubi_err = UBI_ERR_NOT_SUPPORTED;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_RWW_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_OB_ENABLE == 1)
+        if (FLASH_ob_is_protected((uint32_t) addr, size))
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_OB_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_MAP_ENABLE == 1)
+        if (FLASH_map_overlaps((uint32_t) addr, size))
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_MAP_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+        if (FLASH_cache_overlaps((uint32_t) addr, size))
+        {
+            /* The cached page has to be written back before the queued update */
+            if (nvmem_async_is_busy())
+            {
+                ubi_err = UBI_ERR_BUSY;
+                break;
+            }
+            if (FLASH_cache_flush_range((uint32_t) addr, size, 0) != 0)
+            {
+                ubi_err = UBI_ERR_ERROR;
+                break;
+            }
+        }
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+
+        req->op = NVMEM_ASYNC_OP_UPDATE;
+        req->addr = (uint32_t) addr;
+        req->size = size;
+        req->buf = buf;
+
+        ubi_err = _nvmem_async_submit(req);
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_async_wait(nvmem_async_pt req, uint32_t timeoutms)
+{
+    ubi_err_t ubi_err;
+    uint32_t waited = 0;
+    int r;
+
+    do
+    {
+        if (req == NULL)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        r = 0;
+        while (!req->done)
+        {
+            if (timeoutms != NVMEM_WAIT_FOREVER && waited >= timeoutms)
+            {
+                break;
+            }
+
+            if (req->sem != NULL)
+            {
+                if (timeoutms == NVMEM_WAIT_FOREVER)
+                {
+                    r = sem_take(req->sem);
+                }
+                else
+                {
+                    r = sem_take_timedms(req->sem, timeoutms - waited);
+                    waited = timeoutms;
+                }
+                if (r != 0)
+                {
+                    /* Timed out (or the take failed): the request is left as it is, still queued */
+                    break;
+                }
+            }
+            else
+            {
+                task_sleepms(1);
+                waited++;
+            }
+        }
+
+        if (r != 0 || !req->done)
+        {
+            ubi_err = UBI_ERR_TIMEOUT;
+            break;
+        }
+
+        ubi_err = req->result;
+    } while (0);
+
+    return ubi_err;
+}
+
+int nvmem_async_is_busy(void)
+{
+    return (_g_nvmem_async_head != NULL) ? 1 : 0;
+}
+
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_DMA_ENABLE == 1)
+
+#define _NVMEM_DMA(i)               DMA##i
+#define _NVMEM_DMA_CHANNEL(i, c)    DMA##i##_Channel##c
+#define _NVMEM_DMA_IRQN(i, c)       DMA##i##_Channel##c##_IRQn
+#define NVMEM_DMA_(i)               _NVMEM_DMA(i)
+#define NVMEM_DMA_CHANNEL_(i, c)    _NVMEM_DMA_CHANNEL(i, c)
+#define NVMEM_DMA_IRQN_(i, c)       _NVMEM_DMA_IRQN(i, c)
+
+#define NVMEM_DMA           NVMEM_DMA_(STM32CUBEL4__NVMEM_DMA_INSTANCE)
+#define NVMEM_DMA_CHANNEL   NVMEM_DMA_CHANNEL_(STM32CUBEL4__NVMEM_DMA_INSTANCE, STM32CUBEL4__NVMEM_DMA_CHANNEL)
+#define NVMEM_DMA_IRQN      NVMEM_DMA_IRQN_(STM32CUBEL4__NVMEM_DMA_INSTANCE, STM32CUBEL4__NVMEM_DMA_CHANNEL)
+#define NVMEM_DMA_FLAG_SHIFT    (4U * (STM32CUBEL4__NVMEM_DMA_CHANNEL - 1U))
+
+/* Number of data items of a transfer (CNDTR is 16 bit wide) */
+#define NVMEM_DMA_COUNT_MAX 0xFFFFU
+
+static volatile uint8_t _g_nvmem_dma_busy = 0;
+static uint8_t _g_nvmem_dma_init = 0;
+static volatile ubi_err_t * _g_nvmem_dma_result_p = NULL;  /* Result of the waiting reader (NULL for a callback) */
+static sem_pt _g_nvmem_dma_sem = NULL;
+
+static uint32_t _g_nvmem_dma_src;
+static uint32_t _g_nvmem_dma_dst;
+static uint32_t _g_nvmem_dma_words_left;
+static uint32_t _g_nvmem_dma_addr;
+static uint32_t _g_nvmem_dma_size;
+static nvmem_read_callback_ft _g_nvmem_dma_callback = NULL;
+static void * _g_nvmem_dma_callback_arg = NULL;
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+static uint32_t _g_nvmem_dma_ecc_detected_count;
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+
+static ubi_err_t _nvmem_dma_start(const uint8_t *addr, uint8_t *buf, size_t size, nvmem_read_callback_ft callback, void *arg, volatile ubi_err_t *result_p);
+static void _nvmem_dma_start_block(void);
+static void _nvmem_dma_complete(ubi_err_t result);
+
+/*
+ * Starts a DMA read. The bytes before the first word aligned address and after the last one are
+ * copied by the CPU, the words in between by the DMA.
+ * The result is stored at result_p (owned by the waiting reader, UBI_ERR_BUSY until the completion) if not NULL.
+ * Returns UBI_ERR_NOT_SUPPORTED if the source and the destination are not equally word aligned.
+ */
+static ubi_err_t _nvmem_dma_start(const uint8_t *addr, uint8_t *buf, size_t size, nvmem_read_callback_ft callback, void *arg, volatile ubi_err_t *result_p)
+{
+    uint32_t head;
+    uint32_t tail;
+
+    if ((((uint32_t) addr) ^ ((uint32_t) buf)) & 0x3)
+    {
+        return UBI_ERR_NOT_SUPPORTED;
+    }
+
+    ubik_entercrit();
+    if (_g_nvmem_dma_busy)
+    {
+        ubik_exitcrit();
+        return UBI_ERR_BUSY;
+    }
+    _g_nvmem_dma_busy = 1;
+    ubik_exitcrit();
+
+    if (!_g_nvmem_dma_init)
+    {
+#if (STM32CUBEL4__NVMEM_DMA_INSTANCE == 1)
+        __HAL_RCC_DMA1_CLK_ENABLE();
+#else
+        __HAL_RCC_DMA2_CLK_ENABLE();
+#endif
+        HAL_NVIC_SetPriority(NVMEM_DMA_IRQN, NVIC_PRIO_MIDDLE, 0);
+        HAL_NVIC_EnableIRQ(NVMEM_DMA_IRQN);
+        _g_nvmem_dma_init = 1;
+    }
+
+    head = MIN((4 - ((uint32_t) addr & 0x3)) & 0x3, size);
+    tail = (size - head) & 0x3;
+
+    memcpy(buf, addr, head);
+    memcpy(buf + size - tail, addr + size - tail, tail);
+
+    _g_nvmem_dma_src = (uint32_t) addr + head;
+    _g_nvmem_dma_dst = (uint32_t) buf + head;
+    _g_nvmem_dma_words_left = (size - head - tail) / 4;
+    _g_nvmem_dma_addr = (uint32_t) addr;
+    _g_nvmem_dma_size = size;
+    _g_nvmem_dma_callback = callback;
+    _g_nvmem_dma_callback_arg = arg;
+    _g_nvmem_dma_result_p = result_p;
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+    _g_nvmem_dma_ecc_detected_count = _g_nvmem_ecc_detected_count;
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+
+    if (_g_nvmem_dma_words_left == 0)
+    {
+        _nvmem_dma_complete(UBI_ERR_OK);
+    }
+    else
+    {
+        _nvmem_dma_start_block();
+    }
+
+    return UBI_ERR_OK;
+}
+
+/* Starts the transfer of the next block of words. Called in task context at start or in DMA interrupt context. */
+static void _nvmem_dma_start_block(void)
+{
+    uint32_t count = MIN(_g_nvmem_dma_words_left, NVMEM_DMA_COUNT_MAX);
+
+    NVMEM_DMA_CHANNEL->CCR = 0;
+    NVMEM_DMA->IFCR = (DMA_IFCR_CGIF1 << NVMEM_DMA_FLAG_SHIFT);
+
+    /* In memory-to-memory mode, the data is read at CPAR and written at CMAR (DIR = 0) */
+    NVMEM_DMA_CHANNEL->CPAR = _g_nvmem_dma_src;
+    NVMEM_DMA_CHANNEL->CMAR = _g_nvmem_dma_dst;
+    NVMEM_DMA_CHANNEL->CNDTR = count;
+
+    _g_nvmem_dma_src += count * 4;
+    _g_nvmem_dma_dst += count * 4;
+    _g_nvmem_dma_words_left -= count;
+
+    NVMEM_DMA_CHANNEL->CCR = DMA_CCR_MEM2MEM | DMA_CCR_PL_0 | DMA_CCR_MSIZE_1 | DMA_CCR_PSIZE_1 |
+                             DMA_CCR_MINC | DMA_CCR_PINC | DMA_CCR_TEIE | DMA_CCR_TCIE | DMA_CCR_EN;
+}
+
+static void _nvmem_dma_complete(ubi_err_t result)
+{
+    nvmem_read_callback_ft callback = _g_nvmem_dma_callback;
+    void * arg = _g_nvmem_dma_callback_arg;
+    volatile ubi_err_t * result_p = _g_nvmem_dma_result_p;
+
+    NVMEM_DMA_CHANNEL->CCR = 0;
+
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+    if (result == UBI_ERR_OK)
+    {
+        result = FLASH_ecc_check(_g_nvmem_dma_ecc_detected_count, _g_nvmem_dma_addr, _g_nvmem_dma_size);
+    }
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+
+    /* The next request may start as soon as busy is cleared: the result goes to the reader of this one */
+    _g_nvmem_dma_result_p = NULL;
+    _g_nvmem_dma_busy = 0;
+
+    if (callback != NULL)
+    {
+        callback(result, arg);
+    }
+    if (result_p != NULL)
+    {
+        *result_p = result;
+        if (_g_nvmem_dma_sem != NULL)
+        {
+            sem_give(_g_nvmem_dma_sem);
+        }
+    }
+}
+
+void nvmem_stm32_dma_irq_handler(void)
+{
+    uint32_t isr = NVMEM_DMA->ISR >> NVMEM_DMA_FLAG_SHIFT;
+
+    NVMEM_DMA->IFCR = (DMA_IFCR_CGIF1 << NVMEM_DMA_FLAG_SHIFT);
+
+    if (!_g_nvmem_dma_busy)
+    {
+        return;
+    }
+
+    if (isr & DMA_ISR_TEIF1)
+    {
+        _nvmem_dma_complete(UBI_ERR_ERROR);
+    }
+    else if (isr & DMA_ISR_TCIF1)
+    {
+        if (_g_nvmem_dma_words_left > 0)
+        {
+            _nvmem_dma_start_block();
+        }
+        else
+        {
+            _nvmem_dma_complete(UBI_ERR_OK);
+        }
+    }
+}
+
+/*
+ * Reads with the DMA and waits for the completion (on a semaphore once the kernel is running).
+ * Falls back to a CPU copy when the DMA cannot be used.
+ */
+static ubi_err_t FLASH_dma_read(const uint8_t *addr, uint8_t *buf, uint32_t len_bytes)
+{
+  ubi_err_t ubi_err;
+  volatile ubi_err_t result = UBI_ERR_BUSY;
+  sem_pt sem;
+  int use_sem = 0;
+
+  if (bsp_isintr() || 0 != _bsp_critcount)
+  {
+    /* The completion interrupt could not be taken */
+    memcpy(buf, addr, len_bytes);
+    return UBI_ERR_OK;
+  }
+
+  if (_bsp_kernel_active)
+  {
+    if (_g_nvmem_dma_sem == NULL && semb_create(&sem) == 0)
+    {
+      ubik_entercrit();
+      if (_g_nvmem_dma_sem == NULL)
+      {
+        _g_nvmem_dma_sem = sem;
+        sem = NULL;
+      }
+      ubik_exitcrit();
+      if (sem != NULL)
+      {
+        sem_delete(&sem);
+      }
+    }
+    use_sem = (_g_nvmem_dma_sem != NULL);
+  }
+
+  ubi_err = _nvmem_dma_start(addr, buf, len_bytes, NULL, NULL, &result);
+  if (ubi_err != UBI_ERR_OK)
+  {
+    memcpy(buf, addr, len_bytes);
+    return UBI_ERR_OK;
+  }
+
+  /* The result is this request's own: a request started after the completion cannot overwrite it */
+  while (result == UBI_ERR_BUSY)
+  {
+    if (use_sem)
+    {
+      sem_take(_g_nvmem_dma_sem);
+    }
+  }
+
+  return result;
+}
+
+ubi_err_t nvmem_read_async(const uint8_t *addr, uint8_t *buf, size_t size, nvmem_read_callback_ft callback, void *arg)
+{
+    ubi_err_t ubi_err;
+
+    do
+    {
+        if (addr == NULL || buf == NULL)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+        /* The copy is done from the FLASH, so the cached pages are written back first */
+        if (FLASH_cache_flush_range((uint32_t) addr, size, 0) != 0)
+        {
+            ubi_err = UBI_ERR_ERROR;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+
+        ubi_err = _nvmem_dma_start(addr, buf, size, callback, arg, NULL);
+        if (ubi_err == UBI_ERR_NOT_SUPPORTED)
+        {
+            memcpy(buf, addr, size);
+            if (callback != NULL)
+            {
+                callback(UBI_ERR_OK, arg);
+            }
+            ubi_err = UBI_ERR_OK;
+        }
+    } while (0);
+
+    return ubi_err;
+}
+
+int nvmem_read_async_is_busy(void)
+{
+    return _g_nvmem_dma_busy ? 1 : 0;
+}
+
+#endif /* (STM32CUBEL4__NVMEM_DMA_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_MAP_ENABLE == 1)
+
+typedef struct _nvmem_map_t
+{
+    uint32_t addr;
+    uint32_t size;      /* 0 if the slot is free */
+} nvmem_map_t;
+
+static nvmem_map_t _g_nvmem_map[NVMEM_MAP_MAX];
+
+/* Returns 1 if a mapped area overlaps the pages of the area (erase and update work on whole pages) */
+static int FLASH_map_overlaps(uint32_t address, uint32_t len_bytes)
+{
+  uint32_t start = ROUND_DOWN(address, NVMEM_PAGE_SIZE);
+  uint32_t end = ROUND_UP(address + len_bytes, NVMEM_PAGE_SIZE);
+  int overlaps = 0;
+  int i;
+
+  ubik_entercrit();
+  for (i = 0; i < NVMEM_MAP_MAX; i++)
+  {
+    if (_g_nvmem_map[i].size != 0U &&
+        _g_nvmem_map[i].addr < end && _g_nvmem_map[i].addr + _g_nvmem_map[i].size > start)
+    {
+      overlaps = 1;
+      break;
+    }
+  }
+  ubik_exitcrit();
+
+  return overlaps;
+}
+
+ubi_err_t nvmem_map(const uint8_t *addr, size_t size, const uint8_t **ptr_p)
+{
+    ubi_err_t ubi_err;
+    uint32_t address = (uint32_t) addr;
+    int i;
+
+    do
+    {
+        if (ptr_p == NULL || size == 0)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        /* The FLASH is also mapped from 0x00000000 when the system boots from it */
+        if (address < FLASH_SIZE && READ_BIT(SYSCFG->MEMRMP, SYSCFG_MEMRMP_MEM_MODE) == 0U)
+        {
+            address += FLASH_BASE;
+        }
+
+        if (address < FLASH_BASE || size > FLASH_SIZE || address - FLASH_BASE > FLASH_SIZE - size)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+        if (FLASH_cache_flush_range(address, size, 0) != 0)
+        {
+            ubi_err = UBI_ERR_ERROR;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+
+        ubi_err = UBI_ERR_NO_MEM;
+
+        ubik_entercrit();
+        for (i = 0; i < NVMEM_MAP_MAX; i++)
+        {
+            if (_g_nvmem_map[i].size == 0U)
+            {
+                _g_nvmem_map[i].addr = address;
+                _g_nvmem_map[i].size = size;
+                ubi_err = UBI_ERR_OK;
+                break;
+            }
+        }
+        ubik_exitcrit();
+
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+
+        *ptr_p = (const uint8_t *) address;
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_unmap(const uint8_t *ptr)
+{
+    ubi_err_t ubi_err;
+    int i;
+
+    ubi_err = UBI_ERR_NOT_FOUND;
+
+    ubik_entercrit();
+    for (i = 0; i < NVMEM_MAP_MAX; i++)
+    {
+        if (_g_nvmem_map[i].size != 0U && _g_nvmem_map[i].addr == (uint32_t) ptr)
+        {
+            _g_nvmem_map[i].size = 0U;
+            ubi_err = UBI_ERR_OK;
+            break;
+        }
+    }
+    ubik_exitcrit();
+
+    return ubi_err;
+}
+
+int nvmem_is_mapped(const uint8_t *addr, size_t size)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+    return FLASH_map_overlaps((uint32_t) addr, size);
+}
+
+#endif /* (STM32CUBEL4__NVMEM_MAP_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+
+/* Cached page. A slot holds a page only while it is dirty. */
+typedef struct _nvmem_cache_page_t
+{
+    uint32_t addr;          /* Page address (0 if the slot is free) */
+    uint32_t dirty_tick;    /* HAL tick at which the page became dirty */
+    uint32_t use_count;     /* Value of _g_nvmem_cache_use_count at the last update (for LRU) */
+    uint64_t data[NVMEM_PAGE_SIZE_MAX / sizeof(uint64_t)];
+} nvmem_cache_page_t;
+
+static nvmem_cache_page_t _g_nvmem_cache[STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT];
+static uint32_t _g_nvmem_cache_use_count = 0;
+static mutex_pt _g_nvmem_cache_lock = NULL;
+
+static void _nvmem_cache_lock(void);
+static void _nvmem_cache_unlock(void);
+static int _nvmem_cache_write_back(nvmem_cache_page_t *slot);
+static int _nvmem_cache_flush_expired(void);
+
+static void _nvmem_cache_lock(void)
+{
+    mutex_pt lock;
+    int r;
+    (void) r;
+
+    if (!_bsp_kernel_active || bsp_isintr())
+    {
+        return;
+    }
+
+    if (_g_nvmem_cache_lock == NULL)
+    {
+        r = mutex_create(&lock);
+        assert(r == 0);
+
+        ubik_entercrit();
+        if (_g_nvmem_cache_lock == NULL)
+        {
+            _g_nvmem_cache_lock = lock;
+            lock = NULL;
+        }
+        ubik_exitcrit();
+
+        if (lock != NULL)
+        {
+            mutex_delete(&lock);
+        }
+    }
+
+    mutex_lock(_g_nvmem_cache_lock);
+}
+
+static void _nvmem_cache_unlock(void)
+{
+    if (!_bsp_kernel_active || bsp_isintr() || _g_nvmem_cache_lock == NULL)
+    {
+        return;
+    }
+
+    mutex_unlock(_g_nvmem_cache_lock);
+}
+
+/* Writes back a dirty page and frees its slot. Called with the cache locked. */
+static int _nvmem_cache_write_back(nvmem_cache_page_t *slot)
+{
+    int ret = 0;
+
+    if (memcmp((void *) slot->addr, slot->data, NVMEM_PAGE_SIZE) != 0)
+    {
+        ret = FLASH_Update(slot->addr, slot->data, NVMEM_PAGE_SIZE);
+    }
+    if (ret == 0)
+    {
+        slot->addr = 0U;
+    }
+
+    return ret;
+}
+
+/* Writes back the pages that have been dirty for too long. Called with the cache locked. */
+static int _nvmem_cache_flush_expired(void)
+{
+    uint32_t now = HAL_GetTick();
+    int ret = 0;
+    int i;
+
+    for (i = 0; i < STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT; i++)
+    {
+        if (_g_nvmem_cache[i].addr != 0U && (now - _g_nvmem_cache[i].dirty_tick) >= STM32CUBEL4__NVMEM_CACHE_TIMEOUTMS)
+        {
+            if (_nvmem_cache_write_back(&_g_nvmem_cache[i]) != 0)
+            {
+                ret = -1;
+            }
+        }
+    }
+
+    return ret;
+}
+
+/**
+  * @brief  Update the FLASH through the write-back cache.
+  * @param  In: address     Destination address.
+  * @param  In: data        Source address.
+  * @param  In: len_bytes   Number of bytes to update.
+  * @retval  0:  Success.
+  *        !=0:  Failure.
+  */
+static int FLASH_cache_update(uint32_t address, const uint8_t *data, uint32_t len_bytes)
+{
+  int ret = 0;
+  nvmem_cache_page_t *slot;
+  int i;
+
+  _nvmem_cache_lock();
+
+  (void) _nvmem_cache_flush_expired();
+
+  while ((ret == 0) && (len_bytes > 0U))
+  {
+    uint32_t fl_addr = ROUND_DOWN(address, NVMEM_PAGE_SIZE);
+    uint32_t fl_offset = address - fl_addr;
+    uint32_t len = MIN(NVMEM_PAGE_SIZE - fl_offset, len_bytes);
+    uint32_t dw_offset = ROUND_DOWN(fl_offset, 8);
+
+    slot = NULL;
+    for (i = 0; i < STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT; i++)
+    {
+      if (_g_nvmem_cache[i].addr == fl_addr)
+      {
+        slot = &_g_nvmem_cache[i];
+        break;
+      }
+    }
+
+    if (slot == NULL)
+    {
+      if (FLASH_is_blank(fl_addr + dw_offset, ROUND_UP(fl_offset + len, 8) - dw_offset) == 0)
+      {
+        /* No erase is needed: program the doublewords directly */
+        ret = FLASH_Update(address, data, len);
+      }
+      else
+      {
+        /* Take a free slot, or write back the least recently updated page */
+        for (i = 0; i < STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT; i++)
+        {
+          if (_g_nvmem_cache[i].addr == 0U)
+          {
+            slot = &_g_nvmem_cache[i];
+            break;
+          }
+          if ((slot == NULL) || ((int32_t) (_g_nvmem_cache[i].use_count - slot->use_count) < 0))
+          {
+            slot = &_g_nvmem_cache[i];
+          }
+        }
+        if (slot->addr != 0U)
+        {
+          ret = _nvmem_cache_write_back(slot);
+        }
+        if (ret == 0)
+        {
+          memcpy(slot->data, (void *) fl_addr, NVMEM_PAGE_SIZE);
+          slot->addr = fl_addr;
+          slot->dirty_tick = HAL_GetTick();
+        }
+      }
+    }
+
+    if ((ret == 0) && (slot != NULL))
+    {
+      memcpy((uint8_t *) slot->data + fl_offset, data, len);
+      slot->use_count = ++_g_nvmem_cache_use_count;
+    }
+
+    address += len;
+    data += len;
+    len_bytes -= len;
+  }
+
+  _nvmem_cache_unlock();
+
+  return ret;
+}
+
+/**
+  * @brief  Overlay the cached pages on data read from the FLASH.
+  * @param  In: address     Source address.
+  * @param  In: buf         Data read from the FLASH.
+  * @param  In: len_bytes   Number of bytes.
+  */
+static void FLASH_cache_read(uint32_t address, uint8_t *buf, uint32_t len_bytes)
+{
+  uint32_t start;
+  uint32_t end;
+  int i;
+
+  _nvmem_cache_lock();
+
+  for (i = 0; i < STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT; i++)
+  {
+    if (_g_nvmem_cache[i].addr == 0U)
+    {
+      continue;
+    }
+    start = (address > _g_nvmem_cache[i].addr) ? address : _g_nvmem_cache[i].addr;
+    end = MIN(address + len_bytes, _g_nvmem_cache[i].addr + NVMEM_PAGE_SIZE);
+    if (start < end)
+    {
+      memcpy(buf + (start - address), (uint8_t *) _g_nvmem_cache[i].data + (start - _g_nvmem_cache[i].addr), end - start);
+    }
+  }
+
+  _nvmem_cache_unlock();
+}
+
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+/**
+  * @brief  Check if a cached page overlaps the area.
+  * @retval  1: A cached page overlaps the area.
+  *          0: Otherwise.
+  */
+static int FLASH_cache_overlaps(uint32_t address, uint32_t len_bytes)
+{
+  uint32_t start = ROUND_DOWN(address, NVMEM_PAGE_SIZE);
+  uint32_t end = ROUND_UP(address + len_bytes, NVMEM_PAGE_SIZE);
+  int i;
+
+  for (i = 0; i < STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT; i++)
+  {
+    if (_g_nvmem_cache[i].addr != 0U && _g_nvmem_cache[i].addr >= start && _g_nvmem_cache[i].addr < end)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+/**
+  * @brief  Write back (or drop) the cached pages that overlap the area.
+  * @param  In: drop        If not 0, the pages are dropped instead (they are about to be erased).
+  * @retval  0:  Success.
+  *        !=0:  Failure.
+  */
+static int FLASH_cache_flush_range(uint32_t address, uint32_t len_bytes, int drop)
+{
+  uint32_t start = ROUND_DOWN(address, NVMEM_PAGE_SIZE);
+  uint32_t end = ROUND_UP(address + len_bytes, NVMEM_PAGE_SIZE);
+  int ret = 0;
+  int i;
+
+  _nvmem_cache_lock();
+
+  for (i = 0; i < STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT; i++)
+  {
+    if (_g_nvmem_cache[i].addr != 0U && _g_nvmem_cache[i].addr >= start && _g_nvmem_cache[i].addr < end)
+    {
+      if (drop)
+      {
+        _g_nvmem_cache[i].addr = 0U;
+      }
+      else if (_nvmem_cache_write_back(&_g_nvmem_cache[i]) != 0)
+      {
+        ret = -1;
+      }
+    }
+  }
+
+  _nvmem_cache_unlock();
+
+  return ret;
+}
+
+ubi_err_t nvmem_sync(void)
+{
+    ubi_err_t ubi_err;
+    int r;
+    int i;
+
+    do
+    {
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+        if (nvmem_async_is_busy())
+        {
+            ubi_err = UBI_ERR_BUSY;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+        ubi_err = UBI_ERR_OK;
+
+        _nvmem_cache_lock();
+        for (i = 0; i < STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT; i++)
+        {
+            if (_g_nvmem_cache[i].addr != 0U)
+            {
+                r = _nvmem_cache_write_back(&_g_nvmem_cache[i]);
+                if (r != 0)
+                {
+                    ubi_err = UBI_ERR_INTERNAL;
+                }
+            }
+        }
+        _nvmem_cache_unlock();
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_cache_maintain(void)
+{
+    ubi_err_t ubi_err;
+    int r;
+
+    do
+    {
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+        if (nvmem_async_is_busy())
+        {
+            ubi_err = UBI_ERR_BUSY;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+        _nvmem_cache_lock();
+        r = _nvmem_cache_flush_expired();
+        _nvmem_cache_unlock();
+
+        ubi_err = (r == 0) ? UBI_ERR_OK : UBI_ERR_INTERNAL;
+    } while (0);
+
+    return ubi_err;
+}
+
+uint32_t nvmem_cache_get_dirty_count(void)
+{
+    uint32_t count = 0;
+    int i;
+
+    for (i = 0; i < STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT; i++)
+    {
+        if (_g_nvmem_cache[i].addr != 0U)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+void nvmem_stm32_lowpower_enter_hook(void)
+{
+    ubi_err_t ubi_err;
+
+    ubi_err = nvmem_sync();
+    if (ubi_err != UBI_ERR_OK)
+    {
+        logme("nvmem_sync fail");
+    }
+}
+
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_FWUP_ENABLE == 1) || (STM32CUBEL4__NVMEM_OB_ENABLE == 1)
+/**
+  * @brief  Program option bytes and reload them with a single launch.
+  * @note   The launch resets the device, so the function returns only on failure.
+  * @param  In: OBInit      Option byte changes.
+  * @param  In: count       Number of option byte changes.
+  * @retval -1: Failure.
+  */
+static int FLASH_ob_program_launch(FLASH_OBProgramInitTypeDef *OBInit, uint32_t count)
+{
+  HAL_StatusTypeDef status = HAL_OK;
+  uint32_t i;
+
+  HAL_FLASH_Unlock();
+  HAL_FLASH_OB_Unlock();
+  __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+
+  /* Each change is written to the option bytes, they are all loaded by the launch */
+  for (i = 0; (i < count) && (status == HAL_OK); i++)
+  {
+    status = HAL_FLASHEx_OBProgram(&OBInit[i]);
+  }
+  if (status == HAL_OK)
+  {
+    /* Reloads the option bytes, which resets the device */
+    HAL_FLASH_OB_Launch();
+  }
+
+  HAL_FLASH_OB_Lock();
+  HAL_FLASH_Lock();
+
+#ifndef CODE_UNDER_FIREWALL
+  printf("Error programming option bytes\n");
+#endif
+  return -1;
+}
+#endif /* (STM32CUBEL4__NVMEM_FWUP_ENABLE == 1) || (STM32CUBEL4__NVMEM_OB_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_FWUP_ENABLE == 1)
+
+ubi_err_t nvmem_bank_get_inactive(uint8_t **addr_p, size_t *size_p)
+{
+    ubi_err_t ubi_err;
+
+    do
+    {
+        if (addr_p == NULL || size_p == NULL)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        if (!NVMEM_DUAL_BANK)
+        {
+            ubi_err = UBI_ERR_NOT_SUPPORTED;
+            break;
+        }
+
+        /* The active bank is mapped at FLASH_BASE whatever the bank swap setting, so the inactive bank always follows it */
+        *addr_p = (uint8_t *) (FLASH_BASE + NVMEM_BANK_SIZE);
+        *size_p = NVMEM_BANK_SIZE;
+
+        ubi_err = UBI_ERR_OK;
+    } while (0);
+
+    return ubi_err;
+}
+
+int nvmem_bank_get_active(void)
+{
+    return (FLASH_get_bank(FLASH_BASE) == FLASH_BANK_1) ? 1 : 2;
+}
+
+ubi_err_t nvmem_bank_swap(void)
+{
+    ubi_err_t ubi_err;
+    FLASH_OBProgramInitTypeDef OBInit;
+
+    do
+    {
+#if defined(OB_USER_BFB2)
+        if (!NVMEM_DUAL_BANK)
+        {
+            ubi_err = UBI_ERR_NOT_SUPPORTED;
+            break;
+        }
+
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+        if (nvmem_async_is_busy())
+        {
+            ubi_err = UBI_ERR_BUSY;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+        ubi_err = nvmem_sync();
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+
+        memset(&OBInit, 0, sizeof(OBInit));
+        OBInit.OptionType = OPTIONBYTE_USER;
+        OBInit.USERType = OB_USER_BFB2;
+        /* BFB2 selects the boot bank, the bank mapped at FLASH_BASE now is the one to leave */
+        OBInit.USERConfig = (FLASH_get_bank(FLASH_BASE) == FLASH_BANK_1) ? OB_BFB2_ENABLE : OB_BFB2_DISABLE;
+
+        FLASH_ob_program_launch(&OBInit, 1);
+
+        logme("option byte programming fail");
+        ubi_err = UBI_ERR_INTERNAL;
+#else
+        (void) OBInit;
+        ubi_err = UBI_ERR_NOT_SUPPORTED;
+#endif /* defined(OB_USER_BFB2) */
+    } while (0);
+
+    return ubi_err;
+}
+
+#endif /* (STM32CUBEL4__NVMEM_FWUP_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_STREAM_ENABLE == 1)
+
+/**
+  * @brief  Program the buffer of a stream at its write cursor, erasing each page it enters.
+  *         The cursor advances and the buffer drops its head only by what has been programmed,
+  *         so that the rest is programmed again by the next call after a failure.
+  * @param  In: stream      Open stream.
+  * @param  In: len_bytes   Number of bytes of the buffer to program, multiple of 8.
+  * @retval  0: Success.
+  *         -1: Failure.
+  */
+static int FLASH_stream_program(nvmem_stream_pt stream, uint32_t len_bytes)
+{
+  int ret = 0;
+  uint32_t addr = stream->addr;
+  uint32_t offset = 0;
+  uint32_t len;
+
+  __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ALL_ERRORS);
+
+  while ((ret == 0) && (offset < len_bytes))
+  {
+    if (addr >= stream->erased_end)
+    {
+      /* The cursor enters a new page: erase it once, unless it is already erased */
+      if (FLASH_is_blank(addr, NVMEM_PAGE_SIZE) != 0)
+      {
+        ret = FLASH_page_erase(addr);
+        if (ret != 0)
+        {
+          break;
+        }
+      }
+      stream->erased_end = addr + NVMEM_PAGE_SIZE;
+    }
+
+    len = MIN(len_bytes - offset, stream->erased_end - addr);
+    ret = FLASH_page_program(addr, stream->buf + (offset / 8), len);
+    if (ret == 0)
+    {
+      addr += len;
+      offset += len;
+    }
+  }
+  HAL_FLASH_Lock();
+
+  /* The bytes of the padding of a closing buffer are not counted in buf_len */
+  stream->addr = addr;
+  if (offset >= stream->buf_len)
+  {
+    stream->buf_len = 0;
+  }
+  else if (offset > 0)
+  {
+    memmove(stream->buf, (uint8_t *) stream->buf + offset, stream->buf_len - offset);
+    stream->buf_len -= offset;
+  }
+
+  if (ret != 0)
+  {
+#ifndef CODE_UNDER_FIREWALL
+    printf("Error writing %lu bytes at 0x%08lx\n", (unsigned long) (len_bytes - offset), (unsigned long) addr);
+#endif
+  }
+
+  return ret;
+}
+
+ubi_err_t nvmem_stream_open(nvmem_stream_pt stream, uint8_t *addr, size_t size)
+{
+    ubi_err_t ubi_err;
+    uint32_t address = (uint32_t) addr;
+    uint32_t page_end;
+
+    do
+    {
+        if (stream == NULL || (address % 8U) != 0U || size == 0 ||
+                address < FLASH_BASE || size > (FLASH_BASE + FLASH_SIZE) - address)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+        if (nvmem_async_is_busy())
+        {
+            ubi_err = UBI_ERR_BUSY;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+        if (FLASH_journal_overlaps(address, size))
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_OB_ENABLE == 1)
+        if (FLASH_ob_is_protected(address, size))
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_OB_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_MAP_ENABLE == 1)
+        if (FLASH_map_overlaps(address, size))
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_MAP_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+        /* A cached page written back later would overwrite the stream */
+        if (FLASH_cache_flush_range(address, size, 0) != 0)
+        {
+            ubi_err = UBI_ERR_INTERNAL;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+
+        /* The rest of a first page entered in its middle is programmed without erasing it */
+        page_end = ROUND_UP(address, NVMEM_PAGE_SIZE);
+        if (page_end != address && FLASH_is_blank(address, page_end - address) != 0)
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+
+        stream->addr = address;
+        stream->end = address + size;
+        stream->erased_end = page_end;
+        stream->buf_len = 0;
+        stream->open = 1;
+
+        ubi_err = UBI_ERR_OK;
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_stream_append(nvmem_stream_pt stream, const uint8_t *buf, size_t size)
+{
+    ubi_err_t ubi_err;
+    uint32_t len;
+    int r;
+
+    do
+    {
+        if (stream == NULL || !stream->open)
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+
+        if (buf == NULL && size > 0)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        if (size > stream->end - stream->addr - stream->buf_len)
+        {
+            ubi_err = UBI_ERR_BUF_FULL;
+            break;
+        }
+
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+        /* Checked before any input is taken, so that the caller can retry the whole data */
+        if (stream->buf_len + size > NVMEM_STREAM_BUF_SIZE && nvmem_async_is_busy())
+        {
+            ubi_err = UBI_ERR_BUSY;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+        ubi_err = UBI_ERR_OK;
+
+        while (size > 0)
+        {
+            /* A full buffer is programmed before more input is taken, so that a failure leaves the rest of the input to the caller */
+            if (stream->buf_len == NVMEM_STREAM_BUF_SIZE)
+            {
+                r = FLASH_stream_program(stream, NVMEM_STREAM_BUF_SIZE);
+                if (r != 0)
+                {
+                    ubi_err = UBI_ERR_INTERNAL;
+                    break;
+                }
+            }
+
+            len = MIN(size, NVMEM_STREAM_BUF_SIZE - stream->buf_len);
+            memcpy((uint8_t *) stream->buf + stream->buf_len, buf, len);
+            stream->buf_len += len;
+            buf += len;
+            size -= len;
+        }
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_stream_close(nvmem_stream_pt stream)
+{
+    ubi_err_t ubi_err;
+    uint32_t len;
+    int r;
+
+    do
+    {
+        if (stream == NULL || !stream->open)
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+        if (nvmem_async_is_busy())
+        {
+            ubi_err = UBI_ERR_BUSY;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+        ubi_err = UBI_ERR_OK;
+
+        if (stream->buf_len > 0)
+        {
+            len = ROUND_UP(stream->buf_len, 8);
+            memset((uint8_t *) stream->buf + stream->buf_len, 0xFF, len - stream->buf_len);
+
+            r = FLASH_stream_program(stream, len);
+            if (r != 0)
+            {
+                ubi_err = UBI_ERR_INTERNAL;
+            }
+        }
+
+        stream->open = 0;
+    } while (0);
+
+    return ubi_err;
+}
+
+#endif /* (STM32CUBEL4__NVMEM_STREAM_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_OB_ENABLE == 1)
+
+static const uint32_t _g_nvmem_ob_wrp_area[NVMEM_OB_WRP_AREA_COUNT] =
+{
+    OB_WRPAREA_BANK1_AREAA, OB_WRPAREA_BANK1_AREAB,
+#if defined(OB_WRPAREA_BANK2_AREAA)
+    OB_WRPAREA_BANK2_AREAA, OB_WRPAREA_BANK2_AREAB,
+#else
+    0, 0, /* Single bank part, the bank 2 areas are never read */
+#endif /* defined(OB_WRPAREA_BANK2_AREAA) */
+};
+
+static FLASH_OBProgramInitTypeDef _g_nvmem_ob_pending[NVMEM_OB_PENDING_MAX];
+static uint32_t _g_nvmem_ob_pending_count = 0;
+
+static uint32_t _nvmem_ob_bank_base(uint32_t bank);
+static ubi_err_t _nvmem_ob_queue(const FLASH_OBProgramInitTypeDef *OBInit);
+
+/* Address at which a bank is mapped now */
+static uint32_t _nvmem_ob_bank_base(uint32_t bank)
+{
+    return (FLASH_get_bank(FLASH_BASE) == bank) ? FLASH_BASE : (FLASH_BASE + NVMEM_BANK_SIZE);
+}
+
+static ubi_err_t _nvmem_ob_queue(const FLASH_OBProgramInitTypeDef *OBInit)
+{
+    ubi_err_t ubi_err = UBI_ERR_NO_MEM;
+
+    ubik_entercrit();
+    if (_g_nvmem_ob_pending_count < NVMEM_OB_PENDING_MAX)
+    {
+        _g_nvmem_ob_pending[_g_nvmem_ob_pending_count] = *OBInit;
+        _g_nvmem_ob_pending_count++;
+        ubi_err = UBI_ERR_OK;
+    }
+    ubik_exitcrit();
+
+    return ubi_err;
+}
+
+/**
+  * @brief  Get the WRP and PCROP areas in effect, at their current addresses.
+  * @param  Out: wrp     Write protection areas (NVMEM_OB_WRP_AREA_COUNT).
+  * @param  Out: pcrop   PCROP areas of bank 1 and bank 2.
+  */
+static void FLASH_ob_get_areas(nvmem_ob_area_t *wrp, nvmem_ob_area_t *pcrop)
+{
+  FLASH_OBProgramInitTypeDef OBInit;
+  uint32_t base;
+  uint32_t i;
+
+  memset(wrp, 0, NVMEM_OB_WRP_AREA_COUNT * sizeof(nvmem_ob_area_t));
+  memset(pcrop, 0, 2U * sizeof(nvmem_ob_area_t));
+
+  for (i = 0; i < NVMEM_OB_WRP_AREA_COUNT; i++)
+  {
+    if ((i >= NVMEM_OB_WRP_BANK2_A) && !NVMEM_DUAL_BANK)
+    {
+      break;
+    }
+
+    memset(&OBInit, 0, sizeof(OBInit));
+    OBInit.WRPArea = _g_nvmem_ob_wrp_area[i];
+    HAL_FLASHEx_OBGetConfig(&OBInit);
+
+    /* A start offset above the end offset disables the area */
+    base = _nvmem_ob_bank_base((i < NVMEM_OB_WRP_BANK2_A) ? FLASH_BANK_1 : FLASH_BANK_2);
+    if (OBInit.WRPStartOffset <= OBInit.WRPEndOffset)
+    {
+      wrp[i].addr = (uint8_t *) (base + (OBInit.WRPStartOffset * NVMEM_PAGE_SIZE));
+      wrp[i].size = (OBInit.WRPEndOffset - OBInit.WRPStartOffset + 1U) * NVMEM_PAGE_SIZE;
+    }
+  }
+
+  for (i = 0; i < 2; i++)
+  {
+    if ((i == 1) && !NVMEM_DUAL_BANK)
+    {
+      break;
+    }
+
+    memset(&OBInit, 0, sizeof(OBInit));
+    OBInit.PCROPConfig = (i == 0) ? FLASH_BANK_1 : FLASH_BANK_2;
+    HAL_FLASHEx_OBGetConfig(&OBInit);
+
+    /* The HAL follows the bank swap for the PCROP addresses, the end address is the one of the last granule */
+    if (OBInit.PCROPStartAddr <= OBInit.PCROPEndAddr)
+    {
+      pcrop[i].addr = (uint8_t *) OBInit.PCROPStartAddr;
+      pcrop[i].size = ROUND_DOWN(OBInit.PCROPEndAddr, NVMEM_PCROP_GRANULE) - OBInit.PCROPStartAddr + NVMEM_PCROP_GRANULE;
+    }
+  }
+}
+
+/**
+  * @brief  Check if a FLASH area overlaps a WRP or PCROP area.
+  * @param  In: address     Start address of the area.
+  * @param  In: len_bytes   Length of the area.
+  * @retval  1: The area is protected.
+  *          0: The area is not protected.
+  */
+static int FLASH_ob_is_protected(uint32_t address, uint32_t len_bytes)
+{
+  nvmem_ob_area_t wrp[NVMEM_OB_WRP_AREA_COUNT];
+  nvmem_ob_area_t pcrop[2];
+  uint32_t i;
+
+  FLASH_ob_get_areas(wrp, pcrop);
+
+  for (i = 0; i < NVMEM_OB_WRP_AREA_COUNT + 2U; i++)
+  {
+    nvmem_ob_area_t *area = (i < NVMEM_OB_WRP_AREA_COUNT) ? &wrp[i] : &pcrop[i - NVMEM_OB_WRP_AREA_COUNT];
+
+    if ((area->size != 0U) && (address < (uint32_t) area->addr + area->size) && (address + len_bytes > (uint32_t) area->addr))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+ubi_err_t nvmem_ob_set_wrp(uint32_t area, const uint8_t *addr, size_t size)
+{
+    ubi_err_t ubi_err;
+    FLASH_OBProgramInitTypeDef OBInit;
+    uint32_t bank;
+    uint32_t base;
+
+    do
+    {
+        if (area >= NVMEM_OB_WRP_AREA_COUNT)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        bank = (area < NVMEM_OB_WRP_BANK2_A) ? FLASH_BANK_1 : FLASH_BANK_2;
+        if (bank == FLASH_BANK_2 && !NVMEM_DUAL_BANK)
+        {
+            ubi_err = UBI_ERR_NOT_SUPPORTED;
+            break;
+        }
+        base = _nvmem_ob_bank_base(bank);
+
+        memset(&OBInit, 0, sizeof(OBInit));
+        OBInit.OptionType = OPTIONBYTE_WRP;
+        OBInit.WRPArea = _g_nvmem_ob_wrp_area[area];
+
+        if (size == 0)
+        {
+            OBInit.WRPStartOffset = (NVMEM_BANK_SIZE / NVMEM_PAGE_SIZE) - 1U;
+            OBInit.WRPEndOffset = 0;
+        }
+        else
+        {
+            if ((uint32_t) addr < base || size > (base + NVMEM_BANK_SIZE) - (uint32_t) addr)
+            {
+                ubi_err = UBI_ERR_INVALID_PARAM;
+                break;
+            }
+            OBInit.WRPStartOffset = ((uint32_t) addr - base) / NVMEM_PAGE_SIZE;
+            OBInit.WRPEndOffset = ((uint32_t) addr + size - 1U - base) / NVMEM_PAGE_SIZE;
+        }
+
+        ubi_err = _nvmem_ob_queue(&OBInit);
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_ob_set_pcrop(uint32_t bank, const uint8_t *addr, size_t size, int rdp_erase)
+{
+    ubi_err_t ubi_err;
+    FLASH_OBProgramInitTypeDef OBInit;
+    uint32_t base;
+
+    do
+    {
+        if (bank != 1 && bank != 2)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        if (bank == 2 && !NVMEM_DUAL_BANK)
+        {
+            ubi_err = UBI_ERR_NOT_SUPPORTED;
+            break;
+        }
+
+        memset(&OBInit, 0, sizeof(OBInit));
+        OBInit.OptionType = OPTIONBYTE_PCROP;
+        OBInit.PCROPConfig = (bank == 1) ? FLASH_BANK_1 : FLASH_BANK_2;
+        OBInit.PCROPConfig |= rdp_erase ? OB_PCROP_RDP_ERASE : OB_PCROP_RDP_NOT_ERASE;
+
+        base = _nvmem_ob_bank_base((bank == 1) ? FLASH_BANK_1 : FLASH_BANK_2);
+        if (size == 0)
+        {
+            OBInit.PCROPStartAddr = base + NVMEM_BANK_SIZE - NVMEM_PCROP_GRANULE;
+            OBInit.PCROPEndAddr = base;
+        }
+        else
+        {
+            if ((uint32_t) addr < base || size > (base + NVMEM_BANK_SIZE) - (uint32_t) addr)
+            {
+                ubi_err = UBI_ERR_INVALID_PARAM;
+                break;
+            }
+            OBInit.PCROPStartAddr = ROUND_DOWN((uint32_t) addr, NVMEM_PCROP_GRANULE);
+            OBInit.PCROPEndAddr = ROUND_DOWN((uint32_t) addr + size - 1U, NVMEM_PCROP_GRANULE);
+        }
+
+        ubi_err = _nvmem_ob_queue(&OBInit);
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_ob_set_rdp(uint32_t level)
+{
+    FLASH_OBProgramInitTypeDef OBInit;
+
+    memset(&OBInit, 0, sizeof(OBInit));
+    OBInit.OptionType = OPTIONBYTE_RDP;
+    switch (level)
+    {
+    case NVMEM_OB_RDP_LEVEL_0:
+        OBInit.RDPLevel = OB_RDP_LEVEL_0;
+        break;
+    case NVMEM_OB_RDP_LEVEL_1:
+        OBInit.RDPLevel = OB_RDP_LEVEL_1;
+        break;
+    case NVMEM_OB_RDP_LEVEL_2:
+        OBInit.RDPLevel = OB_RDP_LEVEL_2;
+        break;
+    default:
+        return UBI_ERR_INVALID_PARAM;
+    }
+
+    return _nvmem_ob_queue(&OBInit);
+}
+
+ubi_err_t nvmem_ob_set_bfb2(int enable)
+{
+#if defined(OB_USER_BFB2)
+    FLASH_OBProgramInitTypeDef OBInit;
+
+    memset(&OBInit, 0, sizeof(OBInit));
+    OBInit.OptionType = OPTIONBYTE_USER;
+    OBInit.USERType = OB_USER_BFB2;
+    OBInit.USERConfig = enable ? OB_BFB2_ENABLE : OB_BFB2_DISABLE;
+
+    return _nvmem_ob_queue(&OBInit);
+#else
+    (void) enable;
+    return UBI_ERR_NOT_SUPPORTED;
+#endif /* defined(OB_USER_BFB2) */
+}
+
+ubi_err_t nvmem_ob_set_dualbank(int enable)
+{
+#if defined(FLASH_OPTR_DUALBANK) || defined(FLASH_OPTR_DBANK)
+    FLASH_OBProgramInitTypeDef OBInit;
+
+    memset(&OBInit, 0, sizeof(OBInit));
+    OBInit.OptionType = OPTIONBYTE_USER;
+#if defined(FLASH_OPTR_DUALBANK)
+    OBInit.USERType = OB_USER_DUALBANK;
+    OBInit.USERConfig = enable ? OB_DUALBANK_DUAL : OB_DUALBANK_SINGLE;
+#else
+    OBInit.USERType = OB_USER_DBANK;
+    OBInit.USERConfig = enable ? OB_DBANK_64_BITS : OB_DBANK_128_BITS;
+#endif
+
+    return _nvmem_ob_queue(&OBInit);
+#else
+    (void) enable;
+
+    return UBI_ERR_NOT_SUPPORTED;
+#endif /* defined(FLASH_OPTR_DUALBANK) || defined(FLASH_OPTR_DBANK) */
+}
+
+void nvmem_ob_discard(void)
+{
+    ubik_entercrit();
+    _g_nvmem_ob_pending_count = 0;
+    ubik_exitcrit();
+}
+
+uint32_t nvmem_ob_get_pending_count(void)
+{
+    return _g_nvmem_ob_pending_count;
+}
+
+ubi_err_t nvmem_ob_commit(void)
+{
+    ubi_err_t ubi_err;
+
+    do
+    {
+        if (_g_nvmem_ob_pending_count == 0)
+        {
+            ubi_err = UBI_ERR_OK;
+            break;
+        }
+
+#if (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+        if (nvmem_async_is_busy())
+        {
+            ubi_err = UBI_ERR_BUSY;
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+        ubi_err = nvmem_sync();
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+
+        FLASH_ob_program_launch(_g_nvmem_ob_pending, _g_nvmem_ob_pending_count);
+
+        logme("option byte programming fail");
+        _g_nvmem_ob_pending_count = 0;
+        ubi_err = UBI_ERR_INTERNAL;
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_ob_get_info(nvmem_ob_info_t *info_p)
+{
+    ubi_err_t ubi_err;
+    FLASH_OBProgramInitTypeDef OBInit;
+
+    do
+    {
+        if (info_p == NULL)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        memset(info_p, 0, sizeof(nvmem_ob_info_t));
+        FLASH_ob_get_areas(info_p->wrp, info_p->pcrop);
+
+        memset(&OBInit, 0, sizeof(OBInit));
+        OBInit.PCROPConfig = FLASH_BANK_1;
+        HAL_FLASHEx_OBGetConfig(&OBInit);
+
+        info_p->pcrop_rdp_erase = ((OBInit.PCROPConfig & OB_PCROP_RDP_ERASE) == OB_PCROP_RDP_ERASE) ? 1 : 0;
+        if (OBInit.RDPLevel == OB_RDP_LEVEL_0)
+        {
+            info_p->rdp_level = NVMEM_OB_RDP_LEVEL_0;
+        }
+        else if (OBInit.RDPLevel == OB_RDP_LEVEL_2)
+        {
+            info_p->rdp_level = NVMEM_OB_RDP_LEVEL_2;
+        }
+        else
+        {
+            /* Any other value is level 1 */
+            info_p->rdp_level = NVMEM_OB_RDP_LEVEL_1;
+        }
+        info_p->bfb2 = ((OBInit.USERConfig & FLASH_OPTR_BFB2) != 0U) ? 1 : 0;
+#if defined(FLASH_OPTR_DUALBANK)
+        info_p->dualbank = ((OBInit.USERConfig & FLASH_OPTR_DUALBANK) != 0U) ? 1 : 0;
+#elif defined(FLASH_OPTR_DBANK)
+        info_p->dualbank = ((OBInit.USERConfig & FLASH_OPTR_DBANK) != 0U) ? 1 : 0;
+#else
+        info_p->dualbank = 1;
+#endif
+
+        ubi_err = UBI_ERR_OK;
+    } while (0);
+
+    return ubi_err;
+}
+
+int nvmem_is_protected(const uint8_t *addr, size_t size)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+    return FLASH_ob_is_protected((uint32_t) addr, size);
+}
+
+#endif /* (STM32CUBEL4__NVMEM_OB_ENABLE == 1) */
+
+#if 0
+/**
+  * @brief  This function writes a data buffer in flash (data are 32-bit aligned).
+  * @note   After writing data buffer, the flash content is checked.
+  * @param  uDestination: Start address for target location
+  * @param  pSource: pointer on buffer with data to write
+  * @param  uLength: Length of data buffer in byte. It has to be 64-bit aligned.
+  * @retval uint32_t 0: Data successfully written to Flash memory
+  *         1: Error occurred while writing data in Flash memory
+  *         2: Written Data in flash memory is different from expected one
+  */
+int FLASH_Write(uint32_t uDestination, uint32_t *pSource, uint32_t uLength)
+{
+  uint32_t e_ret_status = HAL_ERROR;
+  uint32_t i = 0U;
+
+  /* Initialize Flash */
+  e_ret_status = FLASH_Init();
+
+  if (e_ret_status == HAL_OK)
+  {
+    /* Unlock the Flash to enable the flash control register access *************/
+    if (HAL_FLASH_Unlock() != HAL_OK)
+    {
+      return HAL_ERROR;
+
+    }
+    else
+    {
+
+      /* DataLength must be a multiple of 64 bit */
+      for (i = 0U; i < uLength / 8U; i++)
+      {
+        /* Device voltage range supposed to be [2.7V to 3.6V], the operation will
+        be done by word */
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, uDestination, *((uint64_t *)(pSource + 2U * i))) == HAL_OK)
+        {
+          /* Check the written value */
+          if (*(uint64_t *)uDestination != *(uint64_t *)(pSource + 2U * i))
+          {
+            /* Flash content doesn't match SRAM content */
+            e_ret_status = HAL_ERROR;
+            break;
+          }
+          /* Increment FLASH Destination address */
+          uDestination += 8U;
+        }
+        else
+        {
+          /* Error occurred while writing data in Flash memory */
+          e_ret_status = HAL_ERROR;
+          break;
+        }
+      }
+      /* Lock the Flash to disable the flash control register access (recommended
+      to protect the FLASH memory against possible unwanted operation) *********/
+      HAL_FLASH_Lock();
+    }
+  }
+  return e_ret_status;
+}
+#endif
+
+#endif /* (INCLUDE__STM32CUBEL4_EXTENSION == 1) */
+#endif /* (UBINOS__UBIDRV__INCLUDE_NVMEM == 1) */
+
@@ -0,0 +1,395 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos/ubidrv/nvmem.h>
+
+#if (UBINOS__UBIDRV__INCLUDE_NVMEM == 1)
+#if (STM32CUBEL4__NVMEM_FWUP_ENABLE == 1)
+
+#include <stm32cubel4_extension/nvmem.h>
+#include <stm32cubel4_extension/nvmem_fwup.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#undef LOGM_CATEGORY
+#define LOGM_CATEGORY LOGM_CATEGORY__NVMEM
+
+#if (STM32CUBEL4__NVMEM_FWUP_CHUNK_SIZE % 8) != 0
+#error "STM32CUBEL4__NVMEM_FWUP_CHUNK_SIZE shall be a multiple of 8"
+#endif
+
+#define NVMEM_FWUP_RX_SIZE          64
+
+static ubi_err_t _nvmem_fwup_write_chunk(nvmem_fwup_pt fwup);
+static ubi_err_t _nvmem_fwup_check_vectors(nvmem_fwup_pt fwup);
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 0)
+static uint32_t _nvmem_fwup_crc32(uint32_t crc, const uint8_t * data, uint32_t len);
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 0) */
+static ubi_err_t _nvmem_fwup_dtty_read(uint8_t * buf, uint32_t len, uint32_t timeoutms);
+
+/* Writes the chunk at its place in the image */
+static ubi_err_t _nvmem_fwup_write_chunk(nvmem_fwup_pt fwup)
+{
+    ubi_err_t ubi_err;
+    uint32_t chunk_offset;
+
+    if (fwup->chunk_len == 0)
+    {
+        return UBI_ERR_OK;
+    }
+
+    chunk_offset = fwup->offset - fwup->chunk_len;
+    ubi_err = nvmem_update(fwup->base + chunk_offset, (const uint8_t *) fwup->chunk, fwup->chunk_len);
+    if (ubi_err == UBI_ERR_OK)
+    {
+        fwup->chunk_len = 0;
+    }
+
+    return ubi_err;
+}
+
+/* The initial stack pointer shall be in the SRAM and the reset handler a Thumb address in the active bank area */
+static ubi_err_t _nvmem_fwup_check_vectors(nvmem_fwup_pt fwup)
+{
+    uint32_t vectors[2];
+    uint32_t active_base;
+
+    if (fwup->image_size < sizeof(vectors))
+    {
+        return UBI_ERR_INVALID_DATA;
+    }
+
+    memcpy(vectors, fwup->base, sizeof(vectors));
+    active_base = (uint32_t) fwup->base - fwup->bank_size;
+
+    /* SRAM1 (0x20000000) or SRAM2 (0x10000000) */
+    if (((vectors[0] & 0xFF000000UL) != 0x20000000UL && (vectors[0] & 0xFF000000UL) != 0x10000000UL) ||
+            (vectors[0] & 0x3UL) != 0)
+    {
+        return UBI_ERR_INVALID_DATA;
+    }
+    if ((vectors[1] & 0x1UL) == 0 || vectors[1] < active_base || vectors[1] >= active_base + fwup->image_size)
+    {
+        return UBI_ERR_INVALID_DATA;
+    }
+
+    return UBI_ERR_OK;
+}
+
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 0)
+/* CRC-32 (IEEE 802.3, reflected), a nibble at a time */
+static uint32_t _nvmem_fwup_crc32(uint32_t crc, const uint8_t * data, uint32_t len)
+{
+    static const uint32_t table[16] =
+    {
+        0x00000000UL, 0x1DB71064UL, 0x3B6E20C8UL, 0x26D930ACUL,
+        0x76DC4190UL, 0x6B6B51F4UL, 0x4DB26158UL, 0x5005713CUL,
+        0xEDB88320UL, 0xF00F9344UL, 0xD6D6A3E8UL, 0xCB61B38CUL,
+        0x9B64C2B0UL, 0x86D3D2D4UL, 0xA00AE278UL, 0xBDBDF21CUL,
+    };
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+
+    return crc;
+}
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 0) */
+
+/* Reads len bytes from the dtty, waiting at most timeoutms for each of them */
+static ubi_err_t _nvmem_fwup_dtty_read(uint8_t * buf, uint32_t len, uint32_t timeoutms)
+{
+    uint32_t idlems = 0;
+    uint32_t i = 0;
+    char ch;
+
+    while (i < len)
+    {
+        if (dtty_getc_unblocked(&ch) == 0)
+        {
+            buf[i++] = (uint8_t) ch;
+            idlems = 0;
+        }
+        else
+        {
+            if (idlems >= timeoutms)
+            {
+                return UBI_ERR_TIMEOUT;
+            }
+            task_sleepms(1);
+            idlems++;
+        }
+    }
+
+    return UBI_ERR_OK;
+}
+
+ubi_err_t nvmem_fwup_begin(nvmem_fwup_pt fwup, uint32_t image_size)
+{
+    ubi_err_t ubi_err;
+    size_t bank_size;
+
+    do
+    {
+        if (fwup == NULL || image_size == 0)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        ubi_err = nvmem_bank_get_inactive(&fwup->base, &bank_size);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+
+        if (image_size > bank_size)
+        {
+            ubi_err = UBI_ERR_NO_MEM;
+            break;
+        }
+
+        fwup->bank_size = bank_size;
+        fwup->image_size = image_size;
+        fwup->offset = 0;
+        fwup->chunk_len = 0;
+        fwup->state = NVMEM_FWUP_STATE_WRITING;
+
+        ubi_err = UBI_ERR_OK;
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_fwup_write(nvmem_fwup_pt fwup, const uint8_t * data, size_t size)
+{
+    ubi_err_t ubi_err;
+    uint32_t len;
+
+    do
+    {
+        if (fwup == NULL || fwup->state != NVMEM_FWUP_STATE_WRITING)
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+
+        if (data == NULL && size > 0)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        if (size > fwup->image_size - fwup->offset)
+        {
+            ubi_err = UBI_ERR_BUF_FULL;
+            break;
+        }
+
+        ubi_err = UBI_ERR_OK;
+
+        while (size > 0)
+        {
+            len = sizeof(fwup->chunk) - fwup->chunk_len;
+            len = (size < len) ? size : len;
+
+            memcpy((uint8_t *) fwup->chunk + fwup->chunk_len, data, len);
+            fwup->chunk_len += len;
+            fwup->offset += len;
+            data += len;
+            size -= len;
+
+            if (fwup->chunk_len == sizeof(fwup->chunk))
+            {
+                ubi_err = _nvmem_fwup_write_chunk(fwup);
+                if (ubi_err != UBI_ERR_OK)
+                {
+                    logme("nvmem_update fail");
+                    fwup->state = NVMEM_FWUP_STATE_IDLE;
+                    break;
+                }
+            }
+        }
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_fwup_finish(nvmem_fwup_pt fwup, uint32_t expected_crc)
+{
+    ubi_err_t ubi_err;
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 0)
+    uint8_t buf[NVMEM_FWUP_RX_SIZE];
+    uint32_t crc;
+    uint32_t offset;
+    uint32_t len;
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 0) */
+
+    do
+    {
+        if (fwup == NULL || fwup->state != NVMEM_FWUP_STATE_WRITING)
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+
+        fwup->state = NVMEM_FWUP_STATE_IDLE;
+
+        if (fwup->offset != fwup->image_size)
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+
+        ubi_err = _nvmem_fwup_write_chunk(fwup);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+        ubi_err = nvmem_sync();
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+
+        /* The FLASH contents are checked, not the received data */
+#if (STM32CUBEL4__NVMEM_CRC_ENABLE == 1)
+        ubi_err = nvmem_check(fwup->base, fwup->image_size, expected_crc);
+#else
+        crc = 0xFFFFFFFFUL;
+        for (offset = 0; offset < fwup->image_size; offset += len)
+        {
+            len = fwup->image_size - offset;
+            len = (len < sizeof(buf)) ? len : sizeof(buf);
+            memcpy(buf, fwup->base + offset, len);
+            crc = _nvmem_fwup_crc32(crc, buf, len);
+        }
+        ubi_err = (~crc == expected_crc) ? UBI_ERR_OK : UBI_ERR_INVALID_DATA;
+#endif /* (STM32CUBEL4__NVMEM_CRC_ENABLE == 1) */
+        if (ubi_err != UBI_ERR_OK)
+        {
+            logme("image crc mismatch");
+            break;
+        }
+
+        ubi_err = _nvmem_fwup_check_vectors(fwup);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            logme("image vector table not valid");
+            break;
+        }
+
+        fwup->state = NVMEM_FWUP_STATE_VERIFIED;
+    } while (0);
+
+    return ubi_err;
+}
+
+void nvmem_fwup_abort(nvmem_fwup_pt fwup)
+{
+    if (fwup != NULL)
+    {
+        fwup->chunk_len = 0;
+        fwup->state = NVMEM_FWUP_STATE_IDLE;
+    }
+}
+
+ubi_err_t nvmem_fwup_activate(nvmem_fwup_pt fwup)
+{
+    ubi_err_t ubi_err;
+
+    do
+    {
+        if (fwup == NULL || fwup->state != NVMEM_FWUP_STATE_VERIFIED)
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+
+        ubi_err = nvmem_bank_swap();
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_fwup_receive(nvmem_fwup_pt fwup, uint32_t timeoutms)
+{
+    ubi_err_t ubi_err;
+    uint8_t buf[NVMEM_FWUP_RX_SIZE];
+    uint32_t hdr[NVMEM_FWUP_HDR_SIZE / sizeof(uint32_t)];
+    uint32_t remaining;
+    uint32_t len;
+    int echo;
+
+    if (fwup == NULL)
+    {
+        return UBI_ERR_INVALID_PARAM;
+    }
+
+    echo = dtty_getecho();
+    dtty_setecho(0);
+
+    do
+    {
+        ubi_err = _nvmem_fwup_dtty_read((uint8_t *) hdr, NVMEM_FWUP_HDR_SIZE, timeoutms);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+
+        if (hdr[0] != NVMEM_FWUP_HDR_MAGIC)
+        {
+            ubi_err = UBI_ERR_INVALID_DATA;
+            break;
+        }
+
+        ubi_err = nvmem_fwup_begin(fwup, hdr[1]);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+
+        for (remaining = hdr[1]; remaining > 0; remaining -= len)
+        {
+            len = (remaining < sizeof(buf)) ? remaining : sizeof(buf);
+
+            ubi_err = _nvmem_fwup_dtty_read(buf, len, timeoutms);
+            if (ubi_err != UBI_ERR_OK)
+            {
+                break;
+            }
+
+            ubi_err = nvmem_fwup_write(fwup, buf, len);
+            if (ubi_err != UBI_ERR_OK)
+            {
+                break;
+            }
+        }
+        if (ubi_err != UBI_ERR_OK)
+        {
+            nvmem_fwup_abort(fwup);
+            break;
+        }
+
+        ubi_err = nvmem_fwup_finish(fwup, hdr[2]);
+    } while (0);
+
+    dtty_setecho(echo);
+
+    return ubi_err;
+}
+
+#endif /* (STM32CUBEL4__NVMEM_FWUP_ENABLE == 1) */
+#endif /* (UBINOS__UBIDRV__INCLUDE_NVMEM == 1) */
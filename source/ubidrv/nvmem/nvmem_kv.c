@@ -0,0 +1,946 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos/ubidrv/nvmem.h>
+
+#if (UBINOS__UBIDRV__INCLUDE_NVMEM == 1)
+#if (STM32CUBEL4__NVMEM_KV_ENABLE == 1)
+
+#include <stm32cubel4_extension/nvmem.h>
+#include <stm32cubel4_extension/nvmem_kv.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#undef LOGM_CATEGORY
+#define LOGM_CATEGORY LOGM_CATEGORY__NVMEM
+
+#define NVMEM_KV_PAGE_MAGIC         0x564B564EUL /* "NVKV" */
+#define NVMEM_KV_PAGE_HDR_SIZE      16
+#define NVMEM_KV_REC_HDR_SIZE       8
+#define NVMEM_KV_REC_ALIGN          8
+
+#define NVMEM_KV_REC_VALUE          0x5AA5
+#define NVMEM_KV_REC_DELETE         0xA55A
+#define NVMEM_KV_REC_END            0xFFFF
+
+#define NVMEM_KV_SLOT_EMPTY         0
+#define NVMEM_KV_SLOT_DELETED       1
+
+#define NVMEM_KV_ERASE_COUNT_UNKNOWN 0xFFFFFFFF
+
+#define NVMEM_KV_CHUNK_SIZE         32
+
+typedef struct _nvmem_kv_page_hdr_t
+{
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t erase_count;
+    uint32_t check;
+} nvmem_kv_page_hdr_t;
+
+typedef struct _nvmem_kv_rec_hdr_t
+{
+    uint16_t type;
+    uint16_t key_len;
+    uint16_t value_len;
+    uint16_t crc;
+} nvmem_kv_rec_hdr_t;
+
+static void _nvmem_kv_lock(nvmem_kv_pt kv);
+static void _nvmem_kv_unlock(nvmem_kv_pt kv);
+static uint8_t * _nvmem_kv_page_addr(nvmem_kv_pt kv, uint32_t page);
+static uint32_t _nvmem_kv_rec_size(const nvmem_kv_rec_hdr_t * hdr);
+static uint16_t _nvmem_kv_crc16(uint16_t crc, const uint8_t * data, uint32_t len);
+static uint32_t _nvmem_kv_hash(const uint8_t * key, uint32_t key_len);
+static int _nvmem_kv_page_hdr_is_valid(const nvmem_kv_page_hdr_t * hdr);
+static int _nvmem_kv_rec_is_valid(nvmem_kv_pt kv, const uint8_t * addr, const nvmem_kv_rec_hdr_t * hdr, uint32_t room);
+static int _nvmem_kv_key_equals(const uint8_t * addr, const uint8_t * key, uint32_t key_len);
+static nvmem_kv_slot_t * _nvmem_kv_index_find(nvmem_kv_pt kv, const uint8_t * key, uint32_t key_len, uint32_t hash);
+static ubi_err_t _nvmem_kv_index_set(nvmem_kv_pt kv, const uint8_t * key, uint32_t key_len, uint32_t hash, uint32_t addr);
+static ubi_err_t _nvmem_kv_open_page(nvmem_kv_pt kv, uint32_t reserve);
+static ubi_err_t _nvmem_kv_write_rec(nvmem_kv_pt kv, const uint8_t * rec, uint32_t rec_size, uint32_t reserve, uint32_t * addr_p);
+static ubi_err_t _nvmem_kv_append(nvmem_kv_pt kv, uint16_t type, const uint8_t * key, uint32_t key_len, const uint8_t * value, uint32_t value_len, uint32_t * addr_p);
+static ubi_err_t _nvmem_kv_compact_tail(nvmem_kv_pt kv);
+static uint32_t _nvmem_kv_free_space(nvmem_kv_pt kv);
+static ubi_err_t _nvmem_kv_make_room(nvmem_kv_pt kv, uint32_t rec_size);
+static void _nvmem_kv_replay_page(nvmem_kv_pt kv, uint32_t page);
+
+static void _nvmem_kv_lock(nvmem_kv_pt kv)
+{
+    if (kv->lock != NULL)
+    {
+        mutex_lock(kv->lock);
+    }
+}
+
+static void _nvmem_kv_unlock(nvmem_kv_pt kv)
+{
+    if (kv->lock != NULL)
+    {
+        mutex_unlock(kv->lock);
+    }
+}
+
+static uint8_t * _nvmem_kv_page_addr(nvmem_kv_pt kv, uint32_t page)
+{
+    return kv->base + (page * kv->page_size);
+}
+
+static uint32_t _nvmem_kv_rec_size(const nvmem_kv_rec_hdr_t * hdr)
+{
+    uint32_t size = NVMEM_KV_REC_HDR_SIZE + hdr->key_len + hdr->value_len;
+
+    return ((size + NVMEM_KV_REC_ALIGN - 1) / NVMEM_KV_REC_ALIGN) * NVMEM_KV_REC_ALIGN;
+}
+
+/* CRC-16/CCITT-FALSE */
+static uint16_t _nvmem_kv_crc16(uint16_t crc, const uint8_t * data, uint32_t len)
+{
+    uint32_t i;
+    int j;
+
+    for (i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t) data[i] << 8;
+        for (j = 0; j < 8; j++)
+        {
+            crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+        }
+    }
+
+    return crc;
+}
+
+/* FNV-1a */
+static uint32_t _nvmem_kv_hash(const uint8_t * key, uint32_t key_len)
+{
+    uint32_t hash = 2166136261UL;
+    uint32_t i;
+
+    for (i = 0; i < key_len; i++)
+    {
+        hash ^= key[i];
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
+
+static int _nvmem_kv_page_hdr_is_valid(const nvmem_kv_page_hdr_t * hdr)
+{
+    if (hdr->magic != NVMEM_KV_PAGE_MAGIC)
+    {
+        return 0;
+    }
+
+    if (hdr->check != (hdr->magic ^ hdr->seq ^ hdr->erase_count))
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+static int _nvmem_kv_rec_is_valid(nvmem_kv_pt kv, const uint8_t * addr, const nvmem_kv_rec_hdr_t * hdr, uint32_t room)
+{
+    uint8_t chunk[NVMEM_KV_CHUNK_SIZE];
+    uint32_t remaining;
+    uint32_t len;
+    uint16_t crc;
+
+    (void) kv;
+
+    if (hdr->type != NVMEM_KV_REC_VALUE && hdr->type != NVMEM_KV_REC_DELETE)
+    {
+        return 0;
+    }
+
+    if (hdr->key_len == 0 || hdr->key_len > NVMEM_KV_KEY_LEN_MAX)
+    {
+        return 0;
+    }
+
+    if (_nvmem_kv_rec_size(hdr) > room)
+    {
+        return 0;
+    }
+
+    crc = _nvmem_kv_crc16(0xFFFF, (const uint8_t *) hdr, NVMEM_KV_REC_HDR_SIZE - sizeof(uint16_t));
+    addr += NVMEM_KV_REC_HDR_SIZE;
+    remaining = hdr->key_len + hdr->value_len;
+    while (remaining > 0)
+    {
+        len = (remaining < NVMEM_KV_CHUNK_SIZE) ? remaining : NVMEM_KV_CHUNK_SIZE;
+        nvmem_read(addr, chunk, len);
+        crc = _nvmem_kv_crc16(crc, chunk, len);
+        addr += len;
+        remaining -= len;
+    }
+
+    return (crc == hdr->crc) ? 1 : 0;
+}
+
+static int _nvmem_kv_key_equals(const uint8_t * addr, const uint8_t * key, uint32_t key_len)
+{
+    nvmem_kv_rec_hdr_t hdr;
+    uint8_t rec_key[NVMEM_KV_KEY_LEN_MAX];
+
+    nvmem_read(addr, (uint8_t *) &hdr, sizeof(nvmem_kv_rec_hdr_t));
+    if (hdr.key_len != key_len)
+    {
+        return 0;
+    }
+
+    nvmem_read(addr + NVMEM_KV_REC_HDR_SIZE, rec_key, key_len);
+
+    return (memcmp(rec_key, key, key_len) == 0) ? 1 : 0;
+}
+
+static nvmem_kv_slot_t * _nvmem_kv_index_find(nvmem_kv_pt kv, const uint8_t * key, uint32_t key_len, uint32_t hash)
+{
+    uint32_t mask = kv->index_size - 1;
+    uint32_t i = hash & mask;
+    uint32_t n;
+    nvmem_kv_slot_t * slot;
+
+    for (n = 0; n < kv->index_size; n++)
+    {
+        slot = &kv->index[i];
+        if (slot->addr == NVMEM_KV_SLOT_EMPTY)
+        {
+            break;
+        }
+        if (slot->addr != NVMEM_KV_SLOT_DELETED && slot->hash == hash &&
+                _nvmem_kv_key_equals((const uint8_t *) slot->addr, key, key_len))
+        {
+            return slot;
+        }
+        i = (i + 1) & mask;
+    }
+
+    return NULL;
+}
+
+static ubi_err_t _nvmem_kv_index_set(nvmem_kv_pt kv, const uint8_t * key, uint32_t key_len, uint32_t hash, uint32_t addr)
+{
+    uint32_t mask = kv->index_size - 1;
+    uint32_t i = hash & mask;
+    uint32_t n;
+    nvmem_kv_slot_t * slot;
+    nvmem_kv_slot_t * free_slot = NULL;
+
+    slot = _nvmem_kv_index_find(kv, key, key_len, hash);
+    if (slot != NULL)
+    {
+        slot->addr = addr;
+        return UBI_ERR_OK;
+    }
+
+    for (n = 0; n < kv->index_size; n++)
+    {
+        slot = &kv->index[i];
+        if (slot->addr == NVMEM_KV_SLOT_DELETED)
+        {
+            free_slot = slot;
+            break;
+        }
+        if (slot->addr == NVMEM_KV_SLOT_EMPTY)
+        {
+            /* Keep the load factor under 3/4 so that the probe sequences stay short */
+            if ((kv->index_used + 1) * 4 > kv->index_size * 3)
+            {
+                return UBI_ERR_NO_MEM;
+            }
+            kv->index_used++;
+            free_slot = slot;
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if (free_slot == NULL)
+    {
+        return UBI_ERR_NO_MEM;
+    }
+
+    free_slot->hash = hash;
+    free_slot->addr = addr;
+
+    return UBI_ERR_OK;
+}
+
+/* Starts a new head page. At least reserve free pages are kept for compaction. */
+static ubi_err_t _nvmem_kv_open_page(nvmem_kv_pt kv, uint32_t reserve)
+{
+    ubi_err_t ubi_err;
+    nvmem_kv_page_hdr_t hdr;
+    uint32_t next;
+
+    do
+    {
+        if (kv->page_count - kv->used_pages <= reserve)
+        {
+            ubi_err = UBI_ERR_NO_MEM;
+            break;
+        }
+
+        next = (kv->used_pages == 0) ? kv->head_page : (kv->head_page + 1) % kv->page_count;
+
+        hdr.magic = NVMEM_KV_PAGE_MAGIC;
+        hdr.seq = kv->head_seq + 1;
+        hdr.erase_count = kv->erase_counts[next];
+        hdr.check = hdr.magic ^ hdr.seq ^ hdr.erase_count;
+
+        ubi_err = nvmem_update(_nvmem_kv_page_addr(kv, next), (const uint8_t *) &hdr, sizeof(nvmem_kv_page_hdr_t));
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+
+        if (kv->used_pages == 0)
+        {
+            kv->tail_page = next;
+        }
+        kv->head_page = next;
+        kv->head_offset = NVMEM_KV_PAGE_HDR_SIZE;
+        kv->head_seq = hdr.seq;
+        kv->used_pages++;
+    } while (0);
+
+    return ubi_err;
+}
+
+static ubi_err_t _nvmem_kv_write_rec(nvmem_kv_pt kv, const uint8_t * rec, uint32_t rec_size, uint32_t reserve, uint32_t * addr_p)
+{
+    ubi_err_t ubi_err;
+    uint8_t * addr;
+
+    do
+    {
+        if (rec_size > kv->page_size - NVMEM_KV_PAGE_HDR_SIZE)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        if (kv->used_pages == 0 || kv->head_offset + rec_size > kv->page_size)
+        {
+            ubi_err = _nvmem_kv_open_page(kv, reserve);
+            if (ubi_err != UBI_ERR_OK)
+            {
+                break;
+            }
+        }
+
+        addr = _nvmem_kv_page_addr(kv, kv->head_page) + kv->head_offset;
+        ubi_err = nvmem_update(addr, rec, rec_size);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            /* The rest of the page may be partially programmed: it is not used any more */
+            kv->head_offset = kv->page_size;
+            break;
+        }
+
+        kv->head_offset += rec_size;
+        *addr_p = (uint32_t) addr;
+    } while (0);
+
+    return ubi_err;
+}
+
+static ubi_err_t _nvmem_kv_append(nvmem_kv_pt kv, uint16_t type, const uint8_t * key, uint32_t key_len, const uint8_t * value, uint32_t value_len, uint32_t * addr_p)
+{
+    ubi_err_t ubi_err;
+    nvmem_kv_rec_hdr_t hdr;
+    uint32_t rec_size;
+    uint8_t * rec;
+    uint16_t crc;
+
+    hdr.type = type;
+    hdr.key_len = (uint16_t) key_len;
+    hdr.value_len = (uint16_t) value_len;
+    rec_size = _nvmem_kv_rec_size(&hdr);
+
+    crc = _nvmem_kv_crc16(0xFFFF, (const uint8_t *) &hdr, NVMEM_KV_REC_HDR_SIZE - sizeof(uint16_t));
+    crc = _nvmem_kv_crc16(crc, key, key_len);
+    crc = _nvmem_kv_crc16(crc, value, value_len);
+    hdr.crc = crc;
+
+    rec = (uint8_t *) malloc(rec_size);
+    if (rec == NULL)
+    {
+        return UBI_ERR_NO_MEM;
+    }
+
+    memset(rec, 0xFF, rec_size);
+    memcpy(rec, &hdr, NVMEM_KV_REC_HDR_SIZE);
+    memcpy(rec + NVMEM_KV_REC_HDR_SIZE, key, key_len);
+    if (value_len > 0)
+    {
+        memcpy(rec + NVMEM_KV_REC_HDR_SIZE + key_len, value, value_len);
+    }
+
+    ubi_err = _nvmem_kv_make_room(kv, rec_size);
+    if (ubi_err == UBI_ERR_OK)
+    {
+        ubi_err = _nvmem_kv_write_rec(kv, rec, rec_size, 1, addr_p);
+    }
+
+    free(rec);
+
+    return ubi_err;
+}
+
+/* Copies the live records of the oldest page to the head, then erases it. */
+static ubi_err_t _nvmem_kv_compact_tail(nvmem_kv_pt kv)
+{
+    ubi_err_t ubi_err = UBI_ERR_OK;
+    nvmem_kv_rec_hdr_t hdr;
+    nvmem_kv_slot_t * slot;
+    uint8_t key[NVMEM_KV_KEY_LEN_MAX];
+    uint8_t * page_addr;
+    uint8_t * addr;
+    uint8_t * rec;
+    uint32_t offset;
+    uint32_t rec_size;
+    uint32_t new_addr;
+
+    page_addr = _nvmem_kv_page_addr(kv, kv->tail_page);
+
+    for (offset = NVMEM_KV_PAGE_HDR_SIZE; offset + NVMEM_KV_REC_HDR_SIZE <= kv->page_size; offset += rec_size)
+    {
+        addr = page_addr + offset;
+        nvmem_read(addr, (uint8_t *) &hdr, sizeof(nvmem_kv_rec_hdr_t));
+        if (hdr.type == NVMEM_KV_REC_END || !_nvmem_kv_rec_is_valid(kv, addr, &hdr, kv->page_size - offset))
+        {
+            break;
+        }
+        rec_size = _nvmem_kv_rec_size(&hdr);
+
+        nvmem_read(addr + NVMEM_KV_REC_HDR_SIZE, key, hdr.key_len);
+        slot = _nvmem_kv_index_find(kv, key, hdr.key_len, _nvmem_kv_hash(key, hdr.key_len));
+        if (slot == NULL || slot->addr != (uint32_t) addr)
+        {
+            /* Superseded record */
+            continue;
+        }
+
+        if (hdr.type == NVMEM_KV_REC_DELETE)
+        {
+            /* There is no older record of the key left, so the delete record is dropped */
+            slot->addr = NVMEM_KV_SLOT_DELETED;
+            continue;
+        }
+
+        rec = (uint8_t *) malloc(rec_size);
+        if (rec == NULL)
+        {
+            ubi_err = UBI_ERR_NO_MEM;
+            break;
+        }
+        nvmem_read(addr, rec, rec_size);
+        ubi_err = _nvmem_kv_write_rec(kv, rec, rec_size, 0, &new_addr);
+        free(rec);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+        slot->addr = new_addr;
+    }
+
+    if (ubi_err == UBI_ERR_OK)
+    {
+        ubi_err = nvmem_erase(page_addr, kv->page_size);
+    }
+    if (ubi_err == UBI_ERR_OK)
+    {
+        kv->erase_counts[kv->tail_page]++;
+        kv->tail_page = (kv->tail_page + 1) % kv->page_count;
+        kv->used_pages--;
+    }
+
+    return ubi_err;
+}
+
+/* Record space left in the free pages and in the head page. */
+static uint32_t _nvmem_kv_free_space(nvmem_kv_pt kv)
+{
+    uint32_t free_space;
+
+    free_space = (kv->page_count - kv->used_pages) * (kv->page_size - NVMEM_KV_PAGE_HDR_SIZE);
+    if (kv->used_pages > 0)
+    {
+        free_space += kv->page_size - kv->head_offset;
+    }
+
+    return free_space;
+}
+
+/* Compacts the oldest pages if the record does not fit in the head page and free pages run short. */
+static ubi_err_t _nvmem_kv_make_room(nvmem_kv_pt kv, uint32_t rec_size)
+{
+    ubi_err_t ubi_err = UBI_ERR_OK;
+    uint32_t free_space;
+    uint32_t i;
+
+    if (kv->used_pages > 0 && kv->head_offset + rec_size <= kv->page_size)
+    {
+        return UBI_ERR_OK;
+    }
+
+    for (i = 0; i < kv->page_count; i++)
+    {
+        if (kv->page_count - kv->used_pages >= 2 || kv->used_pages < 2)
+        {
+            break;
+        }
+
+        free_space = _nvmem_kv_free_space(kv);
+        ubi_err = _nvmem_kv_compact_tail(kv);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+        if (_nvmem_kv_free_space(kv) <= free_space)
+        {
+            /* Every record of the oldest page is live: further passes only rotate them */
+            ubi_err = UBI_ERR_NO_MEM;
+            break;
+        }
+    }
+
+    return ubi_err;
+}
+
+static void _nvmem_kv_replay_page(nvmem_kv_pt kv, uint32_t page)
+{
+    nvmem_kv_rec_hdr_t hdr;
+    uint8_t key[NVMEM_KV_KEY_LEN_MAX];
+    uint8_t * page_addr;
+    uint8_t * addr;
+    uint32_t offset;
+
+    page_addr = _nvmem_kv_page_addr(kv, page);
+
+    for (offset = NVMEM_KV_PAGE_HDR_SIZE; offset + NVMEM_KV_REC_HDR_SIZE <= kv->page_size; offset += _nvmem_kv_rec_size(&hdr))
+    {
+        addr = page_addr + offset;
+        nvmem_read(addr, (uint8_t *) &hdr, sizeof(nvmem_kv_rec_hdr_t));
+        if (hdr.type == NVMEM_KV_REC_END)
+        {
+            break;
+        }
+        if (!_nvmem_kv_rec_is_valid(kv, addr, &hdr, kv->page_size - offset))
+        {
+            /* Interrupted write: nothing is appended after it */
+            offset = kv->page_size;
+            break;
+        }
+
+        nvmem_read(addr + NVMEM_KV_REC_HDR_SIZE, key, hdr.key_len);
+        if (_nvmem_kv_index_set(kv, key, hdr.key_len, _nvmem_kv_hash(key, hdr.key_len), (uint32_t) addr) != UBI_ERR_OK)
+        {
+            logme("nvmem_kv index is full");
+        }
+    }
+
+    if (page == kv->head_page)
+    {
+        kv->head_offset = (offset < kv->page_size) ? offset : kv->page_size;
+    }
+}
+
+ubi_err_t nvmem_kv_mount(nvmem_kv_pt kv)
+{
+    ubi_err_t ubi_err;
+    nvmem_kv_page_hdr_t hdr;
+    uint32_t tail_seq = 0;
+    uint32_t page;
+    uint32_t i;
+    int r;
+    (void) r;
+
+    do
+    {
+        if (kv == NULL || kv->base == NULL || kv->page_count < 3 || kv->page_size <= NVMEM_KV_PAGE_HDR_SIZE ||
+                (kv->page_size % NVMEM_KV_REC_ALIGN) != 0 || kv->index_size < 4 ||
+                (kv->index_size & (kv->index_size - 1)) != 0)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        kv->index = (nvmem_kv_slot_t *) calloc(kv->index_size, sizeof(nvmem_kv_slot_t));
+        kv->erase_counts = (uint32_t *) malloc(kv->page_count * sizeof(uint32_t));
+        if (kv->index == NULL || kv->erase_counts == NULL)
+        {
+            free(kv->index);
+            free(kv->erase_counts);
+            kv->index = NULL;
+            kv->erase_counts = NULL;
+            ubi_err = UBI_ERR_NO_MEM;
+            break;
+        }
+
+        kv->lock = NULL;
+        if (_bsp_kernel_active)
+        {
+            r = mutex_create(&kv->lock);
+            assert(r == 0);
+        }
+
+        kv->index_used = 0;
+        kv->used_pages = 0;
+        kv->head_page = 0;
+        kv->tail_page = 0;
+        kv->head_seq = 0;
+        kv->head_offset = kv->page_size;
+
+        ubi_err = UBI_ERR_OK;
+        for (page = 0; page < kv->page_count; page++)
+        {
+            kv->erase_counts[page] = NVMEM_KV_ERASE_COUNT_UNKNOWN;
+
+            nvmem_read(_nvmem_kv_page_addr(kv, page), (uint8_t *) &hdr, sizeof(nvmem_kv_page_hdr_t));
+            if (_nvmem_kv_page_hdr_is_valid(&hdr))
+            {
+                kv->erase_counts[page] = hdr.erase_count;
+                if (kv->used_pages == 0 || (int32_t) (hdr.seq - kv->head_seq) > 0)
+                {
+                    kv->head_page = page;
+                    kv->head_seq = hdr.seq;
+                }
+                if (kv->used_pages == 0 || (int32_t) (hdr.seq - tail_seq) < 0)
+                {
+                    kv->tail_page = page;
+                    tail_seq = hdr.seq;
+                }
+                kv->used_pages++;
+            }
+            else if (!nvmem_is_erased(_nvmem_kv_page_addr(kv, page), kv->page_size))
+            {
+                /* Interrupted page erase or foreign data */
+                ubi_err = nvmem_erase(_nvmem_kv_page_addr(kv, page), kv->page_size);
+                if (ubi_err != UBI_ERR_OK)
+                {
+                    break;
+                }
+            }
+        }
+        if (ubi_err != UBI_ERR_OK)
+        {
+            if (kv->lock != NULL)
+            {
+                mutex_delete(&kv->lock);
+            }
+            free(kv->index);
+            free(kv->erase_counts);
+            kv->index = NULL;
+            kv->erase_counts = NULL;
+            break;
+        }
+
+        for (i = 0; i < kv->used_pages; i++)
+        {
+            _nvmem_kv_replay_page(kv, (kv->tail_page + i) % kv->page_count);
+        }
+
+        for (page = 0; page < kv->page_count; page++)
+        {
+            if (kv->erase_counts[page] == NVMEM_KV_ERASE_COUNT_UNKNOWN)
+            {
+                kv->erase_counts[page] = (kv->used_pages > 0) ? kv->erase_counts[kv->head_page] : 0;
+            }
+        }
+
+        kv->mounted = 1;
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_kv_unmount(nvmem_kv_pt kv)
+{
+    if (kv == NULL || !kv->mounted)
+    {
+        return UBI_ERR_INVALID_STATE;
+    }
+
+    kv->mounted = 0;
+
+    if (kv->lock != NULL)
+    {
+        mutex_delete(&kv->lock);
+    }
+    free(kv->index);
+    free(kv->erase_counts);
+    kv->index = NULL;
+    kv->erase_counts = NULL;
+
+    return UBI_ERR_OK;
+}
+
+ubi_err_t nvmem_kv_format(nvmem_kv_pt kv)
+{
+    ubi_err_t ubi_err = UBI_ERR_OK;
+    uint32_t page;
+
+    if (kv == NULL || !kv->mounted)
+    {
+        return UBI_ERR_INVALID_STATE;
+    }
+
+    _nvmem_kv_lock(kv);
+
+    for (page = 0; page < kv->page_count; page++)
+    {
+        if (nvmem_is_erased(_nvmem_kv_page_addr(kv, page), kv->page_size))
+        {
+            continue;
+        }
+        ubi_err = nvmem_erase(_nvmem_kv_page_addr(kv, page), kv->page_size);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+        kv->erase_counts[page]++;
+    }
+
+    memset(kv->index, 0, kv->index_size * sizeof(nvmem_kv_slot_t));
+    kv->index_used = 0;
+    kv->used_pages = 0;
+    kv->head_page = 0;
+    kv->tail_page = 0;
+    kv->head_offset = kv->page_size;
+
+    _nvmem_kv_unlock(kv);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_kv_set(nvmem_kv_pt kv, const char * key, const void * value, size_t size)
+{
+    ubi_err_t ubi_err;
+    uint32_t key_len;
+    uint32_t addr;
+
+    do
+    {
+        if (kv == NULL || !kv->mounted)
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+
+        if (key == NULL || (value == NULL && size > 0) || size > 0xFFFF)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        key_len = strlen(key);
+        if (key_len == 0 || key_len > NVMEM_KV_KEY_LEN_MAX)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        _nvmem_kv_lock(kv);
+
+        ubi_err = _nvmem_kv_append(kv, NVMEM_KV_REC_VALUE, (const uint8_t *) key, key_len, (const uint8_t *) value, size, &addr);
+        if (ubi_err == UBI_ERR_OK)
+        {
+            ubi_err = _nvmem_kv_index_set(kv, (const uint8_t *) key, key_len, _nvmem_kv_hash((const uint8_t *) key, key_len), addr);
+        }
+
+        _nvmem_kv_unlock(kv);
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_kv_get(nvmem_kv_pt kv, const char * key, void * buf, size_t bufsize, size_t * size_p)
+{
+    ubi_err_t ubi_err;
+    nvmem_kv_rec_hdr_t hdr;
+    nvmem_kv_slot_t * slot;
+    uint32_t key_len;
+
+    do
+    {
+        if (kv == NULL || !kv->mounted)
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+
+        if (key == NULL || (buf == NULL && bufsize > 0))
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        key_len = strlen(key);
+
+        _nvmem_kv_lock(kv);
+
+        do
+        {
+            slot = _nvmem_kv_index_find(kv, (const uint8_t *) key, key_len, _nvmem_kv_hash((const uint8_t *) key, key_len));
+            if (slot == NULL)
+            {
+                ubi_err = UBI_ERR_NOT_FOUND;
+                break;
+            }
+
+            nvmem_read((const uint8_t *) slot->addr, (uint8_t *) &hdr, sizeof(nvmem_kv_rec_hdr_t));
+            if (hdr.type != NVMEM_KV_REC_VALUE)
+            {
+                ubi_err = UBI_ERR_NOT_FOUND;
+                break;
+            }
+
+            if (size_p != NULL)
+            {
+                *size_p = hdr.value_len;
+            }
+
+            if (hdr.value_len > bufsize)
+            {
+                ubi_err = UBI_ERR_BUF_FULL;
+                break;
+            }
+
+            ubi_err = nvmem_read((const uint8_t *) slot->addr + NVMEM_KV_REC_HDR_SIZE + hdr.key_len, (uint8_t *) buf, hdr.value_len);
+        } while (0);
+
+        _nvmem_kv_unlock(kv);
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_kv_delete(nvmem_kv_pt kv, const char * key)
+{
+    ubi_err_t ubi_err;
+    nvmem_kv_rec_hdr_t hdr;
+    nvmem_kv_slot_t * slot;
+    uint32_t key_len;
+    uint32_t addr;
+
+    do
+    {
+        if (kv == NULL || !kv->mounted)
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+
+        if (key == NULL)
+        {
+            ubi_err = UBI_ERR_INVALID_PARAM;
+            break;
+        }
+
+        key_len = strlen(key);
+
+        _nvmem_kv_lock(kv);
+
+        do
+        {
+            slot = _nvmem_kv_index_find(kv, (const uint8_t *) key, key_len, _nvmem_kv_hash((const uint8_t *) key, key_len));
+            if (slot == NULL)
+            {
+                ubi_err = UBI_ERR_NOT_FOUND;
+                break;
+            }
+
+            nvmem_read((const uint8_t *) slot->addr, (uint8_t *) &hdr, sizeof(nvmem_kv_rec_hdr_t));
+            if (hdr.type != NVMEM_KV_REC_VALUE)
+            {
+                ubi_err = UBI_ERR_NOT_FOUND;
+                break;
+            }
+
+            ubi_err = _nvmem_kv_append(kv, NVMEM_KV_REC_DELETE, (const uint8_t *) key, key_len, NULL, 0, &addr);
+            if (ubi_err != UBI_ERR_OK)
+            {
+                break;
+            }
+
+            /* The compaction may have moved the slot */
+            ubi_err = _nvmem_kv_index_set(kv, (const uint8_t *) key, key_len, _nvmem_kv_hash((const uint8_t *) key, key_len), addr);
+        } while (0);
+
+        _nvmem_kv_unlock(kv);
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_kv_compact(nvmem_kv_pt kv, uint32_t min_free_pages)
+{
+    ubi_err_t ubi_err = UBI_ERR_OK;
+    uint32_t free_space;
+    uint32_t i;
+
+    if (kv == NULL || !kv->mounted)
+    {
+        return UBI_ERR_INVALID_STATE;
+    }
+
+    _nvmem_kv_lock(kv);
+
+    for (i = 0; i < kv->page_count; i++)
+    {
+        if (kv->page_count - kv->used_pages >= min_free_pages || kv->used_pages < 2)
+        {
+            break;
+        }
+
+        free_space = _nvmem_kv_free_space(kv);
+        ubi_err = _nvmem_kv_compact_tail(kv);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+        if (_nvmem_kv_free_space(kv) <= free_space)
+        {
+            /* Every record of the oldest page is live: further passes only rotate them */
+            ubi_err = UBI_ERR_NO_MEM;
+            break;
+        }
+    }
+
+    _nvmem_kv_unlock(kv);
+
+    return ubi_err;
+}
+
+uint32_t nvmem_kv_get_free_pages(nvmem_kv_pt kv)
+{
+    if (kv == NULL || !kv->mounted)
+    {
+        return 0;
+    }
+
+    return kv->page_count - kv->used_pages;
+}
+
+uint32_t nvmem_kv_get_erase_count(nvmem_kv_pt kv, uint32_t page)
+{
+    if (kv == NULL || !kv->mounted || page >= kv->page_count)
+    {
+        return 0;
+    }
+
+    return kv->erase_counts[page];
+}
+
+#endif /* (STM32CUBEL4__NVMEM_KV_ENABLE == 1) */
+#endif /* (UBINOS__UBIDRV__INCLUDE_NVMEM == 1) */
@@ -0,0 +1,572 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos/ubidrv/nvmem.h>
+
+#if (UBINOS__UBIDRV__INCLUDE_NVMEM == 1)
+#if (STM32CUBEL4__NVMEM_LOG_ENABLE == 1)
+
+#include <stm32cubel4_extension/nvmem.h>
+#include <stm32cubel4_extension/nvmem_log.h>
+
+#include <assert.h>
+#include <string.h>
+
+#undef LOGM_CATEGORY
+#define LOGM_CATEGORY LOGM_CATEGORY__NVMEM
+
+#define NVMEM_LOG_PAGE_MAGIC        0x474C564EUL /* "NVLG" */
+#define NVMEM_LOG_PAGE_HDR_SIZE     16
+#define NVMEM_LOG_REC_HDR_SIZE      8
+#define NVMEM_LOG_REC_ALIGN         8
+
+#define NVMEM_LOG_REC_DATA          0x4C5A
+#define NVMEM_LOG_REC_END           0xFFFF
+
+typedef struct _nvmem_log_page_hdr_t
+{
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t check;
+    uint32_t reserved;
+} nvmem_log_page_hdr_t;
+
+typedef struct _nvmem_log_rec_hdr_t
+{
+    uint16_t type;
+    uint16_t len;
+    uint16_t len_inv;
+    uint16_t crc;
+} nvmem_log_rec_hdr_t;
+
+static void _nvmem_log_lock(nvmem_log_pt log);
+static void _nvmem_log_unlock(nvmem_log_pt log);
+static uint8_t * _nvmem_log_page_addr(nvmem_log_pt log, uint32_t page);
+static uint32_t _nvmem_log_rec_size(const nvmem_log_rec_hdr_t * hdr);
+static uint16_t _nvmem_log_crc16(uint16_t crc, const uint8_t * data, uint32_t len);
+static int _nvmem_log_page_hdr_read(nvmem_log_pt log, uint32_t page, nvmem_log_page_hdr_t * hdr);
+static int _nvmem_log_rec_read(nvmem_log_pt log, const uint8_t * addr, nvmem_log_rec_hdr_t * hdr, uint8_t * data, uint32_t room);
+static ubi_err_t _nvmem_log_open_page(nvmem_log_pt log);
+static ubi_err_t _nvmem_log_write_rec(nvmem_log_pt log);
+static void _nvmem_log_reader_set_tail(nvmem_log_pt log, nvmem_log_reader_pt reader);
+
+static void _nvmem_log_lock(nvmem_log_pt log)
+{
+    if (log->lock != NULL)
+    {
+        mutex_lock(log->lock);
+    }
+}
+
+static void _nvmem_log_unlock(nvmem_log_pt log)
+{
+    if (log->lock != NULL)
+    {
+        mutex_unlock(log->lock);
+    }
+}
+
+static uint8_t * _nvmem_log_page_addr(nvmem_log_pt log, uint32_t page)
+{
+    return log->base + (page * log->page_size);
+}
+
+static uint32_t _nvmem_log_rec_size(const nvmem_log_rec_hdr_t * hdr)
+{
+    uint32_t size = NVMEM_LOG_REC_HDR_SIZE + hdr->len;
+
+    return ((size + NVMEM_LOG_REC_ALIGN - 1) / NVMEM_LOG_REC_ALIGN) * NVMEM_LOG_REC_ALIGN;
+}
+
+/* CRC-16/CCITT-FALSE */
+static uint16_t _nvmem_log_crc16(uint16_t crc, const uint8_t * data, uint32_t len)
+{
+    uint32_t i;
+    int j;
+
+    for (i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t) data[i] << 8;
+        for (j = 0; j < 8; j++)
+        {
+            crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+        }
+    }
+
+    return crc;
+}
+
+/* Returns 1 if the page holds a valid page header */
+static int _nvmem_log_page_hdr_read(nvmem_log_pt log, uint32_t page, nvmem_log_page_hdr_t * hdr)
+{
+    nvmem_read(_nvmem_log_page_addr(log, page), (uint8_t *) hdr, sizeof(nvmem_log_page_hdr_t));
+
+    if (hdr->magic != NVMEM_LOG_PAGE_MAGIC || hdr->check != (hdr->magic ^ hdr->seq))
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Reads the record at addr (data is NVMEM_LOG_REC_DATA_MAX bytes).
+ * Returns 1 if it is valid, 0 at the end of the page (erased header) and -1 if it is corrupted.
+ */
+static int _nvmem_log_rec_read(nvmem_log_pt log, const uint8_t * addr, nvmem_log_rec_hdr_t * hdr, uint8_t * data, uint32_t room)
+{
+    uint16_t crc;
+
+    (void) log;
+
+    if (room < NVMEM_LOG_REC_HDR_SIZE)
+    {
+        return 0;
+    }
+
+    nvmem_read(addr, (uint8_t *) hdr, sizeof(nvmem_log_rec_hdr_t));
+    if (hdr->type == NVMEM_LOG_REC_END && hdr->len == 0xFFFF && hdr->len_inv == 0xFFFF && hdr->crc == 0xFFFF)
+    {
+        return 0;
+    }
+
+    if (hdr->type != NVMEM_LOG_REC_DATA || hdr->len == 0 || hdr->len > NVMEM_LOG_REC_DATA_MAX ||
+            (hdr->len_inv ^ hdr->len) != 0xFFFF || _nvmem_log_rec_size(hdr) > room)
+    {
+        return -1;
+    }
+
+    nvmem_read(addr + NVMEM_LOG_REC_HDR_SIZE, data, hdr->len);
+    crc = _nvmem_log_crc16(0xFFFF, (const uint8_t *) hdr, NVMEM_LOG_REC_HDR_SIZE - sizeof(uint16_t));
+    crc = _nvmem_log_crc16(crc, data, hdr->len);
+
+    return (crc == hdr->crc) ? 1 : -1;
+}
+
+/* Moves the head to the next page of the ring. The oldest page is dropped when the ring is full. */
+static ubi_err_t _nvmem_log_open_page(nvmem_log_pt log)
+{
+    ubi_err_t ubi_err;
+    nvmem_log_page_hdr_t hdr;
+    uint32_t next;
+    uint8_t * addr;
+
+    do
+    {
+        next = (log->used_pages == 0) ? log->head_page : (log->head_page + 1) % log->page_count;
+
+        if (log->used_pages == log->page_count)
+        {
+            /* The next page is the tail */
+            log->tail_page = (log->tail_page + 1) % log->page_count;
+            log->used_pages--;
+        }
+
+        addr = _nvmem_log_page_addr(log, next);
+        if (!nvmem_is_erased(addr, log->page_size))
+        {
+            ubi_err = nvmem_erase(addr, log->page_size);
+            if (ubi_err != UBI_ERR_OK)
+            {
+                break;
+            }
+        }
+
+        hdr.magic = NVMEM_LOG_PAGE_MAGIC;
+        hdr.seq = log->head_seq + 1;
+        hdr.check = hdr.magic ^ hdr.seq;
+        hdr.reserved = 0xFFFFFFFF;
+
+        ubi_err = nvmem_update(addr, (const uint8_t *) &hdr, sizeof(nvmem_log_page_hdr_t));
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+
+        if (log->used_pages == 0)
+        {
+            log->tail_page = next;
+        }
+        log->head_page = next;
+        log->head_offset = NVMEM_LOG_PAGE_HDR_SIZE;
+        log->head_seq = hdr.seq;
+        log->used_pages++;
+    } while (0);
+
+    return ubi_err;
+}
+
+/* Programs the buffer as a record. Called with the log locked. */
+static ubi_err_t _nvmem_log_write_rec(nvmem_log_pt log)
+{
+    ubi_err_t ubi_err;
+    nvmem_log_rec_hdr_t * hdr;
+    uint8_t * rec;
+    uint32_t rec_size;
+
+    do
+    {
+        if (log->buf_len == 0)
+        {
+            ubi_err = UBI_ERR_OK;
+            break;
+        }
+
+        rec = (uint8_t *) log->buf;
+        hdr = (nvmem_log_rec_hdr_t *) rec;
+        hdr->type = NVMEM_LOG_REC_DATA;
+        hdr->len = (uint16_t) log->buf_len;
+        hdr->len_inv = (uint16_t) ~hdr->len;
+        hdr->crc = _nvmem_log_crc16(0xFFFF, rec, NVMEM_LOG_REC_HDR_SIZE - sizeof(uint16_t));
+        hdr->crc = _nvmem_log_crc16(hdr->crc, rec + NVMEM_LOG_REC_HDR_SIZE, log->buf_len);
+
+        rec_size = _nvmem_log_rec_size(hdr);
+        memset(rec + NVMEM_LOG_REC_HDR_SIZE + log->buf_len, 0xFF, rec_size - NVMEM_LOG_REC_HDR_SIZE - log->buf_len);
+
+        /* The data is dropped if it cannot be programmed */
+        log->buf_len = 0;
+
+        if (log->used_pages == 0 || log->head_offset + rec_size > log->page_size)
+        {
+            ubi_err = _nvmem_log_open_page(log);
+            if (ubi_err != UBI_ERR_OK)
+            {
+                break;
+            }
+        }
+
+        ubi_err = nvmem_update(_nvmem_log_page_addr(log, log->head_page) + log->head_offset, rec, rec_size);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            /* The rest of the page may be partially programmed: it is not used any more */
+            log->head_offset = log->page_size;
+            break;
+        }
+
+        log->head_offset += rec_size;
+    } while (0);
+
+    return ubi_err;
+}
+
+static void _nvmem_log_reader_set_tail(nvmem_log_pt log, nvmem_log_reader_pt reader)
+{
+    if (log->used_pages == 0)
+    {
+        /* The first page opened */
+        reader->page = log->head_page;
+        reader->seq = log->head_seq + 1;
+    }
+    else
+    {
+        reader->page = log->tail_page;
+        reader->seq = log->head_seq - (log->used_pages - 1);
+    }
+    reader->offset = NVMEM_LOG_PAGE_HDR_SIZE;
+}
+
+ubi_err_t nvmem_log_mount(nvmem_log_pt log)
+{
+    nvmem_log_page_hdr_t hdr;
+    nvmem_log_rec_hdr_t rec_hdr;
+    uint8_t data[NVMEM_LOG_REC_DATA_MAX];
+    uint32_t tail_seq = 0;
+    uint32_t page;
+    uint32_t offset;
+    int r;
+
+    if (log == NULL || log->base == NULL || log->page_count < 2 ||
+            log->page_size < NVMEM_LOG_PAGE_HDR_SIZE + NVMEM_LOG_BUF_SIZE || (log->page_size % NVMEM_LOG_REC_ALIGN) != 0)
+    {
+        return UBI_ERR_INVALID_PARAM;
+    }
+
+    log->lock = NULL;
+    if (_bsp_kernel_active)
+    {
+        r = mutex_create(&log->lock);
+        assert(r == 0);
+    }
+
+    log->used_pages = 0;
+    log->head_page = 0;
+    log->tail_page = 0;
+    log->head_seq = 0;
+    log->head_offset = log->page_size;
+    log->buf_len = 0;
+
+    /* Only the page headers are read */
+    for (page = 0; page < log->page_count; page++)
+    {
+        if (_nvmem_log_page_hdr_read(log, page, &hdr))
+        {
+            if (log->used_pages == 0 || (int32_t) (hdr.seq - log->head_seq) > 0)
+            {
+                log->head_page = page;
+                log->head_seq = hdr.seq;
+            }
+            if (log->used_pages == 0 || (int32_t) (hdr.seq - tail_seq) < 0)
+            {
+                log->tail_page = page;
+                tail_seq = hdr.seq;
+            }
+            log->used_pages++;
+        }
+    }
+
+    /* Find the end of the head page */
+    if (log->used_pages > 0)
+    {
+        offset = NVMEM_LOG_PAGE_HDR_SIZE;
+        for (;;)
+        {
+            r = _nvmem_log_rec_read(log, _nvmem_log_page_addr(log, log->head_page) + offset, &rec_hdr, data, log->page_size - offset);
+            if (r == 0)
+            {
+                break;
+            }
+            if (r < 0)
+            {
+                /* Interrupted write: nothing is appended after it */
+                offset = log->page_size;
+                break;
+            }
+            offset += _nvmem_log_rec_size(&rec_hdr);
+        }
+        log->head_offset = offset;
+    }
+
+    log->mounted = 1;
+
+    return UBI_ERR_OK;
+}
+
+ubi_err_t nvmem_log_unmount(nvmem_log_pt log)
+{
+    ubi_err_t ubi_err;
+
+    if (log == NULL || !log->mounted)
+    {
+        return UBI_ERR_INVALID_STATE;
+    }
+
+    _nvmem_log_lock(log);
+    ubi_err = _nvmem_log_write_rec(log);
+    log->mounted = 0;
+    _nvmem_log_unlock(log);
+
+    if (log->lock != NULL)
+    {
+        mutex_delete(&log->lock);
+    }
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_log_format(nvmem_log_pt log)
+{
+    ubi_err_t ubi_err = UBI_ERR_OK;
+    uint32_t page;
+
+    if (log == NULL || !log->mounted)
+    {
+        return UBI_ERR_INVALID_STATE;
+    }
+
+    _nvmem_log_lock(log);
+
+    for (page = 0; page < log->page_count; page++)
+    {
+        if (nvmem_is_erased(_nvmem_log_page_addr(log, page), log->page_size))
+        {
+            continue;
+        }
+        ubi_err = nvmem_erase(_nvmem_log_page_addr(log, page), log->page_size);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+    }
+
+    /* head_seq is kept, so that the cursors see that their pages are reused */
+    log->used_pages = 0;
+    log->head_page = 0;
+    log->tail_page = 0;
+    log->head_offset = log->page_size;
+    log->buf_len = 0;
+
+    _nvmem_log_unlock(log);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_log_append(nvmem_log_pt log, const uint8_t * buf, size_t size)
+{
+    ubi_err_t ubi_err = UBI_ERR_OK;
+    uint8_t * data;
+    uint32_t len;
+
+    if (log == NULL || !log->mounted)
+    {
+        return UBI_ERR_INVALID_STATE;
+    }
+
+    if (buf == NULL && size > 0)
+    {
+        return UBI_ERR_INVALID_PARAM;
+    }
+
+    _nvmem_log_lock(log);
+
+    data = (uint8_t *) log->buf + NVMEM_LOG_REC_HDR_SIZE;
+    while (size > 0)
+    {
+        len = NVMEM_LOG_REC_DATA_MAX - log->buf_len;
+        if (len > size)
+        {
+            len = size;
+        }
+
+        memcpy(data + log->buf_len, buf, len);
+        log->buf_len += len;
+        buf += len;
+        size -= len;
+
+        if (log->buf_len == NVMEM_LOG_REC_DATA_MAX)
+        {
+            ubi_err = _nvmem_log_write_rec(log);
+            if (ubi_err != UBI_ERR_OK)
+            {
+                break;
+            }
+        }
+    }
+
+    _nvmem_log_unlock(log);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_log_sync(nvmem_log_pt log)
+{
+    ubi_err_t ubi_err;
+
+    if (log == NULL || !log->mounted)
+    {
+        return UBI_ERR_INVALID_STATE;
+    }
+
+    _nvmem_log_lock(log);
+    ubi_err = _nvmem_log_write_rec(log);
+    _nvmem_log_unlock(log);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_log_rewind(nvmem_log_pt log, nvmem_log_reader_pt reader)
+{
+    if (log == NULL || !log->mounted)
+    {
+        return UBI_ERR_INVALID_STATE;
+    }
+
+    if (reader == NULL)
+    {
+        return UBI_ERR_INVALID_PARAM;
+    }
+
+    _nvmem_log_lock(log);
+    _nvmem_log_reader_set_tail(log, reader);
+    _nvmem_log_unlock(log);
+
+    return UBI_ERR_OK;
+}
+
+ubi_err_t nvmem_log_read(nvmem_log_pt log, nvmem_log_reader_pt reader, uint8_t * buf, size_t bufsize, size_t * size_p)
+{
+    ubi_err_t ubi_err;
+    nvmem_log_page_hdr_t hdr;
+    nvmem_log_rec_hdr_t rec_hdr;
+    uint8_t data[NVMEM_LOG_REC_DATA_MAX];
+    int rewound = 0;
+    int r;
+
+    if (log == NULL || !log->mounted)
+    {
+        return UBI_ERR_INVALID_STATE;
+    }
+
+    if (reader == NULL || size_p == NULL || (buf == NULL && bufsize > 0))
+    {
+        return UBI_ERR_INVALID_PARAM;
+    }
+
+    _nvmem_log_lock(log);
+
+    for (;;)
+    {
+        if ((int32_t) (reader->seq - log->head_seq) > 0 || log->used_pages == 0)
+        {
+            /* The page of the cursor is not opened yet */
+            ubi_err = UBI_ERR_NOT_FOUND;
+            break;
+        }
+
+        if (!_nvmem_log_page_hdr_read(log, reader->page, &hdr) || hdr.seq != reader->seq)
+        {
+            if (rewound)
+            {
+                ubi_err = UBI_ERR_INVALID_DATA;
+                break;
+            }
+            /* The page has been reused: its records are lost */
+            _nvmem_log_reader_set_tail(log, reader);
+            rewound = 1;
+            continue;
+        }
+
+        if (reader->page == log->head_page && reader->offset >= log->head_offset)
+        {
+            ubi_err = UBI_ERR_NOT_FOUND;
+            break;
+        }
+
+        r = _nvmem_log_rec_read(log, _nvmem_log_page_addr(log, reader->page) + reader->offset, &rec_hdr, data,
+                log->page_size - reader->offset);
+        if (r <= 0)
+        {
+            /* End of the page, or interrupted write */
+            if (reader->page == log->head_page)
+            {
+                ubi_err = UBI_ERR_NOT_FOUND;
+                break;
+            }
+            reader->page = (reader->page + 1) % log->page_count;
+            reader->seq++;
+            reader->offset = NVMEM_LOG_PAGE_HDR_SIZE;
+            continue;
+        }
+
+        *size_p = rec_hdr.len;
+        if (rec_hdr.len > bufsize)
+        {
+            ubi_err = UBI_ERR_BUF_FULL;
+            break;
+        }
+
+        memcpy(buf, data, rec_hdr.len);
+        reader->offset += _nvmem_log_rec_size(&rec_hdr);
+        ubi_err = UBI_ERR_OK;
+        break;
+    }
+
+    _nvmem_log_unlock(log);
+
+    return ubi_err;
+}
+
+#endif /* (STM32CUBEL4__NVMEM_LOG_ENABLE == 1) */
+#endif /* (UBINOS__UBIDRV__INCLUDE_NVMEM == 1) */
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos.h>
+
+#if (INCLUDE__UBINOS__BSP == 1)
+
+#if (UBINOS__BSP__USE_DTTY == 1)
+
+#if (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL)
+
+#if (STM32CUBEL4__DTTY_STM32_UART_ENABLE == 1) || (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1)
+
+#if (STM32CUBEL4__DTTY_BLACKBOX_ENABLE == 1)
+
+#if (UBINOS__UBIDRV__INCLUDE_NVMEM != 1) || (STM32CUBEL4__NVMEM_LOG_ENABLE != 1)
+    #error "nvmem_log is necessary"
+#endif
+
+#include <ubinos/bsp.h>
+#include <ubinos/bsp/arch.h>
+#include <ubinos/bsp_ubik.h>
+#include <stm32cubel4_extension/dtty.h>
+#include <stm32cubel4_extension/nvmem_log.h>
+
+#include <assert.h>
+
+#define DTTY_BLACKBOX_LINE_SIZE 128
+#define DTTY_BLACKBOX_DUMP_WAIT_MS 10
+#define DTTY_BLACKBOX_DUMP_TIMEOUT_MS 1000
+
+cbuf_def_init(_g_dtty_blackbox_buf, STM32CUBEL4__DTTY_BLACKBOX_BUFFER_SIZE);
+
+nvmem_log_pt _g_dtty_blackbox_log = NULL;
+mutex_pt _g_dtty_blackbox_lock = NULL;
+dtty_blackbox_filter_ft _g_dtty_blackbox_filter = NULL;
+uint8_t _g_dtty_blackbox_dumping = 0;
+uint32_t _g_dtty_blackbox_overflow_count = 0;
+
+char _g_dtty_blackbox_line[DTTY_BLACKBOX_LINE_SIZE];
+uint32_t _g_dtty_blackbox_line_len = 0;
+
+void dtty_stm32_blackbox_write(const uint8_t *data, uint32_t len);
+
+/* Implemented by the dtty driver */
+extern uint32_t dtty_stm32_get_write_room(void);
+
+static int _dtty_stm32_blackbox_move(nvmem_log_pt log);
+
+/*
+ * Called by the dtty driver with the characters written (before the autocr conversion).
+ * The high priority lane writes without the write lock, so the capture is a critical section.
+ */
+void dtty_stm32_blackbox_write(const uint8_t *data, uint32_t len)
+{
+    uint32_t written;
+
+    if (NULL == _g_dtty_blackbox_log || _g_dtty_blackbox_dumping)
+    {
+        return;
+    }
+
+    ubik_entercrit();
+    cbuf_write(_g_dtty_blackbox_buf, data, len, &written);
+    ubik_exitcrit();
+    if (written != len)
+    {
+        _g_dtty_blackbox_overflow_count++;
+    }
+}
+
+/* Moves the captured output to the log. Called with the black box locked. */
+static int _dtty_stm32_blackbox_move(nvmem_log_pt log)
+{
+    int r;
+    uint8_t * buf;
+    uint32_t len;
+    uint32_t i;
+
+    r = 0;
+    while (cbuf_get_len(_g_dtty_blackbox_buf) > 0)
+    {
+        buf = cbuf_get_head_addr(_g_dtty_blackbox_buf);
+        len = cbuf_get_contig_len(_g_dtty_blackbox_buf);
+
+        if (NULL == _g_dtty_blackbox_filter)
+        {
+            if (nvmem_log_append(log, buf, len) != UBI_ERR_OK)
+            {
+                r = -1;
+            }
+        }
+        else
+        {
+            for (i = 0; i < len; i++)
+            {
+                _g_dtty_blackbox_line[_g_dtty_blackbox_line_len++] = (char) buf[i];
+                if ('\n' != buf[i] && _g_dtty_blackbox_line_len < DTTY_BLACKBOX_LINE_SIZE)
+                {
+                    continue;
+                }
+
+                if (_g_dtty_blackbox_filter(_g_dtty_blackbox_line, (int) _g_dtty_blackbox_line_len))
+                {
+                    if (nvmem_log_append(log, (const uint8_t *) _g_dtty_blackbox_line, _g_dtty_blackbox_line_len) != UBI_ERR_OK)
+                    {
+                        r = -1;
+                    }
+                }
+                _g_dtty_blackbox_line_len = 0;
+            }
+        }
+
+        cbuf_read(_g_dtty_blackbox_buf, NULL, len, NULL);
+    }
+
+    return r;
+}
+
+int dtty_blackbox_attach(struct _nvmem_log_t *log)
+{
+    int r;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount || !_bsp_kernel_active)
+        {
+            break;
+        }
+
+        if (NULL == _g_dtty_blackbox_lock)
+        {
+            r = mutex_create(&_g_dtty_blackbox_lock);
+            if (r != 0)
+            {
+                r = -1;
+                break;
+            }
+        }
+
+        mutex_lock(_g_dtty_blackbox_lock);
+
+        if (NULL != _g_dtty_blackbox_log && log != _g_dtty_blackbox_log)
+        {
+            /* What was captured for the previous log goes to it */
+            _dtty_stm32_blackbox_move(_g_dtty_blackbox_log);
+        }
+
+        _g_dtty_blackbox_log = log;
+        _g_dtty_blackbox_line_len = 0;
+
+        mutex_unlock(_g_dtty_blackbox_lock);
+
+        r = 0;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+void dtty_blackbox_setfilter(dtty_blackbox_filter_ft filter)
+{
+    _g_dtty_blackbox_filter = filter;
+}
+
+int dtty_blackbox_flush(int sync)
+{
+    int r;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (NULL == _g_dtty_blackbox_lock)
+        {
+            break;
+        }
+
+        mutex_lock(_g_dtty_blackbox_lock);
+
+        if (NULL != _g_dtty_blackbox_log)
+        {
+            r = _dtty_stm32_blackbox_move(_g_dtty_blackbox_log);
+            if (sync && nvmem_log_sync(_g_dtty_blackbox_log) != UBI_ERR_OK)
+            {
+                r = -1;
+            }
+        }
+
+        mutex_unlock(_g_dtty_blackbox_lock);
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int dtty_blackbox_dump(struct _nvmem_log_t *log)
+{
+    int r;
+    ubi_err_t ubi_err;
+    nvmem_log_reader_t reader;
+    uint8_t buf[NVMEM_LOG_REC_DATA_MAX];
+    size_t size;
+    uint32_t waitms;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (NULL == log)
+        {
+            r = -2;
+            break;
+        }
+
+        if (nvmem_log_rewind(log, &reader) != UBI_ERR_OK)
+        {
+            break;
+        }
+
+        _g_dtty_blackbox_dumping = 1;
+
+        r = 0;
+        for (;;)
+        {
+            ubi_err = nvmem_log_read(log, &reader, buf, sizeof(buf), &size);
+            if (ubi_err != UBI_ERR_OK)
+            {
+                if (ubi_err != UBI_ERR_NOT_FOUND)
+                {
+                    r = -1;
+                }
+                break;
+            }
+
+            /* Paced by the free space of the write buffer (with room for the '\r' of the autocr conversion), so that it does not overflow */
+            for (waitms = 0; dtty_stm32_get_write_room() < (uint32_t) size * 2; waitms += DTTY_BLACKBOX_DUMP_WAIT_MS)
+            {
+                if (DTTY_BLACKBOX_DUMP_TIMEOUT_MS <= waitms)
+                {
+                    /* The output is not drained (e.g. the USB host does not read) */
+                    r = -1;
+                    break;
+                }
+                task_sleepms(DTTY_BLACKBOX_DUMP_WAIT_MS);
+            }
+            if (0 > r)
+            {
+                break;
+            }
+
+            dtty_putn((const char *) buf, (int) size);
+            r += (int) size;
+        }
+
+        _g_dtty_blackbox_dumping = 0;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+uint32_t dtty_blackbox_get_overflow_count(void)
+{
+    return _g_dtty_blackbox_overflow_count;
+}
+
+#endif /* (STM32CUBEL4__DTTY_BLACKBOX_ENABLE == 1) */
+
+#endif /* (STM32CUBEL4__DTTY_STM32_UART_ENABLE == 1) || (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1) */
+
+#endif /* (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL) */
+
+#endif /* (UBINOS__BSP__USE_DTTY == 1) */
+
+#endif /* (INCLUDE__UBINOS__BSP == 1) */
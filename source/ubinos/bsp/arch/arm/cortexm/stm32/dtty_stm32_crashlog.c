@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos.h>
+
+#if (INCLUDE__UBINOS__BSP == 1)
+
+#if (UBINOS__BSP__USE_DTTY == 1)
+
+#if (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL)
+
+#if (STM32CUBEL4__DTTY_STM32_UART_ENABLE == 1) || (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1)
+
+#if (STM32CUBEL4__DTTY_CRASHLOG_ENABLE == 1)
+
+#include <ubinos/bsp.h>
+#include <ubinos/bsp/arch.h>
+#include <ubinos/bsp_ubik.h>
+#include <stm32cubel4_extension/dtty.h>
+
+#include <assert.h>
+#include <string.h>
+
+#define DTTY_CRASHLOG_MAGIC 0x474F4C43U /* "CLOG" */
+
+/*
+ * Copy of the last STM32CUBEL4__DTTY_CRASHLOG_SIZE bytes of output.
+ * It is not initialized by the startup code, so it survives a reset (but not a power loss).
+ * The header check and the sum of the buffer tell it apart from the random contents after a power on,
+ * and from a buffer corrupted by the crash.
+ */
+typedef struct _dtty_crashlog_t
+{
+    uint32_t magic;
+    uint32_t pos;       /* Number of bytes written (modulo 2^32) */
+    uint32_t sum;       /* Sum of the bytes of buf, kept up to date by each write */
+    uint32_t check;     /* ~(magic ^ pos ^ sum) */
+    uint8_t buf[STM32CUBEL4__DTTY_CRASHLOG_SIZE];
+} dtty_crashlog_t;
+
+dtty_crashlog_t _g_dtty_crashlog __attribute__((section(".noinit")));
+
+uint8_t _g_dtty_crashlog_replaying = 0;
+uint32_t _g_dtty_crashlog_replayed = 0;
+
+void dtty_stm32_crashlog_write(const uint8_t *data, uint32_t len);
+void dtty_stm32_crashlog_replay(void);
+
+static void _dtty_stm32_crashlog_clear(void);
+static int _dtty_stm32_crashlog_is_valid(void);
+
+static void _dtty_stm32_crashlog_clear(void)
+{
+    ubik_entercrit();
+    memset(_g_dtty_crashlog.buf, 0, STM32CUBEL4__DTTY_CRASHLOG_SIZE);
+    _g_dtty_crashlog.magic = DTTY_CRASHLOG_MAGIC;
+    _g_dtty_crashlog.pos = 0;
+    _g_dtty_crashlog.sum = 0;
+    _g_dtty_crashlog.check = ~(DTTY_CRASHLOG_MAGIC ^ 0 ^ 0);
+    ubik_exitcrit();
+}
+
+static int _dtty_stm32_crashlog_is_valid(void)
+{
+    uint32_t sum = 0;
+    uint32_t i;
+
+    if (_g_dtty_crashlog.magic != DTTY_CRASHLOG_MAGIC ||
+            _g_dtty_crashlog.check != ~(DTTY_CRASHLOG_MAGIC ^ _g_dtty_crashlog.pos ^ _g_dtty_crashlog.sum))
+    {
+        return 0;
+    }
+
+    for (i = 0; i < STM32CUBEL4__DTTY_CRASHLOG_SIZE; i++)
+    {
+        sum += _g_dtty_crashlog.buf[i];
+    }
+
+    return (sum == _g_dtty_crashlog.sum);
+}
+
+/*
+ * Called by the dtty driver with the characters written (before the autocr conversion).
+ * The high priority lane writes without the write lock, so the copy is a critical section.
+ */
+void dtty_stm32_crashlog_write(const uint8_t *data, uint32_t len)
+{
+    uint32_t pos;
+    uint32_t sum;
+    uint32_t i;
+    uint8_t * slot;
+
+    if (_g_dtty_crashlog_replaying)
+    {
+        return;
+    }
+
+    ubik_entercrit();
+    do
+    {
+        if (_g_dtty_crashlog.magic != DTTY_CRASHLOG_MAGIC)
+        {
+            break;
+        }
+
+        pos = _g_dtty_crashlog.pos;
+        sum = _g_dtty_crashlog.sum;
+        for (i = 0; i < len; i++)
+        {
+            slot = &_g_dtty_crashlog.buf[pos % STM32CUBEL4__DTTY_CRASHLOG_SIZE];
+            sum += (uint32_t) data[i] - *slot;
+            *slot = data[i];
+            pos++;
+        }
+        _g_dtty_crashlog.pos = pos;
+        _g_dtty_crashlog.sum = sum;
+        _g_dtty_crashlog.check = ~(DTTY_CRASHLOG_MAGIC ^ pos ^ sum);
+
+        break;
+    } while (1);
+    ubik_exitcrit();
+}
+
+/* Called by dtty_init, before anything else is written */
+void dtty_stm32_crashlog_replay(void)
+{
+    uint32_t pos;
+    uint32_t len;
+    uint32_t start;
+    uint32_t contig;
+
+    _g_dtty_crashlog_replayed = 0;
+
+    if (!_dtty_stm32_crashlog_is_valid())
+    {
+        /* Power on, or corrupted */
+        _dtty_stm32_crashlog_clear();
+        return;
+    }
+
+    pos = _g_dtty_crashlog.pos;
+    len = (pos < STM32CUBEL4__DTTY_CRASHLOG_SIZE) ? pos : STM32CUBEL4__DTTY_CRASHLOG_SIZE;
+
+    _g_dtty_crashlog_replaying = 1;
+
+    start = pos - len;
+    while (len > 0)
+    {
+        contig = STM32CUBEL4__DTTY_CRASHLOG_SIZE - (start % STM32CUBEL4__DTTY_CRASHLOG_SIZE);
+        if (contig > len)
+        {
+            contig = len;
+        }
+
+        dtty_putn((const char *) &_g_dtty_crashlog.buf[start % STM32CUBEL4__DTTY_CRASHLOG_SIZE], contig);
+
+        _g_dtty_crashlog_replayed += contig;
+        start += contig;
+        len -= contig;
+    }
+
+    _dtty_stm32_crashlog_clear();
+
+    _g_dtty_crashlog_replaying = 0;
+}
+
+uint32_t dtty_crashlog_get_replayed(void)
+{
+    return _g_dtty_crashlog_replayed;
+}
+
+void dtty_crashlog_discard(void)
+{
+    _dtty_stm32_crashlog_clear();
+}
+
+#endif /* (STM32CUBEL4__DTTY_CRASHLOG_ENABLE == 1) */
+
+#endif /* (STM32CUBEL4__DTTY_STM32_UART_ENABLE == 1) || (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1) */
+
+#endif /* (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL) */
+
+#endif /* (UBINOS__BSP__USE_DTTY == 1) */
+
+#endif /* (INCLUDE__UBINOS__BSP == 1) */
@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos.h>
+
+#if (INCLUDE__UBINOS__BSP == 1)
+
+#if (UBINOS__BSP__USE_DTTY == 1)
+
+#if (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL)
+
+#if (STM32CUBEL4__DTTY_STM32_UART_ENABLE == 1) || (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1)
+
+#if (STM32CUBEL4__DTTY_POLL_ENABLE == 1)
+
+#if (INCLUDE__UBINOS__UBIK != 1)
+    #error "ubik is necessary"
+#endif
+
+#include <ubinos/bsp.h>
+#include <ubinos/bsp/arch.h>
+#include <ubinos/bsp_ubik.h>
+#include <stm32cubel4_extension/dtty.h>
+
+#include <assert.h>
+
+/* Implemented by the dtty driver (UART or USB) */
+extern uint32_t dtty_stm32_poll_level(void);
+
+dtty_poll_pt _g_dtty_poll_list[DTTY_POLL_MAX];
+
+void dtty_stm32_poll_notify(uint32_t events);
+
+/* Called by the dtty driver on its events, in interrupt or task context */
+void dtty_stm32_poll_notify(uint32_t events)
+{
+    uint32_t i;
+
+    for (i = 0; i < DTTY_POLL_MAX; i++)
+    {
+        if (_g_dtty_poll_list[i] != NULL)
+        {
+            dtty_poll_signal(_g_dtty_poll_list[i], events);
+        }
+    }
+}
+
+int dtty_poll_open(dtty_poll_pt poll, uint32_t mask)
+{
+    int r;
+    uint32_t i;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (NULL == poll)
+        {
+            r = -2;
+            break;
+        }
+
+        poll->mask = mask;
+        poll->pending = 0;
+        r = semb_create(&poll->sem);
+        if (r != 0)
+        {
+            r = -1;
+            break;
+        }
+
+        r = -1;
+        ubik_entercrit();
+        for (i = 0; i < DTTY_POLL_MAX; i++)
+        {
+            if (_g_dtty_poll_list[i] == NULL)
+            {
+                _g_dtty_poll_list[i] = poll;
+                r = 0;
+                break;
+            }
+        }
+        ubik_exitcrit();
+
+        if (r != 0)
+        {
+            sem_delete(&poll->sem);
+        }
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int dtty_poll_close(dtty_poll_pt poll)
+{
+    int r;
+    uint32_t i;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (NULL == poll)
+        {
+            r = -2;
+            break;
+        }
+
+        ubik_entercrit();
+        for (i = 0; i < DTTY_POLL_MAX; i++)
+        {
+            if (_g_dtty_poll_list[i] == poll)
+            {
+                _g_dtty_poll_list[i] = NULL;
+                r = 0;
+                break;
+            }
+        }
+        ubik_exitcrit();
+
+        if (r == 0)
+        {
+            sem_delete(&poll->sem);
+        }
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int dtty_poll_wait(dtty_poll_pt poll, uint32_t timeoutms)
+{
+    int r;
+    int timedout;
+    uint32_t events;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (NULL == poll || NULL == poll->sem)
+        {
+            r = -2;
+            break;
+        }
+
+        timedout = 0;
+        for (;;)
+        {
+            /* RX and TX are levels, the latched ones may be stale */
+            ubik_entercrit();
+            events = poll->pending & ~(DTTY_POLL_RX | DTTY_POLL_TX);
+            poll->pending = 0;
+            ubik_exitcrit();
+
+            events |= dtty_stm32_poll_level();
+            events &= poll->mask;
+
+            if (events != 0 || timeoutms == 0 || timedout)
+            {
+                break;
+            }
+
+            if (timeoutms == DTTY_POLL_WAIT_FOREVER)
+            {
+                sem_take(poll->sem);
+            }
+            else if (sem_take_timedms(poll->sem, timeoutms) != 0)
+            {
+                timedout = 1;
+            }
+        }
+
+        r = (int) events;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+void dtty_poll_signal(dtty_poll_pt poll, uint32_t events)
+{
+    uint32_t mask;
+
+    if (NULL == poll)
+    {
+        return;
+    }
+
+    ubik_entercrit();
+    poll->pending |= events;
+    mask = poll->mask;
+    ubik_exitcrit();
+
+    if ((events & mask) != 0 && poll->sem != NULL && _bsp_kernel_active)
+    {
+        sem_give(poll->sem);
+    }
+}
+
+#if (UBINOS__UBIDRV__INCLUDE_NVMEM == 1) && (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1)
+
+void dtty_poll_nvmem_callback(struct _nvmem_async_t * req, ubi_err_t result, void * arg)
+{
+    (void) req;
+    (void) result;
+
+    dtty_poll_signal((dtty_poll_pt) arg, DTTY_POLL_NVMEM);
+}
+
+#endif /* (UBINOS__UBIDRV__INCLUDE_NVMEM == 1) && (STM32CUBEL4__NVMEM_ASYNC_ENABLE == 1) */
+
+#endif /* (STM32CUBEL4__DTTY_POLL_ENABLE == 1) */
+
+#endif /* (STM32CUBEL4__DTTY_STM32_UART_ENABLE == 1) || (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1) */
+
+#endif /* (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL) */
+
+#endif /* (UBINOS__BSP__USE_DTTY == 1) */
+
+#endif /* (INCLUDE__UBINOS__BSP == 1) */
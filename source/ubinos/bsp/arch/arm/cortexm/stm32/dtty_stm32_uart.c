@@ -1,645 +1,1721 @@
-/*
- * Copyright (c) 2021 Sung Ho Park and CSOS
- *
- * SPDX-License-Identifier: Apache-2.0
- */
-
-#include <ubinos.h>
-
-#if (INCLUDE__UBINOS__BSP == 1)
-
-#if (UBINOS__BSP__USE_DTTY == 1)
-
-#if (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL)
-
-#if (STM32CUBEL4__DTTY_STM32_UART_ENABLE == 1)
-
-#if (INCLUDE__UBINOS__UBIK != 1)
-    #error "ubik is necessary"
-#endif
-
-#include <ubinos/bsp.h>
-#include <ubinos/bsp/arch.h>
-#include <ubinos/bsp_ubik.h>
-
-#include <assert.h>
-
-#include "main.h"
-
-#define SLEEP_TIMEMS	1
-
-extern int _g_bsp_dtty_init;
-extern int _g_bsp_dtty_in_init;
-extern int _g_bsp_dtty_echo;
-extern int _g_bsp_dtty_autocr;
-
-#define DTTY_UART_READ_BUFFER_SIZE (512)
-#define DTTY_UART_WRITE_BUFFER_SIZE (1024 * 10)
-
-#define DTTY_UART_CHECK_INTERVAL_MS 1000
-
-cbuf_def_init(_g_dtty_uart_rbuf, DTTY_UART_READ_BUFFER_SIZE);
-cbuf_def_init(_g_dtty_uart_wbuf, DTTY_UART_WRITE_BUFFER_SIZE);
-
-sem_pt _g_dtty_uart_rsem = NULL;
-sem_pt _g_dtty_uart_wsem = NULL;
-
-mutex_pt _g_dtty_uart_putlock = NULL;
-mutex_pt _g_dtty_uart_getlock = NULL;
-mutex_pt _g_dtty_uart_resetlock = NULL;
-
-uint32_t _g_dtty_uart_rx_overflow_count = 0;
-uint32_t _g_dtty_uart_tx_overflow_count = 0;
-uint32_t _g_dtty_uart_reset_count = 0;
-
-uint8_t _g_dtty_uart_need_reset = 0;
-uint8_t _g_dtty_uart_need_rx_restart = 0;
-uint8_t _g_dtty_uart_need_tx_restart = 0;
-
-static void _dtty_stm32_uart_reset(void);
-static int _dtty_getc_advan(char *ch_p, int blocked);
-
-static void _dtty_stm32_uart_reset(void)
-{
-    HAL_StatusTypeDef stm_err;
-    (void) stm_err;
-
-    mutex_lock(_g_dtty_uart_resetlock);
-
-    if (_g_dtty_uart_need_reset)
-    {
-        DTTY_STM32_UART_HANDLE.Instance = DTTY_STM32_UART;
-        DTTY_STM32_UART_HANDLE.Init.BaudRate = 115200;
-        DTTY_STM32_UART_HANDLE.Init.WordLength = UART_WORDLENGTH_8B;
-        DTTY_STM32_UART_HANDLE.Init.StopBits = UART_STOPBITS_1;
-        DTTY_STM32_UART_HANDLE.Init.Parity = UART_PARITY_NONE;
-        DTTY_STM32_UART_HANDLE.Init.HwFlowCtl = UART_HWCONTROL_NONE;
-        DTTY_STM32_UART_HANDLE.Init.Mode = UART_MODE_TX_RX;
-        DTTY_STM32_UART_HANDLE.Init.OverSampling = UART_OVERSAMPLING_16;
-
-        stm_err = HAL_UART_DeInit(&DTTY_STM32_UART_HANDLE);
-        assert(stm_err == HAL_OK);
-
-        _g_dtty_uart_need_reset = 0;
-        _g_dtty_uart_need_rx_restart = 1;
-        _g_dtty_uart_need_tx_restart = 1;
-
-        stm_err = HAL_UART_Init(&DTTY_STM32_UART_HANDLE);
-        assert(stm_err == HAL_OK);
-
-        HAL_NVIC_SetPriority(DTTY_STM32_UART_IRQn, NVIC_PRIO_MIDDLE, 0);
-
-        _g_dtty_uart_reset_count++;
-    }
-
-    mutex_unlock(_g_dtty_uart_resetlock);
-}
-
-void dtty_stm32_uart_rx_callback(void)
-{
-    uint8_t *buf;
-    uint16_t len;
-    cbuf_pt rbuf = _g_dtty_uart_rbuf;
-    sem_pt rsem = _g_dtty_uart_rsem;
-    int need_signal = 0;
-    HAL_StatusTypeDef status;
-
-    do
-    {
-        if (DTTY_STM32_UART_HANDLE.ErrorCode != HAL_UART_ERROR_NONE)
-        {
-            break;
-        }
-
-        if (_g_dtty_uart_need_reset)
-        {
-            break;
-        }
-
-        if (_g_dtty_uart_need_rx_restart)
-        {
-            bsp_abortsystem();
-        }
-
-        len = 1;
-
-        if (cbuf_is_full(rbuf))
-        {
-            _g_dtty_uart_rx_overflow_count++;
-        }
-        else
-        {
-            if (cbuf_get_len(rbuf) == 0)
-            {
-                need_signal = 1;
-            }
-
-            cbuf_write(rbuf, NULL, len, NULL);
-
-            if (need_signal && _bsp_kernel_active)
-            {
-                sem_give(rsem);
-            }
-        }
-
-        buf = cbuf_get_tail_addr(rbuf);
-        _g_dtty_uart_need_rx_restart = 0;
-        status = HAL_UART_Receive_IT(&DTTY_STM32_UART_HANDLE, buf, len);
-        if (status != HAL_OK)
-        {
-            _g_dtty_uart_need_rx_restart = 1;
-            break;
-        }
-    } while (0);
-}
-
-void dtty_stm32_uart_tx_callback(void)
-{
-    uint8_t *buf;
-    uint16_t len;
-    cbuf_pt wbuf = _g_dtty_uart_wbuf;
-    sem_pt wsem = _g_dtty_uart_wsem;
-    HAL_StatusTypeDef status;
-
-    do
-    {
-        if (DTTY_STM32_UART_HANDLE.ErrorCode != HAL_UART_ERROR_NONE)
-        {
-            break;
-        }
-
-        if (_g_dtty_uart_need_reset)
-        {
-            break;
-        }
-
-        len = 1;
-
-        cbuf_read(wbuf, NULL, len, NULL);
-        if (cbuf_get_len(wbuf) == 0)
-        {
-            if (_bsp_kernel_active)
-            {
-                sem_give(wsem);
-            }
-            _g_dtty_uart_need_tx_restart = 1;
-            break;
-        }
-
-        buf = cbuf_get_head_addr(wbuf);
-        status = HAL_UART_Transmit_IT(&DTTY_STM32_UART_HANDLE, buf, len);
-        if (status != HAL_OK)
-        {
-            bsp_abortsystem(); // Something is wrong. Debugging required.
-            break;
-        }
-
-        break;
-    } while (1);
-}
-
-void dtty_stm32_uart_err_callback(void)
-{
-    _g_dtty_uart_need_reset = 1;
-}
-
-int dtty_init(void)
-{
-    int r;
-    uint8_t * buf;
-    uint16_t len;
-    (void) r;
-    HAL_StatusTypeDef status;
-
-    do
-    {
-        if (bsp_isintr() || 0 != _bsp_critcount)
-        {
-            break;
-        }
-
-        if (!_bsp_kernel_active)
-        {
-            break;
-        }
-
-        if (_g_bsp_dtty_init || _g_bsp_dtty_in_init)
-        {
-            break;
-        }
-
-        _g_bsp_dtty_in_init = 1;
-
-        r = semb_create(&_g_dtty_uart_rsem);
-        assert(r == 0);
-        r = semb_create(&_g_dtty_uart_wsem);
-        assert(r == 0);
-        r = mutex_create(&_g_dtty_uart_resetlock);
-        assert(r == 0);
-        r = mutex_create(&_g_dtty_uart_putlock);
-        assert(r == 0);
-        r = mutex_create(&_g_dtty_uart_getlock);
-        assert(r == 0);
-
-        _g_bsp_dtty_echo = 1;
-        _g_bsp_dtty_autocr = 1;
-
-        _g_dtty_uart_rx_overflow_count = 0;
-        _g_dtty_uart_tx_overflow_count = 0;
-        _g_dtty_uart_need_reset = 1;
-
-        _dtty_stm32_uart_reset();
-
-        _g_dtty_uart_reset_count = 0;
-
-        _g_bsp_dtty_init = 1;
-
-        cbuf_clear(_g_dtty_uart_rbuf);
-
-        buf = cbuf_get_tail_addr(_g_dtty_uart_rbuf);
-        len = 1;
-        _g_dtty_uart_need_rx_restart = 0;
-        status = HAL_UART_Receive_IT(&DTTY_STM32_UART_HANDLE, buf, len);
-        if (status != HAL_OK)
-        {
-            _g_dtty_uart_need_rx_restart = 1;
-        }
-
-        _g_bsp_dtty_in_init = 0;
-
-        break;
-    } while (1);
-
-    return 0;
-}
-
-int dtty_enable(void)
-{
-    return 0;
-}
-
-int dtty_disable(void)
-{
-    return 0;
-}
-
-int dtty_geterror(void)
-{
-    return 0;
-}
-
-static int _dtty_getc_advan(char *ch_p, int blocked)
-{
-    int r;
-    ubi_err_t ubi_err;
-    uint8_t * buf;
-    uint16_t len;
-    HAL_StatusTypeDef status;
-
-    r = -1;
-    do
-    {
-        if (bsp_isintr() || 0 != _bsp_critcount)
-        {
-            break;
-        }
-
-        if (!_g_bsp_dtty_init)
-        {
-            dtty_init();
-            if (!_g_bsp_dtty_init)
-            {
-                break;
-            }
-        }
-
-        if (!blocked)
-        {
-            r = mutex_lock_timed(_g_dtty_uart_getlock, 0);
-        }
-        else
-        {
-            r = mutex_lock(_g_dtty_uart_getlock);
-        }
-        if (r != 0)
-        {
-            break;
-        }
-
-        for (;;)
-        {
-            if (_g_dtty_uart_need_reset)
-            {
-                _dtty_stm32_uart_reset();
-            }
-
-            if (_g_dtty_uart_need_rx_restart)
-            {
-                len = 1;
-
-                buf = cbuf_get_tail_addr(_g_dtty_uart_rbuf);
-                _g_dtty_uart_need_rx_restart = 0;
-                status = HAL_UART_Receive_IT(&DTTY_STM32_UART_HANDLE, buf, len);
-                if (status != HAL_OK)
-                {
-                    _g_dtty_uart_need_rx_restart = 1;
-                }
-            }
-
-            ubi_err = cbuf_read(_g_dtty_uart_rbuf, (uint8_t*) ch_p, 1, NULL);
-            if (ubi_err == UBI_ERR_OK)
-            {
-                r = 0;
-                break;
-            }
-            else
-            {
-                if (!blocked)
-                {
-                    break;
-                }
-                else
-                {
-                    sem_take_timedms(_g_dtty_uart_rsem, DTTY_UART_CHECK_INTERVAL_MS);
-                }
-            }
-        }
-
-        if (0 == r && 0 != _g_bsp_dtty_echo)
-        {
-            dtty_putc(*ch_p);
-        }
-        
-        mutex_unlock(_g_dtty_uart_getlock);
-
-        break;
-    } while (1);
-
-    return r;
-}
-
-int dtty_getc(char *ch_p)
-{
-    return _dtty_getc_advan(ch_p, 1);
-}
-
-int dtty_getc_unblocked(char *ch_p)
-{
-    return _dtty_getc_advan(ch_p, 0);
-}
-
-int dtty_putc(int ch)
-{
-    int r;
-    uint8_t * buf;
-    uint16_t len;
-    uint32_t written;
-    uint8_t data[2];
-    HAL_StatusTypeDef status;
-
-    r = -1;
-    do
-    {
-        if (bsp_isintr() || 0 != _bsp_critcount)
-        {
-            break;
-        }
-
-        if (!_g_bsp_dtty_init)
-        {
-            dtty_init();
-            if (!_g_bsp_dtty_init)
-            {
-                break;
-            }
-        }
-
-        mutex_lock(_g_dtty_uart_putlock);
-
-        do
-        {
-            if (_g_dtty_uart_need_reset)
-            {
-                _dtty_stm32_uart_reset();
-            }
-
-            if (0 != _g_bsp_dtty_autocr && '\n' == ch)
-            {
-                data[0] = '\r';
-                data[1] = '\n';
-                len = 2;
-            }
-            else
-            {
-                data[0] = (uint8_t) ch;
-                len = 1;
-            }
-
-            cbuf_write(_g_dtty_uart_wbuf, data, len, &written);
-            if (written != len)
-            {
-                _g_dtty_uart_tx_overflow_count++;
-            }
-
-            if (_g_dtty_uart_need_tx_restart)
-            {
-                len = 1;
-                buf = cbuf_get_head_addr(_g_dtty_uart_wbuf);
-                _g_dtty_uart_need_tx_restart = 0;
-                status = HAL_UART_Transmit_IT(&DTTY_STM32_UART_HANDLE, buf, len);
-                if (status == HAL_OK || status == HAL_BUSY)
-                {
-                    r = 0;
-                }
-                else
-                {
-                    _g_dtty_uart_need_tx_restart = 1;
-                    r = -1;
-                }
-            }
-            else
-            {
-                r = 0;
-            }
-
-            break;
-        } while (1);
-
-        mutex_unlock(_g_dtty_uart_putlock);
-
-        break;
-    } while (1);
-
-    return r;
-}
-
-int dtty_flush(void)
-{
-    int r;
-    uint8_t * buf;
-    uint16_t len;
-    HAL_StatusTypeDef status;
-
-    r = -1;
-    do
-    {
-        if (bsp_isintr() || 0 != _bsp_critcount)
-        {
-            break;
-        }
-
-        if (!_g_bsp_dtty_init)
-        {
-            dtty_init();
-            if (!_g_bsp_dtty_init)
-            {
-                break;
-            }
-        }
-
-        mutex_lock(_g_dtty_uart_putlock);
- 
-        do
-        {
-            if (_g_dtty_uart_need_reset)
-            {
-                _dtty_stm32_uart_reset();
-            }
-
-            if (cbuf_get_len(_g_dtty_uart_wbuf) == 0)
-            {
-                r = 0;
-                break;
-            }
-
-            sem_take_timedms(_g_dtty_uart_wsem, DTTY_UART_CHECK_INTERVAL_MS);
-
-            if (cbuf_get_len(_g_dtty_uart_wbuf) == 0)
-            {
-                r = 0;
-                break;
-            }
-
-            if (_g_dtty_uart_need_tx_restart)
-            {
-                len = 1;
-                buf = cbuf_get_head_addr(_g_dtty_uart_wbuf);
-                _g_dtty_uart_need_tx_restart = 0;
-                status = HAL_UART_Transmit_IT(&DTTY_STM32_UART_HANDLE, buf, len);
-                if (status == HAL_OK || status == HAL_BUSY)
-                {
-                    r = 0;
-                }
-                else
-                {
-                    _g_dtty_uart_need_tx_restart = 1;
-                    r = -1;
-                }
-            }
-            else
-            {
-                r = 0;
-            }
-        } while (1);
- 
-        mutex_unlock(_g_dtty_uart_putlock);
-
-        break;
-    } while (1);
- 
-    return r;
-}
-
-int dtty_putn(const char *str, int len)
-{
-    int r;
-
-    r = -1;
-    do
-    {
-        if (bsp_isintr() || 0 != _bsp_critcount)
-        {
-            break;
-        }
-
-        if (!_g_bsp_dtty_init)
-        {
-            dtty_init();
-            if (!_g_bsp_dtty_init)
-            {
-                break;
-            }
-        }
-
-        if (NULL == str)
-        {
-            r = -2;
-            break;
-        }
-
-        if (0 > len)
-        {
-            r = -3;
-            break;
-        }
-
-        for (r = 0; r < len; r++)
-        {
-            dtty_putc(*str);
-            str++;
-        }
-
-        break;
-    } while (1);
-
-    return r;
-}
-
-int dtty_kbhit(void)
-{
-    int r;
-
-    r = -1;
-    do
-    {
-        if (bsp_isintr() || 0 != _bsp_critcount)
-        {
-            break;
-        }
-
-        if (!_g_bsp_dtty_init)
-        {
-            dtty_init();
-            if (!_g_bsp_dtty_init)
-            {
-                break;
-            }
-        }
-
-        if (cbuf_get_len(_g_dtty_uart_rbuf) != 0)
-        {
-            r = 1;
-        }
-        else
-        {
-            r = 0;
-        }
-
-        break;
-    } while (1);
-
-    return r;
-}
-
-void dtty_write_process(void *arg)
-{
-}
-
-#endif /* (STM32CUBEL4__DTTY_STM32_UART_ENABLE == 1) */
-
-#endif /* (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL) */
-
-#endif /* (UBINOS__BSP__USE_DTTY == 1) */
-
-#endif /* (INCLUDE__UBINOS__BSP == 1) */
-
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos.h>
+
+#if (INCLUDE__UBINOS__BSP == 1)
+
+#if (UBINOS__BSP__USE_DTTY == 1)
+
+#if (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL)
+
+#if (STM32CUBEL4__DTTY_STM32_UART_ENABLE == 1)
+
+#if (INCLUDE__UBINOS__UBIK != 1)
+    #error "ubik is necessary"
+#endif
+
+#include <ubinos/bsp.h>
+#include <ubinos/bsp/arch.h>
+#include <ubinos/bsp_ubik.h>
+#include <stm32cubel4_extension/dtty.h>
+
+#include <assert.h>
+
+#include "main.h"
+
+#define SLEEP_TIMEMS	1
+
+extern int _g_bsp_dtty_init;
+extern int _g_bsp_dtty_in_init;
+extern int _g_bsp_dtty_echo;
+extern int _g_bsp_dtty_autocr;
+
+#define DTTY_UART_READ_BUFFER_SIZE (512)
+#define DTTY_UART_WRITE_BUFFER_SIZE (1024 * 10)
+
+#define DTTY_UART_CHECK_INTERVAL_MS 1000
+
+cbuf_def_init(_g_dtty_uart_rbuf, DTTY_UART_READ_BUFFER_SIZE);
+cbuf_def_init(_g_dtty_uart_wbuf, DTTY_UART_WRITE_BUFFER_SIZE);
+
+sem_pt _g_dtty_uart_rsem = NULL;
+sem_pt _g_dtty_uart_wsem = NULL;
+
+mutex_pt _g_dtty_uart_putlock = NULL;
+mutex_pt _g_dtty_uart_getlock = NULL;
+mutex_pt _g_dtty_uart_resetlock = NULL;
+
+uint32_t _g_dtty_uart_rx_overflow_count = 0;
+uint32_t _g_dtty_uart_tx_overflow_count = 0;
+uint32_t _g_dtty_uart_reset_count = 0;
+
+uint8_t _g_dtty_uart_need_reset = 0;
+uint8_t _g_dtty_uart_need_rx_restart = 0;
+uint8_t _g_dtty_uart_need_tx_restart = 0;
+
+#if (STM32CUBEL4__DTTY_LINE_ENABLE == 1)
+
+uint8_t _g_dtty_uart_canon = 0;
+uint8_t _g_dtty_uart_line_cr = 0;
+uint32_t _g_dtty_uart_line_len = 0;
+uint32_t _g_dtty_uart_line_count = 0;
+uint8_t _g_dtty_uart_line[STM32CUBEL4__DTTY_LINE_SIZE + 1];
+
+#define DTTY_UART_IS_CANON() (_g_dtty_uart_canon != 0)
+
+/* The line discipline echoes from the receive interrupt, so the task side of the write buffer is protected against it */
+#define DTTY_UART_WBUF_LOCK()   ubik_entercrit()
+#define DTTY_UART_WBUF_UNLOCK() ubik_exitcrit()
+
+static void _dtty_stm32_uart_echo(const char *str, uint32_t len);
+static void _dtty_stm32_uart_line_input(uint8_t ch);
+
+#else
+
+#define DTTY_UART_IS_CANON() 0
+
+#define DTTY_UART_WBUF_LOCK()
+#define DTTY_UART_WBUF_UNLOCK()
+
+#endif /* (STM32CUBEL4__DTTY_LINE_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_READ_ENABLE == 1)
+
+/* The reader is woken when the read buffer reaches this length (1 out of dtty_read) */
+uint32_t _g_dtty_uart_rx_wake_len = 1;
+uint8_t _g_dtty_uart_rto_armed = 0;
+uint32_t _g_dtty_uart_rto_count = 0;
+
+#define DTTY_UART_RX_WAKE_LEN _g_dtty_uart_rx_wake_len
+
+#else
+
+#define DTTY_UART_RX_WAKE_LEN 1
+
+#endif /* (STM32CUBEL4__DTTY_READ_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_POLL_ENABLE == 1)
+
+extern void dtty_stm32_poll_notify(uint32_t events);
+uint32_t dtty_stm32_poll_level(void);
+
+#define DTTY_UART_POLL_NOTIFY(events) dtty_stm32_poll_notify(events)
+
+#else
+
+#define DTTY_UART_POLL_NOTIFY(events)
+
+#endif /* (STM32CUBEL4__DTTY_POLL_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+
+#define DTTY_UART_EARLY_POLL_TIMEOUT 100000
+
+cbuf_def_init(_g_dtty_uart_early_buf, STM32CUBEL4__DTTY_EARLY_BUFFER_SIZE);
+
+uint32_t _g_dtty_uart_early_overflow_count = 0;
+
+uint8_t _g_dtty_uart_early_polled = 0;
+uint8_t _g_dtty_uart_early_hw_init = 0;
+
+static int _dtty_stm32_uart_early_putn(const char *str, int len);
+static void _dtty_stm32_uart_early_replay(void);
+
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_CRASHLOG_ENABLE == 1)
+
+extern void dtty_stm32_crashlog_write(const uint8_t *data, uint32_t len);
+extern void dtty_stm32_crashlog_replay(void);
+
+#define DTTY_UART_CRASHLOG_WRITE(data, len) dtty_stm32_crashlog_write(data, len)
+
+#else
+
+#define DTTY_UART_CRASHLOG_WRITE(data, len)
+
+#endif /* (STM32CUBEL4__DTTY_CRASHLOG_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_BLACKBOX_ENABLE == 1)
+
+extern void dtty_stm32_blackbox_write(const uint8_t *data, uint32_t len);
+
+uint32_t dtty_stm32_get_write_room(void);
+
+#define DTTY_UART_BLACKBOX_WRITE(data, len) dtty_stm32_blackbox_write(data, len)
+
+#else
+
+#define DTTY_UART_BLACKBOX_WRITE(data, len)
+
+#endif /* (STM32CUBEL4__DTTY_BLACKBOX_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_PRIO_ENABLE == 1)
+
+/* High priority lane, drained before the write buffer (normal lane) at its message boundaries */
+cbuf_def_init(_g_dtty_uart_wbuf_high, STM32CUBEL4__DTTY_PRIO_BUFFER_SIZE);
+
+uint8_t _g_dtty_uart_tx_high = 0;   /* The character being sent is from the high priority lane */
+uint32_t _g_dtty_uart_tx_run = 0;   /* Characters of the normal lane sent since its last message boundary */
+
+#endif /* (STM32CUBEL4__DTTY_PRIO_ENABLE == 1) */
+
+static void _dtty_stm32_uart_set_config(void);
+static void _dtty_stm32_uart_reset(void);
+static void _dtty_stm32_uart_rx_check(void);
+static uint32_t _dtty_stm32_uart_tx_len(void);
+static cbuf_pt _dtty_stm32_uart_tx_select(void);
+static HAL_StatusTypeDef _dtty_stm32_uart_tx_start(void);
+static int _dtty_stm32_uart_read(char *ch_p);
+static int _dtty_getc_advan(char *ch_p, int blocked);
+#if (STM32CUBEL4__DTTY_READ_ENABLE == 1)
+static void _dtty_stm32_uart_rto(void);
+#endif /* (STM32CUBEL4__DTTY_READ_ENABLE == 1) */
+
+static void _dtty_stm32_uart_set_config(void)
+{
+    DTTY_STM32_UART_HANDLE.Instance = DTTY_STM32_UART;
+    DTTY_STM32_UART_HANDLE.Init.BaudRate = 115200;
+    DTTY_STM32_UART_HANDLE.Init.WordLength = UART_WORDLENGTH_8B;
+    DTTY_STM32_UART_HANDLE.Init.StopBits = UART_STOPBITS_1;
+    DTTY_STM32_UART_HANDLE.Init.Parity = UART_PARITY_NONE;
+    DTTY_STM32_UART_HANDLE.Init.HwFlowCtl = UART_HWCONTROL_NONE;
+    DTTY_STM32_UART_HANDLE.Init.Mode = UART_MODE_TX_RX;
+    DTTY_STM32_UART_HANDLE.Init.OverSampling = UART_OVERSAMPLING_16;
+}
+
+static void _dtty_stm32_uart_reset(void)
+{
+    HAL_StatusTypeDef stm_err;
+    (void) stm_err;
+
+    mutex_lock(_g_dtty_uart_resetlock);
+
+    if (_g_dtty_uart_need_reset)
+    {
+        _dtty_stm32_uart_set_config();
+
+        stm_err = HAL_UART_DeInit(&DTTY_STM32_UART_HANDLE);
+        assert(stm_err == HAL_OK);
+
+        _g_dtty_uart_need_reset = 0;
+        _g_dtty_uart_need_rx_restart = 1;
+        _g_dtty_uart_need_tx_restart = 1;
+
+        stm_err = HAL_UART_Init(&DTTY_STM32_UART_HANDLE);
+        assert(stm_err == HAL_OK);
+
+        HAL_NVIC_SetPriority(DTTY_STM32_UART_IRQn, NVIC_PRIO_MIDDLE, 0);
+
+#if (STM32CUBEL4__DTTY_LINE_ENABLE == 1)
+        /* Character match on '\r' (CMF) for the line discipline. ADD can be written only while the USART is disabled. */
+        __HAL_UART_DISABLE(&DTTY_STM32_UART_HANDLE);
+        MODIFY_REG(DTTY_STM32_UART_HANDLE.Instance->CR2, USART_CR2_ADD, ((uint32_t) '\r') << UART_CR2_ADDRESS_LSB_POS);
+        __HAL_UART_ENABLE(&DTTY_STM32_UART_HANDLE);
+        __HAL_UART_CLEAR_FLAG(&DTTY_STM32_UART_HANDLE, UART_CLEAR_CMF);
+        _g_dtty_uart_line_len = 0;
+        _g_dtty_uart_line_cr = 0;
+#endif /* (STM32CUBEL4__DTTY_LINE_ENABLE == 1) */
+
+        _g_dtty_uart_reset_count++;
+    }
+
+    mutex_unlock(_g_dtty_uart_resetlock);
+}
+
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+
+/* Before dtty_init (the kernel is not active): kept in the early buffer, or sent at once by polling */
+static int _dtty_stm32_uart_early_putn(const char *str, int len)
+{
+    uint32_t written;
+    uint32_t timeout;
+    int i;
+
+    if (!_g_dtty_uart_early_polled)
+    {
+        cbuf_write(_g_dtty_uart_early_buf, (const uint8_t *) str, len, &written);
+        if (written != (uint32_t) len)
+        {
+            _g_dtty_uart_early_overflow_count++;
+        }
+        return (int) written;
+    }
+
+    if (!_g_dtty_uart_early_hw_init)
+    {
+        _dtty_stm32_uart_set_config();
+        if (HAL_UART_Init(&DTTY_STM32_UART_HANDLE) != HAL_OK)
+        {
+            return -1;
+        }
+        _g_dtty_uart_early_hw_init = 1;
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        /* As dtty_init enables autocr */
+        if ('\n' == str[i] && _dtty_stm32_uart_early_putn("\r", 1) != 1)
+        {
+            return -1;
+        }
+
+        /* The tick may not run yet, so the timeout is a loop count */
+        for (timeout = DTTY_UART_EARLY_POLL_TIMEOUT; timeout > 0; timeout--)
+        {
+            if (__HAL_UART_GET_FLAG(&DTTY_STM32_UART_HANDLE, UART_FLAG_TXE))
+            {
+                break;
+            }
+        }
+        if (timeout == 0)
+        {
+            return -1;
+        }
+        DTTY_STM32_UART_HANDLE.Instance->TDR = (uint8_t) str[i];
+    }
+
+    return len;
+}
+
+static void _dtty_stm32_uart_early_replay(void)
+{
+    uint8_t * buf;
+    uint32_t len;
+
+    while (cbuf_get_len(_g_dtty_uart_early_buf) > 0)
+    {
+        buf = cbuf_get_head_addr(_g_dtty_uart_early_buf);
+        len = cbuf_get_contig_len(_g_dtty_uart_early_buf);
+
+        dtty_putn((const char *) buf, len);
+
+        cbuf_read(_g_dtty_uart_early_buf, NULL, len, NULL);
+    }
+}
+
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+
+static void _dtty_stm32_uart_rx_check(void)
+{
+    uint8_t * buf;
+    uint16_t len;
+    HAL_StatusTypeDef status;
+
+    if (_g_dtty_uart_need_reset)
+    {
+        _dtty_stm32_uart_reset();
+    }
+
+    if (_g_dtty_uart_need_rx_restart)
+    {
+        len = 1;
+
+        buf = cbuf_get_tail_addr(_g_dtty_uart_rbuf);
+        _g_dtty_uart_need_rx_restart = 0;
+        status = HAL_UART_Receive_IT(&DTTY_STM32_UART_HANDLE, buf, len);
+        if (status != HAL_OK)
+        {
+            _g_dtty_uart_need_rx_restart = 1;
+        }
+    }
+}
+
+/* Number of characters waiting to be sent, in all the lanes */
+static uint32_t _dtty_stm32_uart_tx_len(void)
+{
+#if (STM32CUBEL4__DTTY_PRIO_ENABLE == 1)
+    return cbuf_get_len(_g_dtty_uart_wbuf) + cbuf_get_len(_g_dtty_uart_wbuf_high);
+#else
+    return cbuf_get_len(_g_dtty_uart_wbuf);
+#endif /* (STM32CUBEL4__DTTY_PRIO_ENABLE == 1) */
+}
+
+/*
+ * Selects the lane of the next character to send. The high priority lane is taken at a message
+ * boundary of the normal lane (after a line end, or DTTY_PRIO_RUN_MAX characters), or when the
+ * normal lane is empty. Called in interrupt context, or while the transmitter is stopped.
+ */
+static cbuf_pt _dtty_stm32_uart_tx_select(void)
+{
+#if (STM32CUBEL4__DTTY_PRIO_ENABLE == 1)
+    if (cbuf_get_len(_g_dtty_uart_wbuf_high) > 0 && (_g_dtty_uart_tx_run == 0 || cbuf_get_len(_g_dtty_uart_wbuf) == 0))
+    {
+        _g_dtty_uart_tx_high = 1;
+        return _g_dtty_uart_wbuf_high;
+    }
+    _g_dtty_uart_tx_high = 0;
+#endif /* (STM32CUBEL4__DTTY_PRIO_ENABLE == 1) */
+
+    return _g_dtty_uart_wbuf;
+}
+
+/* Starts the transmitter (stopped, with something to send) */
+static HAL_StatusTypeDef _dtty_stm32_uart_tx_start(void)
+{
+    return HAL_UART_Transmit_IT(&DTTY_STM32_UART_HANDLE, cbuf_get_head_addr(_dtty_stm32_uart_tx_select()), 1);
+}
+
+#if (STM32CUBEL4__DTTY_LINE_ENABLE == 1)
+
+/* Called in interrupt context only */
+static void _dtty_stm32_uart_echo(const char *str, uint32_t len)
+{
+    uint32_t written;
+    HAL_StatusTypeDef status;
+
+    if (0 == _g_bsp_dtty_echo)
+    {
+        return;
+    }
+
+    cbuf_write(_g_dtty_uart_wbuf, (const uint8_t *) str, len, &written);
+    if (written != len)
+    {
+        _g_dtty_uart_tx_overflow_count++;
+    }
+
+    if (_g_dtty_uart_need_tx_restart)
+    {
+        _g_dtty_uart_need_tx_restart = 0;
+        status = _dtty_stm32_uart_tx_start();
+        if (status != HAL_OK)
+        {
+            /* Restarted by the next dtty_putc or dtty_flush */
+            _g_dtty_uart_need_tx_restart = 1;
+        }
+    }
+}
+
+/* Called in interrupt context only, the received character is at the tail of the read buffer (not written yet) */
+static void _dtty_stm32_uart_line_input(uint8_t ch)
+{
+    cbuf_pt rbuf = _g_dtty_uart_rbuf;
+    int eol = 0;
+
+    if (__HAL_UART_GET_FLAG(&DTTY_STM32_UART_HANDLE, UART_FLAG_CMF))
+    {
+        __HAL_UART_CLEAR_FLAG(&DTTY_STM32_UART_HANDLE, UART_CLEAR_CMF);
+        eol = 1;
+    }
+    else if ('\n' == ch)
+    {
+        if (_g_dtty_uart_line_cr)
+        {
+            /* Second half of "\r\n" */
+            _g_dtty_uart_line_cr = 0;
+            return;
+        }
+        eol = 1;
+    }
+    _g_dtty_uart_line_cr = ('\r' == ch) ? 1 : 0;
+
+    if (eol)
+    {
+        _g_dtty_uart_line[_g_dtty_uart_line_len] = '\n';
+        /* A line that does not fit is dropped as a whole, so that its head does not join the next line */
+        if (DTTY_UART_READ_BUFFER_SIZE - 1 - cbuf_get_len(rbuf) < _g_dtty_uart_line_len + 1)
+        {
+            _g_dtty_uart_rx_overflow_count++;
+        }
+        else
+        {
+            cbuf_write(rbuf, _g_dtty_uart_line, _g_dtty_uart_line_len + 1, NULL);
+            _g_dtty_uart_line_count++;
+            DTTY_UART_POLL_NOTIFY(DTTY_POLL_RX);
+        }
+        _g_dtty_uart_line_len = 0;
+
+        if (0 != _g_bsp_dtty_autocr)
+        {
+            _dtty_stm32_uart_echo("\r\n", 2);
+        }
+        else
+        {
+            _dtty_stm32_uart_echo("\n", 1);
+        }
+
+        if (_bsp_kernel_active)
+        {
+            sem_give(_g_dtty_uart_rsem);
+        }
+    }
+    else if ('\b' == ch || 0x7F == ch)
+    {
+        if (_g_dtty_uart_line_len > 0)
+        {
+            _g_dtty_uart_line_len--;
+            _dtty_stm32_uart_echo("\b \b", 3);
+        }
+    }
+    else if (_g_dtty_uart_line_len < STM32CUBEL4__DTTY_LINE_SIZE)
+    {
+        _g_dtty_uart_line[_g_dtty_uart_line_len] = ch;
+        _g_dtty_uart_line_len++;
+        _dtty_stm32_uart_echo((const char *) &ch, 1);
+    }
+}
+
+#endif /* (STM32CUBEL4__DTTY_LINE_ENABLE == 1) */
+
+void dtty_stm32_uart_rx_callback(void)
+{
+    uint8_t *buf;
+    uint16_t len;
+    cbuf_pt rbuf = _g_dtty_uart_rbuf;
+    sem_pt rsem = _g_dtty_uart_rsem;
+    int need_signal = 0;
+    HAL_StatusTypeDef status;
+
+    do
+    {
+        if (DTTY_STM32_UART_HANDLE.ErrorCode != HAL_UART_ERROR_NONE)
+        {
+            break;
+        }
+
+        if (_g_dtty_uart_need_reset)
+        {
+            break;
+        }
+
+        if (_g_dtty_uart_need_rx_restart)
+        {
+            bsp_abortsystem();
+        }
+
+        len = 1;
+
+#if (STM32CUBEL4__DTTY_LINE_ENABLE == 1)
+        if (DTTY_UART_IS_CANON())
+        {
+            _dtty_stm32_uart_line_input(*cbuf_get_tail_addr(rbuf));
+        }
+        else if (cbuf_is_full(rbuf))
+#else
+        if (cbuf_is_full(rbuf))
+#endif /* (STM32CUBEL4__DTTY_LINE_ENABLE == 1) */
+        {
+            _g_dtty_uart_rx_overflow_count++;
+        }
+        else
+        {
+            if (cbuf_get_len(rbuf) == 0)
+            {
+                DTTY_UART_POLL_NOTIFY(DTTY_POLL_RX);
+            }
+
+            if (cbuf_get_len(rbuf) + len == DTTY_UART_RX_WAKE_LEN)
+            {
+                need_signal = 1;
+            }
+
+            cbuf_write(rbuf, NULL, len, NULL);
+
+            if (need_signal && _bsp_kernel_active)
+            {
+                sem_give(rsem);
+            }
+        }
+
+        buf = cbuf_get_tail_addr(rbuf);
+        _g_dtty_uart_need_rx_restart = 0;
+        status = HAL_UART_Receive_IT(&DTTY_STM32_UART_HANDLE, buf, len);
+        if (status != HAL_OK)
+        {
+            _g_dtty_uart_need_rx_restart = 1;
+            break;
+        }
+    } while (0);
+}
+
+void dtty_stm32_uart_tx_callback(void)
+{
+    uint8_t *buf;
+    uint16_t len;
+    uint8_t ch;
+    cbuf_pt wbuf = _g_dtty_uart_wbuf;
+    sem_pt wsem = _g_dtty_uart_wsem;
+    HAL_StatusTypeDef status;
+
+    do
+    {
+        if (DTTY_STM32_UART_HANDLE.ErrorCode != HAL_UART_ERROR_NONE)
+        {
+            break;
+        }
+
+        if (_g_dtty_uart_need_reset)
+        {
+            break;
+        }
+
+        len = 1;
+
+#if (STM32CUBEL4__DTTY_PRIO_ENABLE == 1)
+        if (_g_dtty_uart_tx_high)
+        {
+            wbuf = _g_dtty_uart_wbuf_high;
+        }
+#endif /* (STM32CUBEL4__DTTY_PRIO_ENABLE == 1) */
+
+        cbuf_read(wbuf, &ch, len, NULL);
+
+#if (STM32CUBEL4__DTTY_PRIO_ENABLE == 1)
+        if (!_g_dtty_uart_tx_high)
+        {
+            _g_dtty_uart_tx_run++;
+            if ('\n' == ch || _g_dtty_uart_tx_run >= DTTY_PRIO_RUN_MAX)
+            {
+                _g_dtty_uart_tx_run = 0;
+            }
+        }
+#else
+        (void) ch;
+#endif /* (STM32CUBEL4__DTTY_PRIO_ENABLE == 1) */
+
+        if (_dtty_stm32_uart_tx_len() == 0)
+        {
+            if (_bsp_kernel_active)
+            {
+                sem_give(wsem);
+            }
+            DTTY_UART_POLL_NOTIFY(DTTY_POLL_TX);
+            _g_dtty_uart_need_tx_restart = 1;
+            break;
+        }
+
+        buf = cbuf_get_head_addr(_dtty_stm32_uart_tx_select());
+        status = HAL_UART_Transmit_IT(&DTTY_STM32_UART_HANDLE, buf, len);
+        if (status != HAL_OK)
+        {
+            bsp_abortsystem(); // Something is wrong. Debugging required.
+            break;
+        }
+
+        break;
+    } while (1);
+}
+
+void dtty_stm32_uart_err_callback(void)
+{
+#if (STM32CUBEL4__DTTY_READ_ENABLE == 1) && defined(HAL_UART_ERROR_RTO)
+    /*
+     * HAL_UART_IRQHandler reports the RTOF of the receiver timeout armed by dtty_read as HAL_UART_ERROR_RTO
+     * when it sees the flag before dtty_stm32_uart_irq_callback. It ends the read, and the reception goes on.
+     */
+    if ((DTTY_STM32_UART_HANDLE.ErrorCode & HAL_UART_ERROR_RTO) != 0)
+    {
+        _dtty_stm32_uart_rto();
+        if ((DTTY_STM32_UART_HANDLE.ErrorCode & ~HAL_UART_ERROR_RTO) == 0)
+        {
+            return;
+        }
+    }
+#endif /* (STM32CUBEL4__DTTY_READ_ENABLE == 1) && defined(HAL_UART_ERROR_RTO) */
+
+    _g_dtty_uart_need_reset = 1;
+    DTTY_UART_POLL_NOTIFY(DTTY_POLL_ERR);
+}
+
+int dtty_init(void)
+{
+    int r;
+    uint8_t * buf;
+    uint16_t len;
+    (void) r;
+    HAL_StatusTypeDef status;
+
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_bsp_kernel_active)
+        {
+            break;
+        }
+
+        if (_g_bsp_dtty_init || _g_bsp_dtty_in_init)
+        {
+            break;
+        }
+
+        _g_bsp_dtty_in_init = 1;
+
+        r = semb_create(&_g_dtty_uart_rsem);
+        assert(r == 0);
+        r = semb_create(&_g_dtty_uart_wsem);
+        assert(r == 0);
+        r = mutex_create(&_g_dtty_uart_resetlock);
+        assert(r == 0);
+        r = mutex_create(&_g_dtty_uart_putlock);
+        assert(r == 0);
+        r = mutex_create(&_g_dtty_uart_getlock);
+        assert(r == 0);
+
+        _g_bsp_dtty_echo = 1;
+        _g_bsp_dtty_autocr = 1;
+
+        _g_dtty_uart_rx_overflow_count = 0;
+        _g_dtty_uart_tx_overflow_count = 0;
+        _g_dtty_uart_need_reset = 1;
+
+        _dtty_stm32_uart_reset();
+
+        _g_dtty_uart_reset_count = 0;
+
+        _g_bsp_dtty_init = 1;
+
+        cbuf_clear(_g_dtty_uart_rbuf);
+
+        buf = cbuf_get_tail_addr(_g_dtty_uart_rbuf);
+        len = 1;
+        _g_dtty_uart_need_rx_restart = 0;
+        status = HAL_UART_Receive_IT(&DTTY_STM32_UART_HANDLE, buf, len);
+        if (status != HAL_OK)
+        {
+            _g_dtty_uart_need_rx_restart = 1;
+        }
+
+#if (STM32CUBEL4__DTTY_CRASHLOG_ENABLE == 1)
+        dtty_stm32_crashlog_replay();
+#endif /* (STM32CUBEL4__DTTY_CRASHLOG_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+        _dtty_stm32_uart_early_replay();
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+
+        _g_bsp_dtty_in_init = 0;
+
+        break;
+    } while (1);
+
+    return 0;
+}
+
+int dtty_enable(void)
+{
+    return 0;
+}
+
+int dtty_disable(void)
+{
+    return 0;
+}
+
+int dtty_geterror(void)
+{
+    return 0;
+}
+
+static int _dtty_stm32_uart_read(char *ch_p)
+{
+    ubi_err_t ubi_err;
+
+    if (DTTY_UART_IS_CANON())
+    {
+#if (STM32CUBEL4__DTTY_LINE_ENABLE == 1)
+        /* Only the completed lines can be read */
+        if (_g_dtty_uart_line_count == 0)
+        {
+            return -1;
+        }
+
+        ubi_err = cbuf_read(_g_dtty_uart_rbuf, (uint8_t*) ch_p, 1, NULL);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            return -1;
+        }
+
+        if ('\n' == *ch_p)
+        {
+            ubik_entercrit();
+            _g_dtty_uart_line_count--;
+            ubik_exitcrit();
+        }
+
+        return 0;
+#endif /* (STM32CUBEL4__DTTY_LINE_ENABLE == 1) */
+    }
+
+    ubi_err = cbuf_read(_g_dtty_uart_rbuf, (uint8_t*) ch_p, 1, NULL);
+    if (ubi_err != UBI_ERR_OK)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int _dtty_getc_advan(char *ch_p, int blocked)
+{
+    int r;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+                break;
+            }
+        }
+
+        if (!blocked)
+        {
+            r = mutex_lock_timed(_g_dtty_uart_getlock, 0);
+        }
+        else
+        {
+            r = mutex_lock(_g_dtty_uart_getlock);
+        }
+        if (r != 0)
+        {
+            break;
+        }
+
+        for (;;)
+        {
+            _dtty_stm32_uart_rx_check();
+
+            if (_dtty_stm32_uart_read(ch_p) == 0)
+            {
+                r = 0;
+                break;
+            }
+            else
+            {
+                if (!blocked)
+                {
+                    r = -1;
+                    break;
+                }
+                else
+                {
+                    sem_take_timedms(_g_dtty_uart_rsem, DTTY_UART_CHECK_INTERVAL_MS);
+                }
+            }
+        }
+
+        /* In canonical mode, the characters are echoed by the line discipline */
+        if (0 == r && 0 != _g_bsp_dtty_echo && !DTTY_UART_IS_CANON())
+        {
+            dtty_putc(*ch_p);
+        }
+        
+        mutex_unlock(_g_dtty_uart_getlock);
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int dtty_getc(char *ch_p)
+{
+    return _dtty_getc_advan(ch_p, 1);
+}
+
+int dtty_getc_unblocked(char *ch_p)
+{
+    return _dtty_getc_advan(ch_p, 0);
+}
+
+int dtty_putc(int ch)
+{
+    int r;
+    uint16_t len;
+    uint32_t written;
+    uint8_t data[2];
+    HAL_StatusTypeDef status;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+                if (!_bsp_kernel_active)
+                {
+                    data[0] = (uint8_t) ch;
+                    r = (_dtty_stm32_uart_early_putn((const char *) data, 1) == 1) ? 0 : -1;
+                }
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+                break;
+            }
+        }
+
+        mutex_lock(_g_dtty_uart_putlock);
+
+        do
+        {
+            if (_g_dtty_uart_need_reset)
+            {
+                _dtty_stm32_uart_reset();
+            }
+
+            if (0 != _g_bsp_dtty_autocr && '\n' == ch)
+            {
+                data[0] = '\r';
+                data[1] = '\n';
+                len = 2;
+            }
+            else
+            {
+                data[0] = (uint8_t) ch;
+                len = 1;
+            }
+
+            DTTY_UART_WBUF_LOCK();
+
+            /* The character before the autocr conversion */
+            DTTY_UART_CRASHLOG_WRITE(&data[len - 1], 1);
+            DTTY_UART_BLACKBOX_WRITE(&data[len - 1], 1);
+
+            cbuf_write(_g_dtty_uart_wbuf, data, len, &written);
+            if (written != len)
+            {
+                _g_dtty_uart_tx_overflow_count++;
+            }
+
+            if (_g_dtty_uart_need_tx_restart)
+            {
+                _g_dtty_uart_need_tx_restart = 0;
+                status = _dtty_stm32_uart_tx_start();
+                if (status == HAL_OK || status == HAL_BUSY)
+                {
+                    r = 0;
+                }
+                else
+                {
+                    _g_dtty_uart_need_tx_restart = 1;
+                    r = -1;
+                }
+            }
+            else
+            {
+                r = 0;
+            }
+
+            DTTY_UART_WBUF_UNLOCK();
+
+            break;
+        } while (1);
+
+        mutex_unlock(_g_dtty_uart_putlock);
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+#if (STM32CUBEL4__DTTY_BLACKBOX_ENABLE == 1)
+/* Called by the black box dump to pace its output */
+uint32_t dtty_stm32_get_write_room(void)
+{
+    return DTTY_UART_WRITE_BUFFER_SIZE - cbuf_get_len(_g_dtty_uart_wbuf);
+}
+#endif /* (STM32CUBEL4__DTTY_BLACKBOX_ENABLE == 1) */
+
+int dtty_flush(void)
+{
+    int r;
+    HAL_StatusTypeDef status;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+                break;
+            }
+        }
+
+        mutex_lock(_g_dtty_uart_putlock);
+ 
+        do
+        {
+            if (_g_dtty_uart_need_reset)
+            {
+                _dtty_stm32_uart_reset();
+            }
+
+            if (_dtty_stm32_uart_tx_len() == 0)
+            {
+                r = 0;
+                break;
+            }
+
+            sem_take_timedms(_g_dtty_uart_wsem, DTTY_UART_CHECK_INTERVAL_MS);
+
+            if (_dtty_stm32_uart_tx_len() == 0)
+            {
+                r = 0;
+                break;
+            }
+
+            DTTY_UART_WBUF_LOCK();
+
+            if (_g_dtty_uart_need_tx_restart)
+            {
+                _g_dtty_uart_need_tx_restart = 0;
+                status = _dtty_stm32_uart_tx_start();
+                if (status == HAL_OK || status == HAL_BUSY)
+                {
+                    r = 0;
+                }
+                else
+                {
+                    _g_dtty_uart_need_tx_restart = 1;
+                    r = -1;
+                }
+            }
+            else
+            {
+                r = 0;
+            }
+
+            DTTY_UART_WBUF_UNLOCK();
+        } while (1);
+ 
+        mutex_unlock(_g_dtty_uart_putlock);
+
+        break;
+    } while (1);
+ 
+    return r;
+}
+
+int dtty_putn(const char *str, int len)
+{
+    int r;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+                if (!_bsp_kernel_active && NULL != str && 0 <= len)
+                {
+                    r = _dtty_stm32_uart_early_putn(str, len);
+                }
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+                break;
+            }
+        }
+
+        if (NULL == str)
+        {
+            r = -2;
+            break;
+        }
+
+        if (0 > len)
+        {
+            r = -3;
+            break;
+        }
+
+        for (r = 0; r < len; r++)
+        {
+            dtty_putc(*str);
+            str++;
+        }
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+#if (STM32CUBEL4__DTTY_PRIO_ENABLE == 1)
+
+int dtty_putn_prio(int prio, const char *str, int len)
+{
+    int r;
+    int i;
+    uint32_t need;
+    uint8_t cr = '\r';
+    HAL_StatusTypeDef status;
+
+    r = -1;
+    do
+    {
+        if (DTTY_PRIO_NORMAL == prio)
+        {
+            r = dtty_putn(str, len);
+            break;
+        }
+
+        if (DTTY_PRIO_HIGH != prio)
+        {
+            break;
+        }
+
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+                break;
+            }
+        }
+
+        if (NULL == str)
+        {
+            r = -2;
+            break;
+        }
+
+        if (0 > len)
+        {
+            r = -3;
+            break;
+        }
+
+        need = len;
+        if (0 != _g_bsp_dtty_autocr)
+        {
+            for (i = 0; i < len; i++)
+            {
+                if ('\n' == str[i])
+                {
+                    need++;
+                }
+            }
+        }
+
+        if (_g_dtty_uart_need_reset)
+        {
+            _dtty_stm32_uart_reset();
+        }
+
+        /*
+         * The put lock is not taken: dtty_flush holds it until the write buffers are drained.
+         * The message is queued in a critical section instead, so that it never waits for the normal lane.
+         */
+        ubik_entercrit();
+
+        do
+        {
+            /* The message is queued as a whole, so that the lane holds only complete messages */
+            if (cbuf_get_len(_g_dtty_uart_wbuf_high) + need >= STM32CUBEL4__DTTY_PRIO_BUFFER_SIZE)
+            {
+                _g_dtty_uart_tx_overflow_count++;
+                break;
+            }
+
+            DTTY_UART_CRASHLOG_WRITE((const uint8_t *) str, len);
+            DTTY_UART_BLACKBOX_WRITE((const uint8_t *) str, len);
+
+            for (i = 0; i < len; i++)
+            {
+                if (0 != _g_bsp_dtty_autocr && '\n' == str[i])
+                {
+                    cbuf_write(_g_dtty_uart_wbuf_high, &cr, 1, NULL);
+                }
+                cbuf_write(_g_dtty_uart_wbuf_high, (const uint8_t *) &str[i], 1, NULL);
+            }
+
+            r = len;
+            if (_g_dtty_uart_need_tx_restart)
+            {
+                _g_dtty_uart_need_tx_restart = 0;
+                status = _dtty_stm32_uart_tx_start();
+                if (status != HAL_OK && status != HAL_BUSY)
+                {
+                    _g_dtty_uart_need_tx_restart = 1;
+                    r = -1;
+                }
+            }
+
+            break;
+        } while (1);
+
+        ubik_exitcrit();
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+#endif /* (STM32CUBEL4__DTTY_PRIO_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_WRITEV_ENABLE == 1)
+
+int dtty_writev(const dtty_iovec_t *iov, int iovcnt)
+{
+    int r;
+    int i;
+    int n;
+    uint32_t j;
+    uint32_t k;
+    uint32_t len;
+    uint32_t written;
+    const uint8_t * seg;
+    uint8_t cr = '\r';
+    uint8_t overflow = 0;
+    HAL_StatusTypeDef status;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (NULL == iov)
+        {
+            r = -2;
+            break;
+        }
+
+        if (0 > iovcnt)
+        {
+            r = -3;
+            break;
+        }
+
+        for (i = 0; i < iovcnt; i++)
+        {
+            if (NULL == iov[i].iov_base && 0 != iov[i].iov_len)
+            {
+                break;
+            }
+        }
+        if (i < iovcnt)
+        {
+            r = -2;
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+                if (!_bsp_kernel_active)
+                {
+                    for (r = 0, i = 0; i < iovcnt; i++)
+                    {
+                        n = _dtty_stm32_uart_early_putn((const char *) iov[i].iov_base, (int) iov[i].iov_len);
+                        if (n < 0)
+                        {
+                            r = -1;
+                            break;
+                        }
+                        r += n;
+                    }
+                }
+#else
+                (void) n;
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+                break;
+            }
+        }
+
+        mutex_lock(_g_dtty_uart_putlock);
+
+        do
+        {
+            if (_g_dtty_uart_need_reset)
+            {
+                _dtty_stm32_uart_reset();
+            }
+
+            DTTY_UART_WBUF_LOCK();
+
+            r = 0;
+            for (i = 0; i < iovcnt && !overflow; i++)
+            {
+                seg = (const uint8_t *) iov[i].iov_base;
+                len = (uint32_t) iov[i].iov_len;
+
+                DTTY_UART_CRASHLOG_WRITE(seg, len);
+                DTTY_UART_BLACKBOX_WRITE(seg, len);
+
+                /* Copied a line at a time, with the '\r' of the autocr conversion inserted before its end */
+                for (j = 0, k = 0; k <= len; k++)
+                {
+                    if (k < len && ('\n' != seg[k] || 0 == _g_bsp_dtty_autocr))
+                    {
+                        continue;
+                    }
+
+                    if (k > j)
+                    {
+                        cbuf_write(_g_dtty_uart_wbuf, &seg[j], k - j, &written);
+                        r += (int) written;
+                        if (written != k - j)
+                        {
+                            overflow = 1;
+                            break;
+                        }
+                    }
+
+                    if (k < len)
+                    {
+                        cbuf_write(_g_dtty_uart_wbuf, &cr, 1, &written);
+                        if (written != 1)
+                        {
+                            overflow = 1;
+                            break;
+                        }
+                    }
+
+                    j = k;
+                }
+            }
+
+            if (overflow)
+            {
+                _g_dtty_uart_tx_overflow_count++;
+            }
+
+            /* One start for all the segments */
+            if (_g_dtty_uart_need_tx_restart && _dtty_stm32_uart_tx_len() > 0)
+            {
+                _g_dtty_uart_need_tx_restart = 0;
+                status = _dtty_stm32_uart_tx_start();
+                if (status != HAL_OK && status != HAL_BUSY)
+                {
+                    _g_dtty_uart_need_tx_restart = 1;
+                    r = -1;
+                }
+            }
+
+            DTTY_UART_WBUF_UNLOCK();
+
+            break;
+        } while (1);
+
+        mutex_unlock(_g_dtty_uart_putlock);
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+#endif /* (STM32CUBEL4__DTTY_WRITEV_ENABLE == 1) */
+
+int dtty_kbhit(void)
+{
+    int r;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+                break;
+            }
+        }
+
+        if (DTTY_UART_IS_CANON())
+        {
+#if (STM32CUBEL4__DTTY_LINE_ENABLE == 1)
+            r = (_g_dtty_uart_line_count != 0) ? 1 : 0;
+#endif /* (STM32CUBEL4__DTTY_LINE_ENABLE == 1) */
+        }
+        else if (cbuf_get_len(_g_dtty_uart_rbuf) != 0)
+        {
+            r = 1;
+        }
+        else
+        {
+            r = 0;
+        }
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+void dtty_write_process(void *arg)
+{
+}
+
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+
+int dtty_early_setpolled(int enable)
+{
+    if (_g_bsp_dtty_init)
+    {
+        return -1;
+    }
+
+    _g_dtty_uart_early_polled = enable ? 1 : 0;
+
+    return 0;
+}
+
+uint32_t dtty_early_get_overflow_count(void)
+{
+    return _g_dtty_uart_early_overflow_count;
+}
+
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_POLL_ENABLE == 1)
+
+uint32_t dtty_stm32_poll_level(void)
+{
+    uint32_t events = 0;
+
+    if (!_g_bsp_dtty_init)
+    {
+        return 0;
+    }
+
+    if (dtty_kbhit() == 1)
+    {
+        events |= DTTY_POLL_RX;
+    }
+
+    if (!cbuf_is_full(_g_dtty_uart_wbuf))
+    {
+        events |= DTTY_POLL_TX;
+    }
+
+    return events;
+}
+
+#endif /* (STM32CUBEL4__DTTY_POLL_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_READ_ENABLE == 1)
+
+static void _dtty_stm32_uart_rto(void)
+{
+    _g_dtty_uart_rto_count++;
+    if (_g_dtty_uart_rto_armed && _bsp_kernel_active)
+    {
+        sem_give(_g_dtty_uart_rsem);
+    }
+}
+
+void dtty_stm32_uart_irq_callback(void)
+{
+    /* Cleared here, HAL_UART_IRQHandler does not report it as an error */
+    if (__HAL_UART_GET_FLAG(&DTTY_STM32_UART_HANDLE, UART_FLAG_RTOF))
+    {
+        __HAL_UART_CLEAR_FLAG(&DTTY_STM32_UART_HANDLE, UART_CLEAR_RTOF);
+        _dtty_stm32_uart_rto();
+    }
+}
+
+int dtty_read(char *buf, int max, int vmin, uint32_t vtimems)
+{
+    int r;
+    int got;
+    int expired;
+    uint32_t n;
+    uint32_t wake;
+    uint32_t rx_len;
+    uint32_t rto_count;
+    uint64_t rto;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+                break;
+            }
+        }
+
+        if (NULL == buf)
+        {
+            r = -2;
+            break;
+        }
+
+        if (0 >= max || 0 > vmin)
+        {
+            r = -3;
+            break;
+        }
+
+        if (DTTY_UART_IS_CANON())
+        {
+            break;
+        }
+
+        if (vmin > max)
+        {
+            vmin = max;
+        }
+
+        mutex_lock(_g_dtty_uart_getlock);
+
+        if (vmin > 0 && vtimems > 0)
+        {
+            /* The receiver timeout counts bit durations from the end of the last character */
+            rto = ((uint64_t) vtimems * DTTY_STM32_UART_HANDLE.Init.BaudRate) / 1000;
+            if (rto > USART_RTOR_RTO)
+            {
+                rto = USART_RTOR_RTO;
+            }
+
+            ubik_entercrit();
+            MODIFY_REG(DTTY_STM32_UART_HANDLE.Instance->RTOR, USART_RTOR_RTO, (uint32_t) rto);
+            __HAL_UART_CLEAR_FLAG(&DTTY_STM32_UART_HANDLE, UART_CLEAR_RTOF);
+            SET_BIT(DTTY_STM32_UART_HANDLE.Instance->CR2, USART_CR2_RTOEN);
+            SET_BIT(DTTY_STM32_UART_HANDLE.Instance->CR1, USART_CR1_RTOIE);
+            _g_dtty_uart_rto_armed = 1;
+            ubik_exitcrit();
+        }
+
+        got = 0;
+        expired = 0;
+        for (;;)
+        {
+            _dtty_stm32_uart_rx_check();
+
+            n = cbuf_get_len(_g_dtty_uart_rbuf);
+            if (n > (uint32_t) (max - got))
+            {
+                n = max - got;
+            }
+            if (n > 0)
+            {
+                cbuf_read(_g_dtty_uart_rbuf, (uint8_t *) buf + got, n, NULL);
+                got += n;
+            }
+
+            if (got >= max || (vmin > 0 && got >= vmin) || (vmin == 0 && got > 0))
+            {
+                break;
+            }
+
+            if (expired || (vmin == 0 && vtimems == 0))
+            {
+                break;
+            }
+
+            wake = (vmin > 0) ? (uint32_t) (vmin - got) : 1;
+            if (wake > DTTY_UART_READ_BUFFER_SIZE - 1)
+            {
+                wake = DTTY_UART_READ_BUFFER_SIZE - 1;
+            }
+
+            ubik_entercrit();
+            _g_dtty_uart_rx_wake_len = wake;
+            rx_len = cbuf_get_len(_g_dtty_uart_rbuf);
+            rto_count = _g_dtty_uart_rto_count;
+            ubik_exitcrit();
+
+            if (rx_len >= wake)
+            {
+                continue;
+            }
+
+            if (vtimems == 0)
+            {
+                sem_take_timedms(_g_dtty_uart_rsem, DTTY_UART_CHECK_INTERVAL_MS);
+                continue;
+            }
+
+            sem_take_timedms(_g_dtty_uart_rsem, vtimems);
+
+            if (vmin == 0)
+            {
+                expired = 1;
+            }
+            else if (rto_count != _g_dtty_uart_rto_count || rx_len == cbuf_get_len(_g_dtty_uart_rbuf))
+            {
+                /* Receiver timeout, or nothing received for vtimems (the line was already idle when armed).
+                 * The idle time counts only once a character has been received. */
+                expired = (got > 0 || cbuf_get_len(_g_dtty_uart_rbuf) > 0) ? 1 : 0;
+            }
+        }
+
+        ubik_entercrit();
+        _g_dtty_uart_rx_wake_len = 1;
+        if (_g_dtty_uart_rto_armed)
+        {
+            _g_dtty_uart_rto_armed = 0;
+            CLEAR_BIT(DTTY_STM32_UART_HANDLE.Instance->CR1, USART_CR1_RTOIE);
+            CLEAR_BIT(DTTY_STM32_UART_HANDLE.Instance->CR2, USART_CR2_RTOEN);
+        }
+        ubik_exitcrit();
+
+        mutex_unlock(_g_dtty_uart_getlock);
+
+        r = got;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+#endif /* (STM32CUBEL4__DTTY_READ_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_LINE_ENABLE == 1)
+
+int dtty_setcanon(int enable)
+{
+    if (bsp_isintr() || 0 != _bsp_critcount)
+    {
+        return -1;
+    }
+
+    if (!_g_bsp_dtty_init)
+    {
+        dtty_init();
+        if (!_g_bsp_dtty_init)
+        {
+            return -1;
+        }
+    }
+
+    ubik_entercrit();
+    if (enable && !_g_dtty_uart_canon)
+    {
+        __HAL_UART_CLEAR_FLAG(&DTTY_STM32_UART_HANDLE, UART_CLEAR_CMF);
+        _g_dtty_uart_line_len = 0;
+        _g_dtty_uart_line_cr = 0;
+        _g_dtty_uart_line_count = 0;
+    }
+    _g_dtty_uart_canon = enable ? 1 : 0;
+    ubik_exitcrit();
+
+    return 0;
+}
+
+int dtty_getcanon(void)
+{
+    return _g_dtty_uart_canon;
+}
+
+int dtty_getline(char *buf, int max)
+{
+    int r;
+    int len;
+    char ch;
+
+    r = -1;
+    do
+    {
+        if (NULL == buf)
+        {
+            r = -2;
+            break;
+        }
+
+        if (0 >= max)
+        {
+            r = -3;
+            break;
+        }
+
+        len = 0;
+        for (;;)
+        {
+            r = dtty_getc(&ch);
+            if (r != 0)
+            {
+                break;
+            }
+
+            if ('\n' == ch || ('\r' == ch && !DTTY_UART_IS_CANON()))
+            {
+                break;
+            }
+
+            if (len < max - 1)
+            {
+                buf[len] = ch;
+                len++;
+            }
+        }
+        if (r != 0)
+        {
+            break;
+        }
+
+        buf[len] = '\0';
+        r = len;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+#endif /* (STM32CUBEL4__DTTY_LINE_ENABLE == 1) */
+
+#endif /* (STM32CUBEL4__DTTY_STM32_UART_ENABLE == 1) */
+
+#endif /* (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL) */
+
+#endif /* (UBINOS__BSP__USE_DTTY == 1) */
+
+#endif /* (INCLUDE__UBINOS__BSP == 1) */
+
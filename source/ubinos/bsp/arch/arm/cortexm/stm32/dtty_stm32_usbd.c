@@ -1,563 +1,1785 @@
-/*
- * Copyright (c) 2021 Sung Ho Park and CSOS
- *
- * SPDX-License-Identifier: Apache-2.0
- */
-
-#include <ubinos.h>
-
-#if (INCLUDE__UBINOS__BSP == 1)
-
-#if (UBINOS__BSP__USE_DTTY == 1)
-
-#if (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL)
-
-#if (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1)
-
-#if (INCLUDE__UBINOS__UBIK != 1)
-    #error "ubik is necessary"
-#endif
-
-#include <ubinos/bsp.h>
-#include <ubinos/bsp/arch.h>
-#include <ubinos/bsp_ubik.h>
-
-#include <assert.h>
-
-#include "main.h"
-
-extern int _g_bsp_dtty_init;
-extern int _g_bsp_dtty_in_init;
-extern int _g_bsp_dtty_echo;
-extern int _g_bsp_dtty_autocr;
-
-#define DTTY_UART_ISR_WRITE_BUFFER_SIZE (512)
-#define DTTY_UART_READ_BUFFER_SIZE (512)
-#define DTTY_UART_WRITE_BUFFER_SIZE (1024 * 10)
-
-#define DTTY_USBD_READ_CHECK_INTERVAL_MS 1000
-#define DTTY_USBD_WRITE_CHECK_INTERVAL_MS 1000
-
-cbuf_def_init(_g_dtty_usbd_isr_wbuf, DTTY_UART_ISR_WRITE_BUFFER_SIZE);
-cbuf_def_init(_g_dtty_usbd_rbuf, DTTY_UART_READ_BUFFER_SIZE);
-cbuf_def_init(_g_dtty_usbd_wbuf, DTTY_UART_WRITE_BUFFER_SIZE);
-
-sem_pt _g_dtty_usbd_rsem = NULL;
-sem_pt _g_dtty_usbd_wsem = NULL;
-
-mutex_pt _g_dtty_usbd_putlock = NULL;
-mutex_pt _g_dtty_usbd_getlock = NULL;
-mutex_pt _g_dtty_usbd_resetlock = NULL;
-
-uint32_t _g_dtty_usbd_rx_overflow_count = 0;
-uint32_t _g_dtty_usbd_tx_overflow_count = 0;
-uint32_t _g_dtty_usbd_reset_count = 0;
-
-uint8_t _g_dtty_usbd_need_reset = 0;
-
-static void _dtty_stm32_usbd_reset(void);
-static int _dtty_getc_advan(char *ch_p, int blocked);
-
-static void _dtty_stm32_usbd_reset(void)
-{
-    mutex_lock(_g_dtty_usbd_resetlock);
-
-    if (_g_dtty_usbd_need_reset)
-    {
-        _g_dtty_usbd_need_reset = 0;
-
-        /* Enable Power Clock*/
-        __HAL_RCC_PWR_CLK_ENABLE();
-        
-        /* enable USB power on Pwrctrl CR2 register */
-        HAL_PWREx_EnableVddUSB();
-
-        /* Init Device Library */
-        USBD_Init(&USBD_Device, &VCP_Desc, 0);
-        
-        /* Add Supported Class */
-        USBD_RegisterClass(&USBD_Device, USBD_CDC_CLASS);
-        
-        /* Add CDC Interface Class */
-        USBD_CDC_RegisterInterface(&USBD_Device, &USBD_CDC_fops);
-        
-        /* Start Device Process */
-        USBD_Start(&USBD_Device);
-
-        _g_dtty_usbd_reset_count++;
-
-        sem_give(_g_dtty_usbd_wsem);
-    }
-
-    mutex_unlock(_g_dtty_usbd_resetlock);
-}
-
-void dtty_stm32_usbd_rx_callback(uint8_t* buf, uint32_t *len)
-{
-    uint8_t need_notify = 0;
-
-    if (cbuf_get_len(_g_dtty_usbd_rbuf) == 0)
-    {
-        need_notify = 1;
-    }
-    cbuf_write(_g_dtty_usbd_rbuf, buf, *len, NULL);
-    if (need_notify && _g_dtty_usbd_rsem != NULL)
-    {
-        sem_give(_g_dtty_usbd_rsem);
-    }
-
-    USBD_CDC_ReceivePacket(&USBD_Device);
-}
-
-void dtty_stm32_usbd_tx_callback(void)
-{
-    sem_give(_g_dtty_usbd_wsem);
-}
-
-int dtty_init(void)
-{
-    int r;
-    (void) r;
-
-    do
-    {
-        if (bsp_isintr() || 0 != _bsp_critcount)
-        {
-            break;
-        }
-
-        if (!_bsp_kernel_active)
-        {
-            break;
-        }
-
-        if (_g_bsp_dtty_init || _g_bsp_dtty_in_init)
-        {
-            break;
-        }
-
-        _g_bsp_dtty_in_init = 1;
-
-        r = semb_create(&_g_dtty_usbd_rsem);
-        assert(r == 0);
-        r = semb_create(&_g_dtty_usbd_wsem);
-        assert(r == 0);
-        r = mutex_create(&_g_dtty_usbd_resetlock);
-        assert(r == 0);
-        r = mutex_create(&_g_dtty_usbd_putlock);
-        assert(r == 0);
-        r = mutex_create(&_g_dtty_usbd_getlock);
-        assert(r == 0);
-
-        _g_bsp_dtty_echo = 1;
-        _g_bsp_dtty_autocr = 1;
-
-        _g_dtty_usbd_need_reset = 1;
-
-        _dtty_stm32_usbd_reset();
-
-        _g_dtty_usbd_reset_count = 0;
-
-        _g_bsp_dtty_init = 1;
-
-        cbuf_clear(_g_dtty_usbd_rbuf);
-
-        _g_bsp_dtty_in_init = 0;
-
-        break;
-    } while (1);
-
-    return 0;
-}
-
-int dtty_enable(void)
-{
-    return 0;
-}
-
-int dtty_disable(void)
-{
-    return 0;
-}
-
-int dtty_geterror(void)
-{
-    return 0;
-}
-
-static int _dtty_getc_advan(char *ch_p, int blocked)
-{
-    int r;
-    ubi_err_t ubi_err;
-
-    r = -1;
-    do
-    {
-        if (bsp_isintr() || 0 != _bsp_critcount)
-        {
-            break;
-        }
-
-        if (!_g_bsp_dtty_init)
-        {
-            dtty_init();
-            if (!_g_bsp_dtty_init)
-            {
-                break;
-            }
-        }
-
-        if (!blocked)
-        {
-            r = mutex_lock_timed(_g_dtty_usbd_getlock, 0);
-        }
-        else
-        {
-            r = mutex_lock(_g_dtty_usbd_getlock);
-        }
-        if (r != 0)
-        {
-            break;
-        }
-
-        for (;;)
-        {
-            if (_g_dtty_usbd_need_reset)
-            {
-                _dtty_stm32_usbd_reset();
-            }
-
-            ubi_err = cbuf_read(_g_dtty_usbd_rbuf, (uint8_t*) ch_p, 1, NULL);
-            if (ubi_err == UBI_ERR_OK)
-            {
-                r = 0;
-                break;
-            }
-            else
-            {
-                if (!blocked)
-                {
-                    break;
-                }
-                else
-                {
-                    sem_take_timedms(_g_dtty_usbd_rsem, DTTY_USBD_READ_CHECK_INTERVAL_MS);
-                }
-            }
-        }
-
-        if (0 == r && 0 != _g_bsp_dtty_echo)
-        {
-            dtty_putc(*ch_p);
-        }
-        
-        mutex_unlock(_g_dtty_usbd_getlock);
-
-        break;
-    } while (1);
-
-    return r;
-}
-
-int dtty_getc(char *ch_p)
-{
-    return _dtty_getc_advan(ch_p, 1);
-}
-
-int dtty_getc_unblocked(char *ch_p)
-{
-    return _dtty_getc_advan(ch_p, 0);
-}
-
-int dtty_putc(int ch)
-{
-    int r;
-    uint16_t len;
-    uint32_t written;
-    uint8_t data[2];
-    uint8_t need_notify = 0;
-
-    r = -1;
-    do
-    {
-        if (bsp_isintr() || 0 != _bsp_critcount)
-        {
-            data[0] = (uint8_t) ch;
-            len = 1;
-            if (cbuf_get_len(_g_dtty_usbd_isr_wbuf) == 0)
-            {
-                need_notify = 1;
-            }
-            cbuf_write(_g_dtty_usbd_isr_wbuf, data, len, &written);
-            if (written != len)
-            {
-                _g_dtty_usbd_tx_overflow_count++;
-            }
-            if (need_notify)
-            {
-                sem_give(_g_dtty_usbd_wsem);
-            }
-
-            r = 0;
-            break;
-        }
-
-        if (!_g_bsp_dtty_init)
-        {
-            dtty_init();
-            if (!_g_bsp_dtty_init)
-            {
-                break;
-            }
-        }
-
-        mutex_lock(_g_dtty_usbd_putlock);
-
-        do
-        {
-            if (cbuf_is_full(_g_dtty_usbd_wbuf))
-            {
-                _g_dtty_usbd_tx_overflow_count++;
-                break;
-            }
-
-            if (0 != _g_bsp_dtty_autocr && '\n' == ch)
-            {
-                data[0] = '\r';
-                data[1] = '\n';
-                len = 2;
-            }
-            else
-            {
-                data[0] = (uint8_t) ch;
-                len = 1;
-            }
-
-            if (cbuf_get_len(_g_dtty_usbd_wbuf) == 0)
-            {
-                need_notify = 1;
-            }
-            cbuf_write(_g_dtty_usbd_wbuf, data, len, &written);
-            if (written != len)
-            {
-                _g_dtty_usbd_tx_overflow_count++;
-                break;
-            }
-            if (need_notify)
-            {
-                sem_give(_g_dtty_usbd_wsem);
-            }
-
-            r = 0;
-            break;
-        } while (1);
-
-        mutex_unlock(_g_dtty_usbd_putlock);
-
-        break;
-    } while (1);
-
-    return r;
-}
-
-int dtty_flush(void)
-{
-    return 0;
-}
-
-int dtty_putn(const char *str, int len)
-{
-    int r;
-    uint32_t written;
-    uint8_t need_notify = 0;
-
-    r = -1;
-    do
-    {
-        if (NULL == str)
-        {
-            r = -2;
-            break;
-        }
-
-        if (0 > len)
-        {
-            r = -3;
-            break;
-        }
-
-        if (bsp_isintr() || 0 != _bsp_critcount)
-        {
-            if (cbuf_get_len(_g_dtty_usbd_isr_wbuf) == 0)
-            {
-                need_notify = 1;
-            }
-            cbuf_write(_g_dtty_usbd_isr_wbuf, (uint8_t *) str, len, &written);
-            if (written != len)
-            {
-                _g_dtty_usbd_tx_overflow_count++;
-            }
-            if (need_notify)
-            {
-                sem_give(_g_dtty_usbd_wsem);
-            }
-
-            r = written;
-            break;
-        }
-
-        if (!_g_bsp_dtty_init)
-        {
-            dtty_init();
-            if (!_g_bsp_dtty_init)
-            {
-                break;
-            }
-        }
-        if (0 != _g_bsp_dtty_autocr)
-        {
-            for (written = 0; written < len; written++)
-            {
-                r = dtty_putc(*str);
-                if (r < 0)
-                {
-                    break;
-                }
-                str++;
-            }
-        }
-        else
-        {
-            if (cbuf_get_len(_g_dtty_usbd_wbuf) == 0)
-            {
-                need_notify = 1;
-            }
-            cbuf_write(_g_dtty_usbd_wbuf, (uint8_t *) str, len, &written);
-            if (written != len)
-            {
-                _g_dtty_usbd_tx_overflow_count++;
-                break;
-            }
-            if (need_notify)
-            {
-                sem_give(_g_dtty_usbd_wsem);
-            }
-        }
-
-        r = written;
-        break;
-    } while (1);
-
-    return r;
-}
-
-int dtty_kbhit(void)
-{
-    int r;
-
-    r = -1;
-    do
-    {
-        if (bsp_isintr() || 0 != _bsp_critcount)
-        {
-            break;
-        }
-
-        if (!_g_bsp_dtty_init)
-        {
-            dtty_init();
-            if (!_g_bsp_dtty_init)
-            {
-                break;
-            }
-        }
-
-        if (cbuf_get_len(_g_dtty_usbd_rbuf) != 0)
-        {
-            r = 1;
-        }
-        else
-        {
-            r = 0;
-        }
-
-        break;
-    } while (1);
-
-    return r;
-}
-
-void dtty_write_process(void *arg)
-{
-    uint8_t * buf;
-    uint32_t len;
-    int r;
-    uint8_t usb_status;
-
-    if (bsp_isintr() || 0 != _bsp_critcount)
-    {
-        ubi_assert(0);
-    }
-
-    for (;;)
-    {
-        do
-        {
-            if (_g_dtty_usbd_need_reset)
-            {
-                _dtty_stm32_usbd_reset();
-            }
-
-            while (cbuf_get_len(_g_dtty_usbd_isr_wbuf) > 0)
-            {
-                buf = cbuf_get_head_addr(_g_dtty_usbd_isr_wbuf);
-                len = cbuf_get_contig_len(_g_dtty_usbd_isr_wbuf);
-
-                r = dtty_putn((const char *) buf, len);
-                if (r <= 0)
-                {
-                    break;
-                }
-
-                cbuf_read(_g_dtty_usbd_isr_wbuf, NULL, r, NULL);
-            }
-
-            while (cbuf_get_len(_g_dtty_usbd_wbuf) > 0)
-            {
-                buf = cbuf_get_head_addr(_g_dtty_usbd_wbuf);
-                len = cbuf_get_contig_len(_g_dtty_usbd_wbuf);
-                
-                USBD_CDC_SetTxBuffer(&USBD_Device, buf, len);
-                usb_status = USBD_CDC_TransmitPacket(&USBD_Device);
-                if(usb_status == USBD_OK)
-                {
-                    cbuf_read(_g_dtty_usbd_wbuf, NULL, len, NULL);
-                }
-                else
-                {
-                    break;
-                }
-            }
-
-            break;
-        } while (1);
-
-        if (task_is_idle(NULL))
-        {
-            break;
-        }
-        else
-        {
-            sem_take_timedms(_g_dtty_usbd_wsem, DTTY_USBD_WRITE_CHECK_INTERVAL_MS);
-        }
-    }
-}
-
-#endif /* (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1) */
-
-#endif /* (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL) */
-
-#endif /* (UBINOS__BSP__USE_DTTY == 1) */
-
-#endif /* (INCLUDE__UBINOS__BSP == 1) */
-
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos.h>
+
+#if (INCLUDE__UBINOS__BSP == 1)
+
+#if (UBINOS__BSP__USE_DTTY == 1)
+
+#if (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL)
+
+#if (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1)
+
+#if (INCLUDE__UBINOS__UBIK != 1)
+    #error "ubik is necessary"
+#endif
+
+#include <ubinos/bsp.h>
+#include <ubinos/bsp/arch.h>
+#include <ubinos/bsp_ubik.h>
+#include <stm32cubel4_extension/dtty.h>
+
+#include <assert.h>
+#include <string.h>
+
+#include "main.h"
+
+extern int _g_bsp_dtty_init;
+extern int _g_bsp_dtty_in_init;
+extern int _g_bsp_dtty_echo;
+extern int _g_bsp_dtty_autocr;
+
+#define DTTY_UART_ISR_WRITE_BUFFER_SIZE (512)
+#define DTTY_UART_READ_BUFFER_SIZE (512)
+#define DTTY_UART_WRITE_BUFFER_SIZE (1024 * 10)
+
+#define DTTY_USBD_READ_CHECK_INTERVAL_MS 1000
+#define DTTY_USBD_WRITE_CHECK_INTERVAL_MS 1000
+
+cbuf_def_init(_g_dtty_usbd_isr_wbuf, DTTY_UART_ISR_WRITE_BUFFER_SIZE);
+cbuf_def_init(_g_dtty_usbd_rbuf, DTTY_UART_READ_BUFFER_SIZE);
+cbuf_def_init(_g_dtty_usbd_wbuf, DTTY_UART_WRITE_BUFFER_SIZE);
+
+sem_pt _g_dtty_usbd_rsem = NULL;
+sem_pt _g_dtty_usbd_wsem = NULL;
+
+mutex_pt _g_dtty_usbd_putlock = NULL;
+mutex_pt _g_dtty_usbd_getlock = NULL;
+mutex_pt _g_dtty_usbd_resetlock = NULL;
+
+uint32_t _g_dtty_usbd_rx_overflow_count = 0;
+uint32_t _g_dtty_usbd_tx_overflow_count = 0;
+uint32_t _g_dtty_usbd_reset_count = 0;
+
+uint8_t _g_dtty_usbd_need_reset = 0;
+
+#if (STM32CUBEL4__DTTY_LINE_ENABLE == 1)
+
+uint8_t _g_dtty_usbd_canon = 0;
+uint8_t _g_dtty_usbd_line_cr = 0;
+uint32_t _g_dtty_usbd_line_len = 0;
+uint32_t _g_dtty_usbd_line_count = 0;
+uint8_t _g_dtty_usbd_line[STM32CUBEL4__DTTY_LINE_SIZE + 1];
+
+#define DTTY_USBD_IS_CANON() (_g_dtty_usbd_canon != 0)
+
+static void _dtty_stm32_usbd_line_input(uint8_t ch);
+
+#else
+
+#define DTTY_USBD_IS_CANON() 0
+
+#endif /* (STM32CUBEL4__DTTY_LINE_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_READ_ENABLE == 1)
+
+/* The reader is woken when the read buffer reaches this length (1 out of dtty_read) */
+uint32_t _g_dtty_usbd_rx_wake_len = 1;
+uint8_t _g_dtty_usbd_rx_boundary_armed = 0;
+uint32_t _g_dtty_usbd_rx_boundary_count = 0;
+
+#define DTTY_USBD_RX_WAKE_LEN _g_dtty_usbd_rx_wake_len
+
+#else
+
+#define DTTY_USBD_RX_WAKE_LEN 1
+
+#endif /* (STM32CUBEL4__DTTY_READ_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_POLL_ENABLE == 1)
+
+extern void dtty_stm32_poll_notify(uint32_t events);
+uint32_t dtty_stm32_poll_level(void);
+
+#define DTTY_USBD_POLL_NOTIFY(events) dtty_stm32_poll_notify(events)
+
+#else
+
+#define DTTY_USBD_POLL_NOTIFY(events)
+
+#endif /* (STM32CUBEL4__DTTY_POLL_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+
+cbuf_def_init(_g_dtty_usbd_early_buf, STM32CUBEL4__DTTY_EARLY_BUFFER_SIZE);
+
+uint32_t _g_dtty_usbd_early_overflow_count = 0;
+
+static int _dtty_stm32_usbd_early_putn(const char *str, int len);
+static void _dtty_stm32_usbd_early_replay(void);
+
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_CRASHLOG_ENABLE == 1)
+
+extern void dtty_stm32_crashlog_write(const uint8_t *data, uint32_t len);
+extern void dtty_stm32_crashlog_replay(void);
+
+#define DTTY_USBD_CRASHLOG_WRITE(data, len) dtty_stm32_crashlog_write(data, len)
+
+#else
+
+#define DTTY_USBD_CRASHLOG_WRITE(data, len)
+
+#endif /* (STM32CUBEL4__DTTY_CRASHLOG_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_BLACKBOX_ENABLE == 1)
+
+extern void dtty_stm32_blackbox_write(const uint8_t *data, uint32_t len);
+
+uint32_t dtty_stm32_get_write_room(void);
+
+#define DTTY_USBD_BLACKBOX_WRITE(data, len) dtty_stm32_blackbox_write(data, len)
+
+#else
+
+#define DTTY_USBD_BLACKBOX_WRITE(data, len)
+
+#endif /* (STM32CUBEL4__DTTY_BLACKBOX_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_PRIO_ENABLE == 1)
+
+/* High priority lane, drained before the write buffer (normal lane) at its message boundaries */
+cbuf_def_init(_g_dtty_usbd_wbuf_high, STM32CUBEL4__DTTY_PRIO_BUFFER_SIZE);
+
+uint32_t _g_dtty_usbd_tx_run = 0;   /* Characters of the normal lane sent since its last message boundary */
+
+#endif /* (STM32CUBEL4__DTTY_PRIO_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1)
+
+#define DTTY_USBD_LINESTATE_DTR 0x0001
+
+sem_pt _g_dtty_usbd_link_sem = NULL;
+
+uint8_t _g_dtty_usbd_link_dtr = 0;          /* DTR is set by the host (SET_CONTROL_LINE_STATE) */
+uint8_t _g_dtty_usbd_link_suspended = 0;    /* The bus is suspended */
+uint8_t _g_dtty_usbd_link_policy = DTTY_USBD_LINK_KEEP;
+uint32_t _g_dtty_usbd_link_keep = STM32CUBEL4__DTTY_USBD_LINK_KEEP_SIZE;
+uint32_t _g_dtty_usbd_link_drop_count = 0;
+
+#define DTTY_USBD_LINK_IS_UP() (_g_dtty_usbd_link_dtr && !_g_dtty_usbd_link_suspended)
+#define DTTY_USBD_LINK_BLOCKS() (!DTTY_USBD_LINK_IS_UP() && DTTY_USBD_LINK_BLOCK == _g_dtty_usbd_link_policy)
+#define DTTY_USBD_LINK_CHECK(need) _dtty_stm32_usbd_link_check(need)
+
+static void _dtty_stm32_usbd_link_notify(void);
+static void _dtty_stm32_usbd_link_trim(uint32_t need);
+static int _dtty_stm32_usbd_link_check(uint32_t need);
+
+#else
+
+#define DTTY_USBD_LINK_BLOCKS() 0
+#define DTTY_USBD_LINK_CHECK(need) ((void) (need), 0)
+
+#endif /* (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_USBD_PORT_ENABLE == 1)
+
+extern void dtty_stm32_usbd_port_init(void);
+extern void dtty_stm32_usbd_port_process(void);
+
+/* Implemented by the application (composite device) */
+extern void dtty_stm32_usbd_port_register(void);
+extern uint8_t dtty_stm32_usbd_port_transmit(int port, uint8_t *buf, uint32_t len);
+extern uint8_t dtty_stm32_usbd_port_receive(int port);
+
+#define DTTY_USBD_TRANSMIT(buf, len) dtty_stm32_usbd_port_transmit(DTTY_USBD_PORT_CONSOLE, buf, len)
+#define DTTY_USBD_RECEIVE() dtty_stm32_usbd_port_receive(DTTY_USBD_PORT_CONSOLE)
+
+#else
+
+#define DTTY_USBD_TRANSMIT(buf, len) (USBD_CDC_SetTxBuffer(&USBD_Device, buf, len), USBD_CDC_TransmitPacket(&USBD_Device))
+#define DTTY_USBD_RECEIVE() USBD_CDC_ReceivePacket(&USBD_Device)
+
+#endif /* (STM32CUBEL4__DTTY_USBD_PORT_ENABLE == 1) */
+
+static void _dtty_stm32_usbd_reset(void);
+static uint32_t _dtty_stm32_usbd_tx_len(void);
+static cbuf_pt _dtty_stm32_usbd_tx_select(uint32_t *len_p);
+static int _dtty_stm32_usbd_read(char *ch_p);
+static int _dtty_getc_advan(char *ch_p, int blocked);
+
+static void _dtty_stm32_usbd_reset(void)
+{
+    mutex_lock(_g_dtty_usbd_resetlock);
+
+    if (_g_dtty_usbd_need_reset)
+    {
+        _g_dtty_usbd_need_reset = 0;
+
+        /* Enable Power Clock*/
+        __HAL_RCC_PWR_CLK_ENABLE();
+        
+        /* enable USB power on Pwrctrl CR2 register */
+        HAL_PWREx_EnableVddUSB();
+
+        /* Init Device Library */
+        USBD_Init(&USBD_Device, &VCP_Desc, 0);
+        
+#if (STM32CUBEL4__DTTY_USBD_PORT_ENABLE == 1)
+        /* Add the CDC functions of the composite device, with their interfaces */
+        dtty_stm32_usbd_port_register();
+#else
+        /* Add Supported Class */
+        USBD_RegisterClass(&USBD_Device, USBD_CDC_CLASS);
+        
+        /* Add CDC Interface Class */
+        USBD_CDC_RegisterInterface(&USBD_Device, &USBD_CDC_fops);
+#endif /* (STM32CUBEL4__DTTY_USBD_PORT_ENABLE == 1) */
+        
+        /* Start Device Process */
+        USBD_Start(&USBD_Device);
+
+        _g_dtty_usbd_reset_count++;
+
+        sem_give(_g_dtty_usbd_wsem);
+
+        DTTY_USBD_POLL_NOTIFY(DTTY_POLL_ERR);
+    }
+
+    mutex_unlock(_g_dtty_usbd_resetlock);
+}
+
+/* Number of characters waiting to be sent, in all the lanes */
+static uint32_t _dtty_stm32_usbd_tx_len(void)
+{
+#if (STM32CUBEL4__DTTY_PRIO_ENABLE == 1)
+    return cbuf_get_len(_g_dtty_usbd_wbuf) + cbuf_get_len(_g_dtty_usbd_wbuf_high);
+#else
+    return cbuf_get_len(_g_dtty_usbd_wbuf);
+#endif /* (STM32CUBEL4__DTTY_PRIO_ENABLE == 1) */
+}
+
+/*
+ * Selects the lane and the length of the next packet. The high priority lane is taken at a message
+ * boundary of the normal lane (after a line end, or DTTY_PRIO_RUN_MAX characters), or when the
+ * normal lane is empty. While the high priority lane waits, the packets of the normal lane end at
+ * its next message boundary.
+ */
+static cbuf_pt _dtty_stm32_usbd_tx_select(uint32_t *len_p)
+{
+#if (STM32CUBEL4__DTTY_PRIO_ENABLE == 1)
+    uint8_t * buf;
+    uint8_t * eol;
+    uint32_t len;
+
+    if (cbuf_get_len(_g_dtty_usbd_wbuf_high) > 0)
+    {
+        if (_g_dtty_usbd_tx_run == 0 || cbuf_get_len(_g_dtty_usbd_wbuf) == 0)
+        {
+            *len_p = cbuf_get_contig_len(_g_dtty_usbd_wbuf_high);
+            return _g_dtty_usbd_wbuf_high;
+        }
+
+        buf = cbuf_get_head_addr(_g_dtty_usbd_wbuf);
+        len = cbuf_get_contig_len(_g_dtty_usbd_wbuf);
+        if (len > DTTY_PRIO_RUN_MAX - _g_dtty_usbd_tx_run)
+        {
+            len = DTTY_PRIO_RUN_MAX - _g_dtty_usbd_tx_run;
+        }
+        eol = memchr(buf, '\n', len);
+        *len_p = (NULL != eol) ? (uint32_t) (eol - buf) + 1 : len;
+        return _g_dtty_usbd_wbuf;
+    }
+#endif /* (STM32CUBEL4__DTTY_PRIO_ENABLE == 1) */
+
+    *len_p = cbuf_get_contig_len(_g_dtty_usbd_wbuf);
+    return _g_dtty_usbd_wbuf;
+}
+
+#if (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1)
+
+/* Wakes the writer task and the writers waiting for a host. Called in interrupt context. */
+static void _dtty_stm32_usbd_link_notify(void)
+{
+    if (_g_dtty_usbd_wsem != NULL)
+    {
+        sem_give(_g_dtty_usbd_wsem);
+    }
+    if (_g_dtty_usbd_link_sem != NULL)
+    {
+        sem_give(_g_dtty_usbd_link_sem);
+    }
+}
+
+/*
+ * Drops the oldest characters of the write buffers, so that need more fit in the kept output.
+ * The lanes share the budget, and the normal lane is trimmed first. Called with the write lock held.
+ */
+static void _dtty_stm32_usbd_link_trim(uint32_t need)
+{
+    uint32_t len;
+    uint32_t keep;
+    uint32_t drop;
+
+    keep = (DTTY_USBD_LINK_DISCARD == _g_dtty_usbd_link_policy) ? 0 : _g_dtty_usbd_link_keep;
+    len = _dtty_stm32_usbd_tx_len();
+    if (len + need <= keep)
+    {
+        return;
+    }
+
+    drop = len + need - keep;
+    if (drop > len)
+    {
+        drop = len;
+    }
+    _g_dtty_usbd_link_drop_count += drop;
+
+    len = cbuf_get_len(_g_dtty_usbd_wbuf);
+    if (len > drop)
+    {
+        len = drop;
+    }
+    cbuf_read(_g_dtty_usbd_wbuf, NULL, len, NULL);
+    drop -= len;
+
+#if (STM32CUBEL4__DTTY_PRIO_ENABLE == 1)
+    if (drop > 0)
+    {
+        cbuf_read(_g_dtty_usbd_wbuf_high, NULL, drop, NULL);
+    }
+#endif /* (STM32CUBEL4__DTTY_PRIO_ENABLE == 1) */
+}
+
+/*
+ * Applies the link policy before need characters are written to a write buffer, while no host has the
+ * port open. Returns -1 if they are to be dropped. Called with the write lock held.
+ * dtty_init does not wait (DTTY_USBD_LINK_BLOCK): the replayed output is kept as with DTTY_USBD_LINK_KEEP.
+ */
+static int _dtty_stm32_usbd_link_check(uint32_t need)
+{
+    while (DTTY_USBD_LINK_BLOCKS() && !_g_bsp_dtty_in_init)
+    {
+        sem_take_timedms(_g_dtty_usbd_link_sem, DTTY_USBD_WRITE_CHECK_INTERVAL_MS);
+    }
+
+    if (DTTY_USBD_LINK_IS_UP())
+    {
+        return 0;
+    }
+
+    if (DTTY_USBD_LINK_DISCARD == _g_dtty_usbd_link_policy)
+    {
+        _dtty_stm32_usbd_link_trim(0);
+        _g_dtty_usbd_link_drop_count += need;
+        return -1;
+    }
+
+    _dtty_stm32_usbd_link_trim(need);
+    return 0;
+}
+
+#endif /* (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+
+/* Before dtty_init (the kernel is not active): kept in the early buffer */
+static int _dtty_stm32_usbd_early_putn(const char *str, int len)
+{
+    uint32_t written;
+
+    cbuf_write(_g_dtty_usbd_early_buf, (const uint8_t *) str, len, &written);
+    if (written != (uint32_t) len)
+    {
+        _g_dtty_usbd_early_overflow_count++;
+    }
+
+    return (int) written;
+}
+
+static void _dtty_stm32_usbd_early_replay(void)
+{
+    uint8_t * buf;
+    uint32_t len;
+
+    while (cbuf_get_len(_g_dtty_usbd_early_buf) > 0)
+    {
+        buf = cbuf_get_head_addr(_g_dtty_usbd_early_buf);
+        len = cbuf_get_contig_len(_g_dtty_usbd_early_buf);
+
+        dtty_putn((const char *) buf, len);
+
+        cbuf_read(_g_dtty_usbd_early_buf, NULL, len, NULL);
+    }
+}
+
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_LINE_ENABLE == 1)
+
+/* Called in interrupt context only. The echo goes through the interrupt write buffer (dtty_putn). */
+static void _dtty_stm32_usbd_line_input(uint8_t ch)
+{
+    int eol = 0;
+
+    if ('\r' == ch)
+    {
+        eol = 1;
+    }
+    else if ('\n' == ch)
+    {
+        if (_g_dtty_usbd_line_cr)
+        {
+            /* Second half of "\r\n" */
+            _g_dtty_usbd_line_cr = 0;
+            return;
+        }
+        eol = 1;
+    }
+    _g_dtty_usbd_line_cr = ('\r' == ch) ? 1 : 0;
+
+    if (eol)
+    {
+        _g_dtty_usbd_line[_g_dtty_usbd_line_len] = '\n';
+        /* A line that does not fit is dropped as a whole, so that its head does not join the next line */
+        if (DTTY_UART_READ_BUFFER_SIZE - 1 - cbuf_get_len(_g_dtty_usbd_rbuf) < _g_dtty_usbd_line_len + 1)
+        {
+            _g_dtty_usbd_rx_overflow_count++;
+        }
+        else
+        {
+            cbuf_write(_g_dtty_usbd_rbuf, _g_dtty_usbd_line, _g_dtty_usbd_line_len + 1, NULL);
+            _g_dtty_usbd_line_count++;
+            DTTY_USBD_POLL_NOTIFY(DTTY_POLL_RX);
+        }
+        _g_dtty_usbd_line_len = 0;
+
+        if (0 != _g_bsp_dtty_echo)
+        {
+            /* The write process expands it to "\r\n" when autocr is enabled */
+            dtty_putn("\n", 1);
+        }
+
+        if (_g_dtty_usbd_rsem != NULL)
+        {
+            sem_give(_g_dtty_usbd_rsem);
+        }
+    }
+    else if ('\b' == ch || 0x7F == ch)
+    {
+        if (_g_dtty_usbd_line_len > 0)
+        {
+            _g_dtty_usbd_line_len--;
+            if (0 != _g_bsp_dtty_echo)
+            {
+                dtty_putn("\b \b", 3);
+            }
+        }
+    }
+    else if (_g_dtty_usbd_line_len < STM32CUBEL4__DTTY_LINE_SIZE)
+    {
+        _g_dtty_usbd_line[_g_dtty_usbd_line_len] = ch;
+        _g_dtty_usbd_line_len++;
+        if (0 != _g_bsp_dtty_echo)
+        {
+            dtty_putn((const char *) &ch, 1);
+        }
+    }
+}
+
+#endif /* (STM32CUBEL4__DTTY_LINE_ENABLE == 1) */
+
+void dtty_stm32_usbd_rx_callback(uint8_t* buf, uint32_t *len)
+{
+    uint8_t need_notify = 0;
+    uint32_t rx_len;
+
+#if (STM32CUBEL4__DTTY_LINE_ENABLE == 1)
+    uint32_t i;
+
+    if (DTTY_USBD_IS_CANON())
+    {
+        for (i = 0; i < *len; i++)
+        {
+            _dtty_stm32_usbd_line_input(buf[i]);
+        }
+
+        DTTY_USBD_RECEIVE();
+        return;
+    }
+#endif /* (STM32CUBEL4__DTTY_LINE_ENABLE == 1) */
+
+    rx_len = cbuf_get_len(_g_dtty_usbd_rbuf);
+    if (rx_len == 0 && *len > 0)
+    {
+        DTTY_USBD_POLL_NOTIFY(DTTY_POLL_RX);
+    }
+    if (rx_len < DTTY_USBD_RX_WAKE_LEN && rx_len + *len >= DTTY_USBD_RX_WAKE_LEN)
+    {
+        need_notify = 1;
+    }
+#if (STM32CUBEL4__DTTY_READ_ENABLE == 1)
+    if (*len < CDC_DATA_FS_MAX_PACKET_SIZE)
+    {
+        /* A short (or zero length) packet ends a message */
+        _g_dtty_usbd_rx_boundary_count++;
+        if (_g_dtty_usbd_rx_boundary_armed)
+        {
+            need_notify = 1;
+        }
+    }
+#endif /* (STM32CUBEL4__DTTY_READ_ENABLE == 1) */
+    cbuf_write(_g_dtty_usbd_rbuf, buf, *len, NULL);
+    if (need_notify && _g_dtty_usbd_rsem != NULL)
+    {
+        sem_give(_g_dtty_usbd_rsem);
+    }
+
+    DTTY_USBD_RECEIVE();
+}
+
+void dtty_stm32_usbd_tx_callback(void)
+{
+    sem_give(_g_dtty_usbd_wsem);
+    DTTY_USBD_POLL_NOTIFY(DTTY_POLL_TX);
+}
+
+#if (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1)
+
+void dtty_stm32_usbd_linestate_callback(uint16_t state)
+{
+    _g_dtty_usbd_link_dtr = (state & DTTY_USBD_LINESTATE_DTR) ? 1 : 0;
+    _dtty_stm32_usbd_link_notify();
+}
+
+void dtty_stm32_usbd_suspend_callback(void)
+{
+    _g_dtty_usbd_link_suspended = 1;
+}
+
+void dtty_stm32_usbd_resume_callback(void)
+{
+    _g_dtty_usbd_link_suspended = 0;
+    _dtty_stm32_usbd_link_notify();
+}
+
+/* The host opens the port again after the enumeration */
+void dtty_stm32_usbd_reset_callback(void)
+{
+    _g_dtty_usbd_link_dtr = 0;
+    _g_dtty_usbd_link_suspended = 0;
+}
+
+#endif /* (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1) */
+
+int dtty_init(void)
+{
+    int r;
+    (void) r;
+
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_bsp_kernel_active)
+        {
+            break;
+        }
+
+        if (_g_bsp_dtty_init || _g_bsp_dtty_in_init)
+        {
+            break;
+        }
+
+        _g_bsp_dtty_in_init = 1;
+
+        r = semb_create(&_g_dtty_usbd_rsem);
+        assert(r == 0);
+        r = semb_create(&_g_dtty_usbd_wsem);
+        assert(r == 0);
+        r = mutex_create(&_g_dtty_usbd_resetlock);
+        assert(r == 0);
+        r = mutex_create(&_g_dtty_usbd_putlock);
+        assert(r == 0);
+        r = mutex_create(&_g_dtty_usbd_getlock);
+        assert(r == 0);
+#if (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1)
+        r = semb_create(&_g_dtty_usbd_link_sem);
+        assert(r == 0);
+#endif /* (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1) */
+#if (STM32CUBEL4__DTTY_USBD_PORT_ENABLE == 1)
+        /* Before the device is started, as the ports receive from then */
+        dtty_stm32_usbd_port_init();
+#endif /* (STM32CUBEL4__DTTY_USBD_PORT_ENABLE == 1) */
+
+        _g_bsp_dtty_echo = 1;
+        _g_bsp_dtty_autocr = 1;
+
+        _g_dtty_usbd_need_reset = 1;
+
+        _dtty_stm32_usbd_reset();
+
+        _g_dtty_usbd_reset_count = 0;
+
+        _g_bsp_dtty_init = 1;
+
+        cbuf_clear(_g_dtty_usbd_rbuf);
+
+#if (STM32CUBEL4__DTTY_CRASHLOG_ENABLE == 1)
+        dtty_stm32_crashlog_replay();
+#endif /* (STM32CUBEL4__DTTY_CRASHLOG_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+        _dtty_stm32_usbd_early_replay();
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+
+        _g_bsp_dtty_in_init = 0;
+
+        break;
+    } while (1);
+
+    return 0;
+}
+
+int dtty_enable(void)
+{
+    return 0;
+}
+
+int dtty_disable(void)
+{
+    return 0;
+}
+
+int dtty_geterror(void)
+{
+    return 0;
+}
+
+static int _dtty_stm32_usbd_read(char *ch_p)
+{
+    ubi_err_t ubi_err;
+
+    if (DTTY_USBD_IS_CANON())
+    {
+#if (STM32CUBEL4__DTTY_LINE_ENABLE == 1)
+        /* Only the completed lines can be read */
+        if (_g_dtty_usbd_line_count == 0)
+        {
+            return -1;
+        }
+
+        ubi_err = cbuf_read(_g_dtty_usbd_rbuf, (uint8_t*) ch_p, 1, NULL);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            return -1;
+        }
+
+        if ('\n' == *ch_p)
+        {
+            ubik_entercrit();
+            _g_dtty_usbd_line_count--;
+            ubik_exitcrit();
+        }
+
+        return 0;
+#endif /* (STM32CUBEL4__DTTY_LINE_ENABLE == 1) */
+    }
+
+    ubi_err = cbuf_read(_g_dtty_usbd_rbuf, (uint8_t*) ch_p, 1, NULL);
+    if (ubi_err != UBI_ERR_OK)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int _dtty_getc_advan(char *ch_p, int blocked)
+{
+    int r;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+                break;
+            }
+        }
+
+        if (!blocked)
+        {
+            r = mutex_lock_timed(_g_dtty_usbd_getlock, 0);
+        }
+        else
+        {
+            r = mutex_lock(_g_dtty_usbd_getlock);
+        }
+        if (r != 0)
+        {
+            break;
+        }
+
+        for (;;)
+        {
+            if (_g_dtty_usbd_need_reset)
+            {
+                _dtty_stm32_usbd_reset();
+            }
+
+            if (_dtty_stm32_usbd_read(ch_p) == 0)
+            {
+                r = 0;
+                break;
+            }
+            else
+            {
+                if (!blocked)
+                {
+                    r = -1;
+                    break;
+                }
+                else
+                {
+                    sem_take_timedms(_g_dtty_usbd_rsem, DTTY_USBD_READ_CHECK_INTERVAL_MS);
+                }
+            }
+        }
+
+        /* In canonical mode, the characters are echoed by the line discipline */
+        if (0 == r && 0 != _g_bsp_dtty_echo && !DTTY_USBD_IS_CANON())
+        {
+            dtty_putc(*ch_p);
+        }
+        
+        mutex_unlock(_g_dtty_usbd_getlock);
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int dtty_getc(char *ch_p)
+{
+    return _dtty_getc_advan(ch_p, 1);
+}
+
+int dtty_getc_unblocked(char *ch_p)
+{
+    return _dtty_getc_advan(ch_p, 0);
+}
+
+int dtty_putc(int ch)
+{
+    int r;
+    uint16_t len;
+    uint32_t written;
+    uint8_t data[2];
+    uint8_t need_notify = 0;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            data[0] = (uint8_t) ch;
+            len = 1;
+            if (cbuf_get_len(_g_dtty_usbd_isr_wbuf) == 0)
+            {
+                need_notify = 1;
+            }
+            cbuf_write(_g_dtty_usbd_isr_wbuf, data, len, &written);
+            if (written != len)
+            {
+                _g_dtty_usbd_tx_overflow_count++;
+            }
+            if (need_notify)
+            {
+                sem_give(_g_dtty_usbd_wsem);
+            }
+
+            r = 0;
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+                if (!_bsp_kernel_active)
+                {
+                    data[0] = (uint8_t) ch;
+                    r = (_dtty_stm32_usbd_early_putn((const char *) data, 1) == 1) ? 0 : -1;
+                }
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+                break;
+            }
+        }
+
+        mutex_lock(_g_dtty_usbd_putlock);
+
+        do
+        {
+            if (cbuf_is_full(_g_dtty_usbd_wbuf))
+            {
+                _g_dtty_usbd_tx_overflow_count++;
+                break;
+            }
+
+            if (0 != _g_bsp_dtty_autocr && '\n' == ch)
+            {
+                data[0] = '\r';
+                data[1] = '\n';
+                len = 2;
+            }
+            else
+            {
+                data[0] = (uint8_t) ch;
+                len = 1;
+            }
+
+            /* The character before the autocr conversion */
+            DTTY_USBD_CRASHLOG_WRITE(&data[len - 1], 1);
+            DTTY_USBD_BLACKBOX_WRITE(&data[len - 1], 1);
+
+            if (DTTY_USBD_LINK_CHECK(len) != 0)
+            {
+                r = 0;
+                break;
+            }
+
+            if (cbuf_get_len(_g_dtty_usbd_wbuf) == 0)
+            {
+                need_notify = 1;
+            }
+            cbuf_write(_g_dtty_usbd_wbuf, data, len, &written);
+            if (written != len)
+            {
+                _g_dtty_usbd_tx_overflow_count++;
+                break;
+            }
+            if (need_notify)
+            {
+                sem_give(_g_dtty_usbd_wsem);
+            }
+
+            r = 0;
+            break;
+        } while (1);
+
+        mutex_unlock(_g_dtty_usbd_putlock);
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+#if (STM32CUBEL4__DTTY_BLACKBOX_ENABLE == 1)
+/* Called by the black box dump to pace its output */
+uint32_t dtty_stm32_get_write_room(void)
+{
+    return DTTY_UART_WRITE_BUFFER_SIZE - cbuf_get_len(_g_dtty_usbd_wbuf);
+}
+#endif /* (STM32CUBEL4__DTTY_BLACKBOX_ENABLE == 1) */
+
+int dtty_flush(void)
+{
+    return 0;
+}
+
+int dtty_putn(const char *str, int len)
+{
+    int r;
+    uint32_t written;
+    uint8_t need_notify = 0;
+
+    r = -1;
+    do
+    {
+        if (NULL == str)
+        {
+            r = -2;
+            break;
+        }
+
+        if (0 > len)
+        {
+            r = -3;
+            break;
+        }
+
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            if (cbuf_get_len(_g_dtty_usbd_isr_wbuf) == 0)
+            {
+                need_notify = 1;
+            }
+            cbuf_write(_g_dtty_usbd_isr_wbuf, (uint8_t *) str, len, &written);
+            if (written != len)
+            {
+                _g_dtty_usbd_tx_overflow_count++;
+            }
+            if (need_notify)
+            {
+                sem_give(_g_dtty_usbd_wsem);
+            }
+
+            r = written;
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+                if (!_bsp_kernel_active)
+                {
+                    r = _dtty_stm32_usbd_early_putn(str, len);
+                }
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+                break;
+            }
+        }
+        if (0 != _g_bsp_dtty_autocr)
+        {
+            for (written = 0; written < len; written++)
+            {
+                r = dtty_putc(*str);
+                if (r < 0)
+                {
+                    break;
+                }
+                str++;
+            }
+        }
+        else
+        {
+            DTTY_USBD_CRASHLOG_WRITE((const uint8_t *) str, len);
+            DTTY_USBD_BLACKBOX_WRITE((const uint8_t *) str, len);
+
+            mutex_lock(_g_dtty_usbd_putlock);
+
+            do
+            {
+                if (DTTY_USBD_LINK_CHECK(len) != 0)
+                {
+                    r = len;
+                    break;
+                }
+
+                if (cbuf_get_len(_g_dtty_usbd_wbuf) == 0)
+                {
+                    need_notify = 1;
+                }
+                cbuf_write(_g_dtty_usbd_wbuf, (uint8_t *) str, len, &written);
+                if (written != len)
+                {
+                    _g_dtty_usbd_tx_overflow_count++;
+                    break;
+                }
+                if (need_notify)
+                {
+                    sem_give(_g_dtty_usbd_wsem);
+                }
+
+                r = written;
+                break;
+            } while (1);
+
+            mutex_unlock(_g_dtty_usbd_putlock);
+
+            break;
+        }
+
+        r = written;
+        break;
+    } while (1);
+
+    return r;
+}
+
+#if (STM32CUBEL4__DTTY_PRIO_ENABLE == 1)
+
+int dtty_putn_prio(int prio, const char *str, int len)
+{
+    int r;
+    int i;
+    uint32_t need;
+    uint8_t cr = '\r';
+    uint8_t need_notify = 0;
+
+    r = -1;
+    do
+    {
+        if (DTTY_PRIO_NORMAL == prio)
+        {
+            r = dtty_putn(str, len);
+            break;
+        }
+
+        if (DTTY_PRIO_HIGH != prio)
+        {
+            break;
+        }
+
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+                break;
+            }
+        }
+
+        if (NULL == str)
+        {
+            r = -2;
+            break;
+        }
+
+        if (0 > len)
+        {
+            r = -3;
+            break;
+        }
+
+        need = len;
+        if (0 != _g_bsp_dtty_autocr)
+        {
+            for (i = 0; i < len; i++)
+            {
+                if ('\n' == str[i])
+                {
+                    need++;
+                }
+            }
+        }
+
+        mutex_lock(_g_dtty_usbd_putlock);
+
+        do
+        {
+            /* The message is queued as a whole, so that the lane holds only complete messages */
+            if (cbuf_get_len(_g_dtty_usbd_wbuf_high) + need >= STM32CUBEL4__DTTY_PRIO_BUFFER_SIZE)
+            {
+                _g_dtty_usbd_tx_overflow_count++;
+                break;
+            }
+
+            DTTY_USBD_CRASHLOG_WRITE((const uint8_t *) str, len);
+            DTTY_USBD_BLACKBOX_WRITE((const uint8_t *) str, len);
+
+            if (DTTY_USBD_LINK_CHECK(need) != 0)
+            {
+                r = len;
+                break;
+            }
+
+            if (cbuf_get_len(_g_dtty_usbd_wbuf_high) == 0)
+            {
+                need_notify = 1;
+            }
+            for (i = 0; i < len; i++)
+            {
+                if (0 != _g_bsp_dtty_autocr && '\n' == str[i])
+                {
+                    cbuf_write(_g_dtty_usbd_wbuf_high, &cr, 1, NULL);
+                }
+                cbuf_write(_g_dtty_usbd_wbuf_high, (const uint8_t *) &str[i], 1, NULL);
+            }
+            if (need_notify)
+            {
+                sem_give(_g_dtty_usbd_wsem);
+            }
+
+            r = len;
+            break;
+        } while (1);
+
+        mutex_unlock(_g_dtty_usbd_putlock);
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+#endif /* (STM32CUBEL4__DTTY_PRIO_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_WRITEV_ENABLE == 1)
+
+int dtty_writev(const dtty_iovec_t *iov, int iovcnt)
+{
+    int r;
+    int i;
+    int n;
+    uint32_t j;
+    uint32_t k;
+    uint32_t len;
+    uint32_t written;
+    uint32_t total;
+    const uint8_t * seg;
+    cbuf_pt wbuf;
+    uint8_t cr = '\r';
+    uint8_t overflow = 0;
+    uint8_t need_notify = 0;
+    uint8_t in_intr = 0;
+    uint8_t drop = 0;
+
+    r = -1;
+    do
+    {
+        if (NULL == iov)
+        {
+            r = -2;
+            break;
+        }
+
+        if (0 > iovcnt)
+        {
+            r = -3;
+            break;
+        }
+
+        for (total = 0, i = 0; i < iovcnt; i++)
+        {
+            if (NULL == iov[i].iov_base && 0 != iov[i].iov_len)
+            {
+                break;
+            }
+            total += (uint32_t) iov[i].iov_len;
+        }
+        if (i < iovcnt)
+        {
+            r = -2;
+            break;
+        }
+
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            /* As dtty_putn, to the interrupt write buffer, moved to the write buffer by dtty_write_process */
+            in_intr = 1;
+        }
+        else if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+                if (!_bsp_kernel_active)
+                {
+                    for (r = 0, i = 0; i < iovcnt; i++)
+                    {
+                        n = _dtty_stm32_usbd_early_putn((const char *) iov[i].iov_base, (int) iov[i].iov_len);
+                        if (n < 0)
+                        {
+                            r = -1;
+                            break;
+                        }
+                        r += n;
+                    }
+                }
+#else
+                (void) n;
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+                break;
+            }
+        }
+
+        if (in_intr)
+        {
+            wbuf = _g_dtty_usbd_isr_wbuf;
+        }
+        else
+        {
+            wbuf = _g_dtty_usbd_wbuf;
+            mutex_lock(_g_dtty_usbd_putlock);
+
+            if (DTTY_USBD_LINK_CHECK(total) != 0)
+            {
+                drop = 1;
+            }
+        }
+
+        if (cbuf_get_len(wbuf) == 0)
+        {
+            need_notify = 1;
+        }
+
+        r = 0;
+        for (i = 0; i < iovcnt && !overflow; i++)
+        {
+            seg = (const uint8_t *) iov[i].iov_base;
+            len = (uint32_t) iov[i].iov_len;
+
+            if (in_intr)
+            {
+                cbuf_write(wbuf, seg, len, &written);
+                if (written != len)
+                {
+                    overflow = 1;
+                }
+                r += (int) written;
+                continue;
+            }
+
+            DTTY_USBD_CRASHLOG_WRITE(seg, len);
+            DTTY_USBD_BLACKBOX_WRITE(seg, len);
+
+            if (drop)
+            {
+                r += (int) len;
+                continue;
+            }
+
+            /* Copied a line at a time, with the '\r' of the autocr conversion inserted before its end */
+            for (j = 0, k = 0; k <= len; k++)
+            {
+                if (k < len && ('\n' != seg[k] || 0 == _g_bsp_dtty_autocr))
+                {
+                    continue;
+                }
+
+                if (k > j)
+                {
+                    cbuf_write(wbuf, &seg[j], k - j, &written);
+                    r += (int) written;
+                    if (written != k - j)
+                    {
+                        overflow = 1;
+                        break;
+                    }
+                }
+
+                if (k < len)
+                {
+                    cbuf_write(wbuf, &cr, 1, &written);
+                    if (written != 1)
+                    {
+                        overflow = 1;
+                        break;
+                    }
+                }
+
+                j = k;
+            }
+        }
+
+        if (overflow)
+        {
+            _g_dtty_usbd_tx_overflow_count++;
+        }
+
+        /* One notification of the writer task for all the segments */
+        if (need_notify && cbuf_get_len(wbuf) > 0)
+        {
+            sem_give(_g_dtty_usbd_wsem);
+        }
+
+        if (!in_intr)
+        {
+            mutex_unlock(_g_dtty_usbd_putlock);
+        }
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+#endif /* (STM32CUBEL4__DTTY_WRITEV_ENABLE == 1) */
+
+int dtty_kbhit(void)
+{
+    int r;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+                break;
+            }
+        }
+
+        if (DTTY_USBD_IS_CANON())
+        {
+#if (STM32CUBEL4__DTTY_LINE_ENABLE == 1)
+            r = (_g_dtty_usbd_line_count != 0) ? 1 : 0;
+#endif /* (STM32CUBEL4__DTTY_LINE_ENABLE == 1) */
+        }
+        else if (cbuf_get_len(_g_dtty_usbd_rbuf) != 0)
+        {
+            r = 1;
+        }
+        else
+        {
+            r = 0;
+        }
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+void dtty_write_process(void *arg)
+{
+    cbuf_pt wbuf;
+    uint8_t * buf;
+    uint32_t len;
+    int r;
+    uint8_t usb_status;
+
+    if (bsp_isintr() || 0 != _bsp_critcount)
+    {
+        ubi_assert(0);
+    }
+
+    for (;;)
+    {
+        do
+        {
+            if (_g_dtty_usbd_need_reset)
+            {
+                _dtty_stm32_usbd_reset();
+            }
+
+#if (STM32CUBEL4__DTTY_USBD_PORT_ENABLE == 1)
+            /* The other ports have their own endpoints, and are served whatever the state of the console */
+            dtty_stm32_usbd_port_process();
+#endif /* (STM32CUBEL4__DTTY_USBD_PORT_ENABLE == 1) */
+
+            /* Left in the interrupt write buffer while the writers wait for a host */
+            while (cbuf_get_len(_g_dtty_usbd_isr_wbuf) > 0 && !DTTY_USBD_LINK_BLOCKS())
+            {
+                buf = cbuf_get_head_addr(_g_dtty_usbd_isr_wbuf);
+                len = cbuf_get_contig_len(_g_dtty_usbd_isr_wbuf);
+
+                r = dtty_putn((const char *) buf, len);
+                if (r <= 0)
+                {
+                    break;
+                }
+
+                cbuf_read(_g_dtty_usbd_isr_wbuf, NULL, r, NULL);
+            }
+
+#if (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1)
+            if (!DTTY_USBD_LINK_IS_UP())
+            {
+                /* Nothing is sent, and the output queued before the host left is trimmed as the policy says */
+                if (!DTTY_USBD_LINK_BLOCKS())
+                {
+                    mutex_lock(_g_dtty_usbd_putlock);
+                    _dtty_stm32_usbd_link_trim(0);
+                    mutex_unlock(_g_dtty_usbd_putlock);
+                }
+                break;
+            }
+
+            /* The writers trim the write buffers while the host is away, so they are read under the write lock */
+            mutex_lock(_g_dtty_usbd_putlock);
+#endif /* (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1) */
+
+            while (_dtty_stm32_usbd_tx_len() > 0)
+            {
+                wbuf = _dtty_stm32_usbd_tx_select(&len);
+                buf = cbuf_get_head_addr(wbuf);
+                
+                usb_status = DTTY_USBD_TRANSMIT(buf, len);
+                if(usb_status == USBD_OK)
+                {
+#if (STM32CUBEL4__DTTY_PRIO_ENABLE == 1)
+                    if (wbuf == _g_dtty_usbd_wbuf)
+                    {
+                        _g_dtty_usbd_tx_run += len;
+                        if ('\n' == buf[len - 1] || _g_dtty_usbd_tx_run >= DTTY_PRIO_RUN_MAX)
+                        {
+                            _g_dtty_usbd_tx_run = 0;
+                        }
+                    }
+#endif /* (STM32CUBEL4__DTTY_PRIO_ENABLE == 1) */
+                    cbuf_read(wbuf, NULL, len, NULL);
+                }
+                else
+                {
+                    break;
+                }
+            }
+
+#if (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1)
+            mutex_unlock(_g_dtty_usbd_putlock);
+#endif /* (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1) */
+
+            break;
+        } while (1);
+
+        if (task_is_idle(NULL))
+        {
+            break;
+        }
+        else
+        {
+            sem_take_timedms(_g_dtty_usbd_wsem, DTTY_USBD_WRITE_CHECK_INTERVAL_MS);
+        }
+    }
+}
+
+#if (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1)
+
+int dtty_usbd_setlinkpolicy(int policy, uint32_t keep)
+{
+    int r;
+
+    r = -1;
+    do
+    {
+        if (DTTY_USBD_LINK_DISCARD != policy && DTTY_USBD_LINK_KEEP != policy && DTTY_USBD_LINK_BLOCK != policy)
+        {
+            break;
+        }
+
+        if (keep >= DTTY_UART_WRITE_BUFFER_SIZE)
+        {
+            r = -3;
+            break;
+        }
+
+        _g_dtty_usbd_link_keep = keep;
+        _g_dtty_usbd_link_policy = (uint8_t) policy;
+
+        /* The waiting writers see the new policy */
+        if (_g_dtty_usbd_link_sem != NULL)
+        {
+            sem_give(_g_dtty_usbd_link_sem);
+        }
+
+        r = 0;
+        break;
+    } while (1);
+
+    return r;
+}
+
+int dtty_usbd_isconnected(void)
+{
+    return DTTY_USBD_LINK_IS_UP() ? 1 : 0;
+}
+
+uint32_t dtty_usbd_get_link_drop_count(void)
+{
+    return _g_dtty_usbd_link_drop_count;
+}
+
+#endif /* (STM32CUBEL4__DTTY_USBD_LINK_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_EARLY_ENABLE == 1)
+
+int dtty_early_setpolled(int enable)
+{
+    /* The USB device cannot be polled before the kernel is active */
+    return enable ? -1 : 0;
+}
+
+uint32_t dtty_early_get_overflow_count(void)
+{
+    return _g_dtty_usbd_early_overflow_count;
+}
+
+#endif /* (STM32CUBEL4__DTTY_EARLY_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_POLL_ENABLE == 1)
+
+uint32_t dtty_stm32_poll_level(void)
+{
+    uint32_t events = 0;
+
+    if (!_g_bsp_dtty_init)
+    {
+        return 0;
+    }
+
+    if (dtty_kbhit() == 1)
+    {
+        events |= DTTY_POLL_RX;
+    }
+
+    if (!cbuf_is_full(_g_dtty_usbd_wbuf))
+    {
+        events |= DTTY_POLL_TX;
+    }
+
+    return events;
+}
+
+#endif /* (STM32CUBEL4__DTTY_POLL_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_READ_ENABLE == 1)
+
+int dtty_read(char *buf, int max, int vmin, uint32_t vtimems)
+{
+    int r;
+    int got;
+    int expired;
+    uint32_t n;
+    uint32_t wake;
+    uint32_t rx_len;
+    uint32_t boundary_count;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+                break;
+            }
+        }
+
+        if (NULL == buf)
+        {
+            r = -2;
+            break;
+        }
+
+        if (0 >= max || 0 > vmin)
+        {
+            r = -3;
+            break;
+        }
+
+        if (DTTY_USBD_IS_CANON())
+        {
+            break;
+        }
+
+        if (vmin > max)
+        {
+            vmin = max;
+        }
+
+        mutex_lock(_g_dtty_usbd_getlock);
+
+        ubik_entercrit();
+        _g_dtty_usbd_rx_boundary_armed = (vmin > 0 && vtimems > 0) ? 1 : 0;
+        ubik_exitcrit();
+
+        got = 0;
+        expired = 0;
+        for (;;)
+        {
+            if (_g_dtty_usbd_need_reset)
+            {
+                _dtty_stm32_usbd_reset();
+            }
+
+            n = cbuf_get_len(_g_dtty_usbd_rbuf);
+            if (n > (uint32_t) (max - got))
+            {
+                n = max - got;
+            }
+            if (n > 0)
+            {
+                cbuf_read(_g_dtty_usbd_rbuf, (uint8_t *) buf + got, n, NULL);
+                got += n;
+            }
+
+            if (got >= max || (vmin > 0 && got >= vmin) || (vmin == 0 && got > 0))
+            {
+                break;
+            }
+
+            if (expired || (vmin == 0 && vtimems == 0))
+            {
+                break;
+            }
+
+            wake = (vmin > 0) ? (uint32_t) (vmin - got) : 1;
+            if (wake > DTTY_UART_READ_BUFFER_SIZE - CDC_DATA_FS_MAX_PACKET_SIZE)
+            {
+                wake = DTTY_UART_READ_BUFFER_SIZE - CDC_DATA_FS_MAX_PACKET_SIZE;
+            }
+
+            ubik_entercrit();
+            _g_dtty_usbd_rx_wake_len = wake;
+            rx_len = cbuf_get_len(_g_dtty_usbd_rbuf);
+            boundary_count = _g_dtty_usbd_rx_boundary_count;
+            ubik_exitcrit();
+
+            if (rx_len >= wake)
+            {
+                continue;
+            }
+
+            if (vtimems == 0)
+            {
+                sem_take_timedms(_g_dtty_usbd_rsem, DTTY_USBD_READ_CHECK_INTERVAL_MS);
+                continue;
+            }
+
+            sem_take_timedms(_g_dtty_usbd_rsem, vtimems);
+
+            if (vmin == 0)
+            {
+                expired = 1;
+            }
+            else if (boundary_count != _g_dtty_usbd_rx_boundary_count || rx_len == cbuf_get_len(_g_dtty_usbd_rbuf))
+            {
+                /* End of a message (short packet), or nothing received for vtimems.
+                 * The idle time counts only once a character has been received. */
+                expired = (got > 0 || cbuf_get_len(_g_dtty_usbd_rbuf) > 0) ? 1 : 0;
+            }
+        }
+
+        ubik_entercrit();
+        _g_dtty_usbd_rx_wake_len = 1;
+        _g_dtty_usbd_rx_boundary_armed = 0;
+        ubik_exitcrit();
+
+        mutex_unlock(_g_dtty_usbd_getlock);
+
+        r = got;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+#endif /* (STM32CUBEL4__DTTY_READ_ENABLE == 1) */
+
+#if (STM32CUBEL4__DTTY_LINE_ENABLE == 1)
+
+int dtty_setcanon(int enable)
+{
+    if (bsp_isintr() || 0 != _bsp_critcount)
+    {
+        return -1;
+    }
+
+    if (!_g_bsp_dtty_init)
+    {
+        dtty_init();
+        if (!_g_bsp_dtty_init)
+        {
+            return -1;
+        }
+    }
+
+    ubik_entercrit();
+    if (enable && !_g_dtty_usbd_canon)
+    {
+        _g_dtty_usbd_line_len = 0;
+        _g_dtty_usbd_line_cr = 0;
+        _g_dtty_usbd_line_count = 0;
+    }
+    _g_dtty_usbd_canon = enable ? 1 : 0;
+    ubik_exitcrit();
+
+    return 0;
+}
+
+int dtty_getcanon(void)
+{
+    return _g_dtty_usbd_canon;
+}
+
+int dtty_getline(char *buf, int max)
+{
+    int r;
+    int len;
+    char ch;
+
+    r = -1;
+    do
+    {
+        if (NULL == buf)
+        {
+            r = -2;
+            break;
+        }
+
+        if (0 >= max)
+        {
+            r = -3;
+            break;
+        }
+
+        len = 0;
+        for (;;)
+        {
+            r = dtty_getc(&ch);
+            if (r != 0)
+            {
+                break;
+            }
+
+            if ('\n' == ch || ('\r' == ch && !DTTY_USBD_IS_CANON()))
+            {
+                break;
+            }
+
+            if (len < max - 1)
+            {
+                buf[len] = ch;
+                len++;
+            }
+        }
+        if (r != 0)
+        {
+            break;
+        }
+
+        buf[len] = '\0';
+        r = len;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+#endif /* (STM32CUBEL4__DTTY_LINE_ENABLE == 1) */
+
+#endif /* (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1) */
+
+#endif /* (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL) */
+
+#endif /* (UBINOS__BSP__USE_DTTY == 1) */
+
+#endif /* (INCLUDE__UBINOS__BSP == 1) */
+
@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos.h>
+
+#if (INCLUDE__UBINOS__BSP == 1)
+
+#if (UBINOS__BSP__USE_DTTY == 1)
+
+#if (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL)
+
+#if (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1)
+
+#if (STM32CUBEL4__DTTY_USBD_PORT_ENABLE == 1)
+
+#if (INCLUDE__UBINOS__UBIK != 1)
+    #error "ubik is necessary"
+#endif
+
+#include <ubinos/bsp.h>
+#include <ubinos/bsp/arch.h>
+#include <ubinos/bsp_ubik.h>
+#include <stm32cubel4_extension/dtty.h>
+
+#include <assert.h>
+
+#include "main.h"
+
+#if (STM32CUBEL4__DTTY_USBD_PORT_COUNT < 2) || (STM32CUBEL4__DTTY_USBD_PORT_COUNT > DTTY_USBD_PORT_MAX)
+    #error "STM32CUBEL4__DTTY_USBD_PORT_COUNT shall be 2 or 3"
+#endif
+
+extern int _g_bsp_dtty_init;
+
+/* Implemented by the dtty driver */
+extern sem_pt _g_dtty_usbd_wsem;
+extern void dtty_stm32_usbd_rx_callback(uint8_t* buf, uint32_t *len);
+extern void dtty_stm32_usbd_tx_callback(void);
+
+/* Implemented by the application (composite device) */
+extern uint8_t dtty_stm32_usbd_port_transmit(int port, uint8_t *buf, uint32_t len);
+extern uint8_t dtty_stm32_usbd_port_receive(int port);
+
+#if (STM32CUBEL4__DTTY_POLL_ENABLE == 1)
+extern void dtty_stm32_poll_notify(uint32_t events);
+#define DTTY_USBD_PORT_POLL_NOTIFY(events) dtty_stm32_poll_notify(events)
+#else
+#define DTTY_USBD_PORT_POLL_NOTIFY(events)
+#endif /* (STM32CUBEL4__DTTY_POLL_ENABLE == 1) */
+
+typedef struct _dtty_usbd_port_t
+{
+    cbuf_pt wbuf;
+    cbuf_pt rbuf;
+    sem_pt rsem;
+    mutex_pt putlock;
+    mutex_pt getlock;
+    uint32_t tx_overflow_count;
+    uint32_t rx_overflow_count;
+    uint8_t rx_held;    /* The OUT endpoint is not prepared until the reader frees room for a packet (the host gets NAKs) */
+} dtty_usbd_port_t;
+
+cbuf_def_init(_g_dtty_usbd_port1_wbuf, STM32CUBEL4__DTTY_USBD_PORT_BUFFER_SIZE);
+cbuf_def_init(_g_dtty_usbd_port1_rbuf, STM32CUBEL4__DTTY_USBD_PORT_BUFFER_SIZE);
+#if (STM32CUBEL4__DTTY_USBD_PORT_COUNT > 2)
+cbuf_def_init(_g_dtty_usbd_port2_wbuf, STM32CUBEL4__DTTY_USBD_PORT_BUFFER_SIZE);
+cbuf_def_init(_g_dtty_usbd_port2_rbuf, STM32CUBEL4__DTTY_USBD_PORT_BUFFER_SIZE);
+#endif /* (STM32CUBEL4__DTTY_USBD_PORT_COUNT > 2) */
+
+/* The entry of the console (port 0) is not used: its buffers belong to the dtty driver */
+dtty_usbd_port_t _g_dtty_usbd_port[STM32CUBEL4__DTTY_USBD_PORT_COUNT];
+
+uint8_t _g_dtty_usbd_port_init = 0;
+
+void dtty_stm32_usbd_port_init(void);
+void dtty_stm32_usbd_port_process(void);
+void dtty_stm32_usbd_port_rx_callback(int port, uint8_t *buf, uint32_t *len);
+void dtty_stm32_usbd_port_tx_callback(int port);
+
+static dtty_usbd_port_t * _dtty_stm32_usbd_port_get(int port);
+
+static dtty_usbd_port_t * _dtty_stm32_usbd_port_get(int port)
+{
+    if (!_g_dtty_usbd_port_init || DTTY_USBD_PORT_CONSOLE >= port || STM32CUBEL4__DTTY_USBD_PORT_COUNT <= port)
+    {
+        return NULL;
+    }
+
+    return &_g_dtty_usbd_port[port];
+}
+
+/* Called by dtty_init */
+void dtty_stm32_usbd_port_init(void)
+{
+    int r;
+    int port;
+    dtty_usbd_port_t * p;
+    (void) r;
+
+    if (_g_dtty_usbd_port_init)
+    {
+        return;
+    }
+
+    _g_dtty_usbd_port[1].wbuf = _g_dtty_usbd_port1_wbuf;
+    _g_dtty_usbd_port[1].rbuf = _g_dtty_usbd_port1_rbuf;
+#if (STM32CUBEL4__DTTY_USBD_PORT_COUNT > 2)
+    _g_dtty_usbd_port[2].wbuf = _g_dtty_usbd_port2_wbuf;
+    _g_dtty_usbd_port[2].rbuf = _g_dtty_usbd_port2_rbuf;
+#endif /* (STM32CUBEL4__DTTY_USBD_PORT_COUNT > 2) */
+
+    for (port = 1; port < STM32CUBEL4__DTTY_USBD_PORT_COUNT; port++)
+    {
+        p = &_g_dtty_usbd_port[port];
+
+        r = semb_create(&p->rsem);
+        assert(r == 0);
+        r = mutex_create(&p->putlock);
+        assert(r == 0);
+        r = mutex_create(&p->getlock);
+        assert(r == 0);
+
+        p->rx_held = 0;
+    }
+
+    _g_dtty_usbd_port_init = 1;
+}
+
+/* Called by the writer task (dtty_write_process). The ports have their own IN endpoints, so they are served independently. */
+void dtty_stm32_usbd_port_process(void)
+{
+    int port;
+    dtty_usbd_port_t * p;
+    uint8_t * buf;
+    uint32_t len;
+
+    for (port = 1; port < STM32CUBEL4__DTTY_USBD_PORT_COUNT; port++)
+    {
+        p = _dtty_stm32_usbd_port_get(port);
+        if (NULL == p)
+        {
+            break;
+        }
+
+        while (cbuf_get_len(p->wbuf) > 0)
+        {
+            buf = cbuf_get_head_addr(p->wbuf);
+            len = cbuf_get_contig_len(p->wbuf);
+
+            if (dtty_stm32_usbd_port_transmit(port, buf, len) != USBD_OK)
+            {
+                break;
+            }
+
+            cbuf_read(p->wbuf, NULL, len, NULL);
+            DTTY_USBD_PORT_POLL_NOTIFY(DTTY_POLL_PORT_TX(port));
+        }
+    }
+}
+
+void dtty_stm32_usbd_port_rx_callback(int port, uint8_t *buf, uint32_t *len)
+{
+    dtty_usbd_port_t * p;
+    uint32_t written;
+    uint8_t need_notify = 0;
+
+    if (DTTY_USBD_PORT_CONSOLE == port)
+    {
+        dtty_stm32_usbd_rx_callback(buf, len);
+        return;
+    }
+
+    p = _dtty_stm32_usbd_port_get(port);
+    if (NULL != p)
+    {
+        if (cbuf_get_len(p->rbuf) == 0 && *len > 0)
+        {
+            need_notify = 1;
+        }
+        cbuf_write(p->rbuf, buf, *len, &written);
+        if (written != *len)
+        {
+            p->rx_overflow_count++;
+        }
+        if (written > 0)
+        {
+            DTTY_USBD_PORT_POLL_NOTIFY(DTTY_POLL_PORT_RX(port));
+        }
+        if (need_notify)
+        {
+            sem_give(p->rsem);
+        }
+
+        if (STM32CUBEL4__DTTY_USBD_PORT_BUFFER_SIZE - cbuf_get_len(p->rbuf) < CDC_DATA_FS_MAX_PACKET_SIZE)
+        {
+            /* dtty_usbd_port_read prepares the endpoint once it has freed room for a packet */
+            p->rx_held = 1;
+            return;
+        }
+    }
+
+    dtty_stm32_usbd_port_receive(port);
+}
+
+void dtty_stm32_usbd_port_tx_callback(int port)
+{
+    if (DTTY_USBD_PORT_CONSOLE == port)
+    {
+        dtty_stm32_usbd_tx_callback();
+        return;
+    }
+
+    if (NULL != _g_dtty_usbd_wsem)
+    {
+        sem_give(_g_dtty_usbd_wsem);
+    }
+}
+
+int dtty_usbd_port_write(int port, const void *buf, int len)
+{
+    int r;
+    dtty_usbd_port_t * p;
+    uint32_t written;
+    uint8_t need_notify = 0;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+        }
+
+        p = _dtty_stm32_usbd_port_get(port);
+        if (NULL == p)
+        {
+            break;
+        }
+
+        if (NULL == buf)
+        {
+            r = -2;
+            break;
+        }
+
+        if (0 > len)
+        {
+            r = -3;
+            break;
+        }
+
+        mutex_lock(p->putlock);
+
+        if (cbuf_get_len(p->wbuf) == 0)
+        {
+            need_notify = 1;
+        }
+        cbuf_write(p->wbuf, (const uint8_t *) buf, len, &written);
+        if (written != (uint32_t) len)
+        {
+            p->tx_overflow_count++;
+        }
+        if (need_notify && written > 0)
+        {
+            sem_give(_g_dtty_usbd_wsem);
+        }
+
+        mutex_unlock(p->putlock);
+
+        r = (int) written;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+int dtty_usbd_port_read(int port, void *buf, int max, uint32_t timeoutms)
+{
+    int r;
+    dtty_usbd_port_t * p;
+    uint32_t len;
+
+    r = -1;
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            break;
+        }
+
+        if (!_g_bsp_dtty_init)
+        {
+            dtty_init();
+        }
+
+        p = _dtty_stm32_usbd_port_get(port);
+        if (NULL == p)
+        {
+            break;
+        }
+
+        if (NULL == buf)
+        {
+            r = -2;
+            break;
+        }
+
+        if (0 > max)
+        {
+            r = -3;
+            break;
+        }
+
+        mutex_lock(p->getlock);
+
+        /* The semaphore may have been given for data already read, so the buffer is checked again */
+        while (cbuf_get_len(p->rbuf) == 0 && 0 != timeoutms)
+        {
+            if (sem_take_timedms(p->rsem, timeoutms) != 0)
+            {
+                break;
+            }
+        }
+
+        len = cbuf_get_len(p->rbuf);
+        if (len > (uint32_t) max)
+        {
+            len = (uint32_t) max;
+        }
+        cbuf_read(p->rbuf, (uint8_t *) buf, len, NULL);
+
+        if (p->rx_held && STM32CUBEL4__DTTY_USBD_PORT_BUFFER_SIZE - cbuf_get_len(p->rbuf) >= CDC_DATA_FS_MAX_PACKET_SIZE)
+        {
+            ubik_entercrit();
+            p->rx_held = 0;
+            dtty_stm32_usbd_port_receive(port);
+            ubik_exitcrit();
+        }
+
+        mutex_unlock(p->getlock);
+
+        r = (int) len;
+
+        break;
+    } while (1);
+
+    return r;
+}
+
+uint32_t dtty_usbd_port_get_overflow_count(int port)
+{
+    dtty_usbd_port_t * p;
+
+    p = _dtty_stm32_usbd_port_get(port);
+    if (NULL == p)
+    {
+        return 0;
+    }
+
+    return p->tx_overflow_count;
+}
+
+uint32_t dtty_usbd_port_get_rx_overflow_count(int port)
+{
+    dtty_usbd_port_t * p;
+
+    p = _dtty_stm32_usbd_port_get(port);
+    if (NULL == p)
+    {
+        return 0;
+    }
+
+    return p->rx_overflow_count;
+}
+
+#endif /* (STM32CUBEL4__DTTY_USBD_PORT_ENABLE == 1) */
+
+#endif /* (STM32CUBEL4__DTTY_STM32_USBD_ENABLE == 1) */
+
+#endif /* (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL) */
+
+#endif /* (UBINOS__BSP__USE_DTTY == 1) */
+
+#endif /* (INCLUDE__UBINOS__BSP == 1) */
@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * dtty driver checks on the simulated UART.
+ *
+ * The UART dtty driver runs on the host, with the kernel active and a single task. Every check
+ * drives it through its API and through the interrupts of the simulated UART (characters received,
+ * characters sent), and compares what is read and what is sent with what is expected.
+ * The checks run in order on the same driver instance, each one leaves it idle (nothing to read,
+ * nothing to send).
+ *
+ * The result of every check is printed, after the line of its first failed condition.
+ * The exit status is the number of failed checks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ubinos.h>
+#include <stm32cubel4_extension/dtty.h>
+#include <stm32cubel4_extension/nvmem_log.h>
+
+#include "flash_sim.h"
+#include "uart_sim.h"
+
+#define CHECK_OUTPUT_SIZE   1024
+#define CHECK_LONG_LINE_LEN 99
+
+#define CHECK_LOG_ADDR          ((uint8_t *) (FLASH_BASE + FLASH_BANK_SIZE))
+#define CHECK_LOG_PAGE_COUNT    8   /* More than the write buffer: the dump is paced */
+#define CHECK_LOG_WRITE_SIZE    (CHECK_LOG_PAGE_COUNT * FLASH_PAGE_SIZE * 3)
+#define CHECK_LOG_CHUNK_SIZE    128
+
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            printf("  %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            return -1; \
+        } \
+    } while (0)
+
+typedef struct _check_t
+{
+    const char * name;
+    int (*run)(void);           /* Returns 0 if the check passed */
+} check_t;
+
+/* Internals of the UART driver */
+extern cbuf_pt _g_dtty_uart_rbuf;
+extern cbuf_pt _g_dtty_uart_wbuf;
+extern uint32_t _g_dtty_uart_rx_overflow_count;
+extern uint32_t _g_dtty_uart_tx_overflow_count;
+
+/* Layout of the crash log of the driver (dtty_stm32_crashlog.c), to corrupt it as a crash would */
+typedef struct _check_crashlog_t
+{
+    uint32_t magic;
+    uint32_t pos;
+    uint32_t sum;
+    uint32_t check;
+    uint8_t buf[STM32CUBEL4__DTTY_CRASHLOG_SIZE];
+} check_crashlog_t;
+
+extern check_crashlog_t _g_dtty_crashlog;
+
+/* Called by dtty_init, run again here as after a reset */
+extern void dtty_stm32_crashlog_replay(void);
+
+static char _g_check_output[CHECK_OUTPUT_SIZE];
+
+static int _check_receive(const char * str)
+{
+    return (uart_sim_receive(str, strlen(str)) == strlen(str)) ? 0 : -1;
+}
+
+static int _check_output(const char * expected)
+{
+    size_t len;
+
+    len = uart_sim_take_output(_g_check_output, sizeof(_g_check_output));
+
+    return (len == strlen(expected) && strcmp(_g_check_output, expected) == 0) ? 0 : -1;
+}
+
+static int _check_getline(const char * expected)
+{
+    char line[STM32CUBEL4__DTTY_LINE_SIZE * 2];
+
+    if (dtty_kbhit() != 1)
+    {
+        return -1;
+    }
+
+    return (dtty_getline(line, sizeof(line)) == (int) strlen(expected) && strcmp(line, expected) == 0) ? 0 : -1;
+}
+
+static uint32_t _check_rbuf_room(void)
+{
+    return _g_dtty_uart_rbuf->size - 1 - cbuf_get_len(_g_dtty_uart_rbuf);
+}
+
+/* Line discipline: editing, echo, line ends, and the read buffer overflow */
+static int _check_line(void)
+{
+    char line[STM32CUBEL4__DTTY_LINE_SIZE * 2];
+    char ch;
+    uint32_t overflow;
+    uint32_t room;
+    int count;
+    int i;
+
+    CHECK(dtty_setcanon(1) == 0);
+    uart_sim_take_output(NULL, 0);
+
+    /* "\r\n" is one line end, '\r' alone (character match) and '\n' alone are line ends too */
+    CHECK(_check_receive("abc\r\nde\nfg\r") == 0);
+    CHECK(_check_output("abc\r\nde\r\nfg\r\n") == 0);
+    CHECK(_check_getline("abc") == 0);
+    CHECK(_check_getline("de") == 0);
+    CHECK(_check_getline("fg") == 0);
+    CHECK(dtty_kbhit() == 0);
+
+    /* Backspace (0x08 or 0x7F) removes the last character, and nothing on an empty line */
+    CHECK(_check_receive("ab\bx\x7f\x7f\bc\r") == 0);
+    CHECK(_check_output("ab\b \bx\b \b\b \bc\r\n") == 0);
+    CHECK(_check_getline("c") == 0);
+
+    /* The line being edited is not seen by the readers */
+    CHECK(_check_receive("pending") == 0);
+    CHECK(dtty_kbhit() == 0);
+    CHECK(dtty_getc_unblocked(&ch) != 0);
+    CHECK(_check_receive("\r") == 0);
+    CHECK(_check_getline("pending") == 0);
+    uart_sim_take_output(NULL, 0);
+
+    /* The characters beyond STM32CUBEL4__DTTY_LINE_SIZE are dropped */
+    memset(line, 'l', sizeof(line));
+    CHECK(uart_sim_receive(line, STM32CUBEL4__DTTY_LINE_SIZE + 10) == STM32CUBEL4__DTTY_LINE_SIZE + 10);
+    CHECK(_check_receive("\r") == 0);
+    line[STM32CUBEL4__DTTY_LINE_SIZE] = '\0';
+    CHECK(_check_getline(line) == 0);
+    uart_sim_take_output(NULL, 0);
+
+    /* A completed line that does not fit in the read buffer is dropped as a whole */
+    overflow = _g_dtty_uart_rx_overflow_count;
+    for (count = 0; _check_rbuf_room() >= CHECK_LONG_LINE_LEN + 1; count++)
+    {
+        memset(line, 'A' + count, CHECK_LONG_LINE_LEN);
+        line[CHECK_LONG_LINE_LEN] = '\r';
+        CHECK(uart_sim_receive(line, CHECK_LONG_LINE_LEN + 1) == CHECK_LONG_LINE_LEN + 1);
+    }
+    room = _check_rbuf_room();
+    CHECK(room > 1);
+
+    /* One character too long (with its '\n'), then the exact fit */
+    memset(line, 'y', room);
+    line[room] = '\r';
+    CHECK(uart_sim_receive(line, room + 1) == room + 1);
+    CHECK(_g_dtty_uart_rx_overflow_count == overflow + 1);
+    CHECK(_check_rbuf_room() == room);
+
+    memset(line, 'z', room - 1);
+    line[room - 1] = '\r';
+    CHECK(uart_sim_receive(line, room) == room);
+    CHECK(_g_dtty_uart_rx_overflow_count == overflow + 1);
+    CHECK(_check_rbuf_room() == 0);
+
+    for (i = 0; i < count; i++)
+    {
+        memset(line, 'A' + i, CHECK_LONG_LINE_LEN);
+        line[CHECK_LONG_LINE_LEN] = '\0';
+        CHECK(_check_getline(line) == 0);
+    }
+    memset(line, 'z', room - 1);
+    line[room - 1] = '\0';
+    CHECK(_check_getline(line) == 0);
+    CHECK(dtty_kbhit() == 0);
+    uart_sim_take_output(NULL, 0);
+
+    CHECK(dtty_setcanon(0) == 0);
+
+    return 0;
+}
+
+/* Crash log: replay of the tail of the output, and rejection of a corrupted log */
+static int _check_crashlog(void)
+{
+    char data[STM32CUBEL4__DTTY_CRASHLOG_SIZE * 2];
+    size_t len;
+    size_t i;
+
+    /* Empty */
+    dtty_crashlog_discard();
+    dtty_stm32_crashlog_replay();
+    CHECK(dtty_crashlog_get_replayed() == 0);
+    CHECK(_check_output("") == 0);
+
+    /* Replayed once, as written (the autocr conversion is done again) */
+    CHECK(dtty_putn("hello\n", 6) == 6);
+    CHECK(_check_output("hello\r\n") == 0);
+    dtty_stm32_crashlog_replay();
+    CHECK(dtty_crashlog_get_replayed() == 6);
+    CHECK(_check_output("hello\r\n") == 0);
+    dtty_stm32_crashlog_replay();
+    CHECK(dtty_crashlog_get_replayed() == 0);
+
+    /* Only the last STM32CUBEL4__DTTY_CRASHLOG_SIZE bytes are kept, the sum follows the overwritten ones */
+    len = sizeof(data) - STM32CUBEL4__DTTY_CRASHLOG_SIZE / 2;
+    for (i = 0; i < len; i++)
+    {
+        data[i] = (char) ('a' + (i * 7) % 26);
+    }
+    CHECK(dtty_putn(data, (int) len) == (int) len);
+    uart_sim_take_output(NULL, 0);
+    dtty_stm32_crashlog_replay();
+    CHECK(dtty_crashlog_get_replayed() == STM32CUBEL4__DTTY_CRASHLOG_SIZE);
+    data[len] = '\0';
+    CHECK(_check_output(&data[len - STM32CUBEL4__DTTY_CRASHLOG_SIZE]) == 0);
+
+    /* A byte of the ring changed, with a valid header */
+    CHECK(dtty_putn("0123456789", 10) == 10);
+    uart_sim_take_output(NULL, 0);
+    _g_dtty_crashlog.buf[3] ^= 0x10;
+    dtty_stm32_crashlog_replay();
+    CHECK(dtty_crashlog_get_replayed() == 0);
+    CHECK(_check_output("") == 0);
+
+    /* The header changed */
+    CHECK(dtty_putn("0123456789", 10) == 10);
+    uart_sim_take_output(NULL, 0);
+    _g_dtty_crashlog.pos += STM32CUBEL4__DTTY_CRASHLOG_SIZE;
+    dtty_stm32_crashlog_replay();
+    CHECK(dtty_crashlog_get_replayed() == 0);
+    CHECK(_check_output("") == 0);
+
+    /* Random contents after a power on */
+    memset(&_g_dtty_crashlog, 0xA5, sizeof(_g_dtty_crashlog));
+    dtty_stm32_crashlog_replay();
+    CHECK(dtty_crashlog_get_replayed() == 0);
+    CHECK(_check_output("") == 0);
+
+    /* Cleared by the rejection, and written again */
+    CHECK(dtty_putn("bye", 3) == 3);
+    uart_sim_take_output(NULL, 0);
+    dtty_stm32_crashlog_replay();
+    CHECK(dtty_crashlog_get_replayed() == 3);
+    CHECK(_check_output("bye") == 0);
+
+    return 0;
+}
+
+static int _check_blackbox_filter(const char * line, int len)
+{
+    return (len > 0 && 'E' == line[0]) ? 1 : 0;
+}
+
+/* Black box: recording into the log ring, dump from the oldest record, and line filter */
+static int _check_blackbox(void)
+{
+    static char written[CHECK_LOG_WRITE_SIZE + 1];
+    static char output[UART_SIM_OUTPUT_SIZE];
+    nvmem_log_t log;
+    uint32_t overflow;
+    size_t len;
+    size_t i;
+    int r;
+
+    memset(&log, 0, sizeof(nvmem_log_t));
+    log.base = CHECK_LOG_ADDR;
+    log.page_size = FLASH_PAGE_SIZE;
+    log.page_count = CHECK_LOG_PAGE_COUNT;
+    CHECK(nvmem_log_mount(&log) == UBI_ERR_OK);
+    CHECK(nvmem_log_format(&log) == UBI_ERR_OK);
+
+    /* Nothing is recorded before the attach */
+    CHECK(dtty_putn("before\n", 7) == 7);
+    CHECK(dtty_blackbox_dump(&log) == 0);
+    CHECK(dtty_blackbox_attach(&log) == 0);
+    CHECK(dtty_blackbox_flush(1) == 0);
+    CHECK(dtty_blackbox_dump(&log) == 0);
+    uart_sim_take_output(NULL, 0);
+
+    /* Recorded as written (before the autocr conversion), and dumped with it */
+    CHECK(dtty_putn("first\nsecond\n", 13) == 13);
+    CHECK(dtty_blackbox_flush(1) == 0);
+    uart_sim_take_output(NULL, 0);
+    CHECK(dtty_blackbox_dump(&log) == 13);
+    CHECK(_check_output("first\r\nsecond\r\n") == 0);
+
+    /* The dump is not recorded */
+    CHECK(dtty_blackbox_flush(1) == 0);
+    CHECK(dtty_blackbox_dump(&log) == 13);
+    CHECK(_check_output("first\r\nsecond\r\n") == 0);
+
+    /* Three times the size of the ring: the newest output is kept, in order, from a record boundary, and all of it is dumped */
+    for (i = 0; i < CHECK_LOG_WRITE_SIZE; i++)
+    {
+        written[i] = (char) ('a' + (i * 7) % 26);
+    }
+    written[CHECK_LOG_WRITE_SIZE] = '\0';
+    for (i = 0; i < CHECK_LOG_WRITE_SIZE; i += CHECK_LOG_CHUNK_SIZE)
+    {
+        CHECK(dtty_putn(&written[i], CHECK_LOG_CHUNK_SIZE) == CHECK_LOG_CHUNK_SIZE);
+        CHECK(dtty_blackbox_flush(0) == 0);
+    }
+    CHECK(dtty_blackbox_flush(1) == 0);
+    uart_sim_take_output(NULL, 0);
+    r = dtty_blackbox_dump(&log);
+    len = uart_sim_take_output(output, sizeof(output));
+    CHECK(r > 0 && (size_t) r == len);
+    CHECK(len >= (CHECK_LOG_PAGE_COUNT - 1) * (FLASH_PAGE_SIZE - NVMEM_LOG_BUF_SIZE) && len < CHECK_LOG_PAGE_COUNT * FLASH_PAGE_SIZE);
+    CHECK(memcmp(output, &written[CHECK_LOG_WRITE_SIZE - len], len) == 0);
+
+    /* The output that does not fit in the capture buffer is dropped, and counted */
+    overflow = dtty_blackbox_get_overflow_count();
+    CHECK(nvmem_log_format(&log) == UBI_ERR_OK);
+    CHECK(dtty_putn(written, STM32CUBEL4__DTTY_BLACKBOX_BUFFER_SIZE + 10) == STM32CUBEL4__DTTY_BLACKBOX_BUFFER_SIZE + 10);
+    CHECK(dtty_blackbox_get_overflow_count() > overflow);
+    CHECK(dtty_blackbox_flush(1) == 0);
+    uart_sim_take_output(NULL, 0);
+    r = dtty_blackbox_dump(&log);
+    len = uart_sim_take_output(output, sizeof(output));
+    CHECK(r > 0 && (size_t) r == len && len < STM32CUBEL4__DTTY_BLACKBOX_BUFFER_SIZE);
+    CHECK(memcmp(output, written, len) == 0);
+
+    /* Only the lines selected by the filter are recorded */
+    CHECK(nvmem_log_format(&log) == UBI_ERR_OK);
+    dtty_blackbox_setfilter(_check_blackbox_filter);
+    CHECK(dtty_putn("I info\nE error\nI more\nE again\n", 30) == 30);
+    CHECK(dtty_blackbox_flush(1) == 0);
+    dtty_blackbox_setfilter(NULL);
+    uart_sim_take_output(NULL, 0);
+    CHECK(dtty_blackbox_dump(&log) == 16);
+    CHECK(_check_output("E error\r\nE again\r\n") == 0);
+
+    CHECK(dtty_blackbox_attach(NULL) == 0);
+    CHECK(nvmem_log_unmount(&log) == UBI_ERR_OK);
+
+    return 0;
+}
+
+/* Fills the write buffer (the transmitter is not run) up to room characters of free space */
+static int _check_wbuf_fill(uint32_t room)
+{
+    static char fill[CHECK_OUTPUT_SIZE];
+    uint32_t len;
+
+    memset(fill, 'x', sizeof(fill));
+    while (_g_dtty_uart_wbuf->size - 1 - cbuf_get_len(_g_dtty_uart_wbuf) > room)
+    {
+        len = _g_dtty_uart_wbuf->size - 1 - cbuf_get_len(_g_dtty_uart_wbuf) - room;
+        len = (len < sizeof(fill)) ? len : sizeof(fill);
+        if (dtty_putn(fill, (int) len) != (int) len)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Sends the output, and compares its end (after the fill of _check_wbuf_fill) */
+static int _check_output_tail(const char * expected)
+{
+    static char output[UART_SIM_OUTPUT_SIZE];
+    size_t len;
+
+    len = uart_sim_take_output(output, sizeof(output));
+
+    return (len >= strlen(expected) && strcmp(&output[len - strlen(expected)], expected) == 0 &&
+            (len == strlen(expected) || 'x' == output[len - strlen(expected) - 1])) ? 0 : -1;
+}
+
+/* Vectored output: line ends, parameter errors, and the count of the characters accepted by a full write buffer */
+static int _check_writev(void)
+{
+    dtty_iovec_t iov[4];
+    uint32_t overflow;
+
+    iov[0].iov_base = "ab";
+    iov[0].iov_len = 2;
+    iov[1].iov_base = "c\nd";
+    iov[1].iov_len = 3;
+    iov[2].iov_base = NULL;
+    iov[2].iov_len = 0;
+    iov[3].iov_base = "\n";
+    iov[3].iov_len = 1;
+    CHECK(dtty_writev(iov, 4) == 6);
+    CHECK(_check_output("abc\r\nd\r\n") == 0);
+    CHECK(dtty_writev(iov, 0) == 0);
+
+    CHECK(dtty_writev(NULL, 1) == -2);
+    CHECK(dtty_writev(iov, -1) == -3);
+    iov[2].iov_len = 1;
+    CHECK(dtty_writev(iov, 4) == -2);
+    CHECK(_check_output("") == 0);
+
+    /* Room for 10: "0123", "\r\n" (2 for 1 accepted) and "4567" */
+    overflow = _g_dtty_uart_tx_overflow_count;
+    iov[0].iov_base = "0123\n";
+    iov[0].iov_len = 5;
+    iov[1].iov_base = "456789ABCDEF";
+    iov[1].iov_len = 12;
+    CHECK(_check_wbuf_fill(10) == 0);
+    CHECK(dtty_writev(iov, 2) == 9);
+    CHECK(_g_dtty_uart_tx_overflow_count == overflow + 1);
+    CHECK(_check_output_tail("0123\r\n4567") == 0);
+
+    /* Room for 4: the line end does not fit, and is not counted */
+    CHECK(_check_wbuf_fill(4) == 0);
+    CHECK(dtty_writev(iov, 2) == 4);
+    CHECK(_g_dtty_uart_tx_overflow_count == overflow + 2);
+    CHECK(_check_output_tail("0123") == 0);
+
+    /* Exact fit */
+    CHECK(_check_wbuf_fill(18) == 0);
+    CHECK(dtty_writev(iov, 2) == 17);
+    CHECK(_g_dtty_uart_tx_overflow_count == overflow + 2);
+    CHECK(_check_output_tail("0123\r\n456789ABCDEF") == 0);
+
+    return 0;
+}
+
+static const check_t _g_checks[] =
+{
+    { "line",       _check_line },
+    { "crashlog",   _check_crashlog },
+    { "blackbox",   _check_blackbox },
+    { "writev",     _check_writev },
+};
+
+int main(int argc, char * argv[])
+{
+    int failed;
+    size_t i;
+
+    (void) argc;
+    (void) argv;
+
+    if (flash_sim_init() != 0)
+    {
+        return 1;
+    }
+
+    printf("dtty checks on the simulated UART\n");
+
+    failed = 0;
+    for (i = 0; i < sizeof(_g_checks) / sizeof(_g_checks[0]); i++)
+    {
+        if (_g_checks[i].run() != 0)
+        {
+            printf("%-10s FAIL\n", _g_checks[i].name);
+            failed++;
+        }
+        else
+        {
+            printf("%-10s ok\n", _g_checks[i].name);
+        }
+    }
+
+    return failed;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef MAIN_H_
+#define MAIN_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @file main.h
+ *
+ * @brief Host build replacement of the application main header, for the dtty simulator
+ *
+ * The UART HAL functions are implemented by the simulated UART (uart_sim.c).
+ */
+
+#include <stdint.h>
+
+#include "stm32l4xx_hal.h"
+
+typedef struct
+{
+    volatile uint32_t CR1;
+    volatile uint32_t CR2;
+    volatile uint32_t CR3;
+    volatile uint32_t BRR;
+    volatile uint32_t GTPR;
+    volatile uint32_t RTOR;
+    volatile uint32_t RQR;
+    volatile uint32_t ISR;
+    volatile uint32_t ICR;
+    volatile uint32_t RDR;
+    volatile uint32_t TDR;
+} USART_TypeDef;
+
+typedef struct
+{
+    uint32_t BaudRate;
+    uint32_t WordLength;
+    uint32_t StopBits;
+    uint32_t Parity;
+    uint32_t Mode;
+    uint32_t HwFlowCtl;
+    uint32_t OverSampling;
+} UART_InitTypeDef;
+
+typedef struct
+{
+    USART_TypeDef * Instance;
+    UART_InitTypeDef Init;
+    volatile uint32_t ErrorCode;
+} UART_HandleTypeDef;
+
+extern UART_HandleTypeDef uart_sim_handle;
+extern USART_TypeDef uart_sim_usart;
+
+#define DTTY_STM32_UART_HANDLE          uart_sim_handle
+#define DTTY_STM32_UART                 (&uart_sim_usart)
+#define DTTY_STM32_UART_IRQn            0
+
+#define UART_WORDLENGTH_8B              0x00000000U
+#define UART_STOPBITS_1                 0x00000000U
+#define UART_PARITY_NONE                0x00000000U
+#define UART_HWCONTROL_NONE             0x00000000U
+#define UART_MODE_TX_RX                 0x0000000CU
+#define UART_OVERSAMPLING_16            0x00000000U
+
+#define HAL_UART_ERROR_NONE             0x00000000U
+
+#define UART_FLAG_CMF                   0x00020000U
+#define UART_FLAG_TXE                   0x00000080U
+#define UART_CLEAR_CMF                  0x00020000U
+
+#define USART_CR2_ADD                   0xFF000000U
+#define UART_CR2_ADDRESS_LSB_POS        24U
+
+#define MODIFY_REG(REG, CLEARMASK, SETMASK) ((REG) = (((REG) & ~(CLEARMASK)) | (SETMASK)))
+
+#define __HAL_UART_ENABLE(__HANDLE__)               ((__HANDLE__)->Instance->CR1 |= 1U)
+#define __HAL_UART_DISABLE(__HANDLE__)              ((__HANDLE__)->Instance->CR1 &= ~1U)
+#define __HAL_UART_GET_FLAG(__HANDLE__, __FLAG__)   (((__HANDLE__)->Instance->ISR & (__FLAG__)) == (__FLAG__))
+/* The simulated USART has no ICR side effect: the flag is cleared in ISR directly */
+#define __HAL_UART_CLEAR_FLAG(__HANDLE__, __FLAG__) ((__HANDLE__)->Instance->ISR &= ~(__FLAG__))
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef * huart);
+HAL_StatusTypeDef HAL_UART_DeInit(UART_HandleTypeDef * huart);
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef * huart, uint8_t * pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef * huart, uint8_t * pData, uint16_t Size);
+
+void HAL_NVIC_SetPriority(int32_t IRQn, uint32_t PreemptPriority, uint32_t SubPriority);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* MAIN_H_ */
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UBINOS_H_
+#define UBINOS_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @file ubinos.h
+ *
+ * @brief Host build replacement of the ubinos header, for the dtty simulator
+ *
+ * Only the part of the ubinos API used by the UART dtty driver and by the nvmem driver is provided.
+ * The kernel is active and there is a single task: the interrupts are run by the checks,
+ * between the calls to the driver.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define INCLUDE__UBINOS__BSP                    1
+#define INCLUDE__UBINOS__UBIK                   1
+
+#define UBINOS__BSP__USE_DTTY                   1
+#define UBINOS__BSP__DTTY_TYPE__EXTERNAL        1
+#define UBINOS__BSP__DTTY_TYPE                  UBINOS__BSP__DTTY_TYPE__EXTERNAL
+
+#define UBINOS__BSP__BOARD_MODEL__NUCLEOL476RG  1
+#define UBINOS__BSP__BOARD_MODEL                UBINOS__BSP__BOARD_MODEL__NUCLEOL476RG
+
+#define INCLUDE__STM32CUBEL4_EXTENSION          1
+
+/* The nvmem driver runs on the simulated FLASH of the nvmem simulator, for the black box */
+#define UBINOS__UBIDRV__INCLUDE_NVMEM           1
+
+#ifndef STM32CUBEL4__NVMEM_LOG_ENABLE
+#define STM32CUBEL4__NVMEM_LOG_ENABLE           0
+#endif
+
+#define STM32CUBEL4__NVMEM_JOURNAL_ENABLE       0
+#define STM32CUBEL4__NVMEM_KV_ENABLE            0
+#define STM32CUBEL4__NVMEM_MAP_ENABLE           0
+#define STM32CUBEL4__NVMEM_CACHE_ENABLE         0
+#define STM32CUBEL4__NVMEM_STREAM_ENABLE        0
+#define STM32CUBEL4__NVMEM_ASYNC_ENABLE         0
+#define STM32CUBEL4__NVMEM_RWW_ENABLE           0
+#define STM32CUBEL4__NVMEM_CRC_ENABLE           0
+#define STM32CUBEL4__NVMEM_DMA_ENABLE           0
+
+#define STM32CUBEL4__DTTY_STM32_UART_ENABLE     1
+#define STM32CUBEL4__DTTY_STM32_USBD_ENABLE     0
+
+#ifndef STM32CUBEL4__DTTY_LINE_ENABLE
+#define STM32CUBEL4__DTTY_LINE_ENABLE           0
+#endif
+#ifndef STM32CUBEL4__DTTY_LINE_SIZE
+#define STM32CUBEL4__DTTY_LINE_SIZE             128
+#endif
+#ifndef STM32CUBEL4__DTTY_CRASHLOG_ENABLE
+#define STM32CUBEL4__DTTY_CRASHLOG_ENABLE       0
+#endif
+#ifndef STM32CUBEL4__DTTY_CRASHLOG_SIZE
+#define STM32CUBEL4__DTTY_CRASHLOG_SIZE         2048
+#endif
+#ifndef STM32CUBEL4__DTTY_BLACKBOX_ENABLE
+#define STM32CUBEL4__DTTY_BLACKBOX_ENABLE       0
+#endif
+#ifndef STM32CUBEL4__DTTY_BLACKBOX_BUFFER_SIZE
+#define STM32CUBEL4__DTTY_BLACKBOX_BUFFER_SIZE  1024
+#endif
+#ifndef STM32CUBEL4__DTTY_WRITEV_ENABLE
+#define STM32CUBEL4__DTTY_WRITEV_ENABLE         0
+#endif
+
+/* These modes drive peripherals that are not simulated, or are not checked */
+#define STM32CUBEL4__DTTY_READ_ENABLE           0
+#define STM32CUBEL4__DTTY_POLL_ENABLE           0
+#define STM32CUBEL4__DTTY_EARLY_ENABLE          0
+#define STM32CUBEL4__DTTY_PRIO_ENABLE           0
+#define STM32CUBEL4__DTTY_USBD_LINK_ENABLE      0
+#define STM32CUBEL4__DTTY_USBD_PORT_ENABLE      0
+
+#define LOGM_CATEGORY__NVMEM                    0
+#define NVIC_PRIO_MIDDLE                        0
+
+typedef enum
+{
+    UBI_ERR_OK = 0,
+    UBI_ERR_ERROR,
+    UBI_ERR_INTERNAL,
+    UBI_ERR_BUSY,
+    UBI_ERR_INVALID_PARAM,
+    UBI_ERR_INVALID_STATE,
+    UBI_ERR_NOT_SUPPORTED,
+    UBI_ERR_NO_MEM,
+    UBI_ERR_NOT_FOUND,
+    UBI_ERR_TIMEOUT,
+    UBI_ERR_BUF_FULL,
+    UBI_ERR_BUF_EMPTY,
+    UBI_ERR_INVALID_DATA,
+} ubi_err_t;
+
+typedef void * mutex_pt;
+typedef void * sem_pt;
+
+/*
+ * Circular buffer, as the ubinos one: a buffer of size bytes holds up to size - 1 bytes,
+ * and a write that does not fit is partially done.
+ */
+typedef struct _cbuf_t
+{
+    uint32_t head;
+    uint32_t tail;
+    uint32_t size;
+    uint8_t * buf;
+} cbuf_t;
+
+typedef cbuf_t * cbuf_pt;
+
+#define cbuf_def_init(name, size) \
+    uint8_t name##__buf[(size)]; \
+    cbuf_t name##__cbuf = { 0, 0, (size), name##__buf }; \
+    cbuf_pt name = &name##__cbuf
+
+ubi_err_t cbuf_write(cbuf_pt cbuf, const uint8_t * data, uint32_t len, uint32_t * written_p);
+ubi_err_t cbuf_read(cbuf_pt cbuf, uint8_t * buf, uint32_t len, uint32_t * read_p);
+uint32_t cbuf_get_len(cbuf_pt cbuf);
+uint32_t cbuf_get_contig_len(cbuf_pt cbuf);
+int cbuf_is_full(cbuf_pt cbuf);
+uint8_t * cbuf_get_head_addr(cbuf_pt cbuf);
+uint8_t * cbuf_get_tail_addr(cbuf_pt cbuf);
+void cbuf_clear(cbuf_pt cbuf);
+
+extern int _bsp_kernel_active;
+extern int _bsp_critcount;
+
+#define bsp_isintr()        (0)
+#define ubik_entercrit()    do { _bsp_critcount++; } while (0)
+#define ubik_exitcrit()     do { _bsp_critcount--; } while (0)
+
+#define logme(msg)          fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, (msg))
+
+void bsp_abortsystem(void);
+
+int mutex_create(mutex_pt * mutex_p);
+int mutex_delete(mutex_pt * mutex_p);
+int mutex_lock(mutex_pt mutex);
+int mutex_lock_timed(mutex_pt mutex, uint32_t timeoutms);
+int mutex_unlock(mutex_pt mutex);
+
+int semb_create(sem_pt * sem_p);
+int sem_delete(sem_pt * sem_p);
+int sem_give(sem_pt sem);
+int sem_take(sem_pt sem);
+int sem_take_timedms(sem_pt sem, uint32_t timeoutms);
+
+int task_sleepms(uint32_t timems);
+
+int dtty_init(void);
+int dtty_getc(char * ch_p);
+int dtty_getc_unblocked(char * ch_p);
+int dtty_putc(int ch);
+int dtty_putn(const char * str, int len);
+int dtty_flush(void);
+int dtty_kbhit(void);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* UBINOS_H_ */
@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UBINOS_BSP_H_
+#define UBINOS_BSP_H_
+
+/*!
+ * @file bsp.h
+ *
+ * @brief Host build replacement of the ubinos header, for the dtty simulator (see ubinos.h)
+ */
+
+#include <ubinos.h>
+
+#endif /* UBINOS_BSP_H_ */
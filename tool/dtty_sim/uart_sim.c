@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "uart_sim.h"
+
+/* Implemented by the dtty driver, called by the UART interrupt handler of the application */
+extern void dtty_stm32_uart_rx_callback(void);
+extern void dtty_stm32_uart_tx_callback(void);
+
+UART_HandleTypeDef uart_sim_handle;
+USART_TypeDef uart_sim_usart;
+
+static uint8_t * _uart_sim_rx_p = NULL;
+static uint8_t * _uart_sim_tx_p = NULL;
+
+static char _uart_sim_output[UART_SIM_OUTPUT_SIZE];
+static size_t _uart_sim_output_len = 0;
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef * huart)
+{
+    huart->ErrorCode = HAL_UART_ERROR_NONE;
+    huart->Instance->CR1 |= 1U;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_DeInit(UART_HandleTypeDef * huart)
+{
+    huart->Instance->CR1 = 0;
+    huart->Instance->ISR = 0;
+    _uart_sim_rx_p = NULL;
+    _uart_sim_tx_p = NULL;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef * huart, uint8_t * pData, uint16_t Size)
+{
+    (void) huart;
+
+    if (_uart_sim_rx_p != NULL)
+    {
+        return HAL_BUSY;
+    }
+    if (pData == NULL || Size != 1)
+    {
+        return HAL_ERROR;
+    }
+
+    _uart_sim_rx_p = pData;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef * huart, uint8_t * pData, uint16_t Size)
+{
+    (void) huart;
+
+    if (_uart_sim_tx_p != NULL)
+    {
+        return HAL_BUSY;
+    }
+    if (pData == NULL || Size != 1)
+    {
+        return HAL_ERROR;
+    }
+
+    _uart_sim_tx_p = pData;
+    return HAL_OK;
+}
+
+void HAL_NVIC_SetPriority(int32_t IRQn, uint32_t PreemptPriority, uint32_t SubPriority)
+{
+    (void) IRQn;
+    (void) PreemptPriority;
+    (void) SubPriority;
+}
+
+size_t uart_sim_receive(const char *str, size_t len)
+{
+    size_t i;
+    uint8_t * rx_p;
+    uint8_t match;
+
+    match = (uint8_t) ((uart_sim_usart.CR2 & USART_CR2_ADD) >> UART_CR2_ADDRESS_LSB_POS);
+
+    for (i = 0; i < len && _uart_sim_rx_p != NULL; i++)
+    {
+        rx_p = _uart_sim_rx_p;
+        _uart_sim_rx_p = NULL;
+
+        *rx_p = (uint8_t) str[i];
+        if ((uint8_t) str[i] == match)
+        {
+            uart_sim_usart.ISR |= UART_FLAG_CMF;
+        }
+
+        dtty_stm32_uart_rx_callback();
+    }
+
+    return i;
+}
+
+size_t uart_sim_transmit(void)
+{
+    size_t count;
+    uint8_t * tx_p;
+
+    for (count = 0; _uart_sim_tx_p != NULL; count++)
+    {
+        tx_p = _uart_sim_tx_p;
+        _uart_sim_tx_p = NULL;
+
+        if (_uart_sim_output_len < UART_SIM_OUTPUT_SIZE)
+        {
+            _uart_sim_output[_uart_sim_output_len] = (char) *tx_p;
+        }
+        _uart_sim_output_len++;
+
+        dtty_stm32_uart_tx_callback();
+    }
+
+    return count;
+}
+
+size_t uart_sim_take_output(char *buf, size_t max)
+{
+    size_t len;
+    size_t copied;
+
+    uart_sim_transmit();
+
+    len = _uart_sim_output_len;
+    if (max > 0)
+    {
+        copied = (len < UART_SIM_OUTPUT_SIZE) ? len : UART_SIM_OUTPUT_SIZE;
+        copied = (copied < max - 1) ? copied : max - 1;
+        memcpy(buf, _uart_sim_output, copied);
+        buf[copied] = '\0';
+    }
+    _uart_sim_output_len = 0;
+
+    return len;
+}
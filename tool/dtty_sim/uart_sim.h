@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UART_SIM_H_
+#define UART_SIM_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @file uart_sim.h
+ *
+ * @brief Simulated STM32L4 UART of the dtty driver
+ *
+ * The interrupt transfers of one character started by the driver (HAL_UART_Receive_IT and
+ * HAL_UART_Transmit_IT) are completed by the checks: a received character is stored where the
+ * reception was started, and the driver receive callback is called as by the interrupt. A sent
+ * character is appended to the output kept by the simulator, and the driver transmit callback
+ * is called. As on the USART, the character match flag (CMF) is set when the received character
+ * is the one of the ADD field of CR2.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "main.h"
+
+#define UART_SIM_OUTPUT_SIZE    (1024 * 64)
+
+/*!
+ * Receive characters, one interrupt each.
+ *
+ * @param str   Characters to receive
+ * @param len   Number of characters
+ *
+ * @return Number of characters received (the reception stops when the driver did not restart it)
+ */
+size_t uart_sim_receive(const char *str, size_t len);
+
+/*!
+ * Send the characters queued by the driver, until it stops the transmission.
+ *
+ * @return Number of characters sent
+ */
+size_t uart_sim_transmit(void);
+
+/*!
+ * Send the characters queued by the driver, and take the output sent since the previous call,
+ * terminated with '\0'.
+ *
+ * @param buf   Buffer to receive the output
+ * @param max   Size of the buffer (the output that does not fit is dropped)
+ *
+ * @return Length of the output sent (it can be more than max - 1)
+ */
+size_t uart_sim_take_output(char *buf, size_t max);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* UART_SIM_H_ */
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ubinos.h>
+
+#include "uart_sim.h"
+
+int _bsp_kernel_active = 1;
+int _bsp_critcount = 0;
+
+int _g_bsp_dtty_init = 0;
+int _g_bsp_dtty_in_init = 0;
+int _g_bsp_dtty_echo = 0;
+int _g_bsp_dtty_autocr = 0;
+
+void bsp_abortsystem(void)
+{
+    fprintf(stderr, "bsp_abortsystem\n");
+    abort();
+}
+
+ubi_err_t cbuf_write(cbuf_pt cbuf, const uint8_t * data, uint32_t len, uint32_t * written_p)
+{
+    uint32_t room;
+    uint32_t n;
+    uint32_t i;
+
+    room = cbuf->size - 1 - cbuf_get_len(cbuf);
+    n = (len < room) ? len : room;
+
+    for (i = 0; i < n; i++)
+    {
+        if (data != NULL)
+        {
+            cbuf->buf[cbuf->tail] = data[i];
+        }
+        cbuf->tail = (cbuf->tail + 1) % cbuf->size;
+    }
+
+    if (written_p != NULL)
+    {
+        *written_p = n;
+    }
+
+    return (n == len) ? UBI_ERR_OK : UBI_ERR_BUF_FULL;
+}
+
+ubi_err_t cbuf_read(cbuf_pt cbuf, uint8_t * buf, uint32_t len, uint32_t * read_p)
+{
+    uint32_t avail;
+    uint32_t n;
+    uint32_t i;
+
+    avail = cbuf_get_len(cbuf);
+    n = (len < avail) ? len : avail;
+
+    for (i = 0; i < n; i++)
+    {
+        if (buf != NULL)
+        {
+            buf[i] = cbuf->buf[cbuf->head];
+        }
+        cbuf->head = (cbuf->head + 1) % cbuf->size;
+    }
+
+    if (read_p != NULL)
+    {
+        *read_p = n;
+    }
+
+    return (n == len) ? UBI_ERR_OK : UBI_ERR_BUF_EMPTY;
+}
+
+uint32_t cbuf_get_len(cbuf_pt cbuf)
+{
+    return (cbuf->tail + cbuf->size - cbuf->head) % cbuf->size;
+}
+
+uint32_t cbuf_get_contig_len(cbuf_pt cbuf)
+{
+    return (cbuf->tail >= cbuf->head) ? cbuf->tail - cbuf->head : cbuf->size - cbuf->head;
+}
+
+int cbuf_is_full(cbuf_pt cbuf)
+{
+    return (cbuf_get_len(cbuf) == cbuf->size - 1);
+}
+
+uint8_t * cbuf_get_head_addr(cbuf_pt cbuf)
+{
+    return &cbuf->buf[cbuf->head];
+}
+
+uint8_t * cbuf_get_tail_addr(cbuf_pt cbuf)
+{
+    return &cbuf->buf[cbuf->tail];
+}
+
+void cbuf_clear(cbuf_pt cbuf)
+{
+    cbuf->head = 0;
+    cbuf->tail = 0;
+}
+
+int mutex_create(mutex_pt * mutex_p)
+{
+    *mutex_p = (mutex_pt) mutex_p;
+    return 0;
+}
+
+int mutex_delete(mutex_pt * mutex_p)
+{
+    *mutex_p = NULL;
+    return 0;
+}
+
+int mutex_lock(mutex_pt mutex)
+{
+    (void) mutex;
+    return 0;
+}
+
+int mutex_lock_timed(mutex_pt mutex, uint32_t timeoutms)
+{
+    (void) mutex;
+    (void) timeoutms;
+    return 0;
+}
+
+int mutex_unlock(mutex_pt mutex)
+{
+    (void) mutex;
+    return 0;
+}
+
+int semb_create(sem_pt * sem_p)
+{
+    *sem_p = calloc(1, sizeof(int));
+    return (*sem_p != NULL) ? 0 : -1;
+}
+
+int sem_delete(sem_pt * sem_p)
+{
+    free(*sem_p);
+    *sem_p = NULL;
+    return 0;
+}
+
+int sem_give(sem_pt sem)
+{
+    *(int *) sem = 1;
+    return 0;
+}
+
+/* There is no other task: while waiting, only the UART runs (and sends everything queued) */
+int sem_take_timedms(sem_pt sem, uint32_t timeoutms)
+{
+    (void) timeoutms;
+
+    uart_sim_transmit();
+
+    if (*(int *) sem == 0)
+    {
+        return UBI_ERR_TIMEOUT;
+    }
+
+    *(int *) sem = 0;
+    return 0;
+}
+
+int sem_take(sem_pt sem)
+{
+    if (sem_take_timedms(sem, 0) != 0)
+    {
+        /* Would never be given */
+        bsp_abortsystem();
+    }
+    return 0;
+}
+
+int task_sleepms(uint32_t timems)
+{
+    (void) timems;
+
+    uart_sim_transmit();
+
+    return 0;
+}
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _GNU_SOURCE
+
+#include "flash_sim.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE MAP_FIXED
+#endif
+
+SYSCFG_TypeDef flash_sim_syscfg = { 0 };
+
+static int _g_flash_sim_fd = -1;
+static uint8_t * _g_flash_sim_mem = NULL;   /* Writable view of the physical FLASH (bank 1, then bank 2) */
+static int _g_flash_sim_locked = 1;
+static uint32_t _g_flash_sim_error = HAL_FLASH_ERROR_NONE;
+static uint64_t _g_flash_sim_time_us = 0;
+static uint32_t _g_flash_sim_erase_counts[FLASH_SIM_PAGE_COUNT];
+static flash_sim_stats_t _g_flash_sim_stats;
+static uint32_t _g_flash_sim_op_count = 0;
+static uint32_t _g_flash_sim_cut_op = 0;
+static uint64_t _g_flash_sim_cut_seed = 0;
+
+static int _flash_sim_map_window(int noreplace);
+static uint32_t _flash_sim_phys_offset(uint32_t address);
+static HAL_StatusTypeDef _flash_sim_fail(uint32_t error);
+static uint64_t _flash_sim_rand(void);
+static int _flash_sim_next_op_is_cut(void);
+
+static int _flash_sim_map_window(int noreplace)
+{
+    int swap = READ_BIT(SYSCFG->MEMRMP, SYSCFG_MEMRMP_FB_MODE) ? 1 : 0;
+    int flags = MAP_SHARED | (noreplace ? MAP_FIXED_NOREPLACE : MAP_FIXED);
+    void * p;
+
+    p = mmap((void *) FLASH_BASE, FLASH_BANK_SIZE, PROT_READ, flags, _g_flash_sim_fd, swap ? FLASH_BANK_SIZE : 0);
+    if (p != (void *) FLASH_BASE)
+    {
+        return -1;
+    }
+    p = mmap((void *) (FLASH_BASE + FLASH_BANK_SIZE), FLASH_BANK_SIZE, PROT_READ, flags, _g_flash_sim_fd, swap ? 0 : FLASH_BANK_SIZE);
+    if (p != (void *) (FLASH_BASE + FLASH_BANK_SIZE))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* Offset in the physical FLASH of an address of the FLASH window */
+static uint32_t _flash_sim_phys_offset(uint32_t address)
+{
+    uint32_t offset = address - FLASH_BASE;
+
+    if (READ_BIT(SYSCFG->MEMRMP, SYSCFG_MEMRMP_FB_MODE))
+    {
+        offset ^= FLASH_BANK_SIZE;
+    }
+    return offset;
+}
+
+static HAL_StatusTypeDef _flash_sim_fail(uint32_t error)
+{
+    _g_flash_sim_error |= error;
+    _g_flash_sim_stats.error_count++;
+    return HAL_ERROR;
+}
+
+static uint64_t _flash_sim_rand(void)
+{
+    /* xorshift64, seeded with the index of the cut operation, so that a cut is reproducible */
+    _g_flash_sim_cut_seed ^= _g_flash_sim_cut_seed << 13;
+    _g_flash_sim_cut_seed ^= _g_flash_sim_cut_seed >> 7;
+    _g_flash_sim_cut_seed ^= _g_flash_sim_cut_seed << 17;
+    return _g_flash_sim_cut_seed;
+}
+
+static int _flash_sim_next_op_is_cut(void)
+{
+    _g_flash_sim_op_count++;
+    return (_g_flash_sim_cut_op != 0U && _g_flash_sim_op_count == _g_flash_sim_cut_op) ? 1 : 0;
+}
+
+int flash_sim_init(void)
+{
+    if (_g_flash_sim_fd < 0)
+    {
+        _g_flash_sim_fd = memfd_create("flash_sim", 0);
+        if (_g_flash_sim_fd < 0 || ftruncate(_g_flash_sim_fd, FLASH_SIZE) != 0)
+        {
+            perror("flash_sim");
+            return -1;
+        }
+        _g_flash_sim_mem = mmap(NULL, FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, _g_flash_sim_fd, 0);
+        if (_g_flash_sim_mem == MAP_FAILED || _flash_sim_map_window(1) != 0)
+        {
+            fprintf(stderr, "flash_sim: cannot map the FLASH at 0x%08lx\n", (unsigned long) FLASH_BASE);
+            return -1;
+        }
+    }
+
+    memset(_g_flash_sim_mem, 0xFF, FLASH_SIZE);
+    _g_flash_sim_locked = 1;
+    _g_flash_sim_error = HAL_FLASH_ERROR_NONE;
+    _g_flash_sim_time_us = 0;
+    flash_sim_reset_stats();
+
+    return 0;
+}
+
+void flash_sim_deinit(void)
+{
+    if (_g_flash_sim_fd < 0)
+    {
+        return;
+    }
+    munmap((void *) FLASH_BASE, FLASH_SIZE);
+    munmap(_g_flash_sim_mem, FLASH_SIZE);
+    close(_g_flash_sim_fd);
+    _g_flash_sim_fd = -1;
+    _g_flash_sim_mem = NULL;
+}
+
+void flash_sim_set_bank_swap(int swap)
+{
+    if (swap)
+    {
+        SET_BIT(SYSCFG->MEMRMP, SYSCFG_MEMRMP_FB_MODE);
+    }
+    else
+    {
+        CLEAR_BIT(SYSCFG->MEMRMP, SYSCFG_MEMRMP_FB_MODE);
+    }
+    if (_g_flash_sim_fd >= 0)
+    {
+        _flash_sim_map_window(0);
+    }
+}
+
+uint64_t flash_sim_get_time_us(void)
+{
+    return _g_flash_sim_time_us;
+}
+
+void flash_sim_advance_time_us(uint64_t us)
+{
+    _g_flash_sim_time_us += us;
+}
+
+uint32_t flash_sim_get_page_index(const uint8_t *addr)
+{
+    return _flash_sim_phys_offset((uint32_t) (uintptr_t) addr) / FLASH_PAGE_SIZE;
+}
+
+uint32_t flash_sim_get_erase_count(uint32_t page_index)
+{
+    return (page_index < FLASH_SIM_PAGE_COUNT) ? _g_flash_sim_erase_counts[page_index] : 0;
+}
+
+void flash_sim_get_stats(flash_sim_stats_t *stats)
+{
+    *stats = _g_flash_sim_stats;
+}
+
+void flash_sim_reset_stats(void)
+{
+    memset(_g_flash_sim_erase_counts, 0, sizeof(_g_flash_sim_erase_counts));
+    memset(&_g_flash_sim_stats, 0, sizeof(_g_flash_sim_stats));
+}
+
+uint32_t flash_sim_get_op_count(void)
+{
+    return _g_flash_sim_op_count;
+}
+
+void flash_sim_set_power_cut(uint32_t op_index)
+{
+    _g_flash_sim_op_count = 0;
+    _g_flash_sim_cut_op = op_index;
+    _g_flash_sim_cut_seed = 0x9E3779B97F4A7C15ULL * (op_index + 1U);
+}
+
+void flash_sim_save(uint8_t *buf)
+{
+    memcpy(buf, _g_flash_sim_mem, FLASH_SIZE);
+}
+
+void flash_sim_load(const uint8_t *buf)
+{
+    memcpy(_g_flash_sim_mem, buf, FLASH_SIZE);
+}
+
+void flash_sim_clear_error(uint32_t flags)
+{
+    (void) flags;
+    _g_flash_sim_error = HAL_FLASH_ERROR_NONE;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+    _g_flash_sim_locked = 0;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+    _g_flash_sim_locked = 1;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+    uint64_t * dw;
+
+    if (_g_flash_sim_locked)
+    {
+        return _flash_sim_fail(HAL_FLASH_ERROR_WRP);
+    }
+    if (TypeProgram != FLASH_TYPEPROGRAM_DOUBLEWORD || (Address & 0x7U) != 0U ||
+            Address < FLASH_BASE || Address >= FLASH_BASE + FLASH_SIZE)
+    {
+        return _flash_sim_fail(HAL_FLASH_ERROR_PGA);
+    }
+
+    dw = (uint64_t *) (_g_flash_sim_mem + _flash_sim_phys_offset(Address));
+    if (*dw != 0xFFFFFFFFFFFFFFFFULL && Data != 0U)
+    {
+        /* PROGERR: the doubleword is not erased */
+        return _flash_sim_fail(HAL_FLASH_ERROR_PROG);
+    }
+
+    if (_flash_sim_next_op_is_cut())
+    {
+        /* Only some of the bits to clear are cleared */
+        *dw &= ~((*dw & ~Data) & _flash_sim_rand());
+        _exit(FLASH_SIM_EXIT_CUT_PROGRAM);
+    }
+
+    *dw = Data;
+    _g_flash_sim_time_us += FLASH_SIM_PROGRAM_US;
+    _g_flash_sim_stats.program_count++;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError)
+{
+    uint32_t index;
+    uint32_t i;
+
+    *PageError = 0xFFFFFFFFU;
+
+    if (_g_flash_sim_locked)
+    {
+        return _flash_sim_fail(HAL_FLASH_ERROR_WRP);
+    }
+    if (pEraseInit->TypeErase != FLASH_TYPEERASE_PAGES ||
+            (pEraseInit->Banks != FLASH_BANK_1 && pEraseInit->Banks != FLASH_BANK_2) ||
+            pEraseInit->NbPages == 0U || pEraseInit->Page + pEraseInit->NbPages > FLASH_SIM_BANK_PAGE_COUNT)
+    {
+        return _flash_sim_fail(HAL_FLASH_ERROR_PGA);
+    }
+
+    for (i = 0; i < pEraseInit->NbPages; i++)
+    {
+        /* Banks and pages are physical: the bank swap does not apply */
+        index = ((pEraseInit->Banks == FLASH_BANK_2) ? FLASH_SIM_BANK_PAGE_COUNT : 0U) + pEraseInit->Page + i;
+
+        if (_flash_sim_next_op_is_cut())
+        {
+            /* Only some of the bits of the page are set */
+            uint64_t * dw = (uint64_t *) (_g_flash_sim_mem + (index * FLASH_PAGE_SIZE));
+            uint32_t j;
+
+            for (j = 0; j < FLASH_PAGE_SIZE / sizeof(uint64_t); j++)
+            {
+                dw[j] |= _flash_sim_rand() & _flash_sim_rand();
+            }
+            _exit(FLASH_SIM_EXIT_CUT_ERASE);
+        }
+
+        memset(_g_flash_sim_mem + (index * FLASH_PAGE_SIZE), 0xFF, FLASH_PAGE_SIZE);
+        _g_flash_sim_erase_counts[index]++;
+        _g_flash_sim_time_us += FLASH_SIM_ERASE_US;
+        _g_flash_sim_stats.erase_count++;
+    }
+
+    return HAL_OK;
+}
+
+uint32_t HAL_FLASH_GetError(void)
+{
+    return _g_flash_sim_error;
+}
+
+uint32_t HAL_GetTick(void)
+{
+    return (uint32_t) (_g_flash_sim_time_us / 1000U);
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FLASH_SIM_H_
+#define FLASH_SIM_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @file flash_sim.h
+ *
+ * @brief Simulated STM32L4 FLASH controller
+ *
+ * The FLASH is simulated as the STM32L476RG one: 1 MB at FLASH_BASE, 2 banks of 256 pages of 2 KB.
+ * It is mapped read only at its real address, so that the driver reads it directly and a stray
+ * write faults. The controller enforces the rules of the real one:
+ * - Programming is done by doublewords, at doubleword aligned addresses.
+ * - A doubleword that is not erased cannot be programmed again (except with all zeros).
+ * - Erase and program need the FLASH to be unlocked.
+ * - With the bank swap (SYSCFG_MEMRMP_FB_MODE), bank 2 is mapped at FLASH_BASE.
+ *
+ * Operations advance a virtual clock by the typical durations of the datasheet, and the erase
+ * cycles of every page are counted.
+ *
+ * Power cuts are injected by numbering the elementary operations (a doubleword program or a page
+ * erase) from 1. When the selected operation starts, it is left half done (a random subset of the
+ * bits to clear is cleared, or a random subset of the bits of the page is set) and the process
+ * exits with FLASH_SIM_EXIT_CUT_PROGRAM or FLASH_SIM_EXIT_CUT_ERASE. The FLASH is shared memory,
+ * so the operation is run in a child process and the parent sees the FLASH as left by the cut.
+ */
+
+#include <stdint.h>
+
+#include "stm32l4xx_hal.h"
+
+#define FLASH_SIM_PAGE_COUNT        (FLASH_SIZE / FLASH_PAGE_SIZE)
+#define FLASH_SIM_BANK_PAGE_COUNT   (FLASH_BANK_SIZE / FLASH_PAGE_SIZE)
+
+#define FLASH_SIM_PROGRAM_US        82      /*!< 64-bit programming time (typ. 81.7 us) */
+#define FLASH_SIM_ERASE_US          22020   /*!< Page erase time (typ. 22.02 ms) */
+
+#define FLASH_SIM_EXIT_CUT_PROGRAM  98      /*!< Exit status of a process cut during a program */
+#define FLASH_SIM_EXIT_CUT_ERASE    99      /*!< Exit status of a process cut during an erase */
+
+/*!
+ * Simulated FLASH controller statistics
+ */
+typedef struct _flash_sim_stats_t
+{
+    uint32_t program_count;     /*!< Number of programmed doublewords */
+    uint32_t erase_count;       /*!< Number of erased pages */
+    uint32_t error_count;       /*!< Number of rejected operations (rule violations) */
+} flash_sim_stats_t;
+
+/*!
+ * Map the simulated FLASH and erase it.
+ *
+ * @return 0 on success, -1 if the FLASH address range could not be mapped
+ */
+int flash_sim_init(void);
+
+/*!
+ * Unmap the simulated FLASH.
+ */
+void flash_sim_deinit(void);
+
+/*!
+ * Set the bank swap (as done by the BFB2 option bit at reset).
+ *
+ * @param swap  1 to map bank 2 at FLASH_BASE, 0 otherwise
+ */
+void flash_sim_set_bank_swap(int swap);
+
+/*!
+ * Returns the virtual clock in microseconds.
+ */
+uint64_t flash_sim_get_time_us(void);
+
+/*!
+ * Advance the virtual clock.
+ */
+void flash_sim_advance_time_us(uint64_t us);
+
+/*!
+ * Returns the physical page index (bank 1 pages first) of an address in the FLASH.
+ */
+uint32_t flash_sim_get_page_index(const uint8_t *addr);
+
+/*!
+ * Returns the erase cycle count of a physical page.
+ */
+uint32_t flash_sim_get_erase_count(uint32_t page_index);
+
+/*!
+ * Get the statistics.
+ */
+void flash_sim_get_stats(flash_sim_stats_t *stats);
+
+/*!
+ * Clear the statistics and the erase cycle counts.
+ */
+void flash_sim_reset_stats(void);
+
+/*!
+ * Returns the number of elementary operations (doubleword programs and page erases) done since
+ * the last flash_sim_set_power_cut.
+ */
+uint32_t flash_sim_get_op_count(void);
+
+/*!
+ * Select the operation during which the power is cut, and restart the operation count.
+ *
+ * @param op_index  Index of the operation (from 1), or 0 not to cut the power
+ */
+void flash_sim_set_power_cut(uint32_t op_index);
+
+/*!
+ * Copy the contents of the physical FLASH (FLASH_SIZE bytes) to a buffer.
+ */
+void flash_sim_save(uint8_t *buf);
+
+/*!
+ * Restore the contents of the physical FLASH from a buffer.
+ */
+void flash_sim_load(const uint8_t *buf);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* FLASH_SIM_H_ */
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef STM32L4XX_HAL_H_
+#define STM32L4XX_HAL_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @file stm32l4xx_hal.h
+ *
+ * @brief Host build replacement of the STM32L4 HAL header, for the nvmem simulator
+ *
+ * The FLASH HAL functions are implemented by the simulated FLASH controller (flash_sim.c),
+ * with the geometry of the STM32L476RG (1 MB, 2 banks of 256 pages of 2 KB).
+ */
+
+#include <stdint.h>
+
+typedef enum
+{
+    HAL_OK       = 0x00U,
+    HAL_ERROR    = 0x01U,
+    HAL_BUSY     = 0x02U,
+    HAL_TIMEOUT  = 0x03U
+} HAL_StatusTypeDef;
+
+typedef struct
+{
+    uint32_t TypeErase;
+    uint32_t Banks;
+    uint32_t Page;
+    uint32_t NbPages;
+} FLASH_EraseInitTypeDef;
+
+typedef struct
+{
+    volatile uint32_t MEMRMP;
+} SYSCFG_TypeDef;
+
+#define FLASH_BASE                      0x08000000UL
+#define FLASH_SIZE                      0x00100000UL
+#define FLASH_BANK_SIZE                 (FLASH_SIZE >> 1U)
+#define FLASH_PAGE_SIZE                 0x00000800UL
+
+#define FLASH_BANK_1                    0x00000001U
+#define FLASH_BANK_2                    0x00000002U
+
+#define FLASH_TYPEERASE_PAGES           0x00000000U
+#define FLASH_TYPEERASE_MASSERASE       0x00000001U
+#define FLASH_TYPEPROGRAM_DOUBLEWORD    0x00000000U
+
+#define HAL_FLASH_ERROR_NONE            0x00000000U
+#define HAL_FLASH_ERROR_PROG            0x00000008U
+#define HAL_FLASH_ERROR_WRP             0x00000010U
+#define HAL_FLASH_ERROR_PGA             0x00000020U
+
+#define FLASH_FLAG_EOP                  0x00000001U
+#define FLASH_FLAG_WRPERR               0x00000010U
+#define FLASH_FLAG_PGSERR               0x00000080U
+#define FLASH_FLAG_OPTVERR              0x00008000U
+#define FLASH_FLAG_ALL_ERRORS           0x0000C3FAU
+
+#define SYSCFG_MEMRMP_MEM_MODE          0x00000007U
+#define SYSCFG_MEMRMP_FB_MODE           0x00000100U
+
+#define READ_BIT(REG, BIT)              ((REG) & (BIT))
+#define SET_BIT(REG, BIT)               ((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT)             ((REG) &= ~(BIT))
+
+extern SYSCFG_TypeDef flash_sim_syscfg;
+#define SYSCFG                          (&flash_sim_syscfg)
+
+#define __HAL_FLASH_CLEAR_FLAG(__FLAG__)    flash_sim_clear_error(__FLAG__)
+
+#define __disable_irq()                 do { } while (0)
+#define __enable_irq()                  do { } while (0)
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError);
+uint32_t HAL_FLASH_GetError(void);
+uint32_t HAL_GetTick(void);
+
+void flash_sim_clear_error(uint32_t flags);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* STM32L4XX_HAL_H_ */
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UBINOS_H_
+#define UBINOS_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @file ubinos.h
+ *
+ * @brief Host build replacement of the ubinos header, for the nvmem simulator
+ *
+ * Only the part of the ubinos API used by the nvmem driver is provided.
+ * The kernel is never active, so the driver runs its single task paths.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define UBINOS__BSP__BOARD_MODEL__NUCLEOL476RG  1
+#define UBINOS__BSP__BOARD_MODEL                UBINOS__BSP__BOARD_MODEL__NUCLEOL476RG
+
+#define UBINOS__UBIDRV__INCLUDE_NVMEM           1
+
+#define INCLUDE__STM32CUBEL4_EXTENSION          1
+
+#ifndef STM32CUBEL4__NVMEM_JOURNAL_ENABLE
+#define STM32CUBEL4__NVMEM_JOURNAL_ENABLE       0
+#endif
+#ifndef STM32CUBEL4__NVMEM_KV_ENABLE
+#define STM32CUBEL4__NVMEM_KV_ENABLE            0
+#endif
+#ifndef STM32CUBEL4__NVMEM_LOG_ENABLE
+#define STM32CUBEL4__NVMEM_LOG_ENABLE           0
+#endif
+#ifndef STM32CUBEL4__NVMEM_MAP_ENABLE
+#define STM32CUBEL4__NVMEM_MAP_ENABLE           0
+#endif
+#ifndef STM32CUBEL4__NVMEM_CACHE_ENABLE
+#define STM32CUBEL4__NVMEM_CACHE_ENABLE         0
+#endif
+#ifndef STM32CUBEL4__NVMEM_STREAM_ENABLE
+#define STM32CUBEL4__NVMEM_STREAM_ENABLE        0
+#endif
+#ifndef STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT
+#define STM32CUBEL4__NVMEM_CACHE_PAGE_COUNT     2
+#endif
+#ifndef STM32CUBEL4__NVMEM_CACHE_TIMEOUTMS
+#define STM32CUBEL4__NVMEM_CACHE_TIMEOUTMS      1000
+#endif
+
+/* These modes drive peripherals that are not simulated */
+#define STM32CUBEL4__NVMEM_ASYNC_ENABLE         0
+#define STM32CUBEL4__NVMEM_RWW_ENABLE           0
+#define STM32CUBEL4__NVMEM_CRC_ENABLE           0
+#define STM32CUBEL4__NVMEM_DMA_ENABLE           0
+
+#define LOGM_CATEGORY__NVMEM                    0
+#define NVIC_PRIO_MIDDLE                        0
+
+typedef enum
+{
+    UBI_ERR_OK = 0,
+    UBI_ERR_ERROR,
+    UBI_ERR_INTERNAL,
+    UBI_ERR_BUSY,
+    UBI_ERR_INVALID_PARAM,
+    UBI_ERR_INVALID_STATE,
+    UBI_ERR_NOT_SUPPORTED,
+    UBI_ERR_NO_MEM,
+    UBI_ERR_NOT_FOUND,
+    UBI_ERR_TIMEOUT,
+    UBI_ERR_BUF_FULL,
+    UBI_ERR_INVALID_DATA,
+} ubi_err_t;
+
+typedef void * mutex_pt;
+typedef void * sem_pt;
+
+extern int _bsp_kernel_active;
+extern int _bsp_critcount;
+
+#define bsp_isintr()        (0)
+#define ubik_entercrit()    do { _bsp_critcount++; } while (0)
+#define ubik_exitcrit()     do { _bsp_critcount--; } while (0)
+
+#define logme(msg)          fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, (msg))
+
+int mutex_create(mutex_pt * mutex_p);
+int mutex_delete(mutex_pt * mutex_p);
+int mutex_lock(mutex_pt mutex);
+int mutex_unlock(mutex_pt mutex);
+int task_sleepms(uint32_t timems);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* UBINOS_H_ */
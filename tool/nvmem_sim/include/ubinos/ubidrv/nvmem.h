@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UBIDRV_NVMEM_H_
+#define UBIDRV_NVMEM_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @file nvmem.h
+ *
+ * @brief Host build replacement of the ubidrv nvmem API header, for the nvmem simulator
+ */
+
+#include <ubinos.h>
+
+ubi_err_t nvmem_erase(uint8_t *addr, size_t size);
+
+ubi_err_t nvmem_update(uint8_t *addr, const uint8_t *buf, size_t size);
+
+ubi_err_t nvmem_read(const uint8_t *addr, uint8_t *buf, size_t size);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* UBIDRV_NVMEM_H_ */
@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * nvmem latency and wear benchmark on the simulated FLASH.
+ *
+ * Every workload runs on a freshly erased FLASH. The latencies are measured on the virtual clock
+ * of the simulator (datasheet erase and program times), and the contents are checked against a
+ * RAM shadow at the end of the workload.
+ *
+ * Columns: number of operations, mean and max latency of an operation, total time (including the
+ * final nvmem_sync of the cache variant), time of the background work between the operations
+ * (nvmem_journal_maintain of the journal variant), erased pages, programmed doublewords, failed operations,
+ * min and max erase count of the pages of the workload area, max erase count of all pages
+ * (journal pages included), and the result of the content check.
+ * Workloads suffixed with /bs run with the bank swap set.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ubinos.h>
+#include <ubinos/ubidrv/nvmem.h>
+#include <stm32cubel4_extension/nvmem.h>
+#include <stm32cubel4_extension/nvmem_kv.h>
+#include <stm32cubel4_extension/nvmem_log.h>
+
+#include "flash_sim.h"
+
+/* Workloads run in bank 2; the journal area (journal variant) is at the start of bank 1 */
+#define BENCH_AREA_ADDR         ((uint8_t *) (FLASH_BASE + FLASH_BANK_SIZE))
+#define BENCH_AREA_PAGE_COUNT   32
+#define BENCH_AREA_SIZE         (BENCH_AREA_PAGE_COUNT * FLASH_PAGE_SIZE)
+#define BENCH_JOURNAL_ADDR      ((uint8_t *) FLASH_BASE)
+#define BENCH_JOURNAL_SCRATCH   4
+
+typedef struct _bench_result_t
+{
+    const char * name;
+    uint32_t op_count;
+    uint64_t total_us;
+    uint64_t max_us;
+    uint64_t background_us;
+    uint32_t error_count;
+    flash_sim_stats_t stats;
+    uint32_t wear_min;
+    uint32_t wear_max;
+    uint32_t wear_max_global;
+    int verified;
+} bench_result_t;
+
+typedef int (*bench_workload_ft)(bench_result_t * result, uint8_t * shadow);
+
+static uint8_t _g_bench_shadow[BENCH_AREA_SIZE];
+static uint32_t _g_bench_seed = 1;
+
+static uint32_t _bench_rand(void)
+{
+    _g_bench_seed = _g_bench_seed * 1103515245U + 12345U;
+    return _g_bench_seed >> 16;
+}
+
+static void _bench_fill(uint8_t * buf, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        buf[i] = (uint8_t) _bench_rand();
+    }
+}
+
+/* Work of a low priority task between the operations, not part of their latency */
+static void _bench_background(bench_result_t * result)
+{
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+    uint64_t start = flash_sim_get_time_us();
+
+    if (nvmem_journal_maintain() != UBI_ERR_OK)
+    {
+        result->error_count++;
+    }
+    result->background_us += flash_sim_get_time_us() - start;
+#else
+    (void) result;
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) */
+}
+
+/* Runs one timed operation */
+static void _bench_op_update(bench_result_t * result, uint8_t * shadow, uint32_t offset, const uint8_t * buf, size_t size)
+{
+    uint64_t start = flash_sim_get_time_us();
+    uint64_t elapsed;
+
+    if (nvmem_update(BENCH_AREA_ADDR + offset, buf, size) != UBI_ERR_OK)
+    {
+        result->error_count++;
+    }
+    elapsed = flash_sim_get_time_us() - start;
+
+    memcpy(shadow + offset, buf, size);
+    result->op_count++;
+    result->total_us += elapsed;
+    if (elapsed > result->max_us)
+    {
+        result->max_us = elapsed;
+    }
+
+    _bench_background(result);
+}
+
+/* Full page updates */
+static int _bench_page_update(bench_result_t * result, uint8_t * shadow)
+{
+    uint8_t buf[FLASH_PAGE_SIZE];
+    uint32_t round;
+    uint32_t page;
+
+    for (round = 0; round < 4; round++)
+    {
+        for (page = 0; page < BENCH_AREA_PAGE_COUNT; page++)
+        {
+            _bench_fill(buf, sizeof(buf));
+            _bench_op_update(result, shadow, page * FLASH_PAGE_SIZE, buf, sizeof(buf));
+        }
+    }
+    return 0;
+}
+
+/* Bursts of small updates of neighbouring addresses of written pages */
+static int _bench_small_rewrite(bench_result_t * result, uint8_t * shadow)
+{
+    uint8_t buf[FLASH_PAGE_SIZE];
+    uint32_t page;
+    uint32_t i;
+
+    for (page = 0; page < 4; page++)
+    {
+        _bench_fill(buf, sizeof(buf));
+        nvmem_update(BENCH_AREA_ADDR + page * FLASH_PAGE_SIZE, buf, sizeof(buf));
+        memcpy(shadow + page * FLASH_PAGE_SIZE, buf, sizeof(buf));
+    }
+    flash_sim_reset_stats();
+
+    for (page = 0; page < 4; page++)
+    {
+        for (i = 0; i < 64; i++)
+        {
+            _bench_fill(buf, 16);
+            _bench_op_update(result, shadow, page * FLASH_PAGE_SIZE + i * 16, buf, 16);
+        }
+    }
+    return 0;
+}
+
+/* Small appends into erased pages */
+static int _bench_small_append(bench_result_t * result, uint8_t * shadow)
+{
+    uint8_t buf[24];
+    uint32_t offset;
+
+    for (offset = 0; offset + sizeof(buf) <= 8 * FLASH_PAGE_SIZE; offset += sizeof(buf))
+    {
+        _bench_fill(buf, sizeof(buf));
+        _bench_op_update(result, shadow, offset, buf, sizeof(buf));
+    }
+    return 0;
+}
+
+/* Writes the log area once, so the appends of the next workloads overwrite old data */
+static void _bench_log_prefill(uint8_t * shadow)
+{
+    uint8_t buf[FLASH_PAGE_SIZE];
+    uint32_t page;
+
+    for (page = 0; page < 8; page++)
+    {
+        _bench_fill(buf, sizeof(buf));
+        nvmem_update(BENCH_AREA_ADDR + page * FLASH_PAGE_SIZE, buf, sizeof(buf));
+        memcpy(shadow + page * FLASH_PAGE_SIZE, buf, sizeof(buf));
+    }
+    flash_sim_reset_stats();
+}
+
+/* Small appends over old data */
+static int _bench_log_rewrite(bench_result_t * result, uint8_t * shadow)
+{
+    uint8_t buf[24];
+    uint32_t offset;
+
+    _bench_log_prefill(shadow);
+
+    for (offset = 0; offset + sizeof(buf) <= 8 * FLASH_PAGE_SIZE; offset += sizeof(buf))
+    {
+        _bench_fill(buf, sizeof(buf));
+        _bench_op_update(result, shadow, offset, buf, sizeof(buf));
+    }
+    return 0;
+}
+
+/* The same appends through a streaming writer */
+static int _bench_log_stream(bench_result_t * result, uint8_t * shadow)
+{
+    nvmem_stream_t stream;
+    uint8_t buf[24];
+    uint32_t offset;
+    uint64_t start;
+    uint64_t elapsed;
+
+    _bench_log_prefill(shadow);
+
+    if (nvmem_stream_open(&stream, BENCH_AREA_ADDR, 8 * FLASH_PAGE_SIZE) != UBI_ERR_OK)
+    {
+        return -1;
+    }
+
+    for (offset = 0; offset + sizeof(buf) <= 8 * FLASH_PAGE_SIZE; offset += sizeof(buf))
+    {
+        _bench_fill(buf, sizeof(buf));
+
+        start = flash_sim_get_time_us();
+        if (nvmem_stream_append(&stream, buf, sizeof(buf)) != UBI_ERR_OK)
+        {
+            result->error_count++;
+        }
+        elapsed = flash_sim_get_time_us() - start;
+
+        memcpy(shadow + offset, buf, sizeof(buf));
+        result->op_count++;
+        result->total_us += elapsed;
+        if (elapsed > result->max_us)
+        {
+            result->max_us = elapsed;
+        }
+    }
+
+    /* The pages are erased as a whole: the end of the last page does not keep its old data */
+    memset(shadow + offset, 0xFF, 8 * FLASH_PAGE_SIZE - offset);
+
+    /* The tail is part of the cost of the workload */
+    start = flash_sim_get_time_us();
+    if (nvmem_stream_close(&stream) != UBI_ERR_OK)
+    {
+        result->error_count++;
+    }
+    result->total_us += flash_sim_get_time_us() - start;
+
+    return 0;
+}
+
+/* The same appends to a circular log, wrapping several times around its pages */
+static int _bench_log_ring(bench_result_t * result, uint8_t * shadow)
+{
+    nvmem_log_t log;
+    nvmem_log_reader_t reader;
+    uint8_t buf[24];
+    uint8_t rec[NVMEM_LOG_REC_DATA_MAX];
+    size_t size;
+    uint64_t start;
+    uint64_t elapsed;
+    uint32_t last = 0;
+    uint32_t i;
+    int ret = 0;
+
+    memset(&log, 0, sizeof(log));
+    log.base = BENCH_AREA_ADDR;
+    log.page_size = FLASH_PAGE_SIZE;
+    log.page_count = 8;
+
+    if (nvmem_log_mount(&log) != UBI_ERR_OK)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < 2000; i++)
+    {
+        memset(buf, (int) i, sizeof(buf));
+
+        start = flash_sim_get_time_us();
+        if (nvmem_log_append(&log, buf, sizeof(buf)) != UBI_ERR_OK)
+        {
+            result->error_count++;
+        }
+        elapsed = flash_sim_get_time_us() - start;
+
+        result->op_count++;
+        result->total_us += elapsed;
+        if (elapsed > result->max_us)
+        {
+            result->max_us = elapsed;
+        }
+    }
+
+    /* The tail is part of the cost of the workload */
+    start = flash_sim_get_time_us();
+    if (nvmem_log_sync(&log) != UBI_ERR_OK)
+    {
+        result->error_count++;
+    }
+    result->total_us += flash_sim_get_time_us() - start;
+
+    /* The last append shall be read back after a remount */
+    nvmem_log_unmount(&log);
+    if (nvmem_log_mount(&log) != UBI_ERR_OK)
+    {
+        return -1;
+    }
+    nvmem_log_rewind(&log, &reader);
+    size = 0;
+    while (nvmem_log_read(&log, &reader, rec, sizeof(rec), &size) == UBI_ERR_OK)
+    {
+        last = rec[size - 1];
+    }
+    if (last != (uint8_t) (2000 - 1))
+    {
+        ret = -1;
+    }
+    nvmem_log_unmount(&log);
+
+    /* The area is not checked against the shadow */
+    nvmem_read(BENCH_AREA_ADDR, shadow, BENCH_AREA_SIZE);
+
+    return ret;
+}
+
+/* A counter rewritten in place */
+static int _bench_counter(bench_result_t * result, uint8_t * shadow)
+{
+    uint32_t counter;
+
+    for (counter = 0; counter < 500; counter++)
+    {
+        _bench_op_update(result, shadow, 0, (uint8_t *) &counter, sizeof(counter));
+    }
+    return 0;
+}
+
+/* Key-value store sets of a few keys (wear leveling) */
+static int _bench_kv(bench_result_t * result, uint8_t * shadow)
+{
+    nvmem_kv_t kv;
+    char key[16];
+    uint8_t value[32];
+    uint8_t readback[32];
+    size_t size;
+    uint64_t start;
+    uint64_t elapsed;
+    uint32_t i;
+    int ret = 0;
+
+    (void) shadow;
+
+    memset(&kv, 0, sizeof(kv));
+    kv.base = BENCH_AREA_ADDR;
+    kv.page_size = FLASH_PAGE_SIZE;
+    kv.page_count = 8;
+    kv.index_size = 64;
+
+    if (nvmem_kv_mount(&kv) != UBI_ERR_OK)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < 2000; i++)
+    {
+        snprintf(key, sizeof(key), "key%u", (unsigned) (i % 16));
+        memset(value, (int) i, sizeof(value));
+
+        start = flash_sim_get_time_us();
+        if (nvmem_kv_set(&kv, key, value, sizeof(value)) != UBI_ERR_OK)
+        {
+            result->error_count++;
+        }
+        elapsed = flash_sim_get_time_us() - start;
+
+        result->op_count++;
+        result->total_us += elapsed;
+        if (elapsed > result->max_us)
+        {
+            result->max_us = elapsed;
+        }
+    }
+
+    /* The last value of every key shall be read back after a remount */
+    nvmem_kv_unmount(&kv);
+    if (nvmem_kv_mount(&kv) != UBI_ERR_OK)
+    {
+        return -1;
+    }
+    for (i = 2000 - 16; i < 2000; i++)
+    {
+        snprintf(key, sizeof(key), "key%u", (unsigned) (i % 16));
+        memset(value, (int) i, sizeof(value));
+        if (nvmem_kv_get(&kv, key, readback, sizeof(readback), &size) != UBI_ERR_OK ||
+                size != sizeof(value) || memcmp(readback, value, sizeof(value)) != 0)
+        {
+            ret = -1;
+        }
+    }
+    nvmem_kv_unmount(&kv);
+
+    /* The area is not checked against the shadow */
+    nvmem_read(BENCH_AREA_ADDR, shadow, BENCH_AREA_SIZE);
+
+    return ret;
+}
+
+static void _bench_run(const char * name, bench_workload_ft workload, int bank_swap)
+{
+    bench_result_t result;
+    uint8_t readback[FLASH_PAGE_SIZE];
+    uint64_t start;
+    uint32_t page;
+    uint32_t wear;
+    uint32_t offset;
+    int r;
+
+    memset(&result, 0, sizeof(result));
+    result.name = name;
+
+    flash_sim_set_bank_swap(bank_swap);
+    flash_sim_init();
+    memset(_g_bench_shadow, 0xFF, sizeof(_g_bench_shadow));
+    _g_bench_seed = 1;
+
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+    if (nvmem_journal_init(BENCH_JOURNAL_ADDR, BENCH_JOURNAL_SCRATCH) != UBI_ERR_OK)
+    {
+        printf("%-16s journal init failed\n", name);
+        return;
+    }
+    flash_sim_reset_stats();
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) */
+
+    r = workload(&result, _g_bench_shadow);
+
+#if (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1)
+    /* The write back is part of the cost of the workload */
+    start = flash_sim_get_time_us();
+    if (nvmem_sync() != UBI_ERR_OK)
+    {
+        result.error_count++;
+    }
+    result.total_us += flash_sim_get_time_us() - start;
+#endif /* (STM32CUBEL4__NVMEM_CACHE_ENABLE == 1) */
+    (void) start;
+
+    result.verified = (r == 0);
+    for (offset = 0; offset < BENCH_AREA_SIZE; offset += FLASH_PAGE_SIZE)
+    {
+        /* Compare the FLASH itself, not the cached view */
+        memcpy(readback, BENCH_AREA_ADDR + offset, FLASH_PAGE_SIZE);
+        if (memcmp(readback, _g_bench_shadow + offset, FLASH_PAGE_SIZE) != 0)
+        {
+            result.verified = 0;
+        }
+    }
+
+    flash_sim_get_stats(&result.stats);
+    result.wear_min = 0xFFFFFFFF;
+    for (page = 0; page < FLASH_SIM_PAGE_COUNT; page++)
+    {
+        wear = flash_sim_get_erase_count(page);
+        if (page >= flash_sim_get_page_index(BENCH_AREA_ADDR) &&
+                page < flash_sim_get_page_index(BENCH_AREA_ADDR) + BENCH_AREA_PAGE_COUNT)
+        {
+            result.wear_min = (wear < result.wear_min) ? wear : result.wear_min;
+            result.wear_max = (wear > result.wear_max) ? wear : result.wear_max;
+        }
+        result.wear_max_global = (wear > result.wear_max_global) ? wear : result.wear_max_global;
+    }
+
+    printf("%-16s %6u %10.1f %10.1f %10.3f %10.3f %7u %9u %6u %6u %6u %6u  %s\n",
+            result.name, result.op_count,
+            result.op_count ? (double) result.total_us / result.op_count : 0.0,
+            (double) result.max_us, (double) result.total_us / 1000.0, (double) result.background_us / 1000.0,
+            result.stats.erase_count, result.stats.program_count, result.stats.error_count + result.error_count,
+            result.wear_min, result.wear_max, result.wear_max_global,
+            result.verified ? "ok" : "FAIL");
+
+    flash_sim_set_bank_swap(0);
+}
+
+int main(int argc, char * argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    if (flash_sim_init() != 0)
+    {
+        return 1;
+    }
+
+    printf("nvmem benchmark (journal %d, cache %d)\n", STM32CUBEL4__NVMEM_JOURNAL_ENABLE, STM32CUBEL4__NVMEM_CACHE_ENABLE);
+    printf("%-16s %6s %10s %10s %10s %10s %7s %9s %6s %6s %6s %6s  %s\n",
+            "workload", "ops", "mean(us)", "max(us)", "total(ms)", "bg(ms)", "erases", "programs", "errors",
+            "wmin", "wmax", "wglob", "check");
+
+    _bench_run("page_update", _bench_page_update, 0);
+    _bench_run("small_rewrite", _bench_small_rewrite, 0);
+    _bench_run("small_rewrite/bs", _bench_small_rewrite, 1);
+    _bench_run("small_append", _bench_small_append, 0);
+    _bench_run("log_rewrite", _bench_log_rewrite, 0);
+    _bench_run("log_stream", _bench_log_stream, 0);
+    _bench_run("log_ring", _bench_log_ring, 0);
+    _bench_run("counter", _bench_counter, 0);
+    _bench_run("kv_set", _bench_kv, 0);
+
+    flash_sim_deinit();
+
+    return 0;
+}
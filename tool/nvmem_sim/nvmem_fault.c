@@ -0,0 +1,652 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * nvmem power-loss fault injection on the simulated FLASH.
+ *
+ * For every scenario, the operation is first run without a cut to count its elementary FLASH
+ * operations. It is then run once per operation index, from the same initial FLASH contents, with
+ * the power cut during that operation. After every cut, the system is booted again (recovery) and
+ * the invariants of the scenario are checked.
+ *
+ * Every step (setup, operation, recovery and check) runs in its own child process, so that the
+ * driver starts from its reset state as after a real reboot, while the FLASH is shared.
+ *
+ * The result is a coverage matrix: for every scenario, the number of cuts during a program and
+ * during an erase after which the invariants held. A scenario marked "safe" is expected to hold
+ * them after every cut in this build; the others are reported for information.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <ubinos.h>
+#include <ubinos/ubidrv/nvmem.h>
+#include <stm32cubel4_extension/nvmem.h>
+#include <stm32cubel4_extension/nvmem_kv.h>
+#include <stm32cubel4_extension/nvmem_log.h>
+
+#include "flash_sim.h"
+
+#define FAULT_AREA_ADDR         ((uint8_t *) (FLASH_BASE + FLASH_BANK_SIZE))
+#define FAULT_JOURNAL_ADDR      ((uint8_t *) FLASH_BASE)
+#define FAULT_JOURNAL_SCRATCH   2
+
+#define FAULT_SMALL_OFFSET      512
+#define FAULT_SMALL_SIZE        16
+#define FAULT_APPEND_OFFSET     64
+#define FAULT_APPEND_SIZE       24
+#define FAULT_ERASE_PAGE_COUNT  4
+#define FAULT_BANKS_ADDR        ((uint8_t *) (FLASH_BASE + FLASH_BANK_SIZE - FLASH_PAGE_SIZE))
+#define FAULT_END_ADDR          ((uint8_t *) (FLASH_BASE + FLASH_SIZE))
+
+#define FAULT_KV_PAGE_COUNT     3
+#define FAULT_KV_KEY_COUNT      8
+#define FAULT_KV_FILL_COUNT     70
+#define FAULT_KV_OP_COUNT       8
+
+#define FAULT_LOG_PAGE_COUNT    3
+#define FAULT_LOG_ENTRY_SIZE    7
+#define FAULT_LOG_FILL_COUNT    600
+#define FAULT_LOG_OP_COUNT      400
+#define FAULT_LOG_SYNC_PERIOD   50
+
+typedef struct _fault_scenario_t
+{
+    const char * name;
+    int safe;                   /* Crash consistency is expected in this build */
+    void (*setup)(void);        /* Builds the initial FLASH contents */
+    void (*operation)(void);    /* Operation to cut */
+    int (*check)(void);         /* Checks the invariants after the boot, returns 0 if they hold */
+} fault_scenario_t;
+
+typedef struct _fault_result_t
+{
+    uint32_t op_count;
+    uint32_t program_total;
+    uint32_t program_pass;
+    uint32_t erase_total;
+    uint32_t erase_pass;
+    int sane;                   /* The operation passes the check when it is not cut */
+} fault_result_t;
+
+static uint8_t _g_fault_old[FLASH_PAGE_SIZE];
+static uint8_t _g_fault_new[FLASH_PAGE_SIZE];
+static uint8_t _g_fault_snapshot[FLASH_SIZE];
+static volatile uint32_t * _g_fault_shared = NULL;
+
+static void _fault_pattern(uint8_t * buf, size_t size, uint32_t seed)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        seed = seed * 1103515245U + 12345U;
+        buf[i] = (uint8_t) (seed >> 16);
+    }
+}
+
+/* Boot: the recovery the application does at startup */
+static void _fault_boot(void)
+{
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+    if (nvmem_journal_init(FAULT_JOURNAL_ADDR, FAULT_JOURNAL_SCRATCH) != UBI_ERR_OK)
+    {
+        _exit(2);
+    }
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) */
+}
+
+static void _fault_setup_page(void)
+{
+    nvmem_update(FAULT_AREA_ADDR, _g_fault_old, FLASH_PAGE_SIZE);
+}
+
+static void _fault_page_update(void)
+{
+    nvmem_update(FAULT_AREA_ADDR, _g_fault_new, FLASH_PAGE_SIZE);
+}
+
+static int _fault_check_page_update(void)
+{
+    if (memcmp(FAULT_AREA_ADDR, _g_fault_old, FLASH_PAGE_SIZE) == 0 ||
+            memcmp(FAULT_AREA_ADDR, _g_fault_new, FLASH_PAGE_SIZE) == 0)
+    {
+        return 0;
+    }
+    return -1;
+}
+
+static void _fault_small_update(void)
+{
+    nvmem_update(FAULT_AREA_ADDR + FAULT_SMALL_OFFSET, _g_fault_new, FAULT_SMALL_SIZE);
+}
+
+static int _fault_check_small_update(void)
+{
+    uint8_t expected[FLASH_PAGE_SIZE];
+
+    memcpy(expected, _g_fault_old, FLASH_PAGE_SIZE);
+    memcpy(expected + FAULT_SMALL_OFFSET, _g_fault_new, FAULT_SMALL_SIZE);
+
+    if (memcmp(FAULT_AREA_ADDR, _g_fault_old, FLASH_PAGE_SIZE) == 0 ||
+            memcmp(FAULT_AREA_ADDR, expected, FLASH_PAGE_SIZE) == 0)
+    {
+        return 0;
+    }
+    return -1;
+}
+
+static void _fault_setup_none(void)
+{
+}
+
+static void _fault_append(void)
+{
+    nvmem_update(FAULT_AREA_ADDR + FAULT_APPEND_OFFSET, _g_fault_new, FAULT_APPEND_SIZE);
+}
+
+static int _fault_check_append(void)
+{
+    uint8_t expected[FLASH_PAGE_SIZE];
+
+    memset(expected, 0xFF, FLASH_PAGE_SIZE);
+    if (memcmp(FAULT_AREA_ADDR, expected, FLASH_PAGE_SIZE) == 0)
+    {
+        return 0;
+    }
+    memcpy(expected + FAULT_APPEND_OFFSET, _g_fault_new, FAULT_APPEND_SIZE);
+    if (memcmp(FAULT_AREA_ADDR, expected, FLASH_PAGE_SIZE) == 0)
+    {
+        return 0;
+    }
+    return -1;
+}
+
+static void _fault_setup_erase(void)
+{
+    uint32_t page;
+
+    for (page = 0; page < FAULT_ERASE_PAGE_COUNT; page++)
+    {
+        nvmem_update(FAULT_AREA_ADDR + page * FLASH_PAGE_SIZE, _g_fault_old, FLASH_PAGE_SIZE);
+    }
+}
+
+static void _fault_erase(void)
+{
+    nvmem_erase(FAULT_AREA_ADDR, FAULT_ERASE_PAGE_COUNT * FLASH_PAGE_SIZE);
+}
+
+static int _fault_check_erase(void)
+{
+    /* An interrupted erase shall be completed by erasing again */
+    if (nvmem_erase(FAULT_AREA_ADDR, FAULT_ERASE_PAGE_COUNT * FLASH_PAGE_SIZE) != UBI_ERR_OK)
+    {
+        return -1;
+    }
+    return nvmem_is_erased(FAULT_AREA_ADDR, FAULT_ERASE_PAGE_COUNT * FLASH_PAGE_SIZE) ? 0 : -1;
+}
+
+/* The last page of bank 1 and the first page of bank 2 */
+static void _fault_setup_erase_banks(void)
+{
+    nvmem_update(FAULT_BANKS_ADDR, _g_fault_old, FLASH_PAGE_SIZE);
+    nvmem_update(FAULT_BANKS_ADDR + FLASH_PAGE_SIZE, _g_fault_old, FLASH_PAGE_SIZE);
+}
+
+static void _fault_erase_banks(void)
+{
+    nvmem_erase(FAULT_BANKS_ADDR, 2 * FLASH_PAGE_SIZE);
+}
+
+static int _fault_check_erase_banks(void)
+{
+    if (nvmem_erase(FAULT_BANKS_ADDR, 2 * FLASH_PAGE_SIZE) != UBI_ERR_OK)
+    {
+        return -1;
+    }
+    return nvmem_is_erased(FAULT_BANKS_ADDR, 2 * FLASH_PAGE_SIZE) ? 0 : -1;
+}
+
+/* The last pages of the FLASH, after the page left in front of them */
+static void _fault_setup_erase_range(void)
+{
+    uint32_t page;
+
+    for (page = 0; page <= FAULT_ERASE_PAGE_COUNT; page++)
+    {
+        nvmem_update(FAULT_END_ADDR - (page + 1) * FLASH_PAGE_SIZE, _g_fault_old, FLASH_PAGE_SIZE);
+    }
+}
+
+/*
+ * Areas outside of the FLASH are rejected before they are read or erased, without touching the last pages.
+ * The erase of the last pages, which ends at the end of the FLASH, is then cut.
+ */
+static void _fault_erase_range(void)
+{
+    if (nvmem_erase(FAULT_END_ADDR, FLASH_PAGE_SIZE) == UBI_ERR_OK ||
+        nvmem_erase(FAULT_END_ADDR - FLASH_PAGE_SIZE, 2 * FLASH_PAGE_SIZE) == UBI_ERR_OK ||
+        nvmem_erase((uint8_t *) (FLASH_BASE - FLASH_PAGE_SIZE), FLASH_PAGE_SIZE) == UBI_ERR_OK ||
+        nvmem_erase(FAULT_END_ADDR - FLASH_PAGE_SIZE, 0) == UBI_ERR_OK ||
+        nvmem_is_erased(FAULT_END_ADDR - FLASH_PAGE_SIZE, 2 * FLASH_PAGE_SIZE) ||
+        memcmp(FAULT_END_ADDR - FLASH_PAGE_SIZE, _g_fault_old, FLASH_PAGE_SIZE) != 0)
+    {
+        _exit(3);
+    }
+#if (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1)
+    /* Nor is the journal area */
+    if (nvmem_erase(FAULT_JOURNAL_ADDR, FLASH_PAGE_SIZE) == UBI_ERR_OK)
+    {
+        _exit(3);
+    }
+#endif /* (STM32CUBEL4__NVMEM_JOURNAL_ENABLE == 1) */
+
+    nvmem_erase(FAULT_END_ADDR - FAULT_ERASE_PAGE_COUNT * FLASH_PAGE_SIZE, FAULT_ERASE_PAGE_COUNT * FLASH_PAGE_SIZE);
+}
+
+static int _fault_check_erase_range(void)
+{
+    uint8_t * front = FAULT_END_ADDR - (FAULT_ERASE_PAGE_COUNT + 1) * FLASH_PAGE_SIZE;
+
+    if (memcmp(front, _g_fault_old, FLASH_PAGE_SIZE) != 0)
+    {
+        return -1;
+    }
+    if (nvmem_erase(front + FLASH_PAGE_SIZE, FAULT_ERASE_PAGE_COUNT * FLASH_PAGE_SIZE) != UBI_ERR_OK)
+    {
+        return -1;
+    }
+    return nvmem_is_erased(front + FLASH_PAGE_SIZE, FAULT_ERASE_PAGE_COUNT * FLASH_PAGE_SIZE) ? 0 : -1;
+}
+
+static void _fault_kv_config(nvmem_kv_t * kv)
+{
+    memset(kv, 0, sizeof(nvmem_kv_t));
+    kv->base = FAULT_AREA_ADDR;
+    kv->page_size = FLASH_PAGE_SIZE;
+    kv->page_count = FAULT_KV_PAGE_COUNT;
+    kv->index_size = 32;
+}
+
+static void _fault_kv_value(uint32_t key, uint32_t version, uint8_t * value)
+{
+    _fault_pattern(value, 40, key * 1000U + version);
+}
+
+static void _fault_setup_kv(void)
+{
+    nvmem_kv_t kv;
+    char key[16];
+    uint8_t value[40];
+    uint32_t i;
+
+    _fault_kv_config(&kv);
+    if (nvmem_kv_mount(&kv) != UBI_ERR_OK)
+    {
+        _exit(3);
+    }
+    /* Fill the store, so that the sets of the operation compact it */
+    for (i = 0; i < FAULT_KV_FILL_COUNT; i++)
+    {
+        snprintf(key, sizeof(key), "key%u", (unsigned) (i % FAULT_KV_KEY_COUNT));
+        _fault_kv_value(i % FAULT_KV_KEY_COUNT, i / FAULT_KV_KEY_COUNT, value);
+        if (nvmem_kv_set(&kv, key, value, sizeof(value)) != UBI_ERR_OK)
+        {
+            _exit(3);
+        }
+    }
+    nvmem_kv_unmount(&kv);
+}
+
+static void _fault_kv_set(void)
+{
+    nvmem_kv_t kv;
+    uint8_t value[40];
+    uint32_t i;
+
+    _fault_kv_config(&kv);
+    if (nvmem_kv_mount(&kv) != UBI_ERR_OK)
+    {
+        _exit(3);
+    }
+    for (i = 0; i < FAULT_KV_OP_COUNT; i++)
+    {
+        _fault_kv_value(0, 100U + i, value);
+        nvmem_kv_set(&kv, "key0", value, sizeof(value));
+    }
+    nvmem_kv_unmount(&kv);
+}
+
+static int _fault_check_kv(void)
+{
+    nvmem_kv_t kv;
+    char key[16];
+    uint8_t value[40];
+    uint8_t expected[40];
+    size_t size;
+    uint32_t key_index;
+    uint32_t version;
+    int ret = 0;
+    int found;
+
+    _fault_kv_config(&kv);
+    if (nvmem_kv_mount(&kv) != UBI_ERR_OK)
+    {
+        return -1;
+    }
+
+    /* key0 holds its value before the operation or one of the values set by the operation */
+    found = 0;
+    if (nvmem_kv_get(&kv, "key0", value, sizeof(value), &size) == UBI_ERR_OK && size == sizeof(value))
+    {
+        _fault_kv_value(0, (FAULT_KV_FILL_COUNT - 1) / FAULT_KV_KEY_COUNT, expected);
+        found = (memcmp(value, expected, sizeof(value)) == 0);
+        for (version = 0; !found && version < FAULT_KV_OP_COUNT; version++)
+        {
+            _fault_kv_value(0, 100U + version, expected);
+            found = (memcmp(value, expected, sizeof(value)) == 0);
+        }
+    }
+    if (!found)
+    {
+        ret = -1;
+    }
+
+    /* The other keys are untouched */
+    for (key_index = 1; key_index < FAULT_KV_KEY_COUNT; key_index++)
+    {
+        snprintf(key, sizeof(key), "key%u", (unsigned) key_index);
+        _fault_kv_value(key_index, (FAULT_KV_FILL_COUNT - 1 - key_index) / FAULT_KV_KEY_COUNT, expected);
+        if (nvmem_kv_get(&kv, key, value, sizeof(value), &size) != UBI_ERR_OK ||
+                size != sizeof(value) || memcmp(value, expected, sizeof(value)) != 0)
+        {
+            ret = -1;
+        }
+    }
+
+    /* The store is still writable */
+    if (nvmem_kv_set(&kv, "key1", expected, sizeof(expected)) != UBI_ERR_OK)
+    {
+        ret = -1;
+    }
+
+    nvmem_kv_unmount(&kv);
+
+    return ret;
+}
+
+static void _fault_log_config(nvmem_log_t * log)
+{
+    memset(log, 0, sizeof(nvmem_log_t));
+    log->base = FAULT_AREA_ADDR;
+    log->page_size = FLASH_PAGE_SIZE;
+    log->page_count = FAULT_LOG_PAGE_COUNT;
+}
+
+static int _fault_log_append_entries(nvmem_log_t * log, uint32_t first, uint32_t count)
+{
+    char entry[FAULT_LOG_ENTRY_SIZE + 1];
+    uint32_t i;
+
+    for (i = first; i < first + count; i++)
+    {
+        snprintf(entry, sizeof(entry), "%06u\n", (unsigned) (i % 1000000U));
+        if (nvmem_log_append(log, (const uint8_t *) entry, FAULT_LOG_ENTRY_SIZE) != UBI_ERR_OK)
+        {
+            return -1;
+        }
+        if (((i + 1) % FAULT_LOG_SYNC_PERIOD) == 0 && nvmem_log_sync(log) != UBI_ERR_OK)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void _fault_setup_log(void)
+{
+    nvmem_log_t log;
+
+    _fault_log_config(&log);
+    if (nvmem_log_mount(&log) != UBI_ERR_OK || _fault_log_append_entries(&log, 0, FAULT_LOG_FILL_COUNT) != 0)
+    {
+        _exit(3);
+    }
+    nvmem_log_unmount(&log);
+}
+
+static void _fault_log_append(void)
+{
+    nvmem_log_t log;
+
+    _fault_log_config(&log);
+    if (nvmem_log_mount(&log) != UBI_ERR_OK)
+    {
+        _exit(3);
+    }
+    _fault_log_append_entries(&log, FAULT_LOG_FILL_COUNT, FAULT_LOG_OP_COUNT);
+    nvmem_log_unmount(&log);
+}
+
+static int _fault_check_log(void)
+{
+    static uint8_t data[FAULT_LOG_PAGE_COUNT * FLASH_PAGE_SIZE];
+    nvmem_log_t log;
+    nvmem_log_reader_t reader;
+    char entry[FAULT_LOG_ENTRY_SIZE + 1];
+    size_t len = 0;
+    size_t size;
+    uint32_t offset;
+    uint32_t expected = 0;
+    int ret = 0;
+
+    _fault_log_config(&log);
+    if (nvmem_log_mount(&log) != UBI_ERR_OK)
+    {
+        return -1;
+    }
+
+    nvmem_log_rewind(&log, &reader);
+    while (len + NVMEM_LOG_REC_DATA_MAX <= sizeof(data) &&
+            nvmem_log_read(&log, &reader, data + len, NVMEM_LOG_REC_DATA_MAX, &size) == UBI_ERR_OK)
+    {
+        len += size;
+    }
+
+    /*
+     * The entries are consecutive, and the synced ones of the setup are all there.
+     * A record programmed before the cut may end in the middle of an entry.
+     */
+    if (len < FAULT_LOG_ENTRY_SIZE)
+    {
+        ret = -1;
+    }
+    for (offset = 0; ret == 0 && offset + FAULT_LOG_ENTRY_SIZE <= len; offset += FAULT_LOG_ENTRY_SIZE)
+    {
+        if (offset == 0)
+        {
+            expected = (uint32_t) strtoul((const char *) data, NULL, 10);
+        }
+        snprintf(entry, sizeof(entry), "%06u\n", (unsigned) expected);
+        if (memcmp(data + offset, entry, FAULT_LOG_ENTRY_SIZE) != 0)
+        {
+            ret = -1;
+        }
+        expected++;
+    }
+    if (expected < FAULT_LOG_FILL_COUNT)
+    {
+        ret = -1;
+    }
+
+    /* The log is still writable */
+    if (_fault_log_append_entries(&log, expected, 1) != 0 || nvmem_log_sync(&log) != UBI_ERR_OK)
+    {
+        ret = -1;
+    }
+
+    nvmem_log_unmount(&log);
+
+    return ret;
+}
+
+static const fault_scenario_t _g_fault_scenarios[] =
+{
+    { "page_update",  STM32CUBEL4__NVMEM_JOURNAL_ENABLE, _fault_setup_page,  _fault_page_update,  _fault_check_page_update },
+    { "small_update", STM32CUBEL4__NVMEM_JOURNAL_ENABLE, _fault_setup_page,  _fault_small_update, _fault_check_small_update },
+    { "append",       0,                                 _fault_setup_none,  _fault_append,       _fault_check_append },
+    { "erase",        1,                                 _fault_setup_erase, _fault_erase,        _fault_check_erase },
+    { "erase_banks",  1,                                 _fault_setup_erase_banks, _fault_erase_banks, _fault_check_erase_banks },
+    { "erase_range",  1,                                 _fault_setup_erase_range, _fault_erase_range, _fault_check_erase_range },
+    { "kv_set",       1,                                 _fault_setup_kv,    _fault_kv_set,       _fault_check_kv },
+    { "log_append",   1,                                 _fault_setup_log,   _fault_log_append,   _fault_check_log },
+};
+
+/* Runs a step in a child process and returns its exit status */
+static int _fault_run_step(void (*step)(void), int (*check)(void), uint32_t cut)
+{
+    pid_t pid;
+    int status;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        _fault_boot();
+        if (step != NULL)
+        {
+            flash_sim_set_power_cut(cut);
+            step();
+            _g_fault_shared[0] = flash_sim_get_op_count();
+            _exit(0);
+        }
+        _exit((check() == 0) ? 0 : 1);
+    }
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+    {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+static int _fault_run_scenario(const fault_scenario_t * scenario, fault_result_t * result)
+{
+    uint32_t cut;
+    int status;
+    int check;
+
+    memset(result, 0, sizeof(fault_result_t));
+
+    flash_sim_init();
+    if (_fault_run_step(scenario->setup, NULL, 0) != 0)
+    {
+        return -1;
+    }
+    flash_sim_save(_g_fault_snapshot);
+
+    /* Count the operations, and check the scenario without cut */
+    if (_fault_run_step(scenario->operation, NULL, 0) != 0)
+    {
+        return -1;
+    }
+    result->op_count = _g_fault_shared[0];
+    result->sane = (_fault_run_step(NULL, scenario->check, 0) == 0);
+
+    for (cut = 1; cut <= result->op_count; cut++)
+    {
+        flash_sim_load(_g_fault_snapshot);
+
+        status = _fault_run_step(scenario->operation, NULL, cut);
+        check = _fault_run_step(NULL, scenario->check, 0);
+
+        if (status == FLASH_SIM_EXIT_CUT_PROGRAM)
+        {
+            result->program_total++;
+            result->program_pass += (check == 0);
+        }
+        else if (status == FLASH_SIM_EXIT_CUT_ERASE)
+        {
+            result->erase_total++;
+            result->erase_pass += (check == 0);
+        }
+        else
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char * argv[])
+{
+    const fault_scenario_t * scenario;
+    fault_result_t result;
+    uint32_t i;
+    int pass;
+    int failed = 0;
+
+    (void) argc;
+    (void) argv;
+
+    if (flash_sim_init() != 0)
+    {
+        return 1;
+    }
+
+    _g_fault_shared = mmap(NULL, sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (_g_fault_shared == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    _fault_pattern(_g_fault_old, sizeof(_g_fault_old), 1);
+    _fault_pattern(_g_fault_new, sizeof(_g_fault_new), 2);
+
+    printf("nvmem power-loss fault injection (journal %d)\n", STM32CUBEL4__NVMEM_JOURNAL_ENABLE);
+    printf("%-14s %6s %15s %15s %9s  %s\n", "scenario", "ops", "program cuts", "erase cuts", "expected", "result");
+
+    for (i = 0; i < sizeof(_g_fault_scenarios) / sizeof(_g_fault_scenarios[0]); i++)
+    {
+        scenario = &_g_fault_scenarios[i];
+
+        if (_fault_run_scenario(scenario, &result) != 0)
+        {
+            printf("%-14s scenario error\n", scenario->name);
+            failed = 1;
+            continue;
+        }
+
+        pass = result.sane && result.program_pass == result.program_total && result.erase_pass == result.erase_total;
+        if (scenario->safe && !pass)
+        {
+            failed = 1;
+        }
+
+        printf("%-14s %6u %7u/%-7u %7u/%-7u %9s  %s\n", scenario->name, result.op_count,
+                result.program_pass, result.program_total, result.erase_pass, result.erase_total,
+                scenario->safe ? "safe" : "unsafe",
+                !result.sane ? "BROKEN" : (pass ? "pass" : (scenario->safe ? "FAIL" : "not crash safe")));
+    }
+
+    flash_sim_deinit();
+
+    return failed;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2021 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos.h>
+
+#include "flash_sim.h"
+
+int _bsp_kernel_active = 0;
+int _bsp_critcount = 0;
+
+int mutex_create(mutex_pt * mutex_p)
+{
+    *mutex_p = (mutex_pt) mutex_p;
+    return 0;
+}
+
+int mutex_delete(mutex_pt * mutex_p)
+{
+    *mutex_p = NULL;
+    return 0;
+}
+
+int mutex_lock(mutex_pt mutex)
+{
+    (void) mutex;
+    return 0;
+}
+
+int mutex_unlock(mutex_pt mutex)
+{
+    (void) mutex;
+    return 0;
+}
+
+int task_sleepms(uint32_t timems)
+{
+    flash_sim_advance_time_us((uint64_t) timems * 1000U);
+    return 0;
+}